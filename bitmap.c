@@ -0,0 +1,266 @@
+#include "bitmap.h"
+#include <stdio.h>          /* fprintf, stderr */
+#include <stdlib.h>         /* calloc, free */
+#include <assert.h>         /* assert */
+
+#define NB_BITS_WORD (sizeof(tBitmapWord)*8)
+#define FULL_WORD (~(tBitmapWord) 0)
+#define WORD(pWords, index) ((_Atomic tBitmapWord*) &((pWords)[index]))
+#define BIT(index) ((tBitmapWord) 1 << ((index) % NB_BITS_WORD))
+
+static uint32_t getNbWords(const uint64_t nbBits)
+{
+    return (uint32_t) ((nbBits + NB_BITS_WORD - 1) / NB_BITS_WORD);
+}
+
+// Bits of the last word beyond the given number of bits.
+static tBitmapWord getPadding(const uint64_t nbBits)
+{
+    return ((nbBits % NB_BITS_WORD) == 0) ?
+        0 : (FULL_WORD << (nbBits % NB_BITS_WORD));
+}
+
+bool initBitmap(tBitmap* const pBitmap, const uint32_t nbBits)
+{
+    assert(pBitmap != NULL);
+    pBitmap->_nbBits = nbBits;
+    pBitmap->_nbWords = getNbWords(nbBits);
+    atomic_init(&pBitmap->_nbSet, 0);
+    // At least one word each, so that an empty bitmap is a full one.
+    const uint32_t nbSummaryWords = getNbWords(pBitmap->_nbWords);
+    pBitmap->_pWords = calloc(
+        (pBitmap->_nbWords != 0) ? pBitmap->_nbWords : 1,
+        sizeof(*pBitmap->_pWords)
+    );
+    pBitmap->_pSummary = calloc(
+        (nbSummaryWords != 0) ? nbSummaryWords : 1,
+        sizeof(*pBitmap->_pSummary)
+    );
+    if((pBitmap->_pWords == NULL) || (pBitmap->_pSummary == NULL)){
+        fprintf(
+            stderr,
+            "Fail to allocate memory at %s line %d.\n",
+            __FILE__, __LINE__
+        );
+        closeBitmap(pBitmap);
+        return FALSE;
+    }
+    countBitmap(pBitmap);
+    return TRUE;
+}
+
+bool setBit(tBitmap* const pBitmap, const uint32_t index)
+{
+    assert(pBitmap != NULL);
+    if(index >= pBitmap->_nbBits){
+        return FALSE;
+    }
+    const uint32_t word = index / NB_BITS_WORD;
+    const tBitmapWord bit = BIT(index);
+    const tBitmapWord previous = atomic_fetch_or_explicit(
+        WORD(pBitmap->_pWords, word), bit, memory_order_relaxed
+    );
+    if((previous & bit) != 0){
+        return FALSE;
+    }
+    // The word just became full.
+    if((previous | bit) == FULL_WORD){
+        atomic_fetch_or_explicit(
+            WORD(pBitmap->_pSummary, word / NB_BITS_WORD), BIT(word),
+            memory_order_relaxed
+        );
+    }
+    return ((atomic_fetch_add_explicit(
+        &pBitmap->_nbSet, 1, memory_order_acq_rel
+    ) + 1) == pBitmap->_nbBits) ? TRUE : FALSE;
+}
+
+void clearBit(tBitmap* const pBitmap, const uint32_t index)
+{
+    assert(pBitmap != NULL);
+    if(index >= pBitmap->_nbBits){
+        return;
+    }
+    const uint32_t word = index / NB_BITS_WORD;
+    const tBitmapWord bit = BIT(index);
+    const tBitmapWord previous = atomic_fetch_and_explicit(
+        WORD(pBitmap->_pWords, word), ~bit, memory_order_relaxed
+    );
+    if((previous & bit) == 0){
+        return;
+    }
+    // The word is no longer full.
+    if(previous == FULL_WORD){
+        atomic_fetch_and_explicit(
+            WORD(pBitmap->_pSummary, word / NB_BITS_WORD), ~BIT(word),
+            memory_order_relaxed
+        );
+    }
+    atomic_fetch_sub_explicit(&pBitmap->_nbSet, 1, memory_order_acq_rel);
+}
+
+void toggleBit(tBitmap* const pBitmap, const uint32_t index)
+{
+    if(getBit(pBitmap, index) == TRUE){
+        clearBit(pBitmap, index);
+    }else{
+        setBit(pBitmap, index);
+    }
+}
+
+bool getBit(const tBitmap* const pBitmap, const uint32_t index)
+{
+    assert(pBitmap != NULL);
+    if(index >= pBitmap->_nbBits){
+        return FALSE;
+    }
+    return (atomic_load_explicit(
+        WORD(pBitmap->_pWords, index / NB_BITS_WORD), memory_order_relaxed
+    ) & BIT(index)) != 0 ? TRUE : FALSE;
+}
+
+bool isBitmapFull(const tBitmap* const pBitmap)
+{
+    return (getNbMissing(pBitmap) == 0) ? TRUE : FALSE;
+}
+
+uint32_t getNbMissing(const tBitmap* const pBitmap)
+{
+    assert(pBitmap != NULL);
+    return pBitmap->_nbBits - atomic_load(&pBitmap->_nbSet);
+}
+
+// First bit at or after the given index with the given value (the number
+// of bits if none), skipping full words with the summary for missing bits.
+static uint32_t findBit(const tBitmap* const pBitmap, const uint32_t from,
+                        const bool isSet)
+{
+    if(from >= pBitmap->_nbBits){
+        return pBitmap->_nbBits;
+    }
+    const tBitmapWord flip = (isSet == TRUE) ? 0 : FULL_WORD;
+    uint32_t word = from / NB_BITS_WORD;
+    tBitmapWord bits = (atomic_load_explicit(
+        WORD(pBitmap->_pWords, word), memory_order_relaxed
+    ) ^ flip) & (FULL_WORD << (from % NB_BITS_WORD));
+    while(bits == 0){
+        if(++word >= pBitmap->_nbWords){
+            return pBitmap->_nbBits;
+        }
+        if(isSet == FALSE){
+            const tBitmapWord notFull = ~atomic_load_explicit(
+                WORD(pBitmap->_pSummary, word / NB_BITS_WORD),
+                memory_order_relaxed
+            ) & (FULL_WORD << (word % NB_BITS_WORD));
+            if(notFull == 0){
+                // The next summary word (which may be past the end).
+                word = (word / NB_BITS_WORD + 1)*NB_BITS_WORD - 1;
+                continue;
+            }
+            word = (word / NB_BITS_WORD)*NB_BITS_WORD +
+                (uint32_t) __builtin_ctzll(notFull);
+        }
+        bits = atomic_load_explicit(
+            WORD(pBitmap->_pWords, word), memory_order_relaxed
+        ) ^ flip;
+    }
+    // Padding bits are set, a set bit may be past the end.
+    const uint32_t index =
+        word*NB_BITS_WORD + (uint32_t) __builtin_ctzll(bits);
+    return (index < pBitmap->_nbBits) ? index : pBitmap->_nbBits;
+}
+
+// Index of the first missing bit (the number of bits if none).
+uint32_t findFirstMissing(const tBitmap* const pBitmap)
+{
+    assert(pBitmap != NULL);
+    return findBit(pBitmap, 0, FALSE);
+}
+
+/*
+ * Next run of bits with the given value, at or after the given index:
+ * [*pFirst, *pEnd). Return FALSE when there is none.
+ */
+bool findRange(const tBitmap* const pBitmap, const uint32_t from,
+    const bool isSet, uint32_t* const pFirst, uint32_t* const pEnd)
+{
+    assert((pBitmap != NULL) && (pFirst != NULL) && (pEnd != NULL));
+    *pFirst = findBit(pBitmap, from, isSet);
+    if(*pFirst >= pBitmap->_nbBits){
+        return FALSE;
+    }
+    *pEnd = findBit(pBitmap, *pFirst, (isSet == TRUE) ? FALSE : TRUE);
+    return TRUE;
+}
+
+// Set the bits of [first, end), a word at once.
+void setRange(tBitmap* const pBitmap, const uint32_t first,
+    const uint32_t end)
+{
+    assert((pBitmap != NULL) && (first <= end) && (end <= pBitmap->_nbBits));
+    uint32_t index = first;
+    while(index < end){
+        const uint32_t word = index / NB_BITS_WORD;
+        const uint32_t offset = index % NB_BITS_WORD;
+        const uint32_t room = (uint32_t) NB_BITS_WORD - offset;
+        const uint32_t nbBits = ((end - index) < room) ? (end - index) : room;
+        const tBitmapWord bits = ((nbBits == NB_BITS_WORD) ?
+            FULL_WORD : ((((tBitmapWord) 1) << nbBits) - 1)) << offset;
+        const tBitmapWord previous = atomic_fetch_or_explicit(
+            WORD(pBitmap->_pWords, word), bits, memory_order_relaxed
+        );
+        if( ((previous | bits) == FULL_WORD) && (previous != FULL_WORD) ){
+            atomic_fetch_or_explicit(
+                WORD(pBitmap->_pSummary, word / NB_BITS_WORD), BIT(word),
+                memory_order_relaxed
+            );
+        }
+        atomic_fetch_add_explicit(
+            &pBitmap->_nbSet,
+            (uint32_t) __builtin_popcountll(bits & ~previous),
+            memory_order_acq_rel
+        );
+        index += nbBits;
+    }
+}
+
+// Set the padding bits, then the summary and count again (words loaded).
+void countBitmap(tBitmap* const pBitmap)
+{
+    assert(pBitmap != NULL);
+    if(pBitmap->_nbWords != 0){
+        pBitmap->_pWords[pBitmap->_nbWords - 1] |=
+            getPadding(pBitmap->_nbBits);
+    }
+    const uint32_t nbSummaryWords = getNbWords(pBitmap->_nbWords);
+    uint32_t i = 0;
+    for(; i < nbSummaryWords; ++i){
+        pBitmap->_pSummary[i] = 0;
+    }
+    if(nbSummaryWords != 0){
+        pBitmap->_pSummary[nbSummaryWords - 1] =
+            getPadding(pBitmap->_nbWords);
+    }
+    uint64_t nbSet = 0;
+    for(i = 0; i < pBitmap->_nbWords; ++i){
+        nbSet += (uint64_t) __builtin_popcountll(pBitmap->_pWords[i]);
+        if(pBitmap->_pWords[i] == FULL_WORD){
+            pBitmap->_pSummary[i / NB_BITS_WORD] |= BIT(i);
+        }
+    }
+    // Padding bits are not counted.
+    nbSet -= (pBitmap->_nbWords == 0) ? 0 :
+        (uint64_t) __builtin_popcountll(getPadding(pBitmap->_nbBits));
+    atomic_init(&pBitmap->_nbSet, (uint32_t) nbSet);
+}
+
+void closeBitmap(tBitmap* const pBitmap)
+{
+    assert(pBitmap != NULL);
+    free(pBitmap->_pSummary);
+    free(pBitmap->_pWords);
+    pBitmap->_pSummary = NULL;
+    pBitmap->_pWords = NULL;
+    pBitmap->_nbBits = 0;
+    pBitmap->_nbWords = 0;
+}
@@ -0,0 +1,55 @@
+/* 
+ * File:   bitmap.h
+ * Author: pilluh
+ *
+ * Created on 20 octobre 2026, 14:30
+ */
+
+#ifndef BITMAP_H
+#define BITMAP_H
+
+#include "types.h"      /* bool */
+#include <stdint.h>     /* uint32_t, uint64_t */
+#include <stdatomic.h>  /* _Atomic */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uint64_t tBitmapWord;
+
+/*
+ * Completion bitmap of 64-bit words, with a running count of the set bits
+ * and a summary level (one bit per full word), both maintained on each
+ * transition. Bits are set and cleared with atomic word operations, the
+ * thread setting the last missing bit is told so. Padding bits (beyond the
+ * last one) are kept set, so that every full word is all ones.
+ */
+typedef struct sBitmap{
+    tBitmapWord*        _pWords;
+    tBitmapWord*        _pSummary;
+    uint32_t            _nbBits;
+    uint32_t            _nbWords;
+    _Atomic uint32_t    _nbSet;
+} tBitmap;
+
+bool initBitmap(tBitmap* const pBitmap, const uint32_t nbBits);
+bool setBit(tBitmap* const pBitmap, const uint32_t index);
+void clearBit(tBitmap* const pBitmap, const uint32_t index);
+void toggleBit(tBitmap* const pBitmap, const uint32_t index);
+bool getBit(const tBitmap* const pBitmap, const uint32_t index);
+bool isBitmapFull(const tBitmap* const pBitmap);
+uint32_t getNbMissing(const tBitmap* const pBitmap);
+uint32_t findFirstMissing(const tBitmap* const pBitmap);
+bool findRange(const tBitmap* const pBitmap, const uint32_t from,
+    const bool isSet, uint32_t* const pFirst, uint32_t* const pEnd);
+void setRange(tBitmap* const pBitmap, const uint32_t first,
+    const uint32_t end);
+void countBitmap(tBitmap* const pBitmap);
+void closeBitmap(tBitmap* const pBitmap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BITMAP_H */
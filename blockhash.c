@@ -0,0 +1,139 @@
+#include "blockhash.h"
+#include <stdio.h>          /* fprintf, stderr */
+#include <stdlib.h>         /* calloc, free */
+#include <string.h>         /* memcpy */
+#include <assert.h>         /* assert */
+
+#define FINGERPRINT_SEED    ((tFingerprint) 0x9E3779B97F4A7C15ULL)
+#define FINGERPRINT_PRIME   ((tFingerprint) 0xFF51AFD7ED558CCDULL)
+#define MIN_HASH_CAPACITY   ((size_t) 1024)
+
+static tFingerprint mixFingerprint(tFingerprint value)
+{
+    value ^= value >> 33;
+    value *= FINGERPRINT_PRIME;
+    value ^= value >> 33;
+    return value;
+}
+
+tFingerprint fingerprintBlock(const unsigned char* const pData,
+                              const tBlockSize size)
+{
+    assert(pData != NULL);
+    // Four independent lanes of 64-bit words keep the multipliers busy.
+    tFingerprint lanes[4] = {
+        FINGERPRINT_SEED, FINGERPRINT_SEED + 1,
+        FINGERPRINT_SEED + 2, FINGERPRINT_SEED + 3
+    };
+    tBlockSize i = 0;
+    for(; (i + 32) <= size; i += 32){
+        uint64_t words[4];
+        memcpy(words, pData + i, sizeof(words));
+        lanes[0] = (lanes[0] ^ words[0]) * FINGERPRINT_PRIME;
+        lanes[1] = (lanes[1] ^ words[1]) * FINGERPRINT_PRIME;
+        lanes[2] = (lanes[2] ^ words[2]) * FINGERPRINT_PRIME;
+        lanes[3] = (lanes[3] ^ words[3]) * FINGERPRINT_PRIME;
+        lanes[0] ^= lanes[0] >> 29;
+        lanes[1] ^= lanes[1] >> 29;
+        lanes[2] ^= lanes[2] >> 29;
+        lanes[3] ^= lanes[3] >> 29;
+    }
+    tFingerprint fingerprint = size;
+    for(; i < size; ++i){
+        fingerprint = (fingerprint ^ pData[i]) * FINGERPRINT_PRIME;
+    }
+    fingerprint ^= mixFingerprint(lanes[0]);
+    fingerprint = mixFingerprint(fingerprint ^ lanes[1]);
+    fingerprint = mixFingerprint(fingerprint ^ lanes[2]);
+    return mixFingerprint(fingerprint ^ lanes[3]);
+}
+
+bool initBlockHash(tBlockHashTable* const pTable, const size_t nbExpected)
+{
+    assert(pTable != NULL);
+    // Keep the load factor under one half.
+    size_t capacity = MIN_HASH_CAPACITY;
+    while(capacity < (nbExpected * 2)){
+        capacity *= 2;
+    }
+    pTable->_pItems = calloc(capacity, sizeof(*pTable->_pItems));
+    if(pTable->_pItems == NULL){
+        fprintf(
+            stderr,
+            "Fail to allocate memory at %s line %d.\n",
+            __FILE__, __LINE__
+        );
+        pTable->_capacity = 0;
+        pTable->_nbItems = 0;
+        return FALSE;
+    }
+    pTable->_capacity = capacity;
+    pTable->_nbItems = 0;
+    return TRUE;
+}
+
+static void placeBlockHash(tBlockHashTable* const pTable,
+                           const tBlockHashItem* const pItem)
+{
+    size_t slot = mixFingerprint(pItem->_fingerprint) & (pTable->_capacity - 1);
+    while(pTable->_pItems[slot]._used != 0){
+        slot = (slot + 1) & (pTable->_capacity - 1);
+    }
+    pTable->_pItems[slot] = *pItem;
+}
+
+bool insertBlockHash(tBlockHashTable* const pTable,
+                     const tFingerprint fingerprint,
+                     const tBlockNumber number)
+{
+    assert(pTable != NULL);
+    // Grow the table when it becomes half full.
+    if(((pTable->_nbItems + 1) * 2) > pTable->_capacity){
+        tBlockHashTable grown;
+        if(initBlockHash(&grown, pTable->_capacity) != TRUE){
+            return FALSE;
+        }
+        size_t i = 0;
+        for(; i < pTable->_capacity; ++i){
+            if(pTable->_pItems[i]._used != 0){
+                placeBlockHash(&grown, &(pTable->_pItems[i]));
+            }
+        }
+        grown._nbItems = pTable->_nbItems;
+        free(pTable->_pItems);
+        *pTable = grown;
+    }
+    const tBlockHashItem item = {fingerprint, number, 1};
+    placeBlockHash(pTable, &item);
+    ++pTable->_nbItems;
+    return TRUE;
+}
+
+bool findBlockHash(const tBlockHashTable* const pTable,
+                   const tFingerprint fingerprint,
+                   tBlockNumber* const pNumber)
+{
+    assert((pTable != NULL) && (pNumber != NULL));
+    if(pTable->_capacity == 0){
+        return FALSE;
+    }
+    size_t slot = mixFingerprint(fingerprint) & (pTable->_capacity - 1);
+    while(pTable->_pItems[slot]._used != 0){
+        if(pTable->_pItems[slot]._fingerprint == fingerprint){
+            *pNumber = pTable->_pItems[slot]._number;
+            return TRUE;
+        }
+        slot = (slot + 1) & (pTable->_capacity - 1);
+    }
+    return FALSE;
+}
+
+void closeBlockHash(tBlockHashTable* const pTable)
+{
+    if((pTable != NULL) && (pTable->_pItems != NULL)){
+        free(pTable->_pItems);
+        pTable->_pItems = NULL;
+        pTable->_capacity = 0;
+        pTable->_nbItems = 0;
+    }
+}
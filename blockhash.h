@@ -0,0 +1,50 @@
+/* 
+ * File:   blockhash.h
+ * Author: pilluh
+ *
+ * Created on 19 octobre 2026, 16:45
+ */
+
+#ifndef BLOCKHASH_H
+#define BLOCKHASH_H
+
+#include "types.h"      /* tBlockNumber, tBlockSize, tFingerprint, bool */
+#include <stddef.h>     /* size_t */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct sBlockHashItem{
+    tFingerprint    _fingerprint;
+    tBlockNumber    _number;
+    uint32_t        _used;
+} tBlockHashItem;
+
+/*
+ * Open addressing table from block fingerprints to block numbers, sized
+ * for millions of blocks (it doubles when half full).
+ */
+typedef struct sBlockHashTable{
+    size_t          _capacity;
+    size_t          _nbItems;
+    tBlockHashItem* _pItems;
+} tBlockHashTable;
+
+tFingerprint fingerprintBlock(const unsigned char* const pData,
+                              const tBlockSize size);
+bool initBlockHash(tBlockHashTable* const pTable, const size_t nbExpected);
+bool insertBlockHash(tBlockHashTable* const pTable,
+                     const tFingerprint fingerprint,
+                     const tBlockNumber number);
+bool findBlockHash(const tBlockHashTable* const pTable,
+                   const tFingerprint fingerprint,
+                   tBlockNumber* const pNumber);
+void closeBlockHash(tBlockHashTable* const pTable);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BLOCKHASH_H */
+
@@ -2,138 +2,256 @@
 #include "macros.h"         /* NUM_2_STR */
 #include <assert.h>         /* assert, _Static_assert */
 #include <stdio.h>          /* fprintf, stderr */
-#include <stdlib.h>         /* calloc, free */
+#include <string.h>         /* memcpy, memset */
 
-#define NB_BITS_ITEM (sizeof(*((tBlockPacketMap*) NULL)->_pItems)*8)
+#define NB_BITS_ITEM (sizeof(tMapItem)*8)
 
 bool initMap(tBlockPacketMap* const pBlockPacketMap)
 {
+    assert(pBlockPacketMap != NULL);
+    memset(&pBlockPacketMap->_bitmap, 0, sizeof(pBlockPacketMap->_bitmap));
     // Compute the number of items needed.
     if(pBlockPacketMap->_header._packetTotal < 1){
         pBlockPacketMap->_header._packetTotal = 0;
         pBlockPacketMap->_header._nbItems = 0;
-        pBlockPacketMap->_pItems = NULL;
-        return;
+        return FALSE;
     }
     _Static_assert(
         MAX_MAP_NUMBER >= 1,
         "MAX_MAP_NUMBER must be greater than or equal to one."
     );
     if(pBlockPacketMap->_header._packetTotal >
-        ((sizeof(tMapItem)*8)*(MAX_MAP_NUMBER - 1) + 1))
+        (NB_BITS_ITEM*(MAX_MAP_NUMBER - 1) + 1))
     {
         fprintf(
             stderr,
-            "Packet total is too high: %u > %lu.\n",
+            "Packet total is too high: %u > %zu.\n",
             pBlockPacketMap->_header._packetTotal,
-            (sizeof(tMapItem)*8)*(MAX_MAP_NUMBER - 1) + 1
+            NB_BITS_ITEM*(MAX_MAP_NUMBER - 1) + 1
         );
         pBlockPacketMap->_header._packetTotal = 0;
         pBlockPacketMap->_header._nbItems = 0;
-        pBlockPacketMap->_pItems = NULL;
         return FALSE;
     }
-    pBlockPacketMap->_header._nbItems =
-        (pBlockPacketMap->_header._packetTotal - 1) / NB_BITS_ITEM + 1;
-    pBlockPacketMap->_pItems =
-        calloc(
-            pBlockPacketMap->_header._nbItems,
-            sizeof(((tBlockPacketMap*) NULL)->_pItems)
-        );
-    if(pBlockPacketMap->_pItems == NULL){
-        fprintf(
-            stderr, "Fail to allocate memory at %s line %d.\n",
-            __FILE__, __LINE__
-        );
+    if(initBitmap(
+        &pBlockPacketMap->_bitmap, pBlockPacketMap->_header._packetTotal
+    ) != TRUE)
+    {
         pBlockPacketMap->_header._packetTotal = 0;
         pBlockPacketMap->_header._nbItems = 0;
         return FALSE;
     }
+    pBlockPacketMap->_header._nbItems =
+        (tMapNumber) pBlockPacketMap->_bitmap._nbWords;
     return TRUE;
 }
 
-void setMap(tBlockPacketMap* const pBlockPacketMap,
+bool setMap(tBlockPacketMap* const pBlockPacketMap,
     const tPacketNumber packetNumber)
 {
-    if( (pBlockPacketMap != NULL) &&
-        (packetNumber < pBlockPacketMap->_header._packetTotal) )
-    {
-        pBlockPacketMap->_pItems[packetNumber / NB_BITS_ITEM] |=
-            (1 << (packetNumber % NB_BITS_ITEM));
+    if(pBlockPacketMap == NULL){
+        return FALSE;
     }
+    return setBit(&pBlockPacketMap->_bitmap, packetNumber);
 }
 
 void clearMap(tBlockPacketMap* const pBlockPacketMap,
     const tPacketNumber packetNumber)
 {
-    if( (pBlockPacketMap != NULL) &&
-        (packetNumber < pBlockPacketMap->_header._packetTotal) )
-    {
-        pBlockPacketMap->_pItems[packetNumber / NB_BITS_ITEM] &=
-            ~(1 << (packetNumber % NB_BITS_ITEM));
+    if(pBlockPacketMap != NULL){
+        clearBit(&pBlockPacketMap->_bitmap, packetNumber);
     }
 }
 
 void toggleMap(tBlockPacketMap* const pBlockPacketMap,
     const tPacketNumber packetNumber)
 {
-    if( (pBlockPacketMap != NULL) &&
-        (packetNumber < pBlockPacketMap->_header._packetTotal) )
-    {
-        pBlockPacketMap->_pItems[packetNumber / NB_BITS_ITEM] ^=
-            (1 << (packetNumber % NB_BITS_ITEM));
+    if(pBlockPacketMap != NULL){
+        toggleBit(&pBlockPacketMap->_bitmap, packetNumber);
     }
 }
 
 bool getMap(const tBlockPacketMap* const pBlockPacketMap,
     const tPacketNumber packetNumber)
 {
-    if( (pBlockPacketMap != NULL) &&
-        (packetNumber < pBlockPacketMap->_header._packetTotal) )
+    if(pBlockPacketMap == NULL){
+        return FALSE;
+    }
+    return getBit(&pBlockPacketMap->_bitmap, packetNumber);
+}
+
+bool isMapFull(const tBlockPacketMap* const pBlockPacketMap)
+{
+    if(pBlockPacketMap == NULL){
+        return TRUE;
+    }
+    return isBitmapFull(&pBlockPacketMap->_bitmap);
+}
+
+// Number of packets still missing.
+tPacketNumber getMapMissing(const tBlockPacketMap* const pBlockPacketMap)
+{
+    assert(pBlockPacketMap != NULL);
+    return (tPacketNumber) getNbMissing(&pBlockPacketMap->_bitmap);
+}
+
+// First packet missing (the packet total if none).
+tPacketNumber findMapMissing(const tBlockPacketMap* const pBlockPacketMap)
+{
+    assert(pBlockPacketMap != NULL);
+    return (tPacketNumber) findFirstMissing(&pBlockPacketMap->_bitmap);
+}
+
+/*
+ * Next range of received (or missing) packets at or after the given one:
+ * [*pFirst, *pEnd). Return FALSE when there is none.
+ */
+bool findMapRange(const tBlockPacketMap* const pBlockPacketMap,
+    const tPacketNumber from, const bool isReceived,
+    tPacketNumber* const pFirst, tPacketNumber* const pEnd)
+{
+    assert((pBlockPacketMap != NULL) && (pFirst != NULL) && (pEnd != NULL));
+    uint32_t first = 0;
+    uint32_t end = 0;
+    if(findRange(&pBlockPacketMap->_bitmap, from, isReceived, &first, &end)
+        != TRUE)
     {
-        return (
-            pBlockPacketMap->_pItems
-                [packetNumber / NB_BITS_ITEM] &
-                    (1 << (packetNumber % NB_BITS_ITEM))
-            ) != 0 ? TRUE : FALSE;
+        return FALSE;
+    }
+    *pFirst = (tPacketNumber) first;
+    *pEnd = (tPacketNumber) end;
+    return TRUE;
+}
+
+/*
+ * Maps are encoded as the lengths of the alternating missing and received
+ * ranges (starting with a missing one, possibly empty), each one a
+ * variable length integer (7 bits a byte): a nearly empty or nearly full
+ * map takes a few bytes.
+ */
+#define RUN_BYTES_MAX ((sizeof(tPacketNumber)*8 + 6) / 7)
+// Encoded map containers: runs, or the raw words when runs do not pay.
+#define MAP_CONTAINER_RUNS  ((unsigned char) 0)
+#define MAP_CONTAINER_WORDS ((unsigned char) 1)
+
+static size_t encodeRun(unsigned char* const pBuffer, uint32_t length)
+{
+    size_t size = 0;
+    while(length >= 0x80){
+        pBuffer[size++] = (unsigned char) (length | 0x80);
+        length >>= 7;
+    }
+    pBuffer[size++] = (unsigned char) length;
+    return size;
+}
+
+static bool decodeRun(const unsigned char* const pBuffer, const size_t size,
+                      size_t* const pOffset, uint32_t* const pLength)
+{
+    uint32_t length = 0;
+    unsigned int shift = 0;
+    while((*pOffset < size) && (shift < 7*RUN_BYTES_MAX)){
+        const unsigned char byte = pBuffer[(*pOffset)++];
+        length |= (uint32_t) (byte & 0x7F) << shift;
+        if((byte & 0x80) == 0){
+            *pLength = length;
+            return TRUE;
+        }
+        shift += 7;
     }
     return FALSE;
 }
 
-bool isMapFull(const tBlockPacketMap* const pBlockPacketMap)
+// Encoded size upper bound (every packet a range of its own).
+size_t getMapEncodingBound(const tBlockPacketMap* const pBlockPacketMap)
 {
-    if((pBlockPacketMap != NULL) && (pBlockPacketMap->_header._nbItems != 0)){
-        if(pBlockPacketMap->_header._nbItems > 1){
-            tMapNumber i = 0;
-            for(; i < (pBlockPacketMap->_header._nbItems - 1); ++i){
-                if(pBlockPacketMap->_pItems[i] != UINT32_MAX){
-                    return FALSE;
-                }
-            }
+    assert(pBlockPacketMap != NULL);
+    return 1 +
+        ((size_t) pBlockPacketMap->_header._packetTotal + 1)*RUN_BYTES_MAX;
+}
+
+// Return the encoded size.
+size_t encodeMap(const tBlockPacketMap* const pBlockPacketMap,
+    unsigned char* const pBuffer)
+{
+    assert((pBlockPacketMap != NULL) && (pBuffer != NULL));
+    const size_t wordsSize = pBlockPacketMap->_header._nbItems*
+        sizeof(*pBlockPacketMap->_bitmap._pWords);
+    pBuffer[0] = MAP_CONTAINER_RUNS;
+    size_t size = 1;
+    uint32_t next = 0;
+    uint32_t first = 0;
+    uint32_t end = 0;
+    while(findRange(&pBlockPacketMap->_bitmap, next, TRUE, &first, &end)
+        == TRUE)
+    {
+        size += encodeRun(pBuffer + size, first - next);
+        size += encodeRun(pBuffer + size, end - first);
+        next = end;
+        if(size > 1 + wordsSize){
+            break;
         }
-        // Last map item case.
-        const tMapItem lastItem =
-            pBlockPacketMap->_pItems[pBlockPacketMap->_header._nbItems - 1];
-        if(lastItem != UINT32_MAX){
-            const uint32_t mask = (
-                    1 << (
-                        ((pBlockPacketMap->_header._packetTotal - 1) %
-                            NB_BITS_ITEM) + 1
-                    )
-                ) - 1;
-            return (lastItem & mask) == mask ? TRUE : FALSE;
+    }
+    // The missing packets left, if any.
+    if(next < pBlockPacketMap->_header._packetTotal){
+        size += encodeRun(
+            pBuffer + size, pBlockPacketMap->_header._packetTotal - next
+        );
+    }
+    // Scattered packets: the raw words are smaller.
+    if(size > 1 + wordsSize){
+        pBuffer[0] = MAP_CONTAINER_WORDS;
+        memcpy(pBuffer + 1, pBlockPacketMap->_bitmap._pWords, wordsSize);
+        size = 1 + wordsSize;
+    }
+    return size;
+}
+
+// Decode into an initialized map (of the right packet total) left empty.
+bool decodeMap(tBlockPacketMap* const pBlockPacketMap,
+    const unsigned char* const pBuffer, const size_t size)
+{
+    assert((pBlockPacketMap != NULL) && (pBuffer != NULL));
+    const uint32_t total = pBlockPacketMap->_header._packetTotal;
+    const size_t wordsSize = pBlockPacketMap->_header._nbItems*
+        sizeof(*pBlockPacketMap->_bitmap._pWords);
+    if(size == 0){
+        return FALSE;
+    }
+    if(pBuffer[0] == MAP_CONTAINER_WORDS){
+        if(size != 1 + wordsSize){
+            return FALSE;
         }
+        memcpy(pBlockPacketMap->_bitmap._pWords, pBuffer + 1, wordsSize);
+        countBitmap(&pBlockPacketMap->_bitmap);
         return TRUE;
     }
-    return TRUE;
+    if(pBuffer[0] != MAP_CONTAINER_RUNS){
+        return FALSE;
+    }
+    size_t offset = 1;
+    uint32_t next = 0;
+    bool isReceived = FALSE;
+    while(offset < size){
+        uint32_t length = 0;
+        if( (decodeRun(pBuffer, size, &offset, &length) != TRUE) ||
+            (length > (total - next)) )
+        {
+            return FALSE;
+        }
+        if(isReceived == TRUE){
+            setRange(&pBlockPacketMap->_bitmap, next, next + length);
+        }
+        next += length;
+        isReceived = (isReceived == TRUE) ? FALSE : TRUE;
+    }
+    return (next == total) ? TRUE : FALSE;
 }
 
 void closeMap(tBlockPacketMap* const pBlockPacketMap)
 {
-    if((pBlockPacketMap != NULL) && (pBlockPacketMap->_header._nbItems != 0)){
-        assert(pBlockPacketMap->_pItems != NULL);
-        free(pBlockPacketMap->_pItems);
-        pBlockPacketMap->_pItems = NULL;
+    if(pBlockPacketMap != NULL){
+        closeBitmap(&pBlockPacketMap->_bitmap);
         pBlockPacketMap->_header._nbItems = 0;
         pBlockPacketMap->_header._packetTotal = 0;
     }
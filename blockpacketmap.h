@@ -9,14 +9,16 @@
 #define	BLOCKPACKETMAP_H
 
 #include "types.h"      /* tPacketNumber */
-#include <stdint.h>     /* uint32_t */
+#include "bitmap.h"     /* tBitmap, tBitmapWord */
+#include <stdint.h>     /* uint16_t */
+#include <stddef.h>     /* size_t */
 
 #ifdef	__cplusplus
 extern "C" {
 #endif
 
 typedef uint16_t tMapNumber;
-typedef uint32_t tMapItem;
+typedef tBitmapWord tMapItem;
 
 #define MAX_MAP_NUMBER ((tMapNumber) 65535)
 
@@ -25,13 +27,25 @@ typedef struct sBlockPacketMapHeader{
     tMapNumber    _nbItems;
 } tBlockPacketMapHeader;
 
+// Map file header, the encoded ranges follow.
+typedef struct sMapFileHeader{
+    tPacketNumber   _packetTotal;
+    uint16_t        _version;
+    uint32_t        _encodedSize;
+} tMapFileHeader;
+
+/*
+ * Packets received of a block: the header (as stored in map files) and
+ * the completion bitmap, where the thread setting the last bit completes
+ * the block.
+ */
 typedef struct sBlockPacketMap{
     tBlockPacketMapHeader   _header;
-    tMapItem*               _pItems;
+    tBitmap                 _bitmap;
 } tBlockPacketMap;
 
 bool initMap(tBlockPacketMap* const pBlockPacketMap);
-void setMap(tBlockPacketMap* const pBlockPacketMap,
+bool setMap(tBlockPacketMap* const pBlockPacketMap,
     const tPacketNumber packetNumber);
 void clearMap(tBlockPacketMap* const pBlockPacketMap,
     const tPacketNumber packetNumber);
@@ -40,6 +54,16 @@ void toggleMap(tBlockPacketMap* const pBlockPacketMap,
 bool getMap(const tBlockPacketMap* const pBlockPacketMap,
     const tPacketNumber packetNumber);
 bool isMapFull(const tBlockPacketMap* const pBlockPacketMap);
+tPacketNumber getMapMissing(const tBlockPacketMap* const pBlockPacketMap);
+tPacketNumber findMapMissing(const tBlockPacketMap* const pBlockPacketMap);
+bool findMapRange(const tBlockPacketMap* const pBlockPacketMap,
+    const tPacketNumber from, const bool isReceived,
+    tPacketNumber* const pFirst, tPacketNumber* const pEnd);
+size_t getMapEncodingBound(const tBlockPacketMap* const pBlockPacketMap);
+size_t encodeMap(const tBlockPacketMap* const pBlockPacketMap,
+    unsigned char* const pBuffer);
+bool decodeMap(tBlockPacketMap* const pBlockPacketMap,
+    const unsigned char* const pBuffer, const size_t size);
 void closeMap(tBlockPacketMap* const pBlockPacketMap);
 
 #ifdef	__cplusplus
@@ -0,0 +1,46 @@
+#include "blockscan.h"
+#include <assert.h>         /* assert */
+#ifdef __SSE2__
+#include <emmintrin.h>      /* _mm_loadu_si128, _mm_cmpeq_epi8 */
+#endif /* __SSE2__ */
+
+bool findBlockPattern(const unsigned char* const pData, const tBlockSize size,
+                      uint8_t* const pPattern)
+{
+    assert((pData != NULL) && (pPattern != NULL));
+    if(size == 0){
+        return FALSE;
+    }
+    const unsigned char pattern = pData[0];
+    tBlockSize i = 0;
+#ifdef __SSE2__
+    // Compare 64 bytes per iteration, folding the differences before testing.
+    const __m128i expected = _mm_set1_epi8((char) pattern);
+    for(; (i + 64) <= size; i += 64){
+        const __m128i* const p = (const __m128i*) (pData + i);
+        const __m128i diff = _mm_or_si128(
+            _mm_or_si128(
+                _mm_xor_si128(_mm_loadu_si128(p), expected),
+                _mm_xor_si128(_mm_loadu_si128(p + 1), expected)
+            ),
+            _mm_or_si128(
+                _mm_xor_si128(_mm_loadu_si128(p + 2), expected),
+                _mm_xor_si128(_mm_loadu_si128(p + 3), expected)
+            )
+        );
+        if(_mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128()))
+            != 0xFFFF)
+        {
+            return FALSE;
+        }
+    }
+#endif /* __SSE2__ */
+    // Remaining bytes (or everything without SSE2).
+    for(; i < size; ++i){
+        if(pData[i] != pattern){
+            return FALSE;
+        }
+    }
+    *pPattern = pattern;
+    return TRUE;
+}
@@ -0,0 +1,26 @@
+/* 
+ * File:   blockscan.h
+ * Author: pilluh
+ *
+ * Created on 19 octobre 2026, 14:27
+ */
+
+#ifndef BLOCKSCAN_H
+#define BLOCKSCAN_H
+
+#include "types.h"      /* tBlockSize, bool */
+#include <stdint.h>     /* uint8_t */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+bool findBlockPattern(const unsigned char* const pData, const tBlockSize size,
+                      uint8_t* const pPattern);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BLOCKSCAN_H */
+
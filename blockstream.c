@@ -0,0 +1,214 @@
+#include "blockstream.h"
+#include "constantes.h"     /* STREAM_POLL */
+#include "parsefile.h"      /* readBaseBlock */
+#include <stdio.h>          /* fprintf, stderr */
+#include <stdlib.h>         /* realloc, free */
+#include <string.h>         /* memset, strerror */
+#include <errno.h>          /* errno, EINTR */
+#include <assert.h>         /* assert */
+#include <unistd.h>         /* pread, write */
+#include <stdatomic.h>      /* atomic_thread_fence */
+#include <time.h>           /* clock_gettime, struct timespec */
+
+// Tell whether the next block of the stream can be copied.
+static bool isNextReady(const tBlockStream* const pStream)
+{
+    const tBlockNumber number = pStream->_next;
+    if( (pStream->_isIndexed != TRUE) ||
+        (number >= pStream->_nbBlocks) )
+    {
+        return FALSE;
+    }
+    // Data blocks are marked written by the workers once checked.
+    if( (isBlockWritten(pStream->_pJournal, number) == TRUE) &&
+        (getBit(pStream->_pBlocksSettled, number) == TRUE) )
+    {
+        return TRUE;
+    }
+    if(getBit(pStream->_pBlocksRead, number) != TRUE){
+        return FALSE;
+    }
+    // The item is written before the block is marked read.
+    atomic_thread_fence(memory_order_acquire);
+    return (pStream->_pIndexTable->_pItems[number]._type != BLOCK_TYPE_DATA) ?
+        TRUE : FALSE;
+}
+
+// Copy a block to the stream, from the spool or from where it is described.
+static bool streamBlock(tBlockStream* const pStream,
+                        const tIndexItem* const pItem)
+{
+    if(pItem->_size > pStream->_bufferSize){
+        void* const pBuffer = realloc(pStream->_pBuffer, pItem->_size);
+        if(pBuffer == NULL){
+            fprintf(
+                stderr,
+                "Fail to allocate memory at %s line %d.\n",
+                __FILE__, __LINE__
+            );
+            return FALSE;
+        }
+        pStream->_pBuffer = pBuffer;
+        pStream->_bufferSize = pItem->_size;
+    }
+    bool isRead = TRUE;
+    if(pItem->_type == BLOCK_TYPE_PATTERN){
+        memset(pStream->_pBuffer, pItem->_pattern, pItem->_size);
+    }else if(pItem->_type == BLOCK_TYPE_BASE){
+        isRead = readBaseBlock(pStream->_pBaseFile, pItem, pStream->_pBuffer);
+    }else{
+        // Duplicates refer to an earlier block, already in the spool.
+        const tBlockOffset offset = (pItem->_type == BLOCK_TYPE_DUPLICATE) ?
+            pStream->_pIndexTable->_pItems[pItem->_reference]._offset :
+            pItem->_offset;
+        isRead = (pread(pStream->_spoolFd, pStream->_pBuffer, pItem->_size,
+            offset) == (ssize_t) pItem->_size) ? TRUE : FALSE;
+    }
+    if(isRead != TRUE){
+        fprintf(
+            stderr,
+            "Fail to read block %u for the output stream.\n",
+            pItem->_number
+        );
+        return FALSE;
+    }
+    const char* pData = pStream->_pBuffer;
+    size_t remaining = pItem->_size;
+    while(remaining > 0){
+        const ssize_t written = write(pStream->_fd, pData, remaining);
+        if(written < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            fprintf(
+                stderr,
+                "Fail to write output stream (%d: %s).\n",
+                errno, strerror(errno)
+            );
+            return FALSE;
+        }
+        pData += written;
+        remaining -= (size_t) written;
+    }
+    return TRUE;
+}
+
+static void* runBlockStream(void* const pArg)
+{
+    tBlockStream* const pStream = pArg;
+    pthread_mutex_lock(&pStream->_mutex);
+    for(;;){
+        // Notifications may come before the block is ready (or be missed),
+        // look again at intervals.
+        while((pStream->_stopping != TRUE) && (isNextReady(pStream) != TRUE)){
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += (long) STREAM_POLL*1000000L;
+            if(deadline.tv_nsec >= 1000000000L){
+                ++deadline.tv_sec;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&pStream->_ready, &pStream->_mutex,
+                &deadline);
+        }
+        // Stopping, once every ready block is copied.
+        if(isNextReady(pStream) != TRUE){
+            break;
+        }
+        const tIndexItem* const pItem =
+            &(pStream->_pIndexTable->_pItems[pStream->_next]);
+        pthread_mutex_unlock(&pStream->_mutex);
+        const bool result = streamBlock(pStream, pItem);
+        pthread_mutex_lock(&pStream->_mutex);
+        if(result != TRUE){
+            pStream->_failed = TRUE;
+            break;
+        }
+        ++pStream->_next;
+    }
+    pthread_mutex_unlock(&pStream->_mutex);
+    return NULL;
+}
+
+bool initBlockStream(tBlockStream* const pStream, const int fd,
+    const int spoolFd, FILE* const pBaseFile)
+{
+    assert((pStream != NULL) && (fd >= 0) && (spoolFd >= 0));
+    pStream->_fd = fd;
+    pStream->_spoolFd = spoolFd;
+    pStream->_pBaseFile = pBaseFile;
+    pStream->_pIndexTable = NULL;
+    pStream->_pJournal = NULL;
+    pStream->_pBlocksRead = NULL;
+    pStream->_pBlocksSettled = NULL;
+    pStream->_next = 0;
+    pStream->_nbBlocks = 0;
+    pStream->_pBuffer = NULL;
+    pStream->_bufferSize = 0;
+    pStream->_isIndexed = FALSE;
+    pStream->_stopping = FALSE;
+    pStream->_failed = FALSE;
+    pthread_mutex_init(&pStream->_mutex, NULL);
+    pthread_cond_init(&pStream->_ready, NULL);
+    if(pthread_create(&pStream->_thread, NULL, runBlockStream, pStream) != 0){
+        fprintf(stderr, "Fail to start the output stream thread.\n");
+        pthread_cond_destroy(&pStream->_ready);
+        pthread_mutex_destroy(&pStream->_mutex);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void indexBlockStream(tBlockStream* const pStream,
+    const tIndexTable* const pIndexTable, const tJournal* const pJournal,
+    const tBitmap* const pBlocksRead, const tBitmap* const pBlocksSettled)
+{
+    assert((pStream != NULL) && (pIndexTable != NULL) && (pJournal != NULL));
+    pthread_mutex_lock(&pStream->_mutex);
+    pStream->_pIndexTable = pIndexTable;
+    pStream->_pJournal = pJournal;
+    pStream->_pBlocksRead = pBlocksRead;
+    pStream->_pBlocksSettled = pBlocksSettled;
+    pStream->_nbBlocks = pIndexTable->_nbItems;
+    pStream->_isIndexed = TRUE;
+    pthread_cond_signal(&pStream->_ready);
+    pthread_mutex_unlock(&pStream->_mutex);
+}
+
+void notifyBlockStream(tBlockStream* const pStream)
+{
+    assert(pStream != NULL);
+    pthread_mutex_lock(&pStream->_mutex);
+    pthread_cond_signal(&pStream->_ready);
+    pthread_mutex_unlock(&pStream->_mutex);
+}
+
+// The stream of a growing session ends with its last block.
+void endBlockStream(tBlockStream* const pStream, const tBlockNumber nbBlocks)
+{
+    assert(pStream != NULL);
+    pthread_mutex_lock(&pStream->_mutex);
+    pStream->_nbBlocks = nbBlocks;
+    pthread_cond_signal(&pStream->_ready);
+    pthread_mutex_unlock(&pStream->_mutex);
+}
+
+/*
+ * Copy what is left (every block is there when the receive is complete),
+ * then stop. Return TRUE when the whole file went to the stream.
+ */
+bool closeBlockStream(tBlockStream* const pStream)
+{
+    assert(pStream != NULL);
+    pthread_mutex_lock(&pStream->_mutex);
+    pStream->_stopping = TRUE;
+    pthread_cond_signal(&pStream->_ready);
+    pthread_mutex_unlock(&pStream->_mutex);
+    pthread_join(pStream->_thread, NULL);
+    pthread_cond_destroy(&pStream->_ready);
+    pthread_mutex_destroy(&pStream->_mutex);
+    free(pStream->_pBuffer);
+    pStream->_pBuffer = NULL;
+    return ( (pStream->_failed != TRUE) && (pStream->_isIndexed == TRUE) &&
+        (pStream->_next == pStream->_nbBlocks) ) ? TRUE : FALSE;
+}
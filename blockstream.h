@@ -0,0 +1,62 @@
+/* 
+ * File:   blockstream.h
+ * Author: pilluh
+ *
+ * Created on 20 octobre 2026, 16:40
+ */
+
+#ifndef BLOCKSTREAM_H
+#define BLOCKSTREAM_H
+
+#include "types.h"      /* tIndexTable, tIndexItem, tBlockNumber, bool */
+#include "journal.h"    /* tJournal */
+#include "bitmap.h"     /* tBitmap */
+#include <stdio.h>      /* FILE */
+#include <pthread.h>    /* pthread_t, pthread_mutex_t, pthread_cond_t */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * In order output of a receive to a pipe (or the standard output). Blocks
+ * are still written at their place, in a spool file of the output
+ * directory, and a thread copies the longest complete prefix to the stream
+ * as it grows: data blocks once written and settled, described blocks once
+ * described (duplicates are read back from the spool). A growing session
+ * ends with the block total it is eventually told.
+ */
+typedef struct sBlockStream{
+    int                 _fd;
+    int                 _spoolFd;
+    FILE*               _pBaseFile;
+    const tIndexTable*  _pIndexTable;
+    const tJournal*     _pJournal;
+    const tBitmap*      _pBlocksRead;
+    const tBitmap*      _pBlocksSettled;
+    tBlockNumber        _next;
+    tBlockNumber        _nbBlocks;
+    void*               _pBuffer;
+    tBlockSize          _bufferSize;
+    pthread_t           _thread;
+    pthread_mutex_t     _mutex;
+    pthread_cond_t      _ready;
+    bool                _isIndexed;
+    bool                _stopping;
+    bool                _failed;
+} tBlockStream;
+
+bool initBlockStream(tBlockStream* const pStream, const int fd,
+    const int spoolFd, FILE* const pBaseFile);
+void indexBlockStream(tBlockStream* const pStream,
+    const tIndexTable* const pIndexTable, const tJournal* const pJournal,
+    const tBitmap* const pBlocksRead, const tBitmap* const pBlocksSettled);
+void notifyBlockStream(tBlockStream* const pStream);
+void endBlockStream(tBlockStream* const pStream, const tBlockNumber nbBlocks);
+bool closeBlockStream(tBlockStream* const pStream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BLOCKSTREAM_H */
@@ -0,0 +1,414 @@
+#include "blockwindow.h"
+#include "constantes.h"     /* ASSEMBLY_WINDOW_BLOCKS, ASSEMBLY_WINDOW_MEMORY,
+                               DATA_BASENAME, MAP_BASENAME_END */
+#include "parsefile.h"      /* createBlockFile, createMapFile, readMapFile,
+                               buildMapFileName, buildBlockFileName */
+#include <stdio.h>          /* fprintf, stderr, remove */
+#include <stdlib.h>         /* malloc, calloc, free */
+#include <string.h>         /* strlen, strncmp, strcmp, strcat, strerror */
+#include <errno.h>          /* errno */
+#include <assert.h>         /* assert */
+#include <unistd.h>         /* access */
+#include <dirent.h>         /* opendir, readdir, closedir */
+
+// Slot table value of a block which is not being assembled.
+#define NO_SLOT ((uint32_t) 0)
+
+bool initBlockWindow(tBlockWindow* const pWindow, const char* const outputDir,
+    const tBlockNumber nbBlocks, const uint32_t nbShares)
+{
+    assert((pWindow != NULL) && (outputDir != NULL) && (nbShares >= 1));
+    pWindow->_outputDir = outputDir;
+    pWindow->_nbBlocks = nbBlocks;
+    pWindow->_capacity = (ASSEMBLY_WINDOW_BLOCKS + nbShares - 1) / nbShares;
+    pWindow->_nbFreeSlots = pWindow->_capacity;
+    pWindow->_memory = 0;
+    pWindow->_memoryBudget = ASSEMBLY_WINDOW_MEMORY / nbShares;
+    pWindow->_clock = 0;
+    pWindow->_nbSpilled = 0;
+    // One slot number per block (plus one, zero is none): O(1) lookup.
+    pWindow->_pSlots = calloc(nbBlocks, sizeof(*pWindow->_pSlots));
+    pWindow->_pBlocks = calloc(pWindow->_capacity, sizeof(*pWindow->_pBlocks));
+    pWindow->_pFreeSlots =
+        malloc(pWindow->_capacity*sizeof(*pWindow->_pFreeSlots));
+    if( (pWindow->_pSlots == NULL) || (pWindow->_pBlocks == NULL) ||
+        (pWindow->_pFreeSlots == NULL) )
+    {
+        fprintf(
+            stderr,
+            "Fail to allocate memory at %s line %d.\n",
+            __FILE__, __LINE__
+        );
+        free(pWindow->_pFreeSlots);
+        free(pWindow->_pBlocks);
+        free(pWindow->_pSlots);
+        pWindow->_pFreeSlots = NULL;
+        pWindow->_pBlocks = NULL;
+        pWindow->_pSlots = NULL;
+        return FALSE;
+    }
+    uint32_t i = 0;
+    for(; i < pWindow->_capacity; ++i){
+        pWindow->_pFreeSlots[i] = pWindow->_capacity - 1 - i;
+    }
+    return TRUE;
+}
+
+void removeStoredBlocks(const char* const outputDir)
+{
+    assert(outputDir != NULL);
+    DIR* const pDir = opendir(outputDir);
+    if(pDir == NULL){
+        return;
+    }
+    const size_t baseLength = strlen(DATA_BASENAME);
+    const size_t endLength = strlen(MAP_BASENAME_END);
+    const struct dirent* pEntry = NULL;
+    while((pEntry = readdir(pDir)) != NULL){
+        // Only stored blocks have a map file.
+        const size_t length = strlen(pEntry->d_name);
+        if( (length <= (baseLength + endLength)) ||
+            (strncmp(pEntry->d_name, DATA_BASENAME, baseLength) != 0) ||
+            (strcmp(pEntry->d_name + length - endLength, MAP_BASENAME_END)
+                != 0) )
+        {
+            continue;
+        }
+        char* const fileName = malloc(
+            strlen(outputDir) + strlen(DIRECTORY_SEPARATOR) + length + 1
+        );
+        if(fileName == NULL){
+            fprintf(
+                stderr,
+                "Fail to allocate memory at %s line %d.\n",
+                __FILE__, __LINE__
+            );
+            break;
+        }
+        fileName[0] = '\0';
+        strcat(fileName, outputDir);
+        strcat(fileName, DIRECTORY_SEPARATOR);
+        strcat(fileName, pEntry->d_name);
+        // The map file, then its block file.
+        if(remove(fileName) != 0){
+            fprintf(
+                stderr,
+                "Fail to remove map file: '%s' (%d: %s).\n",
+                fileName, errno, strerror(errno)
+            );
+        }
+        fileName[strlen(fileName) - endLength] = '\0';
+        if((remove(fileName) != 0) && (errno != ENOENT)){
+            fprintf(
+                stderr,
+                "Fail to remove block file: '%s' (%d: %s).\n",
+                fileName, errno, strerror(errno)
+            );
+        }
+        free(fileName);
+    }
+    closedir(pDir);
+}
+
+static bool restoreBlockFromMapFile(const char* const outputDir,
+                                    const tBlockNumber blockNumber,
+                                    tBlockPacketMap* const pBlockPacketMap,
+                                    tDataBlock* const pDataBlock)
+{
+    // Build map filename.
+    char* const mapFileName = buildMapFileName(outputDir, blockNumber);
+    if(mapFileName == NULL){
+        return FALSE;
+    }
+    // Read block packet map if available.
+    if(readMapFile(mapFileName, pBlockPacketMap) == TRUE){
+        // Remove it if successfully read.
+        if(remove(mapFileName) != 0){
+            fprintf(
+                stderr,
+                "Fail to remove map file: '%s' (%d: %s).\n",
+                mapFileName, errno, strerror(errno)
+            );
+        }
+        // Build block filename.
+        char* const blockFileName = buildBlockFileName(outputDir, blockNumber);
+        if(blockFileName == NULL){
+            // Free block packet map.
+            closeMap(pBlockPacketMap);
+            // Free map filename.
+            free(mapFileName);
+            return FALSE;
+        }
+        // Read block file, then remove it (completed blocks go to the
+        // output file).
+        if(readBlockFile(blockFileName, pDataBlock, FALSE) != TRUE){
+            // Free block packet map.
+            closeMap(pBlockPacketMap);
+        }else{
+            remove(blockFileName);
+            // Free map filename.
+            free(mapFileName);
+            // Free block filename.
+            free(blockFileName);
+            return TRUE;
+        }
+        // Free block filename.
+        free(blockFileName);
+    }
+    // Free map filename.
+    free(mapFileName);
+    return FALSE;
+}
+
+// Give the slot back, whatever the block became.
+static void freeSlot(tBlockWindow* const pWindow,
+                     tAssemblyBlock* const pAssembly)
+{
+    const uint32_t slot = (uint32_t) (pAssembly - pWindow->_pBlocks);
+    pWindow->_pSlots[pAssembly->_dataBlock._header._blockNumber] = NO_SLOT;
+    free(pAssembly->_dataBlock._pPayload);
+    pAssembly->_dataBlock._pPayload = NULL;
+    closeMap(&pAssembly->_blockPacketMap);
+    pWindow->_memory -= pAssembly->_memory;
+    pAssembly->_memory = 0;
+    pWindow->_pFreeSlots[pWindow->_nbFreeSlots++] = slot;
+}
+
+// Store the least recently used block on disk (what is available of it).
+static void spillAssembly(tBlockWindow* const pWindow)
+{
+    tAssemblyBlock* pOldest = NULL;
+    uint32_t i = 0;
+    for(; i < pWindow->_capacity; ++i){
+        tAssemblyBlock* const pAssembly = &(pWindow->_pBlocks[i]);
+        if( (pAssembly->_dataBlock._pPayload != NULL) &&
+            ((pOldest == NULL) || (pAssembly->_lastUse < pOldest->_lastUse)) )
+        {
+            pOldest = pAssembly;
+        }
+    }
+    assert(pOldest != NULL);
+    if(createBlockFile(pWindow->_outputDir, &pOldest->_dataBlock, FALSE)
+        != FALSE)
+    {
+        createMapFile(
+            pWindow->_outputDir, pOldest->_dataBlock._header._blockNumber,
+            &pOldest->_blockPacketMap
+        );
+    }
+    ++pWindow->_nbSpilled;
+    freeSlot(pWindow, pOldest);
+}
+
+// Make room (block count and memory budget) for a new block, in a slot.
+static tAssemblyBlock* makeRoom(tBlockWindow* const pWindow,
+                                const size_t memory)
+{
+    while( (pWindow->_nbFreeSlots == 0) ||
+           ( (pWindow->_nbFreeSlots < pWindow->_capacity) &&
+             ((pWindow->_memory + memory) > pWindow->_memoryBudget) ) )
+    {
+        spillAssembly(pWindow);
+    }
+    return &(pWindow->_pBlocks[
+        pWindow->_pFreeSlots[pWindow->_nbFreeSlots - 1]]);
+}
+
+// Describe a new block from one of its regular packets.
+static void setAssemblyHeader(tAssemblyBlock* const pAssembly,
+                              const tDataPacketHeader* const pHeader,
+                              const size_t memory)
+{
+    tDataBlock* const pDataBlock = &pAssembly->_dataBlock;
+    pDataBlock->_header._blockNumber = pHeader->_blockNumber;
+    pDataBlock->_header._offset = pHeader->_blockOffset;
+    pDataBlock->_header._rawSize = pHeader->_rawSize;
+    pDataBlock->_header._codec = pHeader->_codec;
+    pDataBlock->_header._checksum = pHeader->_checksum;
+    pDataBlock->_header._payloadSize = memory;
+    // Memorize the max packet size.
+    pAssembly->_maxPacketSize = pHeader->_payloadSize;
+    pAssembly->_memory = memory;
+}
+
+// Take the slot of a new block.
+static void occupySlot(tBlockWindow* const pWindow,
+                       tAssemblyBlock* const pAssembly,
+                       const tBlockNumber blockNumber)
+{
+    --pWindow->_nbFreeSlots;
+    pWindow->_pSlots[blockNumber] =
+        (uint32_t) (pAssembly - pWindow->_pBlocks) + 1;
+    pWindow->_memory += pAssembly->_memory;
+    pAssembly->_lastUse = pWindow->_clock;
+}
+
+tAssemblyBlock* openAssembly(tBlockWindow* const pWindow,
+    const tDataPacketHeader* const pHeader)
+{
+    assert((pWindow != NULL) && (pHeader != NULL));
+    assert(pHeader->_blockNumber < pWindow->_nbBlocks);
+    ++pWindow->_clock;
+    // Block already being assembled.
+    const uint32_t slot = pWindow->_pSlots[pHeader->_blockNumber];
+    if(slot != NO_SLOT){
+        tAssemblyBlock* const pAssembly = &(pWindow->_pBlocks[slot - 1]);
+        pAssembly->_lastUse = pWindow->_clock;
+        return pAssembly;
+    }
+    const bool isLastPacket =
+        (pHeader->_packetNumber == (pHeader->_packetTotal - 1)) ? TRUE : FALSE;
+    // Try to restore previously stored block and map state.
+    tBlockPacketMap restoredMap;
+    tDataBlock restoredBlock;
+    bool isRestored = restoreBlockFromMapFile(
+        pWindow->_outputDir, pHeader->_blockNumber, &restoredMap,
+        &restoredBlock
+    );
+    // Unless stored from another block (another transfer).
+    if( (isRestored == TRUE) &&
+        ( (restoredBlock._header._checksum != pHeader->_checksum) ||
+          (restoredBlock._header._offset != pHeader->_blockOffset) ||
+          (restoredBlock._header._rawSize != pHeader->_rawSize) ||
+          (restoredBlock._header._codec != pHeader->_codec) ||
+          (restoredMap._header._packetTotal != pHeader->_packetTotal) ) )
+    {
+        free(restoredBlock._pPayload);
+        closeMap(&restoredMap);
+        isRestored = FALSE;
+    }
+    // Allocate the block payload only with the not the last packet
+    // (its size is not the regular one), unless it is the only one.
+    if( (isRestored != TRUE) && (isLastPacket == TRUE) &&
+        (pHeader->_packetTotal != 1) )
+    {
+        return NULL;
+    }
+    const size_t memory = (isRestored == TRUE) ?
+        restoredBlock._header._payloadSize :
+        (size_t) pHeader->_packetTotal*pHeader->_payloadSize;
+    tAssemblyBlock* const pAssembly = makeRoom(pWindow, memory);
+    if(isRestored == TRUE){
+        pAssembly->_blockPacketMap = restoredMap;
+        pAssembly->_dataBlock = restoredBlock;
+        // Packets size is known unless only the last one is missing.
+        pAssembly->_maxPacketSize = (getMap(
+            &pAssembly->_blockPacketMap, pHeader->_packetTotal - 1) == FALSE) ?
+                (tPacketSize) (pAssembly->_dataBlock._header._payloadSize /
+                    pHeader->_packetTotal) : 0;
+        pAssembly->_memory = memory;
+    }else{
+        tDataBlock* const pDataBlock = &pAssembly->_dataBlock;
+        pDataBlock->_pPayload = calloc(
+            pHeader->_packetTotal, pHeader->_payloadSize
+        );
+        if(pDataBlock->_pPayload == NULL){
+            fprintf(
+                stderr,
+                "Fail to allocate memory at %s line %d.\n",
+                __FILE__, __LINE__
+            );
+            return NULL;
+        }
+        setAssemblyHeader(pAssembly, pHeader, memory);
+        // Allocate the block packet map.
+        pAssembly->_blockPacketMap._header._packetTotal =
+            pHeader->_packetTotal;
+        if(initMap(&pAssembly->_blockPacketMap) != TRUE){
+            free(pDataBlock->_pPayload);
+            pDataBlock->_pPayload = NULL;
+            return NULL;
+        }
+    }
+    occupySlot(pWindow, pAssembly, pHeader->_blockNumber);
+    return pAssembly;
+}
+
+bool adoptAssembly(tBlockWindow* const pWindow,
+    const tDataPacketHeader* const pHeader, void* const pPayload,
+    const tBlockPacketMap* const pBlockPacketMap,
+    tAssemblyBlock** const ppAssembly)
+{
+    assert((pWindow != NULL) && (pHeader != NULL) && (pPayload != NULL));
+    assert((pBlockPacketMap != NULL) && (ppAssembly != NULL));
+    assert(pHeader->_blockNumber < pWindow->_nbBlocks);
+    ++pWindow->_clock;
+    // Packets already assembled (or stored) are merged by the caller.
+    if(pWindow->_pSlots[pHeader->_blockNumber] != NO_SLOT){
+        return FALSE;
+    }
+    char* const mapFileName =
+        buildMapFileName(pWindow->_outputDir, pHeader->_blockNumber);
+    const bool isStored =
+        ((mapFileName == NULL) || (access(mapFileName, F_OK) == 0)) ?
+            TRUE : FALSE;
+    free(mapFileName);
+    if(isStored == TRUE){
+        return FALSE;
+    }
+    const size_t memory =
+        (size_t) pHeader->_packetTotal*pHeader->_payloadSize;
+    tAssemblyBlock* const pAssembly = makeRoom(pWindow, memory);
+    pAssembly->_dataBlock._pPayload = pPayload;
+    pAssembly->_blockPacketMap = *pBlockPacketMap;
+    setAssemblyHeader(pAssembly, pHeader, memory);
+    occupySlot(pWindow, pAssembly, pHeader->_blockNumber);
+    *ppAssembly = pAssembly;
+    return TRUE;
+}
+
+void discardAssembly(tBlockWindow* const pWindow,
+    const tBlockNumber blockNumber)
+{
+    assert(pWindow != NULL);
+    // Nothing was assembled yet.
+    if(pWindow->_pBlocks == NULL){
+        return;
+    }
+    assert(blockNumber < pWindow->_nbBlocks);
+    const uint32_t slot = pWindow->_pSlots[blockNumber];
+    if(slot != NO_SLOT){
+        freeSlot(pWindow, &(pWindow->_pBlocks[slot - 1]));
+        return;
+    }
+    // The block may be stored (its map file, then its block file).
+    if(pWindow->_nbSpilled == 0){
+        return;
+    }
+    char* const mapFileName =
+        buildMapFileName(pWindow->_outputDir, blockNumber);
+    if( (mapFileName != NULL) && (remove(mapFileName) == 0) ){
+        char* const blockFileName =
+            buildBlockFileName(pWindow->_outputDir, blockNumber);
+        if(blockFileName != NULL){
+            remove(blockFileName);
+        }
+        free(blockFileName);
+    }
+    free(mapFileName);
+}
+
+void releaseAssembly(tBlockWindow* const pWindow,
+    tAssemblyBlock* const pAssembly)
+{
+    assert((pWindow != NULL) && (pAssembly != NULL));
+    freeSlot(pWindow, pAssembly);
+}
+
+void closeBlockWindow(tBlockWindow* const pWindow)
+{
+    assert(pWindow != NULL);
+    if(pWindow->_pBlocks != NULL){
+        uint32_t i = 0;
+        for(; i < pWindow->_capacity; ++i){
+            free(pWindow->_pBlocks[i]._dataBlock._pPayload);
+            closeMap(&(pWindow->_pBlocks[i]._blockPacketMap));
+        }
+    }
+    free(pWindow->_pFreeSlots);
+    free(pWindow->_pBlocks);
+    free(pWindow->_pSlots);
+    pWindow->_pFreeSlots = NULL;
+    pWindow->_pBlocks = NULL;
+    pWindow->_pSlots = NULL;
+}
@@ -0,0 +1,75 @@
+/* 
+ * File:   blockwindow.h
+ * Author: pilluh
+ *
+ * Created on 19 octobre 2026, 20:15
+ */
+
+#ifndef BLOCKWINDOW_H
+#define BLOCKWINDOW_H
+
+#include "types.h"          /* tDataBlock, tDataPacketHeader, bool */
+#include "blockpacketmap.h" /* tBlockPacketMap */
+#include <stdint.h>         /* uint32_t, uint64_t */
+#include <stddef.h>         /* size_t */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A block being assembled from its packets.
+ */
+typedef struct sAssemblyBlock{
+    tDataBlock      _dataBlock;
+    tBlockPacketMap _blockPacketMap;
+    tPacketSize     _maxPacketSize;
+    size_t          _memory;
+    uint64_t        _lastUse;
+} tAssemblyBlock;
+
+/*
+ * Blocks assembled concurrently, found by block number. When the window is
+ * full (blocks or memory), the least recently used block is spilled to disk
+ * (block and map files) and restored when its packets come back. Each
+ * assembler has its own window, with a share of the limits. A block
+ * received in place is adopted with its buffer and map, unless its packets
+ * are already being assembled or stored. Stored blocks are only restored
+ * for packets of the same block (a new receive removes them). A block
+ * completed otherwise (repaired) is discarded, stored or not.
+ */
+typedef struct sBlockWindow{
+    const char*     _outputDir;
+    tAssemblyBlock* _pBlocks;
+    uint32_t*       _pFreeSlots;
+    uint32_t*       _pSlots;
+    tBlockNumber    _nbBlocks;
+    uint32_t        _capacity;
+    uint32_t        _nbFreeSlots;
+    size_t          _memory;
+    size_t          _memoryBudget;
+    uint64_t        _clock;
+    tBlockNumber    _nbSpilled;
+} tBlockWindow;
+
+bool initBlockWindow(tBlockWindow* const pWindow, const char* const outputDir,
+    const tBlockNumber nbBlocks, const uint32_t nbShares);
+tAssemblyBlock* openAssembly(tBlockWindow* const pWindow,
+    const tDataPacketHeader* const pHeader);
+bool adoptAssembly(tBlockWindow* const pWindow,
+    const tDataPacketHeader* const pHeader, void* const pPayload,
+    const tBlockPacketMap* const pBlockPacketMap,
+    tAssemblyBlock** const ppAssembly);
+void releaseAssembly(tBlockWindow* const pWindow,
+    tAssemblyBlock* const pAssembly);
+void discardAssembly(tBlockWindow* const pWindow,
+    const tBlockNumber blockNumber);
+void closeBlockWindow(tBlockWindow* const pWindow);
+void removeStoredBlocks(const char* const outputDir);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BLOCKWINDOW_H */
+
@@ -0,0 +1,277 @@
+#define _GNU_SOURCE         /* pwritev */
+#include "blockworker.h"
+#include "codec.h"          /* decompressBlock */
+#include "crc32.h"          /* crc32c */
+#include "blockhash.h"      /* fingerprintBlock */
+#include "blockstream.h"    /* notifyBlockStream */
+#include <stdio.h>          /* fprintf, stderr */
+#include <stdlib.h>         /* realloc, free, qsort */
+#include <string.h>         /* strerror */
+#include <errno.h>          /* errno, EINTR */
+#include <inttypes.h>       /* PRIu64 */
+#include <assert.h>         /* assert */
+#include <sys/uio.h>        /* pwritev, struct iovec */
+
+static int compareBlockOffset(const void* const pLeft, const void* const pRight)
+{
+    const tBlockOffset left = ((const tDataBlock*) pLeft)->_header._offset;
+    const tBlockOffset right = ((const tDataBlock*) pRight)->_header._offset;
+    return (left < right) ? -1 : ((left > right) ? 1 : 0);
+}
+
+// Write a run of adjacent blocks, starting at the first block offset.
+static bool writeBlockRun(const int fd, const tDataBlock* const pBlocks,
+                          const size_t nbBlocks)
+{
+    struct iovec iov[BLOCK_WORKER_QUEUE];
+    size_t i = 0;
+    for(; i < nbBlocks; ++i){
+        iov[i].iov_base = pBlocks[i]._pPayload;
+        iov[i].iov_len = pBlocks[i]._header._payloadSize;
+    }
+    struct iovec* pIov = iov;
+    int nbIov = (int) nbBlocks;
+    off_t offset = pBlocks[0]._header._offset;
+    while(nbIov > 0){
+        const ssize_t written = pwritev(fd, pIov, nbIov, offset);
+        if(written < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            fprintf(
+                stderr,
+                "Fail to write blocks into output file at %" PRIu64
+                    " (%d: %s).\n",
+                (uint64_t) offset, errno, strerror(errno)
+            );
+            return FALSE;
+        }
+        // Skip what was written (short writes are resumed).
+        offset += written;
+        size_t remaining = (size_t) written;
+        while((nbIov > 0) && (remaining >= pIov->iov_len)){
+            remaining -= pIov->iov_len;
+            ++pIov;
+            --nbIov;
+        }
+        if(nbIov > 0){
+            pIov->iov_base = (char*) pIov->iov_base + remaining;
+            pIov->iov_len -= remaining;
+        }
+    }
+    return TRUE;
+}
+
+// Give a block back to the receive loop (to be received again).
+static void setInvalidBlock(tBlockWorker* const pWorker,
+                            const tBlockNumber blockNumber)
+{
+    pthread_mutex_lock(&pWorker->_mutex);
+    if(pWorker->_nbInvalid == pWorker->_maxInvalid){
+        const size_t maxInvalid =
+            (pWorker->_maxInvalid == 0) ? 16 : 2*pWorker->_maxInvalid;
+        tBlockNumber* const pInvalid = realloc(
+            pWorker->_pInvalid, maxInvalid*sizeof(*pWorker->_pInvalid)
+        );
+        if(pInvalid == NULL){
+            fprintf(
+                stderr,
+                "Fail to allocate memory at %s line %d.\n",
+                __FILE__, __LINE__
+            );
+            pWorker->_failed = TRUE;
+            pthread_mutex_unlock(&pWorker->_mutex);
+            return;
+        }
+        pWorker->_pInvalid = pInvalid;
+        pWorker->_maxInvalid = maxInvalid;
+    }
+    pWorker->_pInvalid[pWorker->_nbInvalid++] = blockNumber;
+    pthread_mutex_unlock(&pWorker->_mutex);
+}
+
+static void* runBlockWorker(void* const pArg)
+{
+    tBlockWorker* const pWorker = pArg;
+    tDataBlock blocks[BLOCK_WORKER_BATCH];
+    bool failed = FALSE;
+    for(;;){
+        // Wait for the next completed blocks, then take a few of them.
+        pthread_mutex_lock(&pWorker->_mutex);
+        pWorker->_failed = (failed == TRUE) ? TRUE : pWorker->_failed;
+        failed = FALSE;
+        while((pWorker->_count == 0) && (pWorker->_stopping == FALSE)){
+            pthread_cond_wait(&pWorker->_notEmpty, &pWorker->_mutex);
+        }
+        if(pWorker->_count == 0){
+            // Stopping and nothing left to do.
+            pthread_mutex_unlock(&pWorker->_mutex);
+            break;
+        }
+        const size_t nbBlocks = (pWorker->_count < BLOCK_WORKER_BATCH) ?
+            pWorker->_count : BLOCK_WORKER_BATCH;
+        size_t i = 0;
+        for(; i < nbBlocks; ++i){
+            blocks[i] = pWorker->_queue[pWorker->_head];
+            pWorker->_head = (pWorker->_head + 1) % BLOCK_WORKER_QUEUE;
+        }
+        pWorker->_count -= nbBlocks;
+        ++pWorker->_nbBusy;
+        pthread_cond_signal(&pWorker->_notFull);
+        pthread_mutex_unlock(&pWorker->_mutex);
+        // Blocks are checked, then written raw at their place.
+        size_t nbRaw = 0;
+        for(i = 0; i < nbBlocks; ++i){
+            if(crc32c(blocks[i]._pPayload, blocks[i]._header._payloadSize) !=
+                blocks[i]._header._checksum)
+            {
+                fprintf(
+                    stderr,
+                    "Invalid data block checksum detected: number %u.\n",
+                    blocks[i]._header._blockNumber
+                );
+                setInvalidBlock(pWorker, blocks[i]._header._blockNumber);
+                free(blocks[i]._pPayload);
+            }else if(decompressBlock(&blocks[i]) == TRUE){
+                blocks[nbRaw++] = blocks[i];
+            }else{
+                free(blocks[i]._pPayload);
+                failed = TRUE;
+            }
+        }
+        // Adjacent blocks are written at once.
+        qsort(blocks, nbRaw, sizeof(*blocks), compareBlockOffset);
+        size_t first = 0;
+        for(i = 1; i <= nbRaw; ++i){
+            if( (i == nbRaw) ||
+                (blocks[i]._header._offset != (blocks[i - 1]._header._offset +
+                    blocks[i - 1]._header._payloadSize)) )
+            {
+                if(writeBlockRun(pWorker->_fd, blocks + first, i - first)
+                    != TRUE)
+                {
+                    failed = TRUE;
+                }else if(pWorker->_pJournal != NULL){
+                    // The journal tells what to check when resuming.
+                    size_t j = first;
+                    for(; j < i; ++j){
+                        markBlockWritten(
+                            pWorker->_pJournal, blocks[j]._header._blockNumber,
+                            fingerprintBlock(
+                                blocks[j]._pPayload,
+                                blocks[j]._header._payloadSize
+                            )
+                        );
+                    }
+                    if(pWorker->_pStream != NULL){
+                        notifyBlockStream(pWorker->_pStream);
+                    }
+                }
+                first = i;
+            }
+        }
+        for(i = 0; i < nbRaw; ++i){
+            free(blocks[i]._pPayload);
+        }
+        pthread_mutex_lock(&pWorker->_mutex);
+        if((--pWorker->_nbBusy == 0) && (pWorker->_count == 0)){
+            pthread_cond_broadcast(&pWorker->_idle);
+        }
+        pthread_mutex_unlock(&pWorker->_mutex);
+    }
+    return NULL;
+}
+
+bool initBlockWorker(tBlockWorker* const pWorker, const int fd,
+    tJournal* const pJournal, tBlockStream* const pStream)
+{
+    assert((pWorker != NULL) && (fd >= 0));
+    pWorker->_nbThreads = 0;
+    pWorker->_head = 0;
+    pWorker->_count = 0;
+    pWorker->_nbBusy = 0;
+    pWorker->_pInvalid = NULL;
+    pWorker->_nbInvalid = 0;
+    pWorker->_maxInvalid = 0;
+    pWorker->_stopping = FALSE;
+    pWorker->_failed = FALSE;
+    pWorker->_fd = fd;
+    pWorker->_pJournal = pJournal;
+    pWorker->_pStream = pStream;
+    pthread_mutex_init(&pWorker->_mutex, NULL);
+    pthread_cond_init(&pWorker->_notEmpty, NULL);
+    pthread_cond_init(&pWorker->_notFull, NULL);
+    pthread_cond_init(&pWorker->_idle, NULL);
+    for(; pWorker->_nbThreads < BLOCK_WORKER_THREADS; ++pWorker->_nbThreads){
+        if(pthread_create(
+            &(pWorker->_threads[pWorker->_nbThreads]), NULL,
+            runBlockWorker, pWorker
+        ) != 0)
+        {
+            fprintf(stderr, "Fail to start the block worker threads.\n");
+            closeBlockWorker(pWorker);
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+void pushBlock(tBlockWorker* const pWorker, tDataBlock* const pDataBlock)
+{
+    assert((pWorker != NULL) && (pDataBlock != NULL));
+    pthread_mutex_lock(&pWorker->_mutex);
+    // Only wait when the workers are far behind.
+    while(pWorker->_count == BLOCK_WORKER_QUEUE){
+        pthread_cond_wait(&pWorker->_notFull, &pWorker->_mutex);
+    }
+    pWorker->_queue[(pWorker->_head + pWorker->_count) % BLOCK_WORKER_QUEUE] =
+        *pDataBlock;
+    ++pWorker->_count;
+    pthread_cond_signal(&pWorker->_notEmpty);
+    pthread_mutex_unlock(&pWorker->_mutex);
+    // The worker owns the payload from now on.
+    pDataBlock->_pPayload = NULL;
+}
+
+void waitBlockWorker(tBlockWorker* const pWorker)
+{
+    assert(pWorker != NULL);
+    pthread_mutex_lock(&pWorker->_mutex);
+    while((pWorker->_count != 0) || (pWorker->_nbBusy != 0)){
+        pthread_cond_wait(&pWorker->_idle, &pWorker->_mutex);
+    }
+    pthread_mutex_unlock(&pWorker->_mutex);
+}
+
+bool popInvalidBlock(tBlockWorker* const pWorker,
+    tBlockNumber* const pBlockNumber)
+{
+    assert((pWorker != NULL) && (pBlockNumber != NULL));
+    pthread_mutex_lock(&pWorker->_mutex);
+    const bool result = (pWorker->_nbInvalid != 0) ? TRUE : FALSE;
+    if(result == TRUE){
+        *pBlockNumber = pWorker->_pInvalid[--pWorker->_nbInvalid];
+    }
+    pthread_mutex_unlock(&pWorker->_mutex);
+    return result;
+}
+
+void closeBlockWorker(tBlockWorker* const pWorker)
+{
+    assert(pWorker != NULL);
+    // Let the workers drain the queue, then wait for them.
+    pthread_mutex_lock(&pWorker->_mutex);
+    pWorker->_stopping = TRUE;
+    pthread_cond_broadcast(&pWorker->_notEmpty);
+    pthread_mutex_unlock(&pWorker->_mutex);
+    size_t i = 0;
+    for(; i < pWorker->_nbThreads; ++i){
+        pthread_join(pWorker->_threads[i], NULL);
+    }
+    pthread_cond_destroy(&pWorker->_idle);
+    pthread_cond_destroy(&pWorker->_notFull);
+    pthread_cond_destroy(&pWorker->_notEmpty);
+    pthread_mutex_destroy(&pWorker->_mutex);
+    free(pWorker->_pInvalid);
+    pWorker->_pInvalid = NULL;
+}
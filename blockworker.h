@@ -0,0 +1,63 @@
+/* 
+ * File:   blockworker.h
+ * Author: pilluh
+ *
+ * Created on 19 octobre 2026, 11:03
+ */
+
+#ifndef BLOCKWORKER_H
+#define BLOCKWORKER_H
+
+#include "types.h"      /* tDataBlock, tBlockNumber, bool */
+#include "constantes.h" /* BLOCK_WORKER_QUEUE, BLOCK_WORKER_THREADS */
+#include "journal.h"    /* tJournal */
+#include "blockstream.h" /* tBlockStream */
+#include <pthread.h>    /* pthread_t, pthread_mutex_t, pthread_cond_t */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Completed blocks are handed over to a pool of worker threads which check,
+ * decompress and write them at their place in the output file (adjacent
+ * blocks in a single write), so the receive loop never waits for the disk.
+ * Blocks failing their checksum are given back to be received again,
+ * written ones are marked in the receive journal (and an output stream
+ * waiting for them is told).
+ */
+typedef struct sBlockWorker{
+    pthread_t           _threads[BLOCK_WORKER_THREADS];
+    size_t              _nbThreads;
+    pthread_mutex_t     _mutex;
+    pthread_cond_t      _notEmpty;
+    pthread_cond_t      _notFull;
+    pthread_cond_t      _idle;
+    tDataBlock          _queue[BLOCK_WORKER_QUEUE];
+    size_t              _head;
+    size_t              _count;
+    size_t              _nbBusy;
+    tBlockNumber*       _pInvalid;
+    size_t              _nbInvalid;
+    size_t              _maxInvalid;
+    bool                _stopping;
+    bool                _failed;
+    int                 _fd;
+    tJournal*           _pJournal;
+    tBlockStream*       _pStream;
+} tBlockWorker;
+
+bool initBlockWorker(tBlockWorker* const pWorker, const int fd,
+    tJournal* const pJournal, tBlockStream* const pStream);
+void pushBlock(tBlockWorker* const pWorker, tDataBlock* const pDataBlock);
+void waitBlockWorker(tBlockWorker* const pWorker);
+bool popInvalidBlock(tBlockWorker* const pWorker,
+    tBlockNumber* const pBlockNumber);
+void closeBlockWorker(tBlockWorker* const pWorker);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BLOCKWORKER_H */
+
@@ -0,0 +1,412 @@
+#include "catchup.h"
+#include "parsefile.h"      /* buildBlockFileName, readBlockFile */
+#include <stdio.h>          /* fprintf, printf, perror, stderr */
+#include <stdlib.h>         /* malloc, free, strtoul */
+#include <string.h>         /* memset, memcpy, strchr, strerror */
+#include <errno.h>          /* errno, EINTR */
+#include <assert.h>         /* assert */
+#include <poll.h>           /* poll, struct pollfd, POLLIN */
+#include <unistd.h>         /* close, sleep, usleep, access */
+#include <sys/socket.h>     /* socket, bind, listen, accept, send, recv */
+#include <arpa/inet.h>      /* inet_aton, inet_ntoa, htons, ntohs */
+
+// Send or receive all the bytes (a peer late for CATCHUP_TIMEOUT fails).
+static bool transferAll(const int sd, void* const pBuffer, const size_t size,
+                        const bool isSend)
+{
+    size_t done = 0;
+    while(done < size){
+        const ssize_t result = (isSend == TRUE) ?
+            send(sd, (char*) pBuffer + done, size - done, MSG_NOSIGNAL) :
+            recv(sd, (char*) pBuffer + done, size - done, 0);
+        if(result < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return FALSE;
+        }else if(result == 0){
+            return FALSE;
+        }
+        done += (size_t) result;
+    }
+    return TRUE;
+}
+
+static void setTimeout(const int sd)
+{
+    const struct timeval timeout = {CATCHUP_TIMEOUT, 0};
+    setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(sd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+// Catch-up server address: "<addr>:<port>".
+bool parseCatchupAddress(const char* const address,
+    struct sockaddr_in* const pSock)
+{
+    assert((address != NULL) && (pSock != NULL));
+    char host[INET_ADDRSTRLEN];
+    const char* const pColon = strchr(address, ':');
+    const size_t length = (pColon != NULL) ? (size_t) (pColon - address) : 0;
+    memset(pSock, 0, sizeof(*pSock));
+    pSock->sin_family = AF_INET;
+    if((length == 0) || (length >= sizeof(host))){
+        fprintf(stderr, "Invalid catch-up address: '%s'.\n", address);
+        return FALSE;
+    }
+    memcpy(host, address, length);
+    host[length] = '\0';
+    char* pEnd = NULL;
+    const unsigned long port = strtoul(pColon + 1, &pEnd, 10);
+    if( (inet_aton(host, &pSock->sin_addr) == 0) || (*pEnd != '\0') ||
+        (port == 0L) || (port >= 65536L) )
+    {
+        fprintf(stderr, "Invalid catch-up address: '%s'.\n", address);
+        return FALSE;
+    }
+    pSock->sin_port = htons((uint16_t) port);
+    return TRUE;
+}
+
+// Reply with a block: its item, and its block file for a data block.
+static bool serveBlock(tCatchupServer* const pServer, const int sd,
+                       const tBlockNumber blockNumber,
+                       const tBlockNumber nbBlocks)
+{
+    tCatchupReply reply;
+    memset(&reply, 0, sizeof(reply));
+    reply._magic = CATCHUP_MAGIC;
+    reply._status = CATCHUP_MISSING;
+    tDataBlock dataBlock = {{0, 0, 0, 0, 0, 0, 0, 0}, NULL};
+    if(blockNumber < nbBlocks){
+        reply._item = pServer->_pIndexTable->_pItems[blockNumber];
+        // Base blocks are served as data blocks, the receiver pulling them
+        // may miss the previous file.
+        if( (reply._item._type != BLOCK_TYPE_DATA) &&
+            (reply._item._type != BLOCK_TYPE_BASE) )
+        {
+            reply._status = CATCHUP_DESCRIBED;
+        }else{
+            char* const blockFileName =
+                buildBlockFileName(pServer->_outputDir, blockNumber);
+            // Older releases kept no block file for base blocks.
+            if( (blockFileName != NULL) &&
+                ( (reply._item._type == BLOCK_TYPE_DATA) ||
+                  (access(blockFileName, F_OK) == 0) ) &&
+                (readBlockFile(blockFileName, &dataBlock, FALSE) == TRUE) )
+            {
+                reply._status = CATCHUP_DATA;
+                reply._item._type = BLOCK_TYPE_DATA;
+                reply._item._reference = dataBlock._header._checksum;
+                reply._header = dataBlock._header;
+            }else if(reply._item._type == BLOCK_TYPE_BASE){
+                reply._status = CATCHUP_DESCRIBED;
+            }
+            free(blockFileName);
+        }
+    }
+    const bool result =
+        ( (transferAll(sd, &reply, sizeof(reply), TRUE) == TRUE) &&
+          ( (reply._status != CATCHUP_DATA) ||
+            (transferAll(
+                sd, dataBlock._pPayload, dataBlock._header._payloadSize, TRUE
+            ) == TRUE) ) ) ? TRUE : FALSE;
+    free(dataBlock._pPayload);
+    return result;
+}
+
+// Serve a request of a receiver, FALSE when it is gone.
+static bool serveRequest(tCatchupServer* const pServer, const int sd)
+{
+    tCatchupRequest request;
+    if( (transferAll(sd, &request, sizeof(request), FALSE) != TRUE) ||
+        (request._magic != CATCHUP_MAGIC) ||
+        (request._version != CATCHUP_VERSION) ||
+        (request._nbBlocks > CATCHUP_MAX_BLOCKS) )
+    {
+        return FALSE;
+    }
+    // Blocks of a live source are served once cut.
+    bool isEnded = TRUE;
+    const tBlockNumber nbBlocks = (pServer->_pLive != NULL) ?
+        getLiveBlocks(pServer->_pLive, &isEnded) :
+        pServer->_pIndexTable->_nbItems;
+    if((isEnded == TRUE) && (request._blockTotal != nbBlocks)){
+        fprintf(
+            stderr,
+            "Catch-up request of another session: %u blocks != %u.\n",
+            request._blockTotal, nbBlocks
+        );
+        return FALSE;
+    }
+    uint16_t i = 0;
+    for(; i < request._nbBlocks; ++i){
+        if(serveBlock(pServer, sd, request._numbers[i], nbBlocks) != TRUE){
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static void* runCatchupServer(void* const pArg)
+{
+    tCatchupServer* const pServer = pArg;
+    struct pollfd pollFds[CATCHUP_CLIENTS + 1];
+    while(atomic_load(&pServer->_stopping) != TRUE){
+        pollFds[0].fd = pServer->_listenSd;
+        pollFds[0].events = POLLIN;
+        size_t i = 0;
+        for(; i < pServer->_nbClients; ++i){
+            pollFds[i + 1].fd = pServer->_clients[i];
+            pollFds[i + 1].events = POLLIN;
+        }
+        if(poll(pollFds, pServer->_nbClients + 1, CATCHUP_POLL) <= 0){
+            continue;
+        }
+        // A request each in turn, a receiver gone is forgotten.
+        for(i = pServer->_nbClients; i > 0; --i){
+            if( (pollFds[i].revents != 0) &&
+                (serveRequest(pServer, pServer->_clients[i - 1]) != TRUE) )
+            {
+                close(pServer->_clients[i - 1]);
+                pServer->_clients[i - 1] =
+                    pServer->_clients[--pServer->_nbClients];
+            }
+        }
+        if((pollFds[0].revents & POLLIN) != 0){
+            const int sd = accept(pServer->_listenSd, NULL, NULL);
+            if((sd >= 0) && (pServer->_nbClients == CATCHUP_CLIENTS)){
+                fprintf(stderr, "Too many catch-up receivers.\n");
+                close(sd);
+            }else if(sd >= 0){
+                setTimeout(sd);
+                pServer->_clients[pServer->_nbClients++] = sd;
+            }
+        }
+    }
+    return NULL;
+}
+
+bool startCatchupServer(tCatchupServer* const pServer,
+    const char* const address, const char* const outputDir,
+    const tIndexTable* const pIndexTable, tLiveSource* const pLive)
+{
+    assert((pServer != NULL) && (outputDir != NULL) && (pIndexTable != NULL));
+    struct sockaddr_in localSock;
+    if(parseCatchupAddress(address, &localSock) != TRUE){
+        return FALSE;
+    }
+    pServer->_listenSd = socket(AF_INET, SOCK_STREAM, 0);
+    if(pServer->_listenSd < 0){
+        perror("Error opening catch-up socket");
+        return FALSE;
+    }
+    const int reuse = 1;
+    if( (setsockopt(pServer->_listenSd, SOL_SOCKET, SO_REUSEADDR, &reuse,
+            sizeof(reuse)) != 0) ||
+        (bind(pServer->_listenSd, (struct sockaddr*) &localSock,
+            sizeof(localSock)) != 0) ||
+        (listen(pServer->_listenSd, CATCHUP_BACKLOG) != 0) )
+    {
+        perror("Error listening for catch-up requests");
+        close(pServer->_listenSd);
+        return FALSE;
+    }
+    pServer->_nbClients = 0;
+    pServer->_outputDir = outputDir;
+    pServer->_pIndexTable = pIndexTable;
+    pServer->_pLive = pLive;
+    atomic_init(&pServer->_stopping, FALSE);
+    if(pthread_create(
+        &pServer->_thread, NULL, runCatchupServer, pServer
+    ) != 0)
+    {
+        fprintf(stderr, "Fail to start the catch-up server thread.\n");
+        close(pServer->_listenSd);
+        return FALSE;
+    }
+    printf("Catch-up server listening on %s.\n", address);
+    return TRUE;
+}
+
+void stopCatchupServer(tCatchupServer* const pServer)
+{
+    assert(pServer != NULL);
+    atomic_store(&pServer->_stopping, TRUE);
+    pthread_join(pServer->_thread, NULL);
+    size_t i = 0;
+    for(; i < pServer->_nbClients; ++i){
+        close(pServer->_clients[i]);
+    }
+    close(pServer->_listenSd);
+}
+
+// Connect to the catch-up server, FALSE when it can not be reached.
+static bool connectCatchup(tCatchupClient* const pClient)
+{
+    pClient->_sd = socket(AF_INET, SOCK_STREAM, 0);
+    if(pClient->_sd < 0){
+        perror("Error opening catch-up socket");
+        return FALSE;
+    }
+    setTimeout(pClient->_sd);
+    if(connect(
+        pClient->_sd, (struct sockaddr*) &pClient->_serverSock,
+        sizeof(pClient->_serverSock)
+    ) != 0)
+    {
+        fprintf(
+            stderr,
+            "Fail to reach the catch-up server %s:%u (%d: %s).\n",
+            inet_ntoa(pClient->_serverSock.sin_addr),
+            ntohs(pClient->_serverSock.sin_port), errno, strerror(errno)
+        );
+        close(pClient->_sd);
+        pClient->_sd = -1;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+ * Pull the blocks of a request, each one handed over as soon as read.
+ * Return the number of blocks pulled, -1 when the connection failed.
+ */
+static int pullBlocks(tCatchupClient* const pClient,
+                      tCatchupRequest* const pRequest)
+{
+    if(transferAll(pClient->_sd, pRequest, sizeof(*pRequest), TRUE) != TRUE){
+        return -1;
+    }
+    int nbPulled = 0;
+    uint16_t i = 0;
+    for(; i < pRequest->_nbBlocks; ++i){
+        tCatchupReply reply;
+        if( (transferAll(pClient->_sd, &reply, sizeof(reply), FALSE)
+                != TRUE) ||
+            (reply._magic != CATCHUP_MAGIC) ||
+            ( (reply._status != CATCHUP_MISSING) &&
+              (reply._item._number != pRequest->_numbers[i]) ) )
+        {
+            fprintf(stderr, "Invalid catch-up reply received.\n");
+            return -1;
+        }
+        if(reply._status == CATCHUP_DESCRIBED){
+            pClient->_callback(pClient->_pContext, &reply._item, NULL);
+            ++nbPulled;
+            continue;
+        }else if(reply._status != CATCHUP_DATA){
+            continue;
+        }
+        tDataBlock dataBlock = {reply._header, NULL};
+        if( (dataBlock._header._blockNumber != pRequest->_numbers[i]) ||
+            (dataBlock._header._payloadSize > UINT32_MAX) )
+        {
+            fprintf(stderr, "Invalid catch-up reply received.\n");
+            return -1;
+        }
+        dataBlock._pPayload = malloc(dataBlock._header._payloadSize);
+        if(dataBlock._pPayload == NULL){
+            fprintf(
+                stderr,
+                "Fail to allocate memory at %s line %d.\n",
+                __FILE__, __LINE__
+            );
+            return -1;
+        }
+        if(transferAll(
+            pClient->_sd, dataBlock._pPayload, dataBlock._header._payloadSize,
+            FALSE
+        ) != TRUE)
+        {
+            free(dataBlock._pPayload);
+            return -1;
+        }
+        pClient->_callback(pClient->_pContext, &reply._item, &dataBlock);
+        ++nbPulled;
+    }
+    return nbPulled;
+}
+
+static void* runCatchupClient(void* const pArg)
+{
+    tCatchupClient* const pClient = pArg;
+    tCatchupRequest request;
+    memset(&request, 0, sizeof(request));
+    request._magic = CATCHUP_MAGIC;
+    request._version = CATCHUP_VERSION;
+    request._blockTotal = pClient->_blockTotal;
+    tBlockNumber cursor = 0;
+    while(atomic_load(&pClient->_stopping) != TRUE){
+        if((pClient->_sd < 0) && (connectCatchup(pClient) != TRUE)){
+            sleep(CATCHUP_RETRY);
+            continue;
+        }
+        // The next missing blocks, from the cursor then from the start.
+        request._nbBlocks = 0;
+        uint32_t first = 0;
+        uint32_t end = 0;
+        while( (request._nbBlocks < CATCHUP_MAX_BLOCKS) &&
+               (findRange(pClient->_pBlocksRead, cursor, FALSE, &first, &end)
+                    == TRUE) &&
+               (first < pClient->_blockTotal) )
+        {
+            for(; (first < end) && (first < pClient->_blockTotal) &&
+                (request._nbBlocks < CATCHUP_MAX_BLOCKS); ++first)
+            {
+                request._numbers[request._nbBlocks++] = first;
+            }
+            cursor = first;
+        }
+        if(request._nbBlocks == 0){
+            // Missing blocks may come back (found invalid).
+            if(cursor == 0){
+                usleep(CATCHUP_POLL*1000);
+            }
+            cursor = 0;
+            continue;
+        }
+        const int nbPulled = pullBlocks(pClient, &request);
+        if(nbPulled < 0){
+            close(pClient->_sd);
+            pClient->_sd = -1;
+        }else if(nbPulled == 0){
+            // Not available yet (a live source).
+            usleep(CATCHUP_POLL*1000);
+        }
+    }
+    if(pClient->_sd >= 0){
+        close(pClient->_sd);
+    }
+    return NULL;
+}
+
+bool startCatchupClient(tCatchupClient* const pClient,
+    const struct sockaddr_in* const pServerSock, tBitmap* const pBlocksRead,
+    const tBlockNumber blockTotal, const tCatchupCallback callback,
+    void* const pContext)
+{
+    assert((pClient != NULL) && (pServerSock != NULL) &&
+        (pBlocksRead != NULL) && (callback != NULL));
+    pClient->_serverSock = *pServerSock;
+    pClient->_sd = -1;
+    pClient->_pBlocksRead = pBlocksRead;
+    pClient->_blockTotal = blockTotal;
+    pClient->_callback = callback;
+    pClient->_pContext = pContext;
+    atomic_init(&pClient->_stopping, FALSE);
+    if(pthread_create(
+        &pClient->_thread, NULL, runCatchupClient, pClient
+    ) != 0)
+    {
+        fprintf(stderr, "Fail to start the catch-up thread.\n");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void stopCatchupClient(tCatchupClient* const pClient)
+{
+    assert(pClient != NULL);
+    atomic_store(&pClient->_stopping, TRUE);
+    pthread_join(pClient->_thread, NULL);
+}
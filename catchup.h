@@ -0,0 +1,101 @@
+/* 
+ * File:   catchup.h
+ * Author: pilluh
+ *
+ * Created on 20 octobre 2026, 22:30
+ */
+
+#ifndef CATCHUP_H
+#define CATCHUP_H
+
+#include "types.h"      /* tIndexItem, tDataBlock, tBlockNumber, bool */
+#include "constantes.h" /* CATCHUP_MAX_BLOCKS, CATCHUP_CLIENTS */
+#include "bitmap.h"     /* tBitmap */
+#include "livesource.h" /* tLiveSource */
+#include <stdint.h>     /* uint16_t, uint32_t */
+#include <stdatomic.h>  /* atomic_bool */
+#include <pthread.h>    /* pthread_t */
+#include <netinet/in.h> /* struct sockaddr_in */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Blocks a straggling receiver pulls at once.
+typedef struct sCatchupRequest{
+    uint32_t        _magic;
+    uint16_t        _version;
+    uint16_t        _nbBlocks;
+    tBlockNumber    _blockTotal;
+    tBlockNumber    _numbers[CATCHUP_MAX_BLOCKS];
+} tCatchupRequest;
+
+/*
+ * Reply for each block pulled: its index item, then for a data block the
+ * header and payload of its block file (as prepared, checked and
+ * decompressed by the receiver like a received block).
+ */
+typedef struct sCatchupReply{
+    uint32_t            _magic;
+    uint16_t            _status;
+    uint16_t            _padding;
+    tIndexItem          _item;
+    tDataBlockHeader    _header;
+} tCatchupReply;
+
+/*
+ * Called with each block pulled: a data block (the callee owns its
+ * payload), or only the item of a described block (pDataBlock is NULL).
+ */
+typedef void (*tCatchupCallback)(void* const pContext,
+    const tIndexItem* const pItem, tDataBlock* const pDataBlock);
+
+/*
+ * Catch-up server of the sender: it serves the prepared blocks by number,
+ * straight from the block files of the output directory, over TCP. One
+ * thread polls the straggling receivers connected, a request each in turn.
+ */
+typedef struct sCatchupServer{
+    int                 _listenSd;
+    int                 _clients[CATCHUP_CLIENTS];
+    size_t              _nbClients;
+    const char*         _outputDir;
+    const tIndexTable*  _pIndexTable;
+    tLiveSource*        _pLive;
+    atomic_bool         _stopping;
+    pthread_t           _thread;
+} tCatchupServer;
+
+/*
+ * Catch-up of a receiver: once started, a thread pulls the blocks still
+ * missing from the catch-up server of the sender, instead of waiting for
+ * the multicast carousel (blocks received meanwhile are dropped).
+ */
+typedef struct sCatchupClient{
+    struct sockaddr_in  _serverSock;
+    int                 _sd;
+    tBitmap*            _pBlocksRead;
+    tBlockNumber        _blockTotal;
+    tCatchupCallback    _callback;
+    void*               _pContext;
+    atomic_bool         _stopping;
+    pthread_t           _thread;
+} tCatchupClient;
+
+bool parseCatchupAddress(const char* const address,
+    struct sockaddr_in* const pSock);
+bool startCatchupServer(tCatchupServer* const pServer,
+    const char* const address, const char* const outputDir,
+    const tIndexTable* const pIndexTable, tLiveSource* const pLive);
+void stopCatchupServer(tCatchupServer* const pServer);
+bool startCatchupClient(tCatchupClient* const pClient,
+    const struct sockaddr_in* const pServerSock, tBitmap* const pBlocksRead,
+    const tBlockNumber blockTotal, const tCatchupCallback callback,
+    void* const pContext);
+void stopCatchupClient(tCatchupClient* const pClient);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CATCHUP_H */
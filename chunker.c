@@ -0,0 +1,128 @@
+#include "chunker.h"
+#include "constantes.h"     /* CDC_SIZE_RATIO, CDC_NORMALIZATION */
+#include <stdio.h>          /* fprintf, stderr */
+#include <stdint.h>         /* SIZE_MAX */
+#include <assert.h>         /* assert */
+
+// Gear table, one random 64 bits value per byte (fixed seed, see below).
+static uint64_t gGearTable[256];
+static bool gGearReady = FALSE;
+
+/*
+ * Boundaries must be the same on every run and every host, so the table
+ * is generated from a constant seed (splitmix64).
+ */
+static void initGearTable(void)
+{
+    uint64_t state = 0x6D756C7469636173ULL;
+    int i = 0;
+    for(; i < 256; ++i){
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        gGearTable[i] = z ^ (z >> 31);
+    }
+    gGearReady = TRUE;
+}
+
+// Mask of the top bits of the hash (the ones mixing the last 64 bytes).
+static uint64_t topBitsMask(const unsigned int nbBits)
+{
+    return (nbBits == 0) ? 0 : (~0ULL << (64 - nbBits));
+}
+
+bool initChunker(tChunker* const pChunker, const tBlockSize avgSize)
+{
+    assert(pChunker != NULL);
+    if( (avgSize < (MIN_BLOCK_SIZE * CDC_SIZE_RATIO)) ||
+        (avgSize > (SIZE_MAX / CDC_SIZE_RATIO)) )
+    {
+        fprintf(
+            stderr,
+            "Invalid average chunk size: %zu < %zu.\n",
+            avgSize, MIN_BLOCK_SIZE * CDC_SIZE_RATIO
+        );
+        return FALSE;
+    }
+    if(gGearReady != TRUE){
+        initGearTable();
+    }
+    // One cut every 2^bits bytes on average.
+    unsigned int nbBits = 0;
+    while(((tBlockSize) 1 << (nbBits + 1)) <= avgSize){
+        ++nbBits;
+    }
+    pChunker->_minSize = avgSize / CDC_SIZE_RATIO;
+    pChunker->_avgSize = avgSize;
+    pChunker->_maxSize = avgSize * CDC_SIZE_RATIO;
+    pChunker->_hardMask = topBitsMask(nbBits + CDC_NORMALIZATION);
+    pChunker->_easyMask = topBitsMask(nbBits - CDC_NORMALIZATION);
+    return TRUE;
+}
+
+/*
+ * Hash of byte i is (hash(i - 2) << 2) + (gear(i - 1) << 1) + gear(i), so odd
+ * and even positions are two independent chains which the CPU runs side by
+ * side (the boundaries are the same as hashing one byte after the other).
+ */
+static tBlockSize scanChunk(const unsigned char* const pData, tBlockSize i,
+                            const tBlockSize end, const uint64_t mask,
+                            uint64_t* const pHash, uint64_t* const pPrevHash)
+{
+    uint64_t hash = *pHash;
+    uint64_t prevHash = *pPrevHash;
+    for(; (i + 1) < end; i += 2){
+        const uint64_t gear = gGearTable[pData[i]];
+        const uint64_t even =
+            (prevHash << 2) + ((gGearTable[pData[i - 1]] << 1) + gear);
+        const uint64_t odd =
+            (hash << 2) + ((gear << 1) + gGearTable[pData[i + 1]]);
+        if(((even & mask) == 0) || ((odd & mask) == 0)){
+            return ((even & mask) == 0) ? (i + 1) : (i + 2);
+        }
+        prevHash = even;
+        hash = odd;
+    }
+    for(; i < end; ++i){
+        prevHash = hash;
+        hash = (hash << 1) + gGearTable[pData[i]];
+        if((hash & mask) == 0){
+            return i + 1;
+        }
+    }
+    *pHash = hash;
+    *pPrevHash = prevHash;
+    return 0;
+}
+
+tBlockSize findChunkBoundary(const tChunker* const pChunker,
+                             const unsigned char* const pData,
+                             const tBlockSize size)
+{
+    assert((pChunker != NULL) && (pData != NULL) && (gGearReady == TRUE));
+    if(size <= pChunker->_minSize){
+        return size;
+    }
+    const tBlockSize maxSize =
+        (size < pChunker->_maxSize) ? size : pChunker->_maxSize;
+    const tBlockSize avgSize =
+        (maxSize < pChunker->_avgSize) ? maxSize : pChunker->_avgSize;
+    // No cut below the min size, only the last 64 bytes are worth hashing.
+    tBlockSize i = (pChunker->_minSize > 64) ? (pChunker->_minSize - 64) : 0;
+    uint64_t hash = 0;
+    uint64_t prevHash = 0;
+    for(; i < pChunker->_minSize; ++i){
+        prevHash = hash;
+        hash = (hash << 1) + gGearTable[pData[i]];
+    }
+    // A harder mask up to the average size, then an easier one.
+    tBlockSize boundary = scanChunk(
+        pData, i, avgSize, pChunker->_hardMask, &hash, &prevHash
+    );
+    if(boundary == 0){
+        boundary = scanChunk(
+            pData, avgSize, maxSize, pChunker->_easyMask, &hash, &prevHash
+        );
+    }
+    return (boundary == 0) ? maxSize : boundary;
+}
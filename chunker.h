@@ -0,0 +1,40 @@
+/* 
+ * File:   chunker.h
+ * Author: pilluh
+ *
+ * Created on 19 octobre 2026, 18:02
+ */
+
+#ifndef CHUNKER_H
+#define CHUNKER_H
+
+#include "types.h"      /* tBlockSize, bool */
+#include <stdint.h>     /* uint64_t */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Content defined chunking parameters (gear rolling hash, the cut mask is
+ * harder below the average size and easier above it).
+ */
+typedef struct sChunker{
+    tBlockSize  _minSize;
+    tBlockSize  _avgSize;
+    tBlockSize  _maxSize;
+    uint64_t    _hardMask;
+    uint64_t    _easyMask;
+} tChunker;
+
+bool initChunker(tChunker* const pChunker, const tBlockSize avgSize);
+tBlockSize findChunkBoundary(const tChunker* const pChunker,
+                             const unsigned char* const pData,
+                             const tBlockSize size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CHUNKER_H */
+
@@ -1,16 +1,25 @@
+#define _GNU_SOURCE         /* recvmmsg, struct mmsghdr */
 #include "client.h"
-#include "constantes.h"     /* MAX_BLOCK_NUMBER */
+#include "constantes.h"     /* MAX_BLOCK_TOTAL, PACKET_MAGIC */
 #include "macros.h"         /* NUM_2_STR */
-#include <stdlib.h>         /* EXIT_FAILURE */
+#include <stdlib.h>         /* EXIT_FAILURE, malloc, realloc, free */
 #include <stdio.h>          /* perror, fprintf, stderr */
-#include <string.h>         /* memset */
+#include <string.h>         /* memset, memcpy, memmove */
+#include <errno.h>          /* errno, EINTR, EAGAIN */
 #include <assert.h>         /* assert */
+#include <unistd.h>         /* read, close */
 
 // Socket includes
 #include <sys/types.h>
-#include <sys/socket.h>     /* socket */
+#include <sys/socket.h>     /* socket, recvmsg */
+#include <sys/uio.h>        /* struct iovec */
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>    /* UDP_GRO */
+
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif /* UDP_GRO */
 
 int initClient(const char* const localAddr,
     const char* const multAddr, const uint16_t port)
@@ -19,7 +28,7 @@ int initClient(const char* const localAddr,
     const int sd = socket(AF_INET, SOCK_DGRAM, 0);
     if(sd < 0){
         perror("Error opening datagram socket (client)");
-        exit(EXIT_FAILURE);
+        return -1;
     }
     /* Enable SO_REUSEADDR to allow multiple instances of this */
     /* application to receive copies of the multicast datagrams. */
@@ -27,7 +36,7 @@ int initClient(const char* const localAddr,
     if(setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0){
         perror("Error setting SO_REUSEADDR");
         close(sd);
-        exit(EXIT_FAILURE);
+        return -1;
     }
     /* Bind to the proper port number with the IP address */
     /* specified as INADDR_ANY. */
@@ -39,7 +48,7 @@ int initClient(const char* const localAddr,
     if(bind(sd, (struct sockaddr*) &localSock, sizeof(localSock)) != 0){
         perror("Error binding datagram socket");
         close(sd);
-        exit(EXIT_FAILURE);
+        return -1;
     }
     /* Join the multicast group 226.1.1.1 on the local 203.106.93.94 */
     /* interface. Note that this IP_ADD_MEMBERSHIP option must be */
@@ -53,8 +62,14 @@ int initClient(const char* const localAddr,
     {
         perror("Error adding multicast group");
         close(sd);
-        exit(EXIT_FAILURE);
+        return -1;
     }
+    /* Room for bursts while the network thread hands batches over. */
+    const int bufferSize = RECEIVE_SOCKET_BUFFER;
+    setsockopt(sd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+    /* Let the kernel coalesce consecutive datagrams (when supported). */
+    const int gro = 1;
+    setsockopt(sd, IPPROTO_UDP, UDP_GRO, &gro, sizeof(gro));
     return sd;
 }
 
@@ -73,110 +88,500 @@ void runClient(const int sd)
     }
 }
 
-bool readPacket(const int sd, tDataPacket* const pDataPacket)
+static bool checkPacketHeader(const tDataPacketHeader* const pHeader,
+                              const size_t payloadSize)
 {
-    assert(pDataPacket != NULL);
-    /* Read header from socket. */
-    size_t result = recv(
-        sd, &(pDataPacket->_header), sizeof(pDataPacket->_header), MSG_PEEK
-    );
-    if(result != sizeof(pDataPacket->_header)){
-        fprintf(
-            stderr,
-            "Error reading packet message (invalid header).\n"
-        );
-        return FALSE;
-    }
-    // Allocate memory buffer.
-    const tPacketSize packetSize =
-        sizeof(pDataPacket->_header) + pDataPacket->_header._payloadSize;
-    void* const buffer = malloc(packetSize);
-    if(buffer == NULL){
+    // Check the packet comes from a compatible sender.
+    if( (pHeader->_magic != PACKET_MAGIC) ||
+        (pHeader->_version != PACKET_VERSION) )
+    {
         fprintf(
             stderr,
-            "Fail to allocate memory at %s line %d.\n",
-            __FILE__, __LINE__
+            "Error reading packet message (unsupported version %u).\n",
+            pHeader->_version
         );
         return FALSE;
     }
-    /* Read header and payload from the socket. */
-    result = recv(sd, buffer, packetSize, MSG_WAITALL);
-    if(result != packetSize){
+    if(payloadSize != pHeader->_payloadSize){
         fprintf(
             stderr,
             "Error reading packet message (invalid packet size).\n"
         );
-        free(buffer);
         return FALSE;
     }
-    // Copy header.
-    memcpy(&(pDataPacket->_header), buffer, sizeof(pDataPacket->_header));
-    // Copy payload (translate buffer memory).
-    memmove(buffer, buffer + sizeof(pDataPacket->_header),
-        pDataPacket->_header._payloadSize);
-    pDataPacket->_pPayload = buffer;
     // Check the total block coherency.
-    if(pDataPacket->_header._blockTotal > (MAX_BLOCK_NUMBER + 1)){
+    if(pHeader->_blockTotal > MAX_BLOCK_TOTAL){
         fprintf(
             stderr,
             "Number of blocks exceeds maximum authorized: "
-                "%u > " NUM_2_STR(MAX_BLOCK_NUMBER) ".\n",
-            pDataPacket->_header._blockTotal
+                "%u > " NUM_2_STR(MAX_BLOCK_TOTAL) ".\n",
+            pHeader->_blockTotal
         );
-        free(buffer);
         return FALSE;
     }
     // Check the block number coherency.
-    if(pDataPacket->_header._blockNumber >= pDataPacket->_header._blockTotal){
+    if(pHeader->_blockNumber >= pHeader->_blockTotal){
         fprintf(
             stderr,
             "Invalid block number: %u >= %u.\n",
-            pDataPacket->_header._blockNumber,
-            pDataPacket->_header._blockTotal
+            pHeader->_blockNumber,
+            pHeader->_blockTotal
         );
-        free(buffer);
         return FALSE;
     }
     // Check the total packet coherency.
-    if(pDataPacket->_header._packetTotal > (MAX_PACKET_NUMBER + 1)){
+    if(pHeader->_packetTotal > MAX_PACKET_NUMBER){
         fprintf(
             stderr,
             "Number of packets exceeds maximum authorized: "
                 "%u > " NUM_2_STR(MAX_PACKET_NUMBER) ".\n",
-            pDataPacket->_header._packetTotal
+            pHeader->_packetTotal
         );
-        free(buffer);
         return FALSE;
     }
     // Check the block number coherency.
-    if(pDataPacket->_header._packetNumber >= pDataPacket->_header._packetTotal){
+    if(pHeader->_packetNumber >= pHeader->_packetTotal){
         fprintf(
             stderr,
             "Invalid packet number: %u >= %u.\n",
-            pDataPacket->_header._packetNumber,
-            pDataPacket->_header._packetTotal
+            pHeader->_packetNumber,
+            pHeader->_packetTotal
         );
-        free(buffer);
         return FALSE;
     }
     // Check the packet size coherency.
-    if( (pDataPacket->_header._payloadSize == 0) ||
-        (pDataPacket->_header._payloadSize >
+    if( (pHeader->_payloadSize == 0) ||
+        (pHeader->_payloadSize >
             (MAX_PACKET_SIZE - sizeof(tPacketSize))) )
     {
         fprintf(
             stderr,
             "Invalid packet size: %u == 0 || > "
                 NUM_2_STR(MAX_PACKET_SIZE - sizeof(tPacketSize)) ".\n",
-            pDataPacket->_header._packetNumber
+            pHeader->_packetNumber
+        );
+        return FALSE;
+    }
+    // Check descriptor packets only hold whole index items.
+    if( (pHeader->_type != PACKET_TYPE_DATA) &&
+        ( (pHeader->_type != PACKET_TYPE_DESCRIPTOR) ||
+          ((pHeader->_payloadSize % sizeof(tIndexItem)) != 0) ) )
+    {
+        fprintf(
+            stderr,
+            "Invalid packet type: %u (payload size %u).\n",
+            pHeader->_type,
+            pHeader->_payloadSize
         );
-        free(buffer);
         return FALSE;
     }
     // On success.
     return TRUE;
 }
 
+bool initPacketBatch(tPacketBatch* const pBatch)
+{
+    assert(pBatch != NULL);
+    memset(pBatch, 0, sizeof(*pBatch));
+    pBatch->_pBuffers = malloc(RECEIVE_BATCH*RECEIVE_BUFFER_SIZE);
+    pBatch->_maxPackets = RECEIVE_BATCH;
+    pBatch->_pPackets =
+        malloc(pBatch->_maxPackets*sizeof(*pBatch->_pPackets));
+    if((pBatch->_pBuffers == NULL) || (pBatch->_pPackets == NULL)){
+        free(pBatch->_pPackets);
+        free(pBatch->_pBuffers);
+        pBatch->_pPackets = NULL;
+        pBatch->_pBuffers = NULL;
+        fprintf(
+            stderr,
+            "Fail to allocate memory at %s line %d.\n",
+            __FILE__, __LINE__
+        );
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Size of the packets coalesced in a datagram (the whole one if not).
+static size_t getSegmentSize(struct msghdr* const pMessage,
+                             const size_t length)
+{
+    struct cmsghdr* pControl = CMSG_FIRSTHDR(pMessage);
+    for(; pControl != NULL; pControl = CMSG_NXTHDR(pMessage, pControl)){
+        if( (pControl->cmsg_level == IPPROTO_UDP) &&
+            (pControl->cmsg_type == UDP_GRO) )
+        {
+            int segmentSize = 0;
+            memcpy(&segmentSize, CMSG_DATA(pControl), sizeof(segmentSize));
+            return (segmentSize > 0) ? (size_t) segmentSize : length;
+        }
+    }
+    return length;
+}
+
+// Keep a packet of the batch (coalesced datagrams hold more packets).
+static bool appendPacket(tPacketBatch* const pBatch,
+                         const tDataPacket* const pDataPacket)
+{
+    if(pBatch->_nbPackets == pBatch->_maxPackets){
+        tDataPacket* const pPackets = realloc(
+            pBatch->_pPackets,
+            2*pBatch->_maxPackets*sizeof(*pBatch->_pPackets)
+        );
+        if(pPackets == NULL){
+            fprintf(
+                stderr,
+                "Fail to allocate memory at %s line %d.\n",
+                __FILE__, __LINE__
+            );
+            return FALSE;
+        }
+        pBatch->_pPackets = pPackets;
+        pBatch->_maxPackets *= 2;
+    }
+    pBatch->_pPackets[pBatch->_nbPackets++] = *pDataPacket;
+    return TRUE;
+}
+
+void addDatagram(tPacketBatch* const pBatch, unsigned char* const pDatagram,
+    const size_t length, const size_t segmentSize)
+{
+    assert((pBatch != NULL) && (pDatagram != NULL) && (segmentSize != 0));
+    tDataPacket dataPacket;
+    const size_t headerSize = sizeof(dataPacket._header);
+    size_t offset = 0;
+    while(offset < length){
+        // Next packet of the datagram.
+        unsigned char* const pSegment = pDatagram + offset;
+        const size_t size = ((length - offset) < segmentSize) ?
+            (length - offset) : segmentSize;
+        offset += size;
+        if(size < headerSize){
+            fprintf(
+                stderr,
+                "Error reading packet message (invalid header).\n"
+            );
+            continue;
+        }
+        memcpy(&(dataPacket._header), pSegment, headerSize);
+        dataPacket._pPayload = pSegment + headerSize;
+        if( (checkPacketHeader(&(dataPacket._header), size - headerSize)
+                == TRUE) &&
+            (appendPacket(pBatch, &dataPacket) != TRUE) )
+        {
+            break;
+        }
+    }
+}
+
+// Allocate a run for a block to come, of packets of a known size.
+static bool openPacketRun(tPacketRun* const pRun,
+                          const tPacketNumber capacity,
+                          const tPacketSize packetSize)
+{
+    pRun->_pPayload = malloc((size_t) capacity*packetSize);
+    if(pRun->_pPayload == NULL){
+        fprintf(
+            stderr,
+            "Fail to allocate memory at %s line %d.\n",
+            __FILE__, __LINE__
+        );
+        return FALSE;
+    }
+    pRun->_capacity = capacity;
+    pRun->_packetSize = packetSize;
+    pRun->_lastSize = 0;
+    pRun->_next = 0;
+    pRun->_isKnown = FALSE;
+    return TRUE;
+}
+
+/*
+ * Land a datagram aimed at a packet of a run, when it is that packet: a
+ * data packet of the run block (the first one landing in a run for a block
+ * to come tells it), at most as large as the regular packets and only
+ * smaller when last.
+ */
+static bool landPacket(tPacketRun* const pRun,
+                       const tDataPacketHeader* const pHeader,
+                       const tPacketNumber target, const size_t payloadSize)
+{
+    if( (pHeader->_type != PACKET_TYPE_DATA) ||
+        (pHeader->_packetNumber != target) ||
+        (payloadSize > pRun->_packetSize) ||
+        ( (payloadSize < pRun->_packetSize) &&
+          (target != (pHeader->_packetTotal - 1)) ) ||
+        (checkPacketHeader(pHeader, payloadSize) != TRUE) )
+    {
+        return FALSE;
+    }
+    if(pRun->_isKnown == TRUE){
+        if( (pHeader->_blockNumber != pRun->_header._blockNumber) ||
+            (pHeader->_blockTotal != pRun->_header._blockTotal) ||
+            (pHeader->_packetTotal != pRun->_header._packetTotal) ||
+            (pHeader->_checksum != pRun->_header._checksum) )
+        {
+            return FALSE;
+        }
+    }else{
+        if(pHeader->_packetTotal > pRun->_capacity){
+            return FALSE;
+        }
+        pRun->_map._header._packetTotal = pHeader->_packetTotal;
+        if(initMap(&pRun->_map) != TRUE){
+            return FALSE;
+        }
+        pRun->_header = *pHeader;
+        pRun->_isKnown = TRUE;
+    }
+    if(target == (pHeader->_packetTotal - 1)){
+        pRun->_lastSize = (tPacketSize) payloadSize;
+    }
+    setMap(&pRun->_map, target);
+    pRun->_next = target + 1;
+    return TRUE;
+}
+
+/*
+ * Receive the next packets of a block in place, from one of its regular
+ * data packets (the last one of a block is smaller, the packet size is
+ * then unknown).
+ */
+static void startPacketRun(tPacketRun* const pRun,
+                           const tDataPacketHeader* const pHeader)
+{
+    if( (pHeader->_type != PACKET_TYPE_DATA) ||
+        (pHeader->_packetNumber >= (pHeader->_packetTotal - 1)) ||
+        (openPacketRun(pRun, pHeader->_packetTotal, pHeader->_payloadSize)
+            != TRUE) )
+    {
+        return;
+    }
+    pRun->_map._header._packetTotal = pHeader->_packetTotal;
+    if(initMap(&pRun->_map) != TRUE){
+        free(pRun->_pPayload);
+        pRun->_pPayload = NULL;
+        return;
+    }
+    pRun->_header = *pHeader;
+    pRun->_isKnown = TRUE;
+    pRun->_next = pHeader->_packetNumber + 1;
+}
+
+void closePacketRun(tPacketRun* const pRun)
+{
+    assert(pRun != NULL);
+    if(pRun->_pPayload != NULL){
+        free(pRun->_pPayload);
+        pRun->_pPayload = NULL;
+        if(pRun->_isKnown == TRUE){
+            closeMap(&pRun->_map);
+        }
+    }
+}
+
+// Aim datagrams at the missing packets of a run, from its next one on.
+static unsigned int aimPackets(tPacketRun* const pRun,
+                               tPacketRun** const ppRuns,
+                               tPacketNumber* const pTargets,
+                               unsigned int nbTargets)
+{
+    tPacketNumber first = pRun->_next;
+    tPacketNumber end = 0;
+    if(pRun->_isKnown != TRUE){
+        for(; (first < pRun->_capacity) && (nbTargets < RECEIVE_BATCH);
+            ++first)
+        {
+            ppRuns[nbTargets] = pRun;
+            pTargets[nbTargets++] = first;
+        }
+        return nbTargets;
+    }
+    while( (nbTargets < RECEIVE_BATCH) &&
+           (first < pRun->_header._packetTotal) &&
+           (findMapRange(&pRun->_map, first, FALSE, &first, &end) == TRUE) )
+    {
+        for(; (first < end) && (nbTargets < RECEIVE_BATCH); ++first){
+            ppRuns[nbTargets] = pRun;
+            pTargets[nbTargets++] = first;
+        }
+    }
+    return nbTargets;
+}
+
+bool readPackets(const int sd, tPacketBatch* const pBatch,
+    tPacketRun* const pRuns)
+{
+    assert(pBatch != NULL);
+    const size_t headerSize = sizeof(tDataPacketHeader);
+    tPacketRun* const pRun = (pRuns != NULL) ? &(pRuns[0]) : NULL;
+    tPacketRun* const pNextRun = (pRuns != NULL) ? &(pRuns[1]) : NULL;
+    // Aim the datagrams at the next missing packets of the run, then at
+    // the first packets of the block to come (alike).
+    tPacketRun* aimedRuns[RECEIVE_BATCH];
+    tPacketNumber targets[RECEIVE_BATCH];
+    unsigned int nbTargets = 0;
+    if((pRun != NULL) && (pRun->_pPayload != NULL)){
+        nbTargets = aimPackets(pRun, aimedRuns, targets, nbTargets);
+        if( (nbTargets < RECEIVE_BATCH) && (pRun->_isKnown == TRUE) &&
+            ( (pNextRun->_pPayload != NULL) ||
+              (openPacketRun(
+                pNextRun, pRun->_header._packetTotal, pRun->_packetSize
+              ) == TRUE) ) )
+        {
+            nbTargets = aimPackets(pNextRun, aimedRuns, targets, nbTargets);
+        }
+    }
+    // Each datagram in its own buffer (it may hold coalesced packets), the
+    // payload of an aimed one at its place in the run block.
+    unsigned int i = 0;
+    for(; i < RECEIVE_BATCH; ++i){
+        unsigned char* const pBuffer =
+            pBatch->_pBuffers + i*RECEIVE_BUFFER_SIZE;
+        struct iovec* const iov = pBatch->_iov[i];
+        struct msghdr* const pMessage = &(pBatch->_messages[i].msg_hdr);
+        memset(pMessage, 0, sizeof(*pMessage));
+        pMessage->msg_iov = iov;
+        pMessage->msg_control = pBatch->_controls[i];
+        pMessage->msg_controllen = sizeof(pBatch->_controls[i]);
+        if(i < nbTargets){
+            const size_t packetSize = aimedRuns[i]->_packetSize;
+            iov[0].iov_base = pBuffer;
+            iov[0].iov_len = headerSize;
+            iov[1].iov_base =
+                aimedRuns[i]->_pPayload + (size_t) targets[i]*packetSize;
+            iov[1].iov_len = packetSize;
+            iov[2].iov_base = pBuffer + headerSize + packetSize;
+            iov[2].iov_len = RECEIVE_BUFFER_SIZE - headerSize - packetSize;
+            pMessage->msg_iovlen = 3;
+        }else{
+            iov[0].iov_base = pBuffer;
+            iov[0].iov_len = RECEIVE_BUFFER_SIZE;
+            pMessage->msg_iovlen = 1;
+        }
+    }
+    pBatch->_nbPackets = 0;
+    pBatch->_run._pPayload = NULL;
+    // Wait for one datagram, then take whatever else is there.
+    const int result =
+        recvmmsg(sd, pBatch->_messages, RECEIVE_BATCH, MSG_WAITFORONE, NULL);
+    if(result <= 0){
+        // Non blocking sockets have nothing more to read.
+        if( (result < 0) && (errno != EINTR) && (errno != EAGAIN) &&
+            (errno != EWOULDBLOCK) )
+        {
+            perror("Error reading datagram messages");
+        }
+        return FALSE;
+    }
+    // Parse the packets once for all. Runs are only handed over once the
+    // whole batch is parsed (the datagrams may still point into them).
+    bool isRunEnded = FALSE;
+    for(i = 0; i < (unsigned int) result; ++i){
+        struct msghdr* const pMessage = &(pBatch->_messages[i].msg_hdr);
+        unsigned char* const pBuffer =
+            pBatch->_pBuffers + i*RECEIVE_BUFFER_SIZE;
+        const size_t length = pBatch->_messages[i].msg_len;
+        if((pMessage->msg_flags & MSG_TRUNC) != 0){
+            fprintf(
+                stderr,
+                "Error reading packet message (truncated datagram).\n"
+            );
+            continue;
+        }
+        if(length == 0){
+            continue;
+        }
+        const size_t segmentSize = getSegmentSize(pMessage, length);
+        if((i < nbTargets) && (length > headerSize)){
+            // The aimed packet is already in place (a single one).
+            tDataPacketHeader header;
+            memcpy(&header, pBuffer, headerSize);
+            if( (segmentSize >= length) &&
+                (landPacket(aimedRuns[i], &header, targets[i],
+                    length - headerSize) == TRUE) )
+            {
+                // The block to come started.
+                if(aimedRuns[i] == pNextRun){
+                    isRunEnded = TRUE;
+                }
+                continue;
+            }
+            // Otherwise gather the whole datagram in its buffer (the run
+            // place is only borrowed, the packet there is still missing).
+            const size_t packetSize = aimedRuns[i]->_packetSize;
+            const size_t headSize = ((length - headerSize) < packetSize) ?
+                (length - headerSize) : packetSize;
+            memcpy(pBuffer + headerSize, pBatch->_iov[i][1].iov_base, headSize);
+        }
+        const size_t nbPackets = pBatch->_nbPackets;
+        addDatagram(pBatch, pBuffer, length, segmentSize);
+        // Another block ends the run.
+        size_t j = nbPackets;
+        for(; (pRun != NULL) && (pRun->_pPayload != NULL) &&
+            (j < pBatch->_nbPackets); ++j)
+        {
+            if( (pRun->_isKnown != TRUE) ||
+                (pBatch->_pPackets[j]._header._blockNumber !=
+                    pRun->_header._blockNumber) )
+            {
+                isRunEnded = TRUE;
+            }
+        }
+    }
+    // The batch is published with the datagrams in their buffers alone, it
+    // keeps no pointer into a run handed over (and freed by its assembler).
+    for(i = 0; i < nbTargets; ++i){
+        struct iovec* const iov = pBatch->_iov[i];
+        iov[0].iov_len = RECEIVE_BUFFER_SIZE;
+        iov[1].iov_base = NULL;
+        iov[1].iov_len = 0;
+        iov[2].iov_base = NULL;
+        iov[2].iov_len = 0;
+        pBatch->_messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    if(pRun == NULL){
+        return TRUE;
+    }
+    // Hand the run over (unless nothing landed), the block to come is then
+    // received in place.
+    if( (isRunEnded == TRUE) ||
+        ( (pRun->_pPayload != NULL) && (pRun->_isKnown == TRUE) &&
+          (pRun->_next >= pRun->_header._packetTotal) ) )
+    {
+        if(pRun->_isKnown == TRUE){
+            pBatch->_run = *pRun;
+            pRun->_pPayload = NULL;
+        }else{
+            closePacketRun(pRun);
+        }
+        *pRun = *pNextRun;
+        pNextRun->_pPayload = NULL;
+    }
+    // Otherwise receive the next packets of the last block in place.
+    if( ( (pRun->_pPayload == NULL) || (pRun->_isKnown != TRUE) ) &&
+        (pBatch->_nbPackets != 0) )
+    {
+        const tDataPacketHeader* const pHeader =
+            &(pBatch->_pPackets[pBatch->_nbPackets - 1]._header);
+        if( (pHeader->_type == PACKET_TYPE_DATA) &&
+            (pHeader->_packetNumber < (pHeader->_packetTotal - 1)) )
+        {
+            closePacketRun(pRun);
+            startPacketRun(pRun, pHeader);
+        }
+    }
+    return TRUE;
+}
+
+void closePacketBatch(tPacketBatch* const pBatch)
+{
+    assert(pBatch != NULL);
+    free(pBatch->_pPackets);
+    free(pBatch->_pBuffers);
+    pBatch->_pPackets = NULL;
+    pBatch->_pBuffers = NULL;
+}
 void closeClient(const int sd)
 {
     if(close(sd) != 0){
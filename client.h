@@ -8,17 +8,67 @@
 #ifndef CLIENT_H
 #define CLIENT_H
 
-#include "types.h"  /* tDataPacket, bool */
-#include <stdint.h> /* uint16_t */
+#include "types.h"      /* tDataPacket, bool */
+#include "constantes.h" /* RECEIVE_BATCH */
+#include "blockpacketmap.h" /* tBlockPacketMap */
+#include <stdint.h>     /* uint16_t */
+#include <stddef.h>     /* size_t */
+#include <sys/socket.h> /* struct mmsghdr, CMSG_SPACE */
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/*
+ * Block received in place while the sender sends it: the datagrams are
+ * aimed at its next missing packets, their payload lands straight into the
+ * block buffer (the header and anything else in the datagram buffer). The
+ * reader owns the run until it hands it over with a batch, once another
+ * block comes or once complete. Meanwhile the first packets of the block
+ * to come are received alike, into a run of the same capacity its first
+ * packet landed tells (known).
+ */
+typedef struct sPacketRun{
+    tDataPacketHeader   _header;
+    unsigned char*      _pPayload;
+    tBlockPacketMap     _map;
+    tPacketSize         _packetSize;
+    tPacketSize         _lastSize;
+    tPacketNumber       _capacity;
+    tPacketNumber       _next;
+    bool                _isKnown;
+} tPacketRun;
+
+/*
+ * Datagrams received at once (recvmmsg), each one in its own buffer where
+ * it may hold several packets coalesced by the kernel (UDP_GRO). Packets
+ * are parsed once received, then only read by the assemblers. Packets read
+ * from a mapped ring point into the ring block held by the batch instead.
+ * A batch may also hand a run over (its payload is NULL otherwise), the
+ * one assembling the block then owns it.
+ */
+typedef struct sPacketBatch{
+    struct mmsghdr      _messages[RECEIVE_BATCH];
+    struct iovec        _iov[RECEIVE_BATCH][3];
+    char                _controls[RECEIVE_BATCH][CMSG_SPACE(sizeof(int))];
+    unsigned char*      _pBuffers;
+    tDataPacket*        _pPackets;
+    size_t              _nbPackets;
+    size_t              _maxPackets;
+    void*               _pRingBlock;
+    tPacketRun          _run;
+} tPacketBatch;
+
 int initClient(const char* const localAddr,
     const char* const multAddr, const uint16_t port);
 void runClient(const int sd);
-bool readPacket(const int sd, tDataPacket* const pDataPacket);
+bool initPacketBatch(tPacketBatch* const pBatch);
+void addDatagram(tPacketBatch* const pBatch, unsigned char* const pDatagram,
+    const size_t length, const size_t segmentSize);
+bool readPackets(const int sd, tPacketBatch* const pBatch,
+    tPacketRun* const pRuns);
+void closePacketRun(tPacketRun* const pRun);
+void closePacketBatch(tPacketBatch* const pBatch);
 void closeClient(const int sd);
 
 #ifdef __cplusplus
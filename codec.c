@@ -0,0 +1,81 @@
+#include "codec.h"
+#include "constantes.h" /* CODEC_NONE, CODEC_ZLIB, COMPRESSION_LEVEL */
+#include "crc32.h"      /* crc32c */
+#include <stdio.h>      /* fprintf, stderr */
+#include <stdlib.h>     /* malloc, free */
+#include <assert.h>     /* assert */
+#include <zlib.h>       /* compressBound, compress2, uncompress */
+
+tBlockSize maxCompressedSize(const tCodec codec, const tBlockSize rawSize)
+{
+    if(codec == CODEC_ZLIB){
+        return compressBound(rawSize);
+    }
+    return rawSize;
+}
+
+tBlockSize compressPayload(const tCodec codec,
+                           const void* const pRaw, const tBlockSize rawSize,
+                           void* const pOutput, const tBlockSize outputSize)
+{
+    assert((pRaw != NULL) && (pOutput != NULL));
+    if(codec != CODEC_ZLIB){
+        return 0;
+    }
+    uLongf compressedSize = outputSize;
+    const int result = compress2(
+        pOutput, &compressedSize, pRaw, rawSize, COMPRESSION_LEVEL
+    );
+    if(result != Z_OK){
+        fprintf(stderr, "Fail to compress block (zlib error %d).\n", result);
+        return 0;
+    }
+    // Compression has to pay, otherwise the raw bytes are kept.
+    return (compressedSize < rawSize) ? compressedSize : 0;
+}
+
+bool decompressBlock(tDataBlock* const pDataBlock)
+{
+    assert(pDataBlock != NULL);
+    if(pDataBlock->_header._codec == CODEC_NONE){
+        return TRUE;
+    }
+    if(pDataBlock->_header._codec != CODEC_ZLIB){
+        fprintf(
+            stderr,
+            "Unknown codec for block %u: %u.\n",
+            pDataBlock->_header._blockNumber, pDataBlock->_header._codec
+        );
+        return FALSE;
+    }
+    void* const pRaw = malloc(pDataBlock->_header._rawSize);
+    if(pRaw == NULL){
+        fprintf(
+            stderr,
+            "Fail to allocate memory at %s line %d.\n",
+            __FILE__, __LINE__
+        );
+        return FALSE;
+    }
+    uLongf rawSize = pDataBlock->_header._rawSize;
+    const int result = uncompress(
+        pRaw, &rawSize,
+        pDataBlock->_pPayload, pDataBlock->_header._payloadSize
+    );
+    if((result != Z_OK) || (rawSize != pDataBlock->_header._rawSize)){
+        fprintf(
+            stderr,
+            "Fail to decompress block %u (zlib error %d).\n",
+            pDataBlock->_header._blockNumber, result
+        );
+        free(pRaw);
+        return FALSE;
+    }
+    // The block now holds the raw bytes.
+    free(pDataBlock->_pPayload);
+    pDataBlock->_pPayload = pRaw;
+    pDataBlock->_header._payloadSize = rawSize;
+    pDataBlock->_header._checksum = crc32c(pRaw, rawSize);
+    pDataBlock->_header._codec = CODEC_NONE;
+    return TRUE;
+}
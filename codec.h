@@ -0,0 +1,28 @@
+/* 
+ * File:   codec.h
+ * Author: pilluh
+ *
+ * Created on 19 octobre 2026, 10:12
+ */
+
+#ifndef CODEC_H
+#define CODEC_H
+
+#include "types.h"      /* tDataBlock, tCodec, tBlockSize, bool */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+tBlockSize maxCompressedSize(const tCodec codec, const tBlockSize rawSize);
+tBlockSize compressPayload(const tCodec codec,
+                           const void* const pRaw, const tBlockSize rawSize,
+                           void* const pOutput, const tBlockSize outputSize);
+bool decompressBlock(tDataBlock* const pDataBlock);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CODEC_H */
+
@@ -20,6 +20,17 @@ extern "C" {
 #define PREPARE_OPTION      "fprepare"
 #define TRANSMIT_OPTION     "ftransmit"
 #define RECEIVE_OPTION      "freceive"
+#define DAEMON_OPTION       "fdaemon"
+#define COMPRESS_OPTION     "--compress"
+#define BASE_OPTION         "--base"
+#define CDC_OPTION          "--cdc"
+#define RING_OPTION         "--ring"
+#define ZEROCOPY_OPTION     "--zerocopy"
+#define LIVE_OPTION         "--live"
+#define DAEMON_SOCKET_OPTION "--daemon"
+#define REPAIR_OPTION       "--repair"
+#define CATCHUP_OPTION      "--catchup"
+#define CATCHUP_AFTER_OPTION "--catchup-after"
 // Default command line parameters.
 #define DEF_DATA_DIRECTORY  "/tmp/mltcastdst"
 #define DEF_BLOCK_SIZE      ((tBlockSize) 65536)
@@ -30,16 +41,148 @@ extern "C" {
 #define INDEX_BASENAME      "data.index"
 #define DATA_BASENAME       "data.block"
 #define MAP_BASENAME_END    ".map"
-#define MAX_BLOCK_DIGITS    5
-#define MAX_BLOCK_NUMBER    ((tBlockNumber) 65534)
+#define JOURNAL_BASENAME    "receive.journal"
+#define STREAM_BASENAME     "stream.spool"
+#define MAX_BLOCK_DIGITS    10
+#define MAX_BLOCK_NUMBER    ((tBlockNumber) 4294967294U)
+#define MAX_BLOCK_TOTAL     ((tBlockNumber) 4294967295U)
 #define MAX_PACKET_NUMBER   ((tPacketNumber) 65534)
 #define MAX_PACKET_SIZE     ((tPacketSize) 65535)
+// File format versions (version 1 was the 16-bit block number format).
+#define INDEX_MAGIC         ((uint32_t) 0x4944464D)
+#define INDEX_VERSION       ((uint16_t) 6)
+#define LEGACY_INDEX_VERSION ((uint16_t) 1)
+#define LEGACY_BLOCK_DIGITS 5
+#define PACKET_MAGIC        ((uint8_t) 0xAC)
+#define PACKET_VERSION      ((uint8_t) 8)
+#define MAP_VERSION         ((uint16_t) 2)
+#define JOURNAL_MAGIC       ((uint32_t) 0x4A44464D)
+#define JOURNAL_VERSION     ((uint16_t) 2)
+#define DAEMON_MAGIC        ((uint32_t) 0x4444464D)
+#define DAEMON_VERSION      ((uint16_t) 1)
+#define REPAIR_MAGIC        ((uint32_t) 0x5244464D)
+#define REPAIR_VERSION      ((uint16_t) 2)
+#define CATCHUP_MAGIC       ((uint32_t) 0x4344464D)
+#define CATCHUP_VERSION     ((uint16_t) 1)
 // Constraints constants.
 #define MIN_BLOCK_SIZE      ((tBlockSize) 1024)
+// Content defined chunks: min/max sizes ratio to the average, mask spread.
+#define CDC_SIZE_RATIO      ((tBlockSize) 4)
+#define CDC_NORMALIZATION   2
+// Block compression (a block is kept raw when it does not shrink).
+#define CODEC_NONE          ((tCodec) 0)
+#define CODEC_ZLIB          ((tCodec) 1)
+#define COMPRESSION_LEVEL   (6)
+// Block types (only data blocks have a block file).
+#define BLOCK_TYPE_DATA     ((uint8_t) 0)
+#define BLOCK_TYPE_PATTERN  ((uint8_t) 1)
+#define BLOCK_TYPE_DUPLICATE ((uint8_t) 2)
+#define BLOCK_TYPE_BASE     ((uint8_t) 3)
+// Packet types (descriptor packets carry index items of non data blocks).
+#define PACKET_TYPE_DATA        ((uint8_t) 0)
+#define PACKET_TYPE_DESCRIPTOR  ((uint8_t) 1)
+// Packet flags (a growing session does not know its block total yet).
+#define PACKET_FLAG_GROWING     ((uint8_t) 0x01)
+// Catch-up reply status (described blocks come without any payload).
+#define CATCHUP_DATA        ((uint16_t) 0)
+#define CATCHUP_DESCRIBED   ((uint16_t) 1)
+#define CATCHUP_MISSING     ((uint16_t) 2)
 // Transmit option.
 #define BLOCK_SEND_REPEAT   (2)
+// Throttling window (in milliseconds) and bandwidth (in kilobits per
+// second, not kilobytes): a packet of the window bytes is sent per window.
+#define THROT_WINDOW        (100)
+#define THROT_BW            (700)
+// Packets sent by one io_uring submission (each window of them followed by
+// its pacing timeout), and the submission queue entries (the batch, up to
+// a timeout per packet and one more, and a block load).
+#define SEND_BATCH          (32)
+#define SEND_URING_ENTRIES  (128)
+// Blocks kept loaded until the kernel is done with their zero copy sends,
+// and how long completions are waited for (in milliseconds).
+#define ZEROCOPY_BLOCKS     (64)
+#define ZEROCOPY_POLL       (100)
+// Live sources: blocks a growing session holds at most, milliseconds
+// waited for more data, after which a partial block is cut, and after which
+// a file which stopped growing ends the session.
+#define LIVE_MAX_BLOCKS     ((tBlockNumber) 262144)
+#define LIVE_POLL           (100)
+#define LIVE_FLUSH          (1000)
+#define LIVE_SOURCE_IDLE    (10000)
+// States of an embedded session, returned when it processed what is ready.
+#define SESSION_FAILED      (-1)
+#define SESSION_RUNNING     (0)
+#define SESSION_COMPLETE    (1)
 // Receive option.
-#define DISCARD_BLOCK_WITH_NEXT_ONE
+#define BLOCK_WORKER_QUEUE  (16)
+// Worker threads checking and writing completed blocks, and the blocks each
+// one takes at once.
+#define BLOCK_WORKER_THREADS (4)
+#define BLOCK_WORKER_BATCH  (4)
+// Datagrams received at once, each one in a buffer big enough for any
+// datagram (coalesced ones included).
+#define RECEIVE_BATCH       (32)
+#define RECEIVE_BUFFER_SIZE ((size_t) 65536)
+// Batches buffered between the network thread and the assembler, and the
+// socket buffer absorbing the bursts meanwhile.
+#define RECEIVE_RING_BATCHES    (8)
+#define RECEIVE_SOCKET_BUFFER   (8*1024*1024)
+// Receive ring shared with the kernel (--ring): its blocks, and the
+// milliseconds after which a block partly filled is handed over anyway.
+#define RECEIVE_RING_BLOCK_SIZE ((size_t) 1024*1024)
+#define RECEIVE_RING_BLOCKS     (32)
+#define RECEIVE_RING_TIMEOUT    (4)
+// Milliseconds waited for a ring block before checking the receive goes on.
+#define RECEIVE_RING_POLL       (100)
+// Seconds between two updates of the receive socket filter, and the
+// settled block ranges it drops at most.
+#define RECEIVE_FILTER_INTERVAL (1)
+#define RECEIVE_FILTER_RANGES   (512)
+// Seconds between two flushes of the receive journal.
+#define JOURNAL_FLUSH_INTERVAL  (5)
+// Shared receiver daemon: sessions received at once, clients waiting at
+// most for the socket, milliseconds between two looks at the receiving
+// children, and seconds a received file is still handed out (a later
+// request receives the session again).
+#define DAEMON_SESSIONS     (64)
+#define DAEMON_BACKLOG      (64)
+#define DAEMON_POLL         (500)
+#define DAEMON_KEEP         (60)
+// Peer repair (--repair): bitmap words per announce, blocks fetched at
+// once, and connections waiting at most. Seconds between two announces,
+// announces without any block received after which a receive stalls,
+// seconds a peer is waited for, and seconds a completed receiver stays a
+// peer once the others stopped fetching from it.
+#define REPAIR_WORDS        (128)
+#define REPAIR_MAX_BLOCKS   (64)
+#define REPAIR_BACKLOG      (16)
+#define REPAIR_INTERVAL     (1)
+#define REPAIR_IDLE         (2)
+#define REPAIR_TIMEOUT      (2)
+#define REPAIR_LINGER       (3)
+// Catch-up over TCP (--catchup): blocks pulled at once, receivers served
+// at once and waiting at most, milliseconds between two looks at them (or
+// at blocks not available yet), and seconds a peer is waited for, then
+// before connecting again. A receiver pulls the blocks still missing once
+// it holds this percentage of them, or after this many seconds (unless told
+// otherwise, --catchup-after).
+#define CATCHUP_MAX_BLOCKS  (64)
+#define CATCHUP_CLIENTS     (64)
+#define CATCHUP_BACKLOG     (16)
+#define CATCHUP_POLL        (100)
+#define CATCHUP_TIMEOUT     (5)
+#define CATCHUP_RETRY       (1)
+#define CATCHUP_THRESHOLD   (95)
+#define CATCHUP_BUDGET      (60)
+// Output file name of a receive to the standard output, and milliseconds
+// waited for the next block of a stream before looking again.
+#define STREAM_OUTPUT           "-"
+#define STREAM_POLL             (100)
+// Assembler threads at most, blocks are shared out by block number.
+#define RECEIVE_ASSEMBLERS      (4)
+// Blocks assembled concurrently (beyond, the oldest is spilled to disk).
+#define ASSEMBLY_WINDOW_BLOCKS  ((uint32_t) 64)
+#define ASSEMBLY_WINDOW_MEMORY  ((size_t) 64*1024*1024)
 // Platform dependant platform.
 #ifdef _WIN32
     #define DIRECTORY_SEPARATOR "\\"
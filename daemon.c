@@ -0,0 +1,487 @@
+#define _GNU_SOURCE         /* copy_file_range */
+#include "daemon.h"
+#include "constantes.h"     /* DAEMON_MAGIC, DAEMON_SESSIONS, STREAM_OUTPUT */
+#include "splitfile.h"      /* createOutputDir */
+#include <stdio.h>          /* fprintf, perror, printf, snprintf */
+#include <stdlib.h>         /* exit, realloc, free, EXIT_FAILURE */
+#include <string.h>         /* memset, memcpy, strcmp, strncpy, strerror */
+#include <errno.h>          /* errno, EINTR */
+#include <assert.h>         /* assert */
+#include <limits.h>         /* PATH_MAX */
+#include <fcntl.h>          /* open, O_RDONLY, O_WRONLY, O_CREAT */
+#include <poll.h>           /* poll, struct pollfd */
+#include <signal.h>         /* signal, SIGPIPE, SIG_IGN */
+#include <unistd.h>         /* fork, close, unlink, STDOUT_FILENO */
+#include <sys/ioctl.h>      /* ioctl */
+#include <sys/sendfile.h>   /* sendfile */
+#include <sys/socket.h>     /* socket, sendmsg, recvmsg, SCM_RIGHTS */
+#include <sys/stat.h>       /* fstat, stat, S_ISFIFO */
+#include <sys/un.h>         /* struct sockaddr_un */
+#include <sys/wait.h>       /* waitpid, WIFEXITED, WEXITSTATUS */
+#include <linux/fs.h>       /* FICLONE */
+#include <arpa/inet.h>      /* inet_pton, inet_ntop */
+#include <netinet/in.h>     /* struct in_addr, IN_MULTICAST */
+
+// Reply to a client (with the received file on success), then let it go.
+static void replyClient(const int clientSd, const uint16_t status,
+                        const uint64_t size, const int fd)
+{
+    tDaemonReply reply = {DAEMON_MAGIC, DAEMON_VERSION, status, size};
+    struct iovec iov = {&reply, sizeof(reply)};
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    if(fd >= 0){
+        memset(control, 0, sizeof(control));
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        struct cmsghdr* const pControl = CMSG_FIRSTHDR(&message);
+        pControl->cmsg_level = SOL_SOCKET;
+        pControl->cmsg_type = SCM_RIGHTS;
+        pControl->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(pControl), &fd, sizeof(int));
+    }
+    if(sendmsg(clientSd, &message, MSG_NOSIGNAL) < 0){
+        perror("Error replying to a daemon client");
+    }
+    close(clientSd);
+}
+
+/*
+ * Check the addresses of a request (they name the session files): a
+ * multicast group and a local address, rewritten the usual way.
+ */
+static bool checkRequestAddresses(tDaemonRequest* const pRequest)
+{
+    struct in_addr multAddr;
+    struct in_addr localAddr;
+    if( (inet_pton(AF_INET, pRequest->_multAddr, &multAddr) != 1) ||
+        (IN_MULTICAST(ntohl(multAddr.s_addr)) == 0) ||
+        (inet_pton(AF_INET, pRequest->_localAddr, &localAddr) != 1) )
+    {
+        return FALSE;
+    }
+    inet_ntop(
+        AF_INET, &multAddr, pRequest->_multAddr, sizeof(pRequest->_multAddr)
+    );
+    inet_ntop(
+        AF_INET, &localAddr, pRequest->_localAddr,
+        sizeof(pRequest->_localAddr)
+    );
+    return TRUE;
+}
+
+// Received file of a session, in the work directory.
+static void buildSessionName(const char* const workDir,
+                             const tDaemonRequest* const pRequest,
+                             const char* const extension,
+                             char* const pName, const size_t size)
+{
+    snprintf(
+        pName, size, "%s" DIRECTORY_SEPARATOR "%s-%s-%u%s",
+        workDir, pRequest->_multAddr, pRequest->_localAddr, pRequest->_port,
+        extension
+    );
+}
+
+/*
+ * Receive a session in a child process: the receive exits on errors, the
+ * daemon reads it from the child status.
+ */
+static bool startSession(tDaemonSession* const pSession,
+                         const char* const workDir, const int sd,
+                         const tReceiveOptions* const pOptions)
+{
+    char fileName[PATH_MAX];
+    char outputDir[PATH_MAX];
+    buildSessionName(
+        workDir, &pSession->_request, ".data", fileName, sizeof(fileName)
+    );
+    buildSessionName(
+        workDir, &pSession->_request, "", outputDir, sizeof(outputDir)
+    );
+    // Clients of a previous receive keep their copy.
+    unlink(fileName);
+    fflush(stdout);
+    pSession->_pid = fork();
+    if(pSession->_pid < 0){
+        perror("Error starting a daemon session");
+        return FALSE;
+    }
+    if(pSession->_pid == 0){
+        close(sd);
+        receiveFile(
+            fileName, outputDir, pSession->_request._localAddr,
+            pSession->_request._multAddr, pSession->_request._port,
+            pOptions
+        );
+        exit(EXIT_SUCCESS);
+    }
+    printf(
+        "Receiving %s:%u for the local clients.\n",
+        pSession->_request._multAddr, pSession->_request._port
+    );
+    return TRUE;
+}
+
+// Forget a session (the clients holding its file keep it).
+static void removeSession(tDaemonSession* const pSessions,
+                          size_t* const pNbSessions, const size_t index,
+                          const char* const workDir)
+{
+    tDaemonSession* const pSession = &(pSessions[index]);
+    if(pSession->_fd >= 0){
+        char fileName[PATH_MAX];
+        buildSessionName(
+            workDir, &pSession->_request, ".data", fileName, sizeof(fileName)
+        );
+        unlink(fileName);
+        close(pSession->_fd);
+    }
+    size_t i = 0;
+    for(; i < pSession->_nbClients; ++i){
+        replyClient(pSession->_pClients[i], 1, 0, -1);
+    }
+    free(pSession->_pClients);
+    pSessions[index] = pSessions[--(*pNbSessions)];
+}
+
+// Hand the received file out to the waiting clients of finished sessions.
+static void reapSessions(tDaemonSession* const pSessions,
+                         size_t* const pNbSessions, const char* const workDir)
+{
+    int status = 0;
+    pid_t pid;
+    while((pid = waitpid(-1, &status, WNOHANG)) > 0){
+        size_t index = 0;
+        while((index < *pNbSessions) && (pSessions[index]._pid != pid)){
+            ++index;
+        }
+        if(index == *pNbSessions){
+            continue;
+        }
+        tDaemonSession* const pSession = &(pSessions[index]);
+        pSession->_pid = 0;
+        char fileName[PATH_MAX];
+        buildSessionName(
+            workDir, &pSession->_request, ".data", fileName, sizeof(fileName)
+        );
+        struct stat buf;
+        if( WIFEXITED(status) && (WEXITSTATUS(status) == EXIT_SUCCESS) ){
+            pSession->_fd = open(fileName, O_RDONLY);
+        }
+        if((pSession->_fd < 0) || (fstat(pSession->_fd, &buf) != 0)){
+            fprintf(
+                stderr,
+                "Fail to receive %s:%u for the local clients.\n",
+                pSession->_request._multAddr, pSession->_request._port
+            );
+            removeSession(pSessions, pNbSessions, index, workDir);
+            continue;
+        }
+        pSession->_size = (uint64_t) buf.st_size;
+        pSession->_completed = time(NULL);
+        size_t i = 0;
+        for(; i < pSession->_nbClients; ++i){
+            replyClient(
+                pSession->_pClients[i], 0, pSession->_size, pSession->_fd
+            );
+        }
+        pSession->_nbClients = 0;
+    }
+}
+
+// Take the request of a new client, to the session it wants.
+static void acceptClient(const int sd, tDaemonSession* const pSessions,
+                         size_t* const pNbSessions, const char* const workDir,
+                         const tReceiveOptions* const pOptions)
+{
+    const int clientSd = accept(sd, NULL, NULL);
+    if(clientSd < 0){
+        if(errno != EINTR){
+            perror("Error accepting a daemon client");
+        }
+        return;
+    }
+    // A client which does not tell what it wants is not waited for.
+    const struct timeval timeout = {1, 0};
+    setsockopt(clientSd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    tDaemonRequest request;
+    if( (recv(clientSd, &request, sizeof(request), MSG_WAITALL) !=
+            (ssize_t) sizeof(request)) ||
+        (request._magic != DAEMON_MAGIC) ||
+        (request._version != DAEMON_VERSION) )
+    {
+        fprintf(stderr, "Invalid daemon client request.\n");
+        close(clientSd);
+        return;
+    }
+    request._multAddr[sizeof(request._multAddr) - 1] = '\0';
+    request._localAddr[sizeof(request._localAddr) - 1] = '\0';
+    if(checkRequestAddresses(&request) != TRUE){
+        fprintf(stderr, "Invalid daemon client request (addresses).\n");
+        replyClient(clientSd, 1, 0, -1);
+        return;
+    }
+    size_t index = 0;
+    while( (index < *pNbSessions) &&
+        ( (strcmp(pSessions[index]._request._multAddr,
+            request._multAddr) != 0) ||
+          (strcmp(pSessions[index]._request._localAddr,
+            request._localAddr) != 0) ||
+          (pSessions[index]._request._port != request._port) ) )
+    {
+        ++index;
+    }
+    // A received file is handed out at once.
+    if((index < *pNbSessions) && (pSessions[index]._fd >= 0)){
+        replyClient(
+            clientSd, 0, pSessions[index]._size, pSessions[index]._fd
+        );
+        return;
+    }
+    if(index == *pNbSessions){
+        if(*pNbSessions == DAEMON_SESSIONS){
+            fprintf(stderr, "Too many daemon sessions.\n");
+            replyClient(clientSd, 1, 0, -1);
+            return;
+        }
+        tDaemonSession* const pSession = &(pSessions[index]);
+        memset(pSession, 0, sizeof(*pSession));
+        pSession->_request = request;
+        pSession->_fd = -1;
+        if(startSession(pSession, workDir, sd, pOptions) != TRUE){
+            replyClient(clientSd, 1, 0, -1);
+            return;
+        }
+        ++(*pNbSessions);
+    }
+    tDaemonSession* const pSession = &(pSessions[index]);
+    int* const pClients = realloc(
+        pSession->_pClients,
+        (pSession->_nbClients + 1)*sizeof(*pSession->_pClients)
+    );
+    if(pClients == NULL){
+        fprintf(
+            stderr,
+            "Fail to allocate memory at %s line %d.\n", __FILE__, __LINE__
+        );
+        replyClient(clientSd, 1, 0, -1);
+        return;
+    }
+    pSession->_pClients = pClients;
+    pSession->_pClients[pSession->_nbClients++] = clientSd;
+}
+
+void runDaemon(const char* const socketPath, const char* const workDir,
+    const tReceiveOptions* const pOptions)
+{
+    assert((socketPath != NULL) && (workDir != NULL) && (pOptions != NULL));
+    // Clients leaving before their reply must not take the daemon down.
+    signal(SIGPIPE, SIG_IGN);
+    createOutputDir(workDir);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(strlen(socketPath) >= sizeof(address.sun_path)){
+        fprintf(stderr, "Invalid daemon socket path: '%s'.\n", socketPath);
+        exit(EXIT_FAILURE);
+    }
+    strncpy(address.sun_path, socketPath, sizeof(address.sun_path) - 1);
+    const int sd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(sd < 0){
+        perror("Error opening the daemon socket");
+        exit(EXIT_FAILURE);
+    }
+    // The socket of a previous daemon is replaced.
+    unlink(socketPath);
+    if( (bind(sd, (struct sockaddr*) &address, sizeof(address)) != 0) ||
+        (listen(sd, DAEMON_BACKLOG) != 0) )
+    {
+        fprintf(
+            stderr,
+            "Fail to listen on daemon socket: '%s' (%d: %s).\n",
+            socketPath, errno, strerror(errno)
+        );
+        close(sd);
+        exit(EXIT_FAILURE);
+    }
+    printf("Daemon listening on '%s'... Press CTRL + C to interrupt.\n",
+        socketPath);
+    tDaemonSession sessions[DAEMON_SESSIONS];
+    size_t nbSessions = 0;
+    for(;;){
+        struct pollfd pollSd = {sd, POLLIN, 0};
+        if(poll(&pollSd, 1, DAEMON_POLL) > 0){
+            acceptClient(sd, sessions, &nbSessions, workDir, pOptions);
+        }
+        reapSessions(sessions, &nbSessions, workDir);
+        // Received files are handed out for a while, then received again.
+        const time_t now = time(NULL);
+        size_t i = nbSessions;
+        while(i-- > 0){
+            if( (sessions[i]._fd >= 0) &&
+                ((now - sessions[i]._completed) >= DAEMON_KEEP) )
+            {
+                removeSession(sessions, &nbSessions, i, workDir);
+            }
+        }
+    }
+}
+
+/*
+ * Ask the daemon for a session, return the read only descriptor of the
+ * received file (-1 on failure) and its size.
+ */
+int requestDaemonFile(const char* const socketPath,
+    const char* const localAddr, const char* const multAddr,
+    const uint16_t port, uint64_t* const pSize)
+{
+    assert((socketPath != NULL) && (pSize != NULL));
+    tDaemonRequest request;
+    memset(&request, 0, sizeof(request));
+    request._magic = DAEMON_MAGIC;
+    request._version = DAEMON_VERSION;
+    request._port = port;
+    strncpy(request._multAddr, multAddr, sizeof(request._multAddr) - 1);
+    strncpy(request._localAddr, localAddr, sizeof(request._localAddr) - 1);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socketPath, sizeof(address.sun_path) - 1);
+    const int sd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if( (sd < 0) ||
+        (connect(sd, (struct sockaddr*) &address, sizeof(address)) != 0) ||
+        (send(sd, &request, sizeof(request), MSG_NOSIGNAL) !=
+            (ssize_t) sizeof(request)) )
+    {
+        fprintf(
+            stderr,
+            "Fail to reach the daemon: '%s' (%d: %s).\n",
+            socketPath, errno, strerror(errno)
+        );
+        if(sd >= 0){
+            close(sd);
+        }
+        return -1;
+    }
+    // Wait for the whole session to be received.
+    tDaemonReply reply;
+    struct iovec iov = {&reply, sizeof(reply)};
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    ssize_t result;
+    while(((result = recvmsg(sd, &message, MSG_CMSG_CLOEXEC)) < 0) &&
+        (errno == EINTR))
+    {
+    }
+    close(sd);
+    int fd = -1;
+    struct cmsghdr* const pControl = CMSG_FIRSTHDR(&message);
+    if( (result == (ssize_t) sizeof(reply)) && (pControl != NULL) &&
+        (pControl->cmsg_level == SOL_SOCKET) &&
+        (pControl->cmsg_type == SCM_RIGHTS) )
+    {
+        memcpy(&fd, CMSG_DATA(pControl), sizeof(fd));
+    }
+    if( (fd < 0) || (reply._magic != DAEMON_MAGIC) || (reply._status != 0) ){
+        fprintf(stderr, "The daemon failed to receive %s:%u.\n",
+            multAddr, port);
+        if(fd >= 0){
+            close(fd);
+        }
+        return -1;
+    }
+    *pSize = reply._size;
+    return fd;
+}
+
+// Copy the received file, where the kernel can copy without any reading.
+static bool copyDaemonFile(const int fd, const int outputFd,
+                           const uint64_t size)
+{
+    uint64_t offset = 0;
+    bool useRange = TRUE;
+    while(offset < size){
+        ssize_t result = -1;
+        if(useRange == TRUE){
+            loff_t inOffset = (loff_t) offset;
+            result = copy_file_range(
+                fd, &inOffset, outputFd, NULL, size - offset, 0
+            );
+            // Not between these files, the data goes through a pipe then.
+            if((result < 0) && (errno != EINTR)){
+                useRange = FALSE;
+                continue;
+            }
+        }else{
+            off_t inOffset = (off_t) offset;
+            result = sendfile(outputFd, fd, &inOffset, size - offset);
+        }
+        if(result < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return FALSE;
+        }
+        if(result == 0){
+            return FALSE;
+        }
+        offset += (uint64_t) result;
+    }
+    return TRUE;
+}
+
+/*
+ * Get a session from the daemon instead of receiving it: the output file
+ * is a clone of the daemon one when the file system allows it, a copy
+ * otherwise (or a stream to the standard output or a pipe).
+ */
+void receiveFromDaemon(const char* const socketPath,
+    const char* const fileName, const char* const localAddr,
+    const char* const multAddr, const uint16_t port)
+{
+    assert((socketPath != NULL) && (fileName != NULL));
+    uint64_t size = 0;
+    const int fd =
+        requestDaemonFile(socketPath, localAddr, multAddr, port, &size);
+    if(fd < 0){
+        exit(EXIT_FAILURE);
+    }
+    struct stat buf;
+    const bool isStream = ( (strcmp(fileName, STREAM_OUTPUT) == 0) ||
+        ((stat(fileName, &buf) == 0) && S_ISFIFO(buf.st_mode)) ) ?
+            TRUE : FALSE;
+    const int outputFd = (strcmp(fileName, STREAM_OUTPUT) == 0) ?
+        STDOUT_FILENO :
+        open(fileName, O_WRONLY | ((isStream == TRUE) ? 0 :
+            (O_CREAT | O_TRUNC)), 0666);
+    if( (outputFd < 0) ||
+        ( ((isStream == TRUE) ||
+           (ioctl(outputFd, FICLONE, fd) != 0)) &&
+          (copyDaemonFile(fd, outputFd, size) != TRUE) ) )
+    {
+        fprintf(
+            stderr,
+            "Fail to write output file: '%s' (%d: %s).\n",
+            fileName, errno, strerror(errno)
+        );
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+    if((outputFd != STDOUT_FILENO) && (close(outputFd) != 0)){
+        fprintf(
+            stderr,
+            "Fail to close output file: '%s' (%d: %s).\n",
+            fileName, errno, strerror(errno)
+        );
+        exit(EXIT_FAILURE);
+    }
+}
@@ -0,0 +1,68 @@
+/* 
+ * File:   daemon.h
+ * Author: pilluh
+ *
+ * Created on 20 octobre 2026, 20:20
+ */
+
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include "types.h"          /* bool */
+#include "receivefile.h"    /* tReceiveOptions */
+#include <stdint.h>         /* uint16_t, uint32_t, uint64_t */
+#include <sys/types.h>      /* pid_t */
+#include <time.h>           /* time_t */
+#include <netinet/in.h>     /* INET_ADDRSTRLEN */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Request of a local client: the session it wants.
+typedef struct sDaemonRequest{
+    uint32_t        _magic;
+    uint16_t        _version;
+    uint16_t        _port;
+    char            _multAddr[INET_ADDRSTRLEN];
+    char            _localAddr[INET_ADDRSTRLEN];
+} tDaemonRequest;
+
+// Reply of the daemon, the received file descriptor comes along on success.
+typedef struct sDaemonReply{
+    uint32_t        _magic;
+    uint16_t        _version;
+    uint16_t        _status;
+    uint64_t        _size;
+} tDaemonReply;
+
+/*
+ * A session of the daemon: received once (by a child process, a failure
+ * does not take the daemon down) into a file of the work directory, for
+ * every client waiting for it. The file is then handed out as a read only
+ * descriptor: clients map it (sharing the page cache) or clone it.
+ */
+typedef struct sDaemonSession{
+    tDaemonRequest  _request;
+    pid_t           _pid;
+    int             _fd;
+    uint64_t        _size;
+    int*            _pClients;
+    size_t          _nbClients;
+    time_t          _completed;
+} tDaemonSession;
+
+void runDaemon(const char* const socketPath, const char* const workDir,
+    const tReceiveOptions* const pOptions);
+int requestDaemonFile(const char* const socketPath,
+    const char* const localAddr, const char* const multAddr,
+    const uint16_t port, uint64_t* const pSize);
+void receiveFromDaemon(const char* const socketPath,
+    const char* const fileName, const char* const localAddr,
+    const char* const multAddr, const uint16_t port);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DAEMON_H */
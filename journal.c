@@ -0,0 +1,262 @@
+#include "journal.h"
+#include "constantes.h"     /* JOURNAL_BASENAME, JOURNAL_MAGIC */
+#include "blockhash.h"      /* fingerprintBlock */
+#include <stdio.h>          /* fprintf, stderr, remove */
+#include <stdlib.h>         /* malloc, realloc, free */
+#include <string.h>         /* strlen, strcat, strerror */
+#include <errno.h>          /* errno */
+#include <assert.h>         /* assert */
+#include <fcntl.h>          /* open, O_RDWR, O_CREAT */
+#include <unistd.h>         /* pread, ftruncate, fdatasync, close */
+#include <sys/mman.h>       /* mmap, msync, munmap */
+#include <sys/stat.h>       /* fstat */
+
+#define NB_BITS_WORD (sizeof(uint64_t)*8)
+
+// Bitmap words, rounded up to keep the index table aligned.
+static size_t getNbWords(const tBlockNumber nbItems)
+{
+    return ((size_t) nbItems + NB_BITS_WORD - 1) / NB_BITS_WORD;
+}
+
+static void clearItem(tIndexItem* const pItem)
+{
+    const tIndexItem initItem = {
+        INVALID_BLOCK_NUMBER, BLOCK_TYPE_DATA, 0, 0, 0, 0, 0, 0
+    };
+    *pItem = initItem;
+}
+
+bool openJournal(tJournal* const pJournal, const char* const outputDir,
+    const tBlockNumber nbItems, const uint32_t session,
+    bool* const pIsResumed)
+{
+    assert((pJournal != NULL) && (outputDir != NULL) && (pIsResumed != NULL));
+    *pIsResumed = FALSE;
+    // Build journal filename.
+    pJournal->_fileName = malloc(
+        strlen(outputDir) + strlen(DIRECTORY_SEPARATOR) +
+            strlen(JOURNAL_BASENAME) + 1
+    );
+    if(pJournal->_fileName == NULL){
+        fprintf(
+            stderr,
+            "Fail to allocate memory at %s line %d.\n",
+            __FILE__, __LINE__
+        );
+        return FALSE;
+    }
+    pJournal->_fileName[0] = '\0';
+    strcat(pJournal->_fileName, outputDir);
+    strcat(pJournal->_fileName, DIRECTORY_SEPARATOR);
+    strcat(pJournal->_fileName, JOURNAL_BASENAME);
+    pJournal->_nbItems = nbItems;
+    pJournal->_session = session;
+    pJournal->_size = sizeof(tJournalHeader) +
+        getNbWords(nbItems)*sizeof(uint64_t) +
+        (size_t) nbItems*sizeof(tIndexItem);
+    // Open (or create) the journal, a previous one is kept if it matches.
+    pJournal->_fd = open(pJournal->_fileName, O_RDWR | O_CREAT, 0666);
+    struct stat buf;
+    if((pJournal->_fd < 0) || (fstat(pJournal->_fd, &buf) != 0)){
+        fprintf(
+            stderr,
+            "Fail to open journal file: '%s' (%d: %s).\n",
+            pJournal->_fileName, errno, strerror(errno)
+        );
+        if(pJournal->_fd >= 0){
+            close(pJournal->_fd);
+        }
+        free(pJournal->_fileName);
+        pJournal->_fileName = NULL;
+        return FALSE;
+    }
+    tJournalHeader header;
+    if( ((size_t) buf.st_size == pJournal->_size) &&
+        (pread(pJournal->_fd, &header, sizeof(header), 0) ==
+            (ssize_t) sizeof(header)) &&
+        (header._magic == JOURNAL_MAGIC) &&
+        (header._version == JOURNAL_VERSION) &&
+        (header._nbItems == nbItems) &&
+        (session != 0) && (header._session == session) )
+    {
+        *pIsResumed = TRUE;
+    }
+    // Otherwise start a new one from scratch.
+    else if( (ftruncate(pJournal->_fd, 0) != 0) ||
+             (ftruncate(pJournal->_fd, pJournal->_size) != 0) )
+    {
+        fprintf(
+            stderr,
+            "Fail to size journal file: '%s' (%d: %s).\n",
+            pJournal->_fileName, errno, strerror(errno)
+        );
+        close(pJournal->_fd);
+        free(pJournal->_fileName);
+        pJournal->_fileName = NULL;
+        return FALSE;
+    }
+    pJournal->_pMapping = mmap(
+        NULL, pJournal->_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+        pJournal->_fd, 0
+    );
+    if(pJournal->_pMapping == MAP_FAILED){
+        fprintf(
+            stderr,
+            "Fail to map journal file: '%s' (%d: %s).\n",
+            pJournal->_fileName, errno, strerror(errno)
+        );
+        pJournal->_pMapping = NULL;
+        close(pJournal->_fd);
+        free(pJournal->_fileName);
+        pJournal->_fileName = NULL;
+        return FALSE;
+    }
+    tJournalHeader* const pHeader = pJournal->_pMapping;
+    pJournal->_pWritten = (_Atomic uint64_t*) (pHeader + 1);
+    pJournal->_pItems =
+        (tIndexItem*) (pJournal->_pWritten + getNbWords(nbItems));
+    if(*pIsResumed == FALSE){
+        // The file is zeroed: only the items need to be set.
+        tBlockNumber i = 0;
+        for(; i < nbItems; ++i){
+            clearItem(&(pJournal->_pItems[i]));
+        }
+        pHeader->_magic = JOURNAL_MAGIC;
+        pHeader->_version = JOURNAL_VERSION;
+        pHeader->_padding = 0;
+        pHeader->_nbItems = nbItems;
+        pHeader->_session = session;
+    }
+    return TRUE;
+}
+
+/*
+ * Keep the blocks of a resumed journal which can be trusted: data blocks
+ * whose content is found in the output file, and described blocks. Return
+ * the number of blocks kept, the others are received again.
+ */
+tBlockNumber checkJournal(tJournal* const pJournal, const int fd)
+{
+    assert((pJournal != NULL) && (pJournal->_pMapping != NULL));
+    void* pBuffer = NULL;
+    tBlockSize bufferSize = 0;
+    tBlockNumber nbKept = 0;
+    tBlockNumber i = 0;
+    for(; i < pJournal->_nbItems; ++i){
+        tIndexItem* const pItem = &(pJournal->_pItems[i]);
+        bool isKept = FALSE;
+        if(pItem->_number != i){
+            // Not received (or not a valid item).
+        }else if(pItem->_type != BLOCK_TYPE_DATA){
+            isKept = TRUE;
+        }else if((atomic_load(&(pJournal->_pWritten[i / NB_BITS_WORD])) &
+            ((uint64_t) 1 << (i % NB_BITS_WORD))) != 0)
+        {
+            // Check the block made it to the disk (the journal may be ahead).
+            if(pItem->_size > bufferSize){
+                void* const pNewBuffer = realloc(pBuffer, pItem->_size);
+                if(pNewBuffer == NULL){
+                    fprintf(
+                        stderr,
+                        "Fail to allocate memory at %s line %d.\n",
+                        __FILE__, __LINE__
+                    );
+                    break;
+                }
+                pBuffer = pNewBuffer;
+                bufferSize = pItem->_size;
+            }
+            isKept = ( (pread(fd, pBuffer, pItem->_size, pItem->_offset) ==
+                (ssize_t) pItem->_size) &&
+                (fingerprintBlock(pBuffer, pItem->_size) ==
+                    pItem->_fingerprint) ) ? TRUE : FALSE;
+        }
+        if(isKept == TRUE){
+            ++nbKept;
+        }else{
+            forgetBlock(pJournal, i);
+        }
+    }
+    // Blocks left unchecked (out of memory) are received again.
+    for(; i < pJournal->_nbItems; ++i){
+        forgetBlock(pJournal, i);
+    }
+    free(pBuffer);
+    return nbKept;
+}
+
+void markBlockWritten(tJournal* const pJournal,
+    const tBlockNumber blockNumber, const tFingerprint fingerprint)
+{
+    assert((pJournal != NULL) && (blockNumber < pJournal->_nbItems));
+    pJournal->_pItems[blockNumber]._fingerprint = fingerprint;
+    atomic_fetch_or(
+        &(pJournal->_pWritten[blockNumber / NB_BITS_WORD]),
+        (uint64_t) 1 << (blockNumber % NB_BITS_WORD)
+    );
+}
+
+bool isBlockWritten(const tJournal* const pJournal,
+    const tBlockNumber blockNumber)
+{
+    assert((pJournal != NULL) && (blockNumber < pJournal->_nbItems));
+    return ((atomic_load(&(pJournal->_pWritten[blockNumber / NB_BITS_WORD])) &
+        ((uint64_t) 1 << (blockNumber % NB_BITS_WORD))) != 0) ? TRUE : FALSE;
+}
+
+void forgetBlock(tJournal* const pJournal, const tBlockNumber blockNumber)
+{
+    assert((pJournal != NULL) && (blockNumber < pJournal->_nbItems));
+    atomic_fetch_and(
+        &(pJournal->_pWritten[blockNumber / NB_BITS_WORD]),
+        ~((uint64_t) 1 << (blockNumber % NB_BITS_WORD))
+    );
+    clearItem(&(pJournal->_pItems[blockNumber]));
+}
+
+/*
+ * Flush the output file first, so that the journal is hardly ever ahead of
+ * it (a resumed receive checks it anyway).
+ */
+bool flushJournal(tJournal* const pJournal, const int fd)
+{
+    assert(pJournal != NULL);
+    if(pJournal->_pMapping == NULL){
+        return TRUE;
+    }
+    if( (fdatasync(fd) != 0) ||
+        (msync(pJournal->_pMapping, pJournal->_size, MS_SYNC) != 0) )
+    {
+        fprintf(
+            stderr,
+            "Fail to flush journal file: '%s' (%d: %s).\n",
+            pJournal->_fileName, errno, strerror(errno)
+        );
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void closeJournal(tJournal* const pJournal, const bool isDone)
+{
+    assert(pJournal != NULL);
+    if(pJournal->_pMapping == NULL){
+        return;
+    }
+    munmap(pJournal->_pMapping, pJournal->_size);
+    close(pJournal->_fd);
+    // A completed receive has nothing to resume.
+    if((isDone == TRUE) && (remove(pJournal->_fileName) != 0)){
+        fprintf(
+            stderr,
+            "Fail to remove journal file: '%s' (%d: %s).\n",
+            pJournal->_fileName, errno, strerror(errno)
+        );
+    }
+    free(pJournal->_fileName);
+    pJournal->_fileName = NULL;
+    pJournal->_pMapping = NULL;
+    pJournal->_pWritten = NULL;
+    pJournal->_pItems = NULL;
+}
@@ -0,0 +1,64 @@
+/* 
+ * File:   journal.h
+ * Author: pilluh
+ *
+ * Created on 20 octobre 2026, 09:12
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "types.h"      /* tIndexItem, tBlockNumber, tFingerprint, bool */
+#include <stdint.h>     /* uint16_t, uint32_t, uint64_t */
+#include <stddef.h>     /* size_t */
+#include <stdatomic.h>  /* _Atomic */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct sJournalHeader{
+    uint32_t        _magic;
+    uint16_t        _version;
+    uint16_t        _padding;
+    tBlockNumber    _nbItems;
+    uint32_t        _session;
+} tJournalHeader;
+
+/*
+ * Receive progress, memory mapped from the output directory: the header,
+ * a bitmap of the data blocks written into the output file, then the index
+ * table itself (received descriptors and data blocks). The receiver works
+ * straight on the mapped index table, the journal is flushed at intervals
+ * and checked against the output file when a receive is resumed. A receive
+ * is only resumed from the same session (the identity the sender gives its
+ * packets), an unknown one (zero) is never resumed.
+ */
+typedef struct sJournal{
+    char*               _fileName;
+    int                 _fd;
+    void*               _pMapping;
+    size_t              _size;
+    _Atomic uint64_t*   _pWritten;
+    tIndexItem*         _pItems;
+    tBlockNumber        _nbItems;
+    uint32_t            _session;
+} tJournal;
+
+bool openJournal(tJournal* const pJournal, const char* const outputDir,
+    const tBlockNumber nbItems, const uint32_t session,
+    bool* const pIsResumed);
+tBlockNumber checkJournal(tJournal* const pJournal, const int fd);
+void markBlockWritten(tJournal* const pJournal,
+    const tBlockNumber blockNumber, const tFingerprint fingerprint);
+bool isBlockWritten(const tJournal* const pJournal,
+    const tBlockNumber blockNumber);
+void forgetBlock(tJournal* const pJournal, const tBlockNumber blockNumber);
+bool flushJournal(tJournal* const pJournal, const int fd);
+void closeJournal(tJournal* const pJournal, const bool isDone);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JOURNAL_H */
@@ -0,0 +1,228 @@
+#include "livesource.h"
+#include "constantes.h"     /* LIVE_MAX_BLOCKS, LIVE_POLL, LIVE_FLUSH, ... */
+#include "crc32.h"          /* crc32c */
+#include "codec.h"          /* maxCompressedSize, compressPayload */
+#include "blockhash.h"      /* fingerprintBlock */
+#include "parsefile.h"      /* createBlockFile, createIndexFile */
+#include "splitfile.h"      /* createOutputDir, resetOuputDir */
+#include <stdio.h>          /* fprintf, stderr */
+#include <stdlib.h>         /* malloc, free, exit, EXIT_FAILURE */
+#include <string.h>         /* strcmp, strerror */
+#include <errno.h>          /* errno, EINTR, EAGAIN */
+#include <assert.h>         /* assert */
+#include <fcntl.h>          /* open, O_RDONLY */
+#include <poll.h>           /* poll, struct pollfd, POLLIN */
+#include <sys/stat.h>       /* fstat, S_ISREG */
+#include <time.h>           /* clock_gettime, CLOCK_MONOTONIC */
+#include <unistd.h>         /* read, close, usleep, STDIN_FILENO */
+
+// Milliseconds of a monotonic clock.
+static uint64_t getMilliseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec*1000 + (uint64_t) now.tv_nsec/1000000;
+}
+
+// Write a block file then publish its index item.
+static void cutBlock(tLiveSource* const pSource,
+                     unsigned char* const pData, const tBlockSize size,
+                     const tBlockOffset offset, const tBlockNumber number,
+                     void* const pCompressed, const tBlockSize compressedSize)
+{
+    tDataBlock dataBlock = {
+        {size, size, offset, 0, number, CODEC_NONE, 0, 0},
+        pData
+    };
+    // Compress the block, unless it does not get any smaller.
+    const tBlockSize packedSize = (pCompressed == NULL) ? 0 :
+        compressPayload(
+            pSource->_codec, pData, size, pCompressed, compressedSize
+        );
+    if(packedSize != 0){
+        dataBlock._header._payloadSize = packedSize;
+        dataBlock._header._codec = pSource->_codec;
+        dataBlock._pPayload = pCompressed;
+    }
+    // The checksum covers the bytes as stored and sent.
+    dataBlock._header._checksum = crc32c(
+        dataBlock._pPayload, dataBlock._header._payloadSize
+    );
+    if(createBlockFile(pSource->_outputDir, &dataBlock, FALSE) != TRUE){
+        exit(EXIT_FAILURE);
+    }
+    tIndexItem* const pItem = &(pSource->_indexTable._pItems[number]);
+    pItem->_number = number;
+    pItem->_type = BLOCK_TYPE_DATA;
+    pItem->_pattern = 0;
+    pItem->_padding = 0;
+    pItem->_offset = offset;
+    pItem->_size = size;
+    pItem->_reference = 0;
+    pItem->_fingerprint = fingerprintBlock(pData, size);
+    // The sender reads the item once it is counted.
+    atomic_store_explicit(&pSource->_nbBlocks, number + 1,
+        memory_order_release);
+}
+
+/*
+ * Read the source until it ends: pipes end with their writer, files when
+ * they stop growing. A block is cut when full, or when the source stays
+ * idle with a partial one.
+ */
+static void* runLiveSource(void* const pArg)
+{
+    tLiveSource* const pSource = pArg;
+    const tBlockSize blockSize = pSource->_blockSize;
+    unsigned char* const pData = malloc(blockSize);
+    const tBlockSize compressedSize =
+        maxCompressedSize(pSource->_codec, blockSize);
+    void* const pCompressed = (pSource->_codec == CODEC_NONE) ? NULL :
+        malloc(compressedSize);
+    if( (pData == NULL) ||
+        ((pSource->_codec != CODEC_NONE) && (pCompressed == NULL)) )
+    {
+        fprintf(
+            stderr,
+            "Fail to allocate memory at %s line %d.\n", __FILE__, __LINE__
+        );
+        exit(EXIT_FAILURE);
+    }
+    tBlockSize filled = 0;
+    tBlockOffset offset = 0;
+    tBlockNumber number = 0;
+    uint64_t lastData = getMilliseconds();
+    bool isEnded = FALSE;
+    while(isEnded == FALSE){
+        ssize_t result = 0;
+        if(pSource->_isStream == TRUE){
+            struct pollfd pollFd = {pSource->_fd, POLLIN, 0};
+            if(poll(&pollFd, 1, LIVE_POLL) > 0){
+                result = read(pSource->_fd, pData + filled, blockSize - filled);
+                // End of the pipe.
+                isEnded = (result == 0) ? TRUE : FALSE;
+            }
+        }else{
+            result = read(pSource->_fd, pData + filled, blockSize - filled);
+            if(result == 0){
+                // End of the file for now, wait for it to grow.
+                isEnded = ((getMilliseconds() - lastData) >= LIVE_SOURCE_IDLE) ?
+                    TRUE : FALSE;
+                if(isEnded == FALSE){
+                    usleep(LIVE_POLL*1000);
+                }
+            }
+        }
+        if(result < 0){
+            if((errno == EINTR) || (errno == EAGAIN)){
+                continue;
+            }
+            fprintf(
+                stderr,
+                "Fail to read live source (%d: %s).\n", errno, strerror(errno)
+            );
+            isEnded = TRUE;
+        }else if(result > 0){
+            filled += (tBlockSize) result;
+            lastData = getMilliseconds();
+        }
+        // Cut full blocks, and partial ones on idle sources.
+        if( (filled != 0) && ((filled == blockSize) || (isEnded == TRUE) ||
+            ((getMilliseconds() - lastData) >= LIVE_FLUSH)) )
+        {
+            if(number == LIVE_MAX_BLOCKS){
+                fprintf(
+                    stderr,
+                    "Live source exceeds %u blocks, the session ends there.\n",
+                    LIVE_MAX_BLOCKS
+                );
+                break;
+            }
+            cutBlock(
+                pSource, pData, filled, offset, number,
+                pCompressed, compressedSize
+            );
+            offset += filled;
+            filled = 0;
+            ++number;
+        }
+    }
+    free(pCompressed);
+    free(pData);
+    // The directory is then a regular prepared one.
+    pSource->_indexTable._nbItems = number;
+    if((number != 0) &&
+        (createIndexFile(pSource->_outputDir, &pSource->_indexTable) != TRUE))
+    {
+        exit(EXIT_FAILURE);
+    }
+    atomic_store_explicit(&pSource->_isEnded, TRUE, memory_order_release);
+    return NULL;
+}
+
+/*
+ * Start cutting a live source ("-" is the standard input) into blocks of
+ * the output directory.
+ */
+bool startLiveSource(tLiveSource* const pSource, const char* const fileName,
+    const char* const outputDir, const tBlockSize blockSize,
+    const tCodec codec)
+{
+    assert((pSource != NULL) && (fileName != NULL) && (outputDir != NULL));
+    // Create output files directory.
+    createOutputDir(outputDir);
+    // Reset previous output files (and their index).
+    resetOuputDir(outputDir);
+    pSource->_fd = (strcmp(fileName, "-") == 0) ? STDIN_FILENO :
+        open(fileName, O_RDONLY);
+    struct stat buf;
+    if((pSource->_fd < 0) || (fstat(pSource->_fd, &buf) != 0)){
+        fprintf(stderr, "Fail to open live source: '%s'.\n", fileName);
+        return FALSE;
+    }
+    pSource->_outputDir = outputDir;
+    pSource->_isStream = S_ISREG(buf.st_mode) ? FALSE : TRUE;
+    pSource->_blockSize = blockSize;
+    pSource->_codec = codec;
+    pSource->_indexTable = (tIndexTable) {
+        LIVE_MAX_BLOCKS, INDEX_VERSION, NULL
+    };
+    pSource->_indexTable._pItems =
+        malloc(LIVE_MAX_BLOCKS*sizeof(*pSource->_indexTable._pItems));
+    if(pSource->_indexTable._pItems == NULL){
+        fprintf(
+            stderr,
+            "Fail to allocate memory at %s line %d.\n", __FILE__, __LINE__
+        );
+        return FALSE;
+    }
+    atomic_init(&pSource->_nbBlocks, 0);
+    atomic_init(&pSource->_isEnded, FALSE);
+    if(pthread_create(&pSource->_thread, NULL, runLiveSource, pSource) != 0){
+        fprintf(stderr, "Fail to start the live source thread.\n");
+        free(pSource->_indexTable._pItems);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Blocks cut so far, and whether there will be no more.
+tBlockNumber getLiveBlocks(tLiveSource* const pSource, bool* const pIsEnded)
+{
+    assert((pSource != NULL) && (pIsEnded != NULL));
+    // The count is final once the source ended.
+    *pIsEnded =
+        atomic_load_explicit(&pSource->_isEnded, memory_order_acquire);
+    return atomic_load_explicit(&pSource->_nbBlocks, memory_order_acquire);
+}
+
+void closeLiveSource(tLiveSource* const pSource)
+{
+    assert(pSource != NULL);
+    pthread_join(pSource->_thread, NULL);
+    if(pSource->_fd != STDIN_FILENO){
+        close(pSource->_fd);
+    }
+    free(pSource->_indexTable._pItems);
+    pSource->_indexTable._pItems = NULL;
+}
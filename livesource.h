@@ -0,0 +1,51 @@
+/* 
+ * File:   livesource.h
+ * Author: pilluh
+ *
+ * Created on 20 octobre 2026, 18:10
+ */
+
+#ifndef LIVESOURCE_H
+#define LIVESOURCE_H
+
+#include "types.h"      /* tIndexTable, tBlockSize, tCodec, bool */
+#include <stdatomic.h>  /* _Atomic, atomic_bool */
+#include <pthread.h>    /* pthread_t */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A source still being written (a file, a pipe or the standard input) is
+ * cut into blocks as data arrives, by a thread: each block file is written
+ * in the output directory, then its item is published in the index table
+ * (allocated for LIVE_MAX_BLOCKS items, the count only grows). A partial
+ * block is cut when the source stays idle. The session ends with the
+ * source: the end of a pipe, or a file which stopped growing; the index
+ * file is then written, the directory is a regular prepared one.
+ */
+typedef struct sLiveSource{
+    const char*             _outputDir;
+    int                     _fd;
+    bool                    _isStream;
+    tBlockSize              _blockSize;
+    tCodec                  _codec;
+    tIndexTable             _indexTable;
+    _Atomic tBlockNumber    _nbBlocks;
+    atomic_bool             _isEnded;
+    pthread_t               _thread;
+} tLiveSource;
+
+bool startLiveSource(tLiveSource* const pSource, const char* const fileName,
+    const char* const outputDir, const tBlockSize blockSize,
+    const tCodec codec);
+tBlockNumber getLiveBlocks(tLiveSource* const pSource,
+    bool* const pIsEnded);
+void closeLiveSource(tLiveSource* const pSource);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIVESOURCE_H */
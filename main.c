@@ -5,30 +5,120 @@
  * Created on 28 décembre 2015, 14:54
  */
 
-#include <stdint.h>         /* uint16_t */
+#include <stdint.h>         /* uint16_t, uint32_t, UINT32_MAX */
 #include <stdio.h>          /* fprintf, stderr */
-#include <stdlib.h>         /* EXIT_FAILURE, EXIT_SUCCESS */
-#include <string.h>         /* strcmp */
+#include <stdlib.h>         /* EXIT_FAILURE, EXIT_SUCCESS, strtoul */
+#include <string.h>         /* strcmp, strncmp */
 #include "constantes.h"     /* DEF_BLOCK_SIZE, PREPARE_OPTION, TRANSMIT_OPTION,
-                                RECEIVE_OPTION */
+                                RECEIVE_OPTION, COMPRESS_OPTION, BASE_OPTION,
+                                RING_OPTION, ZEROCOPY_OPTION, LIVE_OPTION,
+                                DAEMON_OPTION, DAEMON_SOCKET_OPTION,
+                                REPAIR_OPTION, CATCHUP_OPTION,
+                                CATCHUP_AFTER_OPTION, CATCHUP_THRESHOLD,
+                                CATCHUP_BUDGET */
 #include "splitfile.h"      /* splitFile */
 #include "transmitfile.h"   /* transmitFile */
 #include "receivefile.h"    /* receiveFile */
+#include "daemon.h"         /* runDaemon, receiveFromDaemon */
 
 /*
  * 
  */
 int main(int argc, char** argv)
 {
+    // Extract "--" options, the remaining parameters are positional.
+    tSplitOptions splitOptions = {CODEC_NONE, NULL, FALSE};
+    tReceiveOptions receiveOptions = {
+        NULL, FALSE, 0, NULL, CATCHUP_THRESHOLD, CATCHUP_BUDGET
+    };
+    tTransmitOptions transmitOptions = {FALSE, NULL, CODEC_NONE, NULL};
+    bool isLive = FALSE;
+    const char* daemonSocket = NULL;
+    int i = 1;
+    int nbArgs = 1;
+    for(; i < argc; ++i){
+        if(strncmp(argv[i], "--", 2) != 0){
+            argv[nbArgs++] = argv[i];
+        }else if(strcmp(argv[i], COMPRESS_OPTION) == 0){
+            splitOptions._codec = CODEC_ZLIB;
+            transmitOptions._codec = CODEC_ZLIB;
+        }else if(strcmp(argv[i], CDC_OPTION) == 0){
+            // The block size is then an average size.
+            splitOptions._contentDefined = TRUE;
+        }else if(strcmp(argv[i], RING_OPTION) == 0){
+            // Read datagrams from a ring shared with the kernel.
+            receiveOptions._useRing = TRUE;
+        }else if(strcmp(argv[i], ZEROCOPY_OPTION) == 0){
+            // Send from the block buffers, without copying them.
+            transmitOptions._zeroCopy = TRUE;
+        }else if(strcmp(argv[i], LIVE_OPTION) == 0){
+            // Send the input file while it is written (or a pipe).
+            isLive = TRUE;
+        }else if( (strcmp(argv[i], DAEMON_SOCKET_OPTION) == 0) &&
+            ((i + 1) < argc) )
+        {
+            // Get the file from the host daemon instead of the group.
+            daemonSocket = argv[++i];
+        }else if((strcmp(argv[i], REPAIR_OPTION) == 0) && ((i + 1) < argc)){
+            // Repair missed blocks from the peers on this repair group port.
+            const unsigned long repairPort = strtoul(argv[++i], NULL, 10);
+            if((repairPort == 0L) || (repairPort >= 65536L)){
+                fprintf(stderr, "Invalid repair port: '%s'.\n", argv[i]);
+                return (EXIT_FAILURE);
+            }
+            receiveOptions._repairPort = (uint16_t) repairPort;
+        }else if((strcmp(argv[i], CATCHUP_OPTION) == 0) && ((i + 1) < argc)){
+            // Serve (or pull) the last blocks over TCP on this address.
+            transmitOptions._catchupAddress = argv[++i];
+            receiveOptions._catchupAddress = argv[i];
+        }else if( (strcmp(argv[i], CATCHUP_AFTER_OPTION) == 0) &&
+            ((i + 1) < argc) )
+        {
+            // Pull once holding this percentage of the blocks, or after
+            // this many seconds ("<percent>:<seconds>").
+            char* pColon = NULL;
+            char* pEnd = NULL;
+            const unsigned long threshold = strtoul(argv[++i], &pColon, 10);
+            const unsigned long budget = (*pColon == ':') ?
+                strtoul(pColon + 1, &pEnd, 10) : 0;
+            if( (pColon == argv[i]) || (*pColon != ':') ||
+                (pEnd == (pColon + 1)) || (*pEnd != '\0') ||
+                (threshold > 100L) || (budget > UINT32_MAX) )
+            {
+                fprintf(stderr, "Invalid catch-up start: '%s'.\n", argv[i]);
+                return (EXIT_FAILURE);
+            }
+            receiveOptions._catchupThreshold = (uint32_t) threshold;
+            receiveOptions._catchupBudget = (uint32_t) budget;
+        }else if((strcmp(argv[i], BASE_OPTION) == 0) && ((i + 1) < argc)){
+            // Previous prepared directory or previous received file.
+            splitOptions._baseDir = argv[++i];
+            receiveOptions._baseFileName = argv[i];
+        }else{
+            fprintf(stderr, "Invalid option: '%s'.\n", argv[i]);
+            return (EXIT_FAILURE);
+        }
+    }
+    argc = nbArgs;
     // Check mandatory parameters.
     if(argc < 3){
         // Print usage.
         printf(
             "Usage: %s <"PREPARE_OPTION"|"TRANSMIT_OPTION"|"RECEIVE_OPTION"> "
-                "<input-file> <output-dir>=%s (<block-size>=%zu | | "
-                "<multi-addr>=%s <local-addr>=%s <port>=%d)\n",
+                "<input-file> <output-dir>=%s (<block-size>=%zu "
+                "["COMPRESS_OPTION"] ["CDC_OPTION"] "
+                "["BASE_OPTION" <previous-dir>] | | "
+                "<multi-addr>=%s <local-addr>=%s <port>=%d "
+                "["ZEROCOPY_OPTION"] ["LIVE_OPTION"] ["COMPRESS_OPTION"] "
+                "["CATCHUP_OPTION" <addr:port>] | "
+                "["BASE_OPTION" <previous-file>] ["RING_OPTION"] "
+                "["DAEMON_SOCKET_OPTION" <socket>] "
+                "["REPAIR_OPTION" <port>] ["CATCHUP_OPTION" <addr:port> "
+                "["CATCHUP_AFTER_OPTION" <percent:seconds>]])\n"
+                "       %s "DAEMON_OPTION" <socket> <work-dir>=%s "
+                "["RING_OPTION"] ["REPAIR_OPTION" <port>]\n",
             argv[0], DEF_DATA_DIRECTORY, DEF_BLOCK_SIZE, DEF_MULTI_ADDR,
-                DEF_LOCAL_ADDR, DEF_PORT_NUMBER
+                DEF_LOCAL_ADDR, DEF_PORT_NUMBER, argv[0], DEF_DATA_DIRECTORY
         );
         return (EXIT_FAILURE);
     }
@@ -48,7 +138,7 @@ int main(int argc, char** argv)
                 return (EXIT_FAILURE);
             }
         }
-        splitFile(inputFileName, outputDir, blockSize);
+        splitFile(inputFileName, outputDir, blockSize, &splitOptions);
     }else if( (strcmp(option, TRANSMIT_OPTION) == 0) ||
         (strcmp(option, RECEIVE_OPTION) == 0) )
     {
@@ -68,16 +158,26 @@ int main(int argc, char** argv)
             }
         }
         if(strcmp(option, TRANSMIT_OPTION) == 0){
-            transmitFile(outputDir, localAddr, multAddr, (uint16_t) port);
+            transmitOptions._liveSource = (isLive == TRUE) ?
+                inputFileName : NULL;
+            transmitFile(outputDir, localAddr, multAddr, (uint16_t) port,
+                &transmitOptions);
+        }else if(daemonSocket != NULL){
+            receiveFromDaemon(daemonSocket, inputFileName, localAddr,
+                multAddr, (uint16_t) port);
         }else{
             receiveFile(inputFileName, outputDir, localAddr, multAddr,
-                (uint16_t) port);
+                (uint16_t) port, &receiveOptions);
         }
+    }else if(strcmp(option, DAEMON_OPTION) == 0){
+        // The input file is the socket of the local clients.
+        runDaemon(inputFileName, outputDir, &receiveOptions);
     }else{
         fprintf(
             stderr,
             "Invalid option: '%s' "
-                "("PREPARE_OPTION"|"TRANSMIT_OPTION"|"RECEIVE_OPTION").\n",
+                "("PREPARE_OPTION"|"TRANSMIT_OPTION"|"RECEIVE_OPTION"|"
+                    DAEMON_OPTION").\n",
             argv[1]
         );
         return (EXIT_FAILURE);
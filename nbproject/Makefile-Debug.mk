@@ -35,14 +35,33 @@ OBJECTDIR=${CND_BUILDDIR}/${CND_CONF}/${CND_PLATFORM}
 
 # Object Files
 OBJECTFILES= \
+	${OBJECTDIR}/bitmap.o \
+	${OBJECTDIR}/blockhash.o \
+	${OBJECTDIR}/blockpacketmap.o \
+	${OBJECTDIR}/blockscan.o \
+	${OBJECTDIR}/blockstream.o \
+	${OBJECTDIR}/blockwindow.o \
+	${OBJECTDIR}/blockworker.o \
+	${OBJECTDIR}/catchup.o \
+	${OBJECTDIR}/chunker.o \
 	${OBJECTDIR}/client.o \
+	${OBJECTDIR}/codec.o \
 	${OBJECTDIR}/crc32.o \
+	${OBJECTDIR}/daemon.o \
+	${OBJECTDIR}/journal.o \
+	${OBJECTDIR}/livesource.o \
 	${OBJECTDIR}/main.o \
+	${OBJECTDIR}/packetfilter.o \
+	${OBJECTDIR}/packetring.o \
 	${OBJECTDIR}/parsefile.o \
 	${OBJECTDIR}/receivefile.o \
+	${OBJECTDIR}/repair.o \
+	${OBJECTDIR}/ringclient.o \
 	${OBJECTDIR}/server.o \
+	${OBJECTDIR}/session.o \
 	${OBJECTDIR}/splitfile.o \
-	${OBJECTDIR}/transmitfile.o
+	${OBJECTDIR}/transmitfile.o \
+	${OBJECTDIR}/uring.o
 
 
 # C Compiler Flags
@@ -59,7 +78,7 @@ FFLAGS=
 ASFLAGS=
 
 # Link Libraries and Options
-LDLIBSOPTIONS=
+LDLIBSOPTIONS=-lpthread -lz
 
 # Build Targets
 .build-conf: ${BUILD_SUBPROJECTS}
@@ -69,21 +88,96 @@ ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/multicastfiledistribution: ${OBJECTFI
 	${MKDIR} -p ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}
 	${LINK.c} -o ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/multicastfiledistribution ${OBJECTFILES} ${LDLIBSOPTIONS}
 
+${OBJECTDIR}/bitmap.o: bitmap.c 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/bitmap.o bitmap.c
+
+${OBJECTDIR}/blockhash.o: blockhash.c 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/blockhash.o blockhash.c
+
+${OBJECTDIR}/blockpacketmap.o: blockpacketmap.c 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/blockpacketmap.o blockpacketmap.c
+
+${OBJECTDIR}/blockscan.o: blockscan.c 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/blockscan.o blockscan.c
+
+${OBJECTDIR}/blockstream.o: blockstream.c 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/blockstream.o blockstream.c
+
+${OBJECTDIR}/blockwindow.o: blockwindow.c 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/blockwindow.o blockwindow.c
+
+${OBJECTDIR}/blockworker.o: blockworker.c 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/blockworker.o blockworker.c
+
+${OBJECTDIR}/catchup.o: catchup.c 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/catchup.o catchup.c
+
+${OBJECTDIR}/chunker.o: chunker.c 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/chunker.o chunker.c
+
 ${OBJECTDIR}/client.o: client.c 
 	${MKDIR} -p ${OBJECTDIR}
 	${RM} "$@.d"
 	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/client.o client.c
 
+${OBJECTDIR}/codec.o: codec.c 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/codec.o codec.c
+
 ${OBJECTDIR}/crc32.o: crc32.c 
 	${MKDIR} -p ${OBJECTDIR}
 	${RM} "$@.d"
 	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/crc32.o crc32.c
 
+${OBJECTDIR}/daemon.o: daemon.c 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/daemon.o daemon.c
+
+${OBJECTDIR}/journal.o: journal.c 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/journal.o journal.c
+
+${OBJECTDIR}/livesource.o: livesource.c 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/livesource.o livesource.c
+
 ${OBJECTDIR}/main.o: main.c 
 	${MKDIR} -p ${OBJECTDIR}
 	${RM} "$@.d"
 	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/main.o main.c
 
+${OBJECTDIR}/packetfilter.o: packetfilter.c 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/packetfilter.o packetfilter.c
+
+${OBJECTDIR}/packetring.o: packetring.c 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/packetring.o packetring.c
+
 ${OBJECTDIR}/parsefile.o: parsefile.c 
 	${MKDIR} -p ${OBJECTDIR}
 	${RM} "$@.d"
@@ -94,11 +188,26 @@ ${OBJECTDIR}/receivefile.o: receivefile.c
 	${RM} "$@.d"
 	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/receivefile.o receivefile.c
 
+${OBJECTDIR}/repair.o: repair.c 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/repair.o repair.c
+
+${OBJECTDIR}/ringclient.o: ringclient.c 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/ringclient.o ringclient.c
+
 ${OBJECTDIR}/server.o: server.c 
 	${MKDIR} -p ${OBJECTDIR}
 	${RM} "$@.d"
 	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/server.o server.c
 
+${OBJECTDIR}/session.o: session.c 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/session.o session.c
+
 ${OBJECTDIR}/splitfile.o: splitfile.c 
 	${MKDIR} -p ${OBJECTDIR}
 	${RM} "$@.d"
@@ -109,6 +218,11 @@ ${OBJECTDIR}/transmitfile.o: transmitfile.c
 	${RM} "$@.d"
 	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/transmitfile.o transmitfile.c
 
+${OBJECTDIR}/uring.o: uring.c 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/uring.o uring.c
+
 # Subprojects
 .build-subprojects:
 
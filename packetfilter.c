@@ -0,0 +1,328 @@
+#include "packetfilter.h"
+#include "constantes.h"     /* PACKET_MAGIC, RECEIVE_FILTER_RANGES */
+#include <stdlib.h>         /* malloc, realloc, free, qsort */
+#include <stdio.h>          /* perror, fprintf, stderr */
+#include <string.h>         /* memcmp */
+#include <stddef.h>         /* offsetof */
+#include <assert.h>         /* assert, _Static_assert */
+#include <sys/socket.h>     /* setsockopt, SO_ATTACH_FILTER */
+#include <arpa/inet.h>      /* inet_addr, ntohl */
+#include <netinet/in.h>     /* IPPROTO_UDP */
+
+// Filter results: the whole packet, or nothing.
+#define FILTER_KEEP ((uint32_t) -1)
+#define FILTER_DROP ((uint32_t) 0)
+// Scratch memory: the packet header position, then assembled fields.
+#define FILTER_BASE (0)
+#define FILTER_SUM  (4)
+// Instructions besides the block ranges (the longest header checks).
+#define FILTER_HEADER_CODE (96)
+
+_Static_assert(
+    (FILTER_HEADER_CODE + 4*RECEIVE_FILTER_RANGES) <= BPF_MAXINSNS,
+    "RECEIVE_FILTER_RANGES exceeds the kernel filter size."
+);
+
+static void emit(tPacketFilter* const pFilter, const uint16_t code,
+                 const uint8_t jt, const uint8_t jf, const uint32_t k)
+{
+    assert(pFilter->_nextSize < BPF_MAXINSNS);
+    struct sock_filter* const pCode =
+        &(pFilter->_pNext[pFilter->_nextSize++]);
+    pCode->code = code;
+    pCode->jt = jt;
+    pCode->jf = jf;
+    pCode->k = k;
+}
+
+// Go on when the accumulator is k, return otherwise.
+static void emitExpect(tPacketFilter* const pFilter, const uint32_t k,
+                       const uint32_t result)
+{
+    emit(pFilter, BPF_JMP | BPF_JEQ | BPF_K, 1, 0, k);
+    emit(pFilter, BPF_RET | BPF_K, 0, 0, result);
+}
+
+/*
+ * Load a packet header field into the accumulator. Fields are in host byte
+ * order, they are assembled byte by byte (the index register is restored to
+ * the header position).
+ */
+static void emitLoadField(tPacketFilter* const pFilter, const uint32_t offset,
+                          const uint32_t size)
+{
+    const uint16_t probe = 1;
+    const bool isLittleEndian =
+        (*((const uint8_t*) &probe) == 1) ? TRUE : FALSE;
+    uint32_t i = 0;
+    for(; i < size; ++i){
+        const uint32_t shift =
+            8*((isLittleEndian == TRUE) ? i : (size - 1 - i));
+        emit(pFilter, BPF_LD | BPF_B | BPF_IND, 0, 0, offset + i);
+        if(shift != 0){
+            emit(pFilter, BPF_ALU | BPF_LSH | BPF_K, 0, 0, shift);
+        }
+        if(i != 0){
+            emit(pFilter, BPF_LDX | BPF_MEM, 0, 0, FILTER_SUM);
+            emit(pFilter, BPF_ALU | BPF_OR | BPF_X, 0, 0, 0);
+        }
+        if(i != (size - 1)){
+            emit(pFilter, BPF_ST, 0, 0, FILTER_SUM);
+            emit(pFilter, BPF_LDX | BPF_MEM, 0, 0, FILTER_BASE);
+        }
+    }
+    emit(pFilter, BPF_LDX | BPF_MEM, 0, 0, FILTER_BASE);
+}
+
+// Find the packet header, the index register and scratch memory hold it.
+static void emitHeaderPosition(tPacketFilter* const pFilter)
+{
+    if(pFilter->_hasIpHeader == TRUE){
+        // Unfragmented UDP datagrams to the group and port only.
+        emit(pFilter, BPF_LD | BPF_B | BPF_ABS, 0, 0, 9);
+        emitExpect(pFilter, IPPROTO_UDP, FILTER_DROP);
+        emit(pFilter, BPF_LD | BPF_W | BPF_ABS, 0, 0, 16);
+        emitExpect(pFilter, ntohl(pFilter->_group), FILTER_DROP);
+        emit(pFilter, BPF_LD | BPF_H | BPF_ABS, 0, 0, 6);
+        emit(pFilter, BPF_JMP | BPF_JSET | BPF_K, 0, 1, 0x3FFF);
+        emit(pFilter, BPF_RET | BPF_K, 0, 0, FILTER_DROP);
+        emit(pFilter, BPF_LDX | BPF_B | BPF_MSH, 0, 0, 0);
+        emit(pFilter, BPF_LD | BPF_H | BPF_IND, 0, 0, 2);
+        emitExpect(pFilter, pFilter->_port, FILTER_DROP);
+        emit(pFilter, BPF_MISC | BPF_TXA, 0, 0, 0);
+        emit(pFilter, BPF_ALU | BPF_ADD | BPF_K, 0, 0, 8);
+        emit(pFilter, BPF_MISC | BPF_TAX, 0, 0, 0);
+    }else{
+        // Socket filters see the datagram from its UDP header.
+        emit(pFilter, BPF_LDX | BPF_IMM, 0, 0, 8);
+    }
+    emit(pFilter, BPF_MISC | BPF_TXA, 0, 0, 0);
+    emit(pFilter, BPF_ST, 0, 0, FILTER_BASE);
+}
+
+static void emitProgram(tPacketFilter* const pFilter,
+                        const tBlockNumber blockTotal,
+                        const size_t nbRanges)
+{
+    pFilter->_nextSize = 0;
+    emitHeaderPosition(pFilter);
+    // Packets of this session only (once known, by its block total).
+    emit(
+        pFilter, BPF_LD | BPF_B | BPF_IND, 0, 0,
+        offsetof(tDataPacketHeader, _magic)
+    );
+    emitExpect(pFilter, PACKET_MAGIC, FILTER_DROP);
+    emit(
+        pFilter, BPF_LD | BPF_B | BPF_IND, 0, 0,
+        offsetof(tDataPacketHeader, _version)
+    );
+    emitExpect(pFilter, PACKET_VERSION, FILTER_DROP);
+    if(blockTotal == 0){
+        emit(pFilter, BPF_RET | BPF_K, 0, 0, FILTER_KEEP);
+        return;
+    }
+    emitLoadField(
+        pFilter, offsetof(tDataPacketHeader, _blockTotal),
+        sizeof(tBlockNumber)
+    );
+    emitExpect(pFilter, blockTotal, FILTER_DROP);
+    // Descriptors are always kept.
+    emit(
+        pFilter, BPF_LD | BPF_B | BPF_IND, 0, 0,
+        offsetof(tDataPacketHeader, _type)
+    );
+    emitExpect(pFilter, PACKET_TYPE_DATA, FILTER_KEEP);
+    // Coalesced datagrams (UDP_GRO) hold other blocks after the first one.
+    emitLoadField(
+        pFilter, offsetof(tDataPacketHeader, _payloadSize),
+        sizeof(tPacketSize)
+    );
+    emit(
+        pFilter, BPF_ALU | BPF_ADD | BPF_K, 0, 0, sizeof(tDataPacketHeader)
+    );
+    emit(pFilter, BPF_ALU | BPF_ADD | BPF_X, 0, 0, 0);
+    emit(pFilter, BPF_ST, 0, 0, FILTER_SUM);
+    emit(pFilter, BPF_LD | BPF_W | BPF_LEN, 0, 0, 0);
+    emit(pFilter, BPF_LDX | BPF_MEM, 0, 0, FILTER_SUM);
+    emit(pFilter, BPF_JMP | BPF_JEQ | BPF_X, 1, 0, 0);
+    emit(pFilter, BPF_RET | BPF_K, 0, 0, FILTER_KEEP);
+    emit(pFilter, BPF_LDX | BPF_MEM, 0, 0, FILTER_BASE);
+    // Drop the settled blocks (ranges in ascending order).
+    emitLoadField(
+        pFilter, offsetof(tDataPacketHeader, _blockNumber),
+        sizeof(tBlockNumber)
+    );
+    assert(pFilter->_nextSize <= FILTER_HEADER_CODE);
+    size_t i = 0;
+    for(; i < nbRanges; ++i){
+        emit(
+            pFilter, BPF_JMP | BPF_JGE | BPF_K, 1, 0,
+            pFilter->_pRanges[i]._first
+        );
+        emit(pFilter, BPF_RET | BPF_K, 0, 0, FILTER_KEEP);
+        emit(
+            pFilter, BPF_JMP | BPF_JGE | BPF_K, 1, 0,
+            pFilter->_pRanges[i]._end
+        );
+        emit(pFilter, BPF_RET | BPF_K, 0, 0, FILTER_DROP);
+    }
+    emit(pFilter, BPF_RET | BPF_K, 0, 0, FILTER_KEEP);
+}
+
+// Attach the program built, it becomes the current one.
+static bool attachProgram(tPacketFilter* const pFilter)
+{
+    const struct sock_fprog program = {
+        (unsigned short) pFilter->_nextSize, pFilter->_pNext
+    };
+    if(setsockopt(
+        pFilter->_sd, SOL_SOCKET, SO_ATTACH_FILTER, &program,
+        sizeof(program)
+    ) != 0)
+    {
+        perror("Error attaching socket filter");
+        return FALSE;
+    }
+    struct sock_filter* const pCode = pFilter->_pCode;
+    pFilter->_pCode = pFilter->_pNext;
+    pFilter->_size = pFilter->_nextSize;
+    pFilter->_pNext = pCode;
+    return TRUE;
+}
+
+bool initPacketFilter(tPacketFilter* const pFilter, const int sd,
+    const bool hasIpHeader, const char* const multAddr, const uint16_t port)
+{
+    assert((pFilter != NULL) && (multAddr != NULL));
+    pFilter->_sd = sd;
+    pFilter->_hasIpHeader = hasIpHeader;
+    pFilter->_group = inet_addr(multAddr);
+    pFilter->_port = port;
+    pFilter->_size = 0;
+    pFilter->_nextSize = 0;
+    pFilter->_pRanges = NULL;
+    pFilter->_maxRanges = 0;
+    pFilter->_pCode = malloc(BPF_MAXINSNS*sizeof(*pFilter->_pCode));
+    pFilter->_pNext = malloc(BPF_MAXINSNS*sizeof(*pFilter->_pNext));
+    if((pFilter->_pCode == NULL) || (pFilter->_pNext == NULL)){
+        closePacketFilter(pFilter);
+        fprintf(
+            stderr,
+            "Fail to allocate memory at %s line %d.\n",
+            __FILE__, __LINE__
+        );
+        return FALSE;
+    }
+    // Other sessions are dropped from the start.
+    emitProgram(pFilter, 0, 0);
+    if(attachProgram(pFilter) != TRUE){
+        closePacketFilter(pFilter);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static int compareRangeLength(const void* const pLeft,
+                              const void* const pRight)
+{
+    const tBlockRange* const pLeftRange = pLeft;
+    const tBlockRange* const pRightRange = pRight;
+    const tBlockNumber left = pLeftRange->_end - pLeftRange->_first;
+    const tBlockNumber right = pRightRange->_end - pRightRange->_first;
+    return (left > right) ? -1 : ((left < right) ? 1 : 0);
+}
+
+static int compareRangeFirst(const void* const pLeft,
+                             const void* const pRight)
+{
+    const tBlockNumber left = ((const tBlockRange*) pLeft)->_first;
+    const tBlockNumber right = ((const tBlockRange*) pRight)->_first;
+    return (left < right) ? -1 : ((left > right) ? 1 : 0);
+}
+
+// Collect the settled ranges, the largest ones when there are too many.
+static bool collectRanges(tPacketFilter* const pFilter,
+                          const tBitmap* const pSettled,
+                          size_t* const pNbRanges)
+{
+    size_t nbRanges = 0;
+    uint32_t first = 0;
+    uint32_t end = 0;
+    while(findRange(pSettled, end, TRUE, &first, &end) == TRUE){
+        if(nbRanges == pFilter->_maxRanges){
+            const size_t maxRanges = (pFilter->_maxRanges == 0) ?
+                RECEIVE_FILTER_RANGES : 2*pFilter->_maxRanges;
+            tBlockRange* const pRanges = realloc(
+                pFilter->_pRanges, maxRanges*sizeof(*pFilter->_pRanges)
+            );
+            if(pRanges == NULL){
+                fprintf(
+                    stderr,
+                    "Fail to allocate memory at %s line %d.\n",
+                    __FILE__, __LINE__
+                );
+                return FALSE;
+            }
+            pFilter->_pRanges = pRanges;
+            pFilter->_maxRanges = maxRanges;
+        }
+        pFilter->_pRanges[nbRanges]._first = first;
+        pFilter->_pRanges[nbRanges]._end = end;
+        ++nbRanges;
+    }
+    if(nbRanges > RECEIVE_FILTER_RANGES){
+        qsort(
+            pFilter->_pRanges, nbRanges, sizeof(*pFilter->_pRanges),
+            compareRangeLength
+        );
+        nbRanges = RECEIVE_FILTER_RANGES;
+        qsort(
+            pFilter->_pRanges, nbRanges, sizeof(*pFilter->_pRanges),
+            compareRangeFirst
+        );
+    }
+    *pNbRanges = nbRanges;
+    return TRUE;
+}
+
+/*
+ * Build the program again and attach it when it changed. On failure, the
+ * filter is detached (an outdated one could drop blocks needed again).
+ */
+bool updatePacketFilter(tPacketFilter* const pFilter,
+    const tBlockNumber blockTotal, const tBitmap* const pSettled)
+{
+    assert((pFilter != NULL) && (pSettled != NULL));
+    size_t nbRanges = 0;
+    if(collectRanges(pFilter, pSettled, &nbRanges) == TRUE){
+        emitProgram(pFilter, blockTotal, nbRanges);
+        if( (pFilter->_nextSize == pFilter->_size) &&
+            (memcmp(
+                pFilter->_pNext, pFilter->_pCode,
+                pFilter->_size*sizeof(*pFilter->_pCode)) == 0) )
+        {
+            return TRUE;
+        }
+        if(attachProgram(pFilter) == TRUE){
+            return TRUE;
+        }
+    }
+    const int unused = 0;
+    setsockopt(
+        pFilter->_sd, SOL_SOCKET, SO_DETACH_FILTER, &unused, sizeof(unused)
+    );
+    return FALSE;
+}
+
+void closePacketFilter(tPacketFilter* const pFilter)
+{
+    assert(pFilter != NULL);
+    free(pFilter->_pRanges);
+    free(pFilter->_pNext);
+    free(pFilter->_pCode);
+    pFilter->_pRanges = NULL;
+    pFilter->_pNext = NULL;
+    pFilter->_pCode = NULL;
+    pFilter->_maxRanges = 0;
+    pFilter->_size = 0;
+}
@@ -0,0 +1,57 @@
+/* 
+ * File:   packetfilter.h
+ * Author: pilluh
+ *
+ * Created on 20 octobre 2026, 11:05
+ */
+
+#ifndef PACKETFILTER_H
+#define PACKETFILTER_H
+
+#include "types.h"      /* tBlockNumber, bool */
+#include "bitmap.h"     /* tBitmap */
+#include <stdint.h>     /* uint16_t, uint32_t */
+#include <stddef.h>     /* size_t */
+#include <linux/filter.h> /* struct sock_filter */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct sBlockRange{
+    tBlockNumber    _first;
+    tBlockNumber    _end;
+} tBlockRange;
+
+/*
+ * Classic BPF program attached to the receive socket: the kernel drops the
+ * packets of other sessions and of the blocks already settled, before any
+ * wakeup or copy. It only matches header fields, so it is generated again
+ * from the settled blocks as they grow (the largest ranges of them when too
+ * many), and attached when it changed. Packets it can not judge are kept,
+ * the assemblers check anyway.
+ */
+typedef struct sPacketFilter{
+    int                 _sd;
+    bool                _hasIpHeader;
+    uint32_t            _group;
+    uint16_t            _port;
+    struct sock_filter* _pCode;
+    size_t              _size;
+    struct sock_filter* _pNext;
+    size_t              _nextSize;
+    tBlockRange*        _pRanges;
+    size_t              _maxRanges;
+} tPacketFilter;
+
+bool initPacketFilter(tPacketFilter* const pFilter, const int sd,
+    const bool hasIpHeader, const char* const multAddr, const uint16_t port);
+bool updatePacketFilter(tPacketFilter* const pFilter,
+    const tBlockNumber blockTotal, const tBitmap* const pSettled);
+void closePacketFilter(tPacketFilter* const pFilter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PACKETFILTER_H */
@@ -0,0 +1,212 @@
+#define _GNU_SOURCE         /* struct mmsghdr */
+#include "packetring.h"
+#include <stdio.h>          /* fprintf, perror, stderr */
+#include <assert.h>         /* assert */
+#include <errno.h>          /* errno, EINTR */
+#include <stdint.h>         /* uint64_t */
+#include <unistd.h>         /* write, close */
+#include <poll.h>           /* poll, struct pollfd, POLLIN */
+#include <sys/eventfd.h>    /* eventfd */
+
+static bool readBatch(tPacketRing* const pRing, tPacketBatch* const pBatch)
+{
+    if(pRing->_pRingClient != NULL){
+        return readRingPackets(pRing->_pRingClient, pBatch);
+    }
+    // Wait for datagrams, or to be woken up when stopping.
+    struct pollfd pollSds[2] = {
+        {pRing->_sd, POLLIN, 0},
+        {pRing->_wakeFd, POLLIN, 0}
+    };
+    if( (poll(pollSds, 2, -1) <= 0) || (pollSds[1].revents != 0) ||
+        (pollSds[0].revents == 0) )
+    {
+        return FALSE;
+    }
+    return readPackets(pRing->_sd, pBatch, pRing->_runs);
+}
+
+static void* runPacketRing(void* const pArg)
+{
+    tPacketRing* const pRing = pArg;
+    for(;;){
+        // Wait for a free slot (the assemblers are far behind otherwise).
+        while(sem_wait(&pRing->_free) != 0){
+            assert(errno == EINTR);
+        }
+        if(atomic_load(&pRing->_stopping) == TRUE){
+            break;
+        }
+        const size_t tail =
+            atomic_load_explicit(&pRing->_tail, memory_order_relaxed);
+        const size_t slot = tail % RECEIVE_RING_BATCHES;
+        // Fill it with the datagrams at hand, then publish it.
+        while(readBatch(pRing, &(pRing->_batches[slot])) != TRUE){
+            if(atomic_load(&pRing->_stopping) == TRUE){
+                return NULL;
+            }
+        }
+        atomic_store_explicit(
+            &(pRing->_nbReaders[slot]), pRing->_nbConsumers,
+            memory_order_relaxed
+        );
+        atomic_store_explicit(&pRing->_tail, tail + 1, memory_order_release);
+        unsigned int i = 0;
+        for(; i < pRing->_nbConsumers; ++i){
+            sem_post(&(pRing->_filled[i]));
+        }
+    }
+    return NULL;
+}
+
+// Free the semaphores and batches of a ring which is not running.
+static void freePacketRing(tPacketRing* const pRing)
+{
+    close(pRing->_wakeFd);
+    sem_destroy(&pRing->_free);
+    unsigned int i = 0;
+    for(; i < pRing->_nbConsumers; ++i){
+        sem_destroy(&(pRing->_filled[i]));
+    }
+    size_t slot = 0;
+    for(; slot < RECEIVE_RING_BATCHES; ++slot){
+        closePacketBatch(&(pRing->_batches[slot]));
+    }
+}
+
+bool startPacketRing(tPacketRing* const pRing, const int sd,
+    tRingClient* const pRingClient, const unsigned int nbConsumers)
+{
+    assert((pRing != NULL) && (nbConsumers >= 1));
+    assert(nbConsumers <= RECEIVE_ASSEMBLERS);
+    size_t slot = 0;
+    for(; slot < RECEIVE_RING_BATCHES; ++slot){
+        if(initPacketBatch(&(pRing->_batches[slot])) != TRUE){
+            while(slot > 0){
+                closePacketBatch(&(pRing->_batches[--slot]));
+            }
+            return FALSE;
+        }
+        atomic_init(&(pRing->_nbReaders[slot]), 0);
+    }
+    pRing->_runs[0]._pPayload = NULL;
+    pRing->_runs[1]._pPayload = NULL;
+    pRing->_wakeFd = eventfd(0, EFD_CLOEXEC);
+    if(pRing->_wakeFd < 0){
+        perror("Error creating the network thread event");
+        while(slot > 0){
+            closePacketBatch(&(pRing->_batches[--slot]));
+        }
+        return FALSE;
+    }
+    atomic_init(&pRing->_tail, 0);
+    atomic_init(&pRing->_stopping, FALSE);
+    unsigned int i = 0;
+    for(; i < nbConsumers; ++i){
+        pRing->_heads[i] = 0;
+        sem_init(&(pRing->_filled[i]), 0, 0);
+    }
+    sem_init(&pRing->_free, 0, RECEIVE_RING_BATCHES);
+    pRing->_nbConsumers = nbConsumers;
+    pRing->_sd = sd;
+    pRing->_pRingClient = pRingClient;
+    if(pthread_create(&pRing->_thread, NULL, runPacketRing, pRing) != 0){
+        fprintf(stderr, "Fail to start the network thread.\n");
+        freePacketRing(pRing);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+tPacketBatch* acquireBatch(tPacketRing* const pRing,
+    const unsigned int consumer)
+{
+    assert((pRing != NULL) && (consumer < pRing->_nbConsumers));
+    while(sem_wait(&(pRing->_filled[consumer])) != 0){
+        assert(errno == EINTR);
+    }
+    // The slot content is visible once its position is.
+    const size_t head = pRing->_heads[consumer];
+    if( (atomic_load(&pRing->_stopping) == TRUE) ||
+        (head == atomic_load_explicit(&pRing->_tail, memory_order_acquire)) )
+    {
+        return NULL;
+    }
+    return &(pRing->_batches[head % RECEIVE_RING_BATCHES]);
+}
+
+/*
+ * Wake a consumer up without a batch (its next acquire may then return
+ * none while the ring goes on).
+ */
+void wakeConsumer(tPacketRing* const pRing, const unsigned int consumer)
+{
+    assert((pRing != NULL) && (consumer < pRing->_nbConsumers));
+    sem_post(&(pRing->_filled[consumer]));
+}
+
+bool isRingStopping(tPacketRing* const pRing)
+{
+    assert(pRing != NULL);
+    return (atomic_load(&pRing->_stopping) == TRUE) ? TRUE : FALSE;
+}
+
+void releaseBatch(tPacketRing* const pRing, const unsigned int consumer)
+{
+    assert((pRing != NULL) && (consumer < pRing->_nbConsumers));
+    const size_t slot = (pRing->_heads[consumer]++) % RECEIVE_RING_BATCHES;
+    // The last assembler done with the batch gives the slot back (and the
+    // ring block to the kernel).
+    if(atomic_fetch_sub_explicit(
+        &(pRing->_nbReaders[slot]), 1, memory_order_acq_rel
+    ) == 1)
+    {
+        releaseRingPackets(&(pRing->_batches[slot]));
+        sem_post(&pRing->_free);
+    }
+}
+
+void stopPacketRing(tPacketRing* const pRing)
+{
+    assert(pRing != NULL);
+    // Wake the network thread and the assemblers up, wherever they wait.
+    atomic_store(&pRing->_stopping, TRUE);
+    const uint64_t wake = 1;
+    if(write(pRing->_wakeFd, &wake, sizeof(wake)) != sizeof(wake)){
+        perror("Error waking the network thread");
+    }
+    sem_post(&pRing->_free);
+    unsigned int i = 0;
+    for(; i < pRing->_nbConsumers; ++i){
+        sem_post(&(pRing->_filled[i]));
+    }
+    pthread_join(pRing->_thread, NULL);
+}
+
+void closePacketRing(tPacketRing* const pRing)
+{
+    assert(pRing != NULL);
+    // Free the runs being received, and the runs handed over to assemblers
+    // which stopped before reading them.
+    closePacketRun(&(pRing->_runs[0]));
+    closePacketRun(&(pRing->_runs[1]));
+    const size_t tail = atomic_load(&pRing->_tail);
+    size_t position = tail;
+    unsigned int i = 0;
+    for(; i < pRing->_nbConsumers; ++i){
+        if(pRing->_heads[i] < position){
+            position = pRing->_heads[i];
+        }
+    }
+    for(; position < tail; ++position){
+        tPacketRun* const pRun =
+            &(pRing->_batches[position % RECEIVE_RING_BATCHES]._run);
+        if( (pRun->_pPayload != NULL) &&
+            (position >= pRing->_heads[
+                pRun->_header._blockNumber % pRing->_nbConsumers]) )
+        {
+            closePacketRun(pRun);
+        }
+    }
+    freePacketRing(pRing);
+}
@@ -0,0 +1,68 @@
+/* 
+ * File:   packetring.h
+ * Author: pilluh
+ *
+ * Created on 19 octobre 2026, 23:40
+ */
+
+#ifndef PACKETRING_H
+#define PACKETRING_H
+
+#include "types.h"      /* bool */
+#include "client.h"     /* tPacketBatch, tPacketRun */
+#include "ringclient.h" /* tRingClient */
+#include "constantes.h" /* RECEIVE_RING_BATCHES, RECEIVE_ASSEMBLERS */
+#include <stddef.h>     /* size_t */
+#include <stdatomic.h>  /* atomic_uint, atomic_size_t, atomic_bool */
+#include <pthread.h>    /* pthread_t */
+#include <semaphore.h>  /* sem_t */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Single producer ring of packet batches: the network thread only drains
+ * the socket into it, and every assembler reads every batch in order (each
+ * one keeping the packets of its own blocks). A slot is reused once all
+ * the assemblers released it. Slots are handed over by positions and
+ * counters alone, semaphores are only there to sleep when the ring is empty
+ * or full. Batches are read from the socket, or from the ring client when
+ * there is one. The network thread waits on the socket and on an event
+ * which wakes it up when stopping. It receives the blocks in place while
+ * they come (a run, and the next one), a run handed over with a batch
+ * belongs to the consumer of its block (block number modulo the number of
+ * consumers).
+ */
+typedef struct sPacketRing{
+    tPacketBatch        _batches[RECEIVE_RING_BATCHES];
+    atomic_uint         _nbReaders[RECEIVE_RING_BATCHES];
+    atomic_size_t       _tail;
+    size_t              _heads[RECEIVE_ASSEMBLERS];
+    sem_t               _filled[RECEIVE_ASSEMBLERS];
+    sem_t               _free;
+    unsigned int        _nbConsumers;
+    atomic_bool         _stopping;
+    pthread_t           _thread;
+    int                 _sd;
+    int                 _wakeFd;
+    tRingClient*        _pRingClient;
+    tPacketRun          _runs[2];
+} tPacketRing;
+
+bool startPacketRing(tPacketRing* const pRing, const int sd,
+    tRingClient* const pRingClient, const unsigned int nbConsumers);
+tPacketBatch* acquireBatch(tPacketRing* const pRing,
+    const unsigned int consumer);
+void wakeConsumer(tPacketRing* const pRing, const unsigned int consumer);
+bool isRingStopping(tPacketRing* const pRing);
+void releaseBatch(tPacketRing* const pRing, const unsigned int consumer);
+void stopPacketRing(tPacketRing* const pRing);
+void closePacketRing(tPacketRing* const pRing);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PACKETRING_H */
+
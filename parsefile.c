@@ -1,11 +1,17 @@
+#define _GNU_SOURCE     /* fallocate, FALLOC_FL_PUNCH_HOLE */
 #include "parsefile.h"
 #include "constantes.h" /* INDEX_BASENAME, DIRECTORY_SEPARATOR */
 #include "macros.h"     /* NUM_2_STR */
+#include "crc32.h"      /* crc32c */
+#include "blockhash.h"  /* fingerprintBlock */
 #include <stdio.h>      /* fopen, fprintf, stderr, fgetc, EOF */
 #include <stdlib.h>     /* malloc, free */
 #include <assert.h>     /* assert */
 #include <string.h>     /* strlen */
-#include <errno.h>      /* errno, ENOENT */
+#include <errno.h>      /* errno, ENOENT, EOPNOTSUPP */
+#include <fcntl.h>      /* fallocate */
+#include <unistd.h>     /* ftruncate, pread */
+#include <sys/stat.h>   /* fstat */
 
 char* buildIndexFileName(const char* const outputDir)
 {
@@ -27,6 +33,75 @@ char* buildIndexFileName(const char* const outputDir)
     return indexFilename;
 }
 
+/*
+ * Read an index written before the format version was introduced: a 16-bit
+ * item number followed by {uint16_t number, uint32_t offset} items. The file
+ * size is the only way to tell it apart from garbage.
+ */
+static bool readLegacyIndexFile(const char* const fileName, FILE* const pFile,
+                                tIndexTable* pIndexTable)
+{
+    typedef struct sLegacyIndexItem{
+        uint16_t    _number;
+        uint32_t    _offset;
+    } tLegacyIndexItem;
+    uint16_t nbItems = 0;
+    const long fileSize = (fseek(pFile, 0, SEEK_END) == 0) ? ftell(pFile) : -1;
+    if( (fseek(pFile, 0, SEEK_SET) != 0) ||
+        (fread(&nbItems, sizeof(nbItems), 1, pFile) != 1) ||
+        (fileSize != (long) (sizeof(nbItems) +
+            nbItems*sizeof(tLegacyIndexItem))) )
+    {
+        fprintf(
+            stderr,
+            "Fail to read index file: '%s' (unknown format).\n",
+            fileName
+        );
+        return FALSE;
+    }
+    tLegacyIndexItem* const pLegacyItems =
+        malloc(nbItems*sizeof(*pLegacyItems));
+    pIndexTable->_pItems = malloc(nbItems*sizeof(*pIndexTable->_pItems));
+    if((pLegacyItems == NULL) || (pIndexTable->_pItems == NULL)){
+        fprintf(
+            stderr,
+            "Fail to allocate memory at %s line %d.\n",
+            __FILE__, __LINE__
+        );
+        free(pLegacyItems);
+        free(pIndexTable->_pItems);
+        pIndexTable->_pItems = NULL;
+        return FALSE;
+    }
+    if(fread(pLegacyItems, sizeof(*pLegacyItems), nbItems, pFile) != nbItems){
+        fprintf(
+            stderr,
+            "Fail to read index file: '%s' (incorrect item array).\n",
+            fileName
+        );
+        free(pLegacyItems);
+        free(pIndexTable->_pItems);
+        pIndexTable->_pItems = NULL;
+        return FALSE;
+    }
+    // Widen every item to the current layout.
+    uint16_t i = 0;
+    for(; i < nbItems; ++i){
+        pIndexTable->_pItems[i]._number = pLegacyItems[i]._number;
+        pIndexTable->_pItems[i]._type = BLOCK_TYPE_DATA;
+        pIndexTable->_pItems[i]._pattern = 0;
+        pIndexTable->_pItems[i]._padding = 0;
+        pIndexTable->_pItems[i]._offset = pLegacyItems[i]._offset;
+        pIndexTable->_pItems[i]._size = 0;
+        pIndexTable->_pItems[i]._reference = 0;
+        pIndexTable->_pItems[i]._fingerprint = 0;
+    }
+    free(pLegacyItems);
+    pIndexTable->_nbItems = nbItems;
+    pIndexTable->_version = LEGACY_INDEX_VERSION;
+    return TRUE;
+}
+
 bool readIndexFile(const char* const fileName, tIndexTable* pIndexTable)
 {
     assert((fileName != NULL) && (pIndexTable != NULL));
@@ -42,19 +117,27 @@ bool readIndexFile(const char* const fileName, tIndexTable* pIndexTable)
         }
         return FALSE;
     }
-    // First read the number of items.
-    size_t result = fread(
-        &pIndexTable->_nbItems, sizeof(pIndexTable->_nbItems), 1, pFile
-    );
-    if(result != 1){
+    // First read the header (magic, version and number of items).
+    tIndexHeader header;
+    size_t result = fread(&header, sizeof(header), 1, pFile);
+    if((result != 1) || (header._magic != INDEX_MAGIC)){
+        // Not a versioned index, it may come from an older release.
+        const bool legacy = readLegacyIndexFile(fileName, pFile, pIndexTable);
+        fclose(pFile);
+        return legacy;
+    }
+    // Only the current layout (and the legacy one) can be read.
+    if(header._version != INDEX_VERSION){
         fprintf(
             stderr,
-            "Fail to read index file: '%s' (incorrect item number).\n",
-            fileName
+            "Fail to read index file: '%s' (unsupported version %u).\n",
+            fileName, header._version
         );
         fclose(pFile);
         return FALSE;
     }
+    pIndexTable->_nbItems = header._nbItems;
+    pIndexTable->_version = header._version;
     // Allocate the necessary memory storage.
     pIndexTable->_pItems = (tIndexItem*) malloc(
         pIndexTable->_nbItems*sizeof(*pIndexTable->_pItems)
@@ -68,7 +151,7 @@ bool readIndexFile(const char* const fileName, tIndexTable* pIndexTable)
         fclose(pFile);
         return FALSE;
     }
-    // Then, read the data array.
+    // Then, read the data array (in one go, it may hold millions of items).
     result = fread(
         pIndexTable->_pItems, sizeof(*pIndexTable->_pItems),
         pIndexTable->_nbItems, pFile
@@ -79,12 +162,16 @@ bool readIndexFile(const char* const fileName, tIndexTable* pIndexTable)
             "Fail to read index file: '%s' (incorrect item array).\n",
             fileName
         );
+        free(pIndexTable->_pItems);
+        pIndexTable->_pItems = NULL;
         fclose(pFile);
         return FALSE;
     }
     // Lastly, close the index file.
     if(fclose(pFile) != 0){
         fprintf(stderr, "Fail to close input file: '%s'.\n", fileName);
+        free(pIndexTable->_pItems);
+        pIndexTable->_pItems = NULL;
         return FALSE;
     }
     return TRUE;
@@ -106,14 +193,15 @@ bool createIndexFile(const char* const outputDir,
         free(indexFilename);
         return FALSE;
     }
-    // First write number of items.
-    size_t result = fwrite(
-        &pIndexTable->_nbItems, sizeof(pIndexTable->_nbItems), 1, pFile
-    );
+    // First write the header (always in the current version).
+    const tIndexHeader header = {
+        INDEX_MAGIC, INDEX_VERSION, 0, pIndexTable->_nbItems
+    };
+    size_t result = fwrite(&header, sizeof(header), 1, pFile);
     if(result != 1){
         fprintf(
             stderr,
-            "Fail to write into index file: '%s' (index number).\n",
+            "Fail to write into index file: '%s' (header).\n",
             indexFilename
         );
         free(indexFilename);
@@ -173,7 +261,7 @@ char* buildBlockFileName(const char* const outputDir,
     strcat(blockFilename, DATA_BASENAME);
     sprintf(
         blockFilename + strlen(blockFilename),
-        "%0" NUM_2_STR(MAX_BLOCK_DIGITS) "d", blockNumber
+        "%0" NUM_2_STR(MAX_BLOCK_DIGITS) "u", blockNumber
     );
     return blockFilename;
 }
@@ -373,7 +461,7 @@ char* buildMapFileName(const char* const outputDir,
     strcat(mapFileName, DATA_BASENAME);
     sprintf(
         mapFileName + strlen(mapFileName),
-        "%0" NUM_2_STR(MAX_BLOCK_DIGITS) "d", blockNumber
+        "%0" NUM_2_STR(MAX_BLOCK_DIGITS) "u", blockNumber
     );
     strcat(mapFileName, MAP_BASENAME_END);
     return mapFileName;
@@ -395,11 +483,11 @@ bool readMapFile(const char* const fileName,
         }
         return FALSE;
     }
-    // First read the block header.
-    size_t result = fread(
-        &pBlockPacketMap->_header, sizeof(pBlockPacketMap->_header), 1, pFile
-    );
-    if(result != 1){
+    // First read the map header.
+    tMapFileHeader header;
+    if( (fread(&header, sizeof(header), 1, pFile) != 1) ||
+        (header._version != MAP_VERSION) )
+    {
         fprintf(
             stderr,
             "Fail to read map file: '%s' (incorrect header).\n",
@@ -408,46 +496,54 @@ bool readMapFile(const char* const fileName,
         fclose(pFile);
         return FALSE;
     }
-    // Allocate the item table.
-    pBlockPacketMap->_pItems = malloc(
-        pBlockPacketMap->_header._nbItems * sizeof(*pBlockPacketMap->_pItems)
-    );
-    if(pBlockPacketMap->_pItems == NULL){
+    // Allocate the map.
+    pBlockPacketMap->_header._packetTotal = header._packetTotal;
+    if(initMap(pBlockPacketMap) != TRUE){
+        fclose(pFile);
+        return FALSE;
+    }
+    if(header._encodedSize > getMapEncodingBound(pBlockPacketMap)){
         fprintf(
             stderr,
-            "Fail to allocate memory at %s line %d.\n",
-            __FILE__, __LINE__
+            "Fail to read map file: '%s' (incorrect size).\n",
+            fileName
         );
+        closeMap(pBlockPacketMap);
         fclose(pFile);
         return FALSE;
     }
-    // Then, read the payload.
-    result = fread(
-        pBlockPacketMap->_pItems, sizeof(*pBlockPacketMap->_pItems),
-        pBlockPacketMap->_header._nbItems, pFile
-    );
-    if(result != pBlockPacketMap->_header._nbItems){
+    unsigned char* const pBuffer = malloc(header._encodedSize + 1);
+    if(pBuffer == NULL){
         fprintf(
             stderr,
-            "Fail to read map file: '%s' (incorrect data).\n",
-            fileName
+            "Fail to allocate memory at %s line %d.\n",
+            __FILE__, __LINE__
         );
+        closeMap(pBlockPacketMap);
         fclose(pFile);
         return FALSE;
     }
-    // Check the end of file is reached (no ignored data should be there).
-    if(fgetc(pFile) != EOF){
+    // Then, read and decode the ranges (no ignored data should be there).
+    if( (fread(pBuffer, 1, header._encodedSize, pFile) !=
+            header._encodedSize) ||
+        (fgetc(pFile) != EOF) ||
+        (decodeMap(pBlockPacketMap, pBuffer, header._encodedSize) != TRUE) )
+    {
         fprintf(
             stderr,
-            "Fail to read map file: '%s' (remaining data).\n",
+            "Fail to read map file: '%s' (incorrect data).\n",
             fileName
         );
+        free(pBuffer);
+        closeMap(pBlockPacketMap);
         fclose(pFile);
         return FALSE;
     }
+    free(pBuffer);
     // Lastly, close the block file.
     if(fclose(pFile) != 0){
         fprintf(stderr, "Fail to close map file: '%s'.\n", fileName);
+        closeMap(pBlockPacketMap);
         return FALSE;
     }
     return TRUE;
@@ -462,14 +558,6 @@ bool createMapFile(const char* const outputDir, const tBlockNumber blockNumber,
         fprintf(stderr, "Max block number exceeded: %u.\n", blockNumber);
         return FALSE;
     }
-    // Check map number.
-    if(pBlockPacketMap->_header._nbItems > MAX_MAP_NUMBER){
-        fprintf(stderr,
-            "Max map item number exceeded: %u.\n",
-            pBlockPacketMap->_header._nbItems
-        );
-        return FALSE;
-    }
     // Build map filename.
     char* const mapFileName =
         malloc(strlen(outputDir) + (ADD_MAP_FILENAME_SIZE) + 1);
@@ -487,7 +575,7 @@ bool createMapFile(const char* const outputDir, const tBlockNumber blockNumber,
     strcat(mapFileName, DATA_BASENAME);
     sprintf(
         mapFileName + strlen(mapFileName),
-        "%0" NUM_2_STR(MAX_BLOCK_DIGITS) "d", blockNumber
+        "%0" NUM_2_STR(MAX_BLOCK_DIGITS) "u", blockNumber
     );
     strcat(mapFileName, MAP_BASENAME_END);
     // Open/create map file.
@@ -497,35 +585,39 @@ bool createMapFile(const char* const outputDir, const tBlockNumber blockNumber,
         free(mapFileName);
         return FALSE;
     }
-    // First write block header.
-    size_t result = fwrite(
-        &pBlockPacketMap->_header, sizeof(pBlockPacketMap->_header), 1, pFile
-    );
-    if(result != 1){
+    // Encode the map (received and missing ranges).
+    unsigned char* const pBuffer =
+        malloc(getMapEncodingBound(pBlockPacketMap));
+    if(pBuffer == NULL){
         fprintf(
             stderr,
-            "Fail to write into map file: '%s' (header).\n",
-            mapFileName
+            "Fail to allocate memory at %s line %d.\n",
+            __FILE__, __LINE__
         );
         free(mapFileName);
         fclose(pFile);
         return FALSE;
     }
-    // Then write block data.
-    result = fwrite(
-        pBlockPacketMap->_pItems, sizeof(*pBlockPacketMap->_pItems),
-        pBlockPacketMap->_header._nbItems, pFile
-    );
-    if(result != pBlockPacketMap->_header._nbItems){
+    tMapFileHeader header;
+    header._packetTotal = pBlockPacketMap->_header._packetTotal;
+    header._version = MAP_VERSION;
+    header._encodedSize = (uint32_t) encodeMap(pBlockPacketMap, pBuffer);
+    // Write the header, then the ranges.
+    if( (fwrite(&header, sizeof(header), 1, pFile) != 1) ||
+        (fwrite(pBuffer, 1, header._encodedSize, pFile) !=
+            header._encodedSize) )
+    {
         fprintf(
             stderr,
-            "Fail to write into map file: '%s' (data).\n",
+            "Fail to write into map file: '%s'.\n",
             mapFileName
         );
+        free(pBuffer);
         free(mapFileName);
         fclose(pFile);
         return FALSE;
     }
+    free(pBuffer);
     // Close the map file.
     if(fclose(pFile) != 0){
         fprintf(stderr, "Fail to close map file: '%s'.\n", mapFileName);
@@ -537,74 +629,145 @@ bool createMapFile(const char* const outputDir, const tBlockNumber blockNumber,
     return TRUE;
 }
 
-bool generateDataFile(const char* const fileName, const char* const outputDir)
+bool writePatternBlock(FILE* const pFile, const tIndexItem* const pItem)
 {
-    assert(outputDir != NULL);
-    // Build index filename.
-    char* const indexFilename = buildIndexFileName(outputDir);
-    // First read index file if present.
-    tIndexTable indexTable;
-    if(readIndexFile(indexFilename, &indexTable) == FALSE){
-        // Free index filename.
-        free(indexFilename);
-        // The index file does not exist, so nothing to be done.
+    assert((pFile != NULL) && (pItem != NULL));
+    const int fd = fileno(pFile);
+    const off_t blockEnd = pItem->_offset + pItem->_size;
+    if(fflush(pFile) != 0){
         return FALSE;
     }
-    // Free index filename (no more needed).
-    free(indexFilename);
-    // Then open output file.
-    FILE* const pFile = fopen(fileName, "wb+");
-    if(pFile == NULL){
-        fprintf(stderr, "Fail to open output file: '%s'.\n", fileName);
-        // Free index table.
-        free(indexTable._pItems);
+    if(pItem->_pattern == 0){
+        // Zeroes become a hole: grow the file if needed, then punch it.
+        struct stat buf;
+        if(fstat(fd, &buf) != 0){
+            return FALSE;
+        }
+        if((buf.st_size < blockEnd) && (ftruncate(fd, blockEnd) != 0)){
+            return FALSE;
+        }
+        if( (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                pItem->_offset, pItem->_size) != 0) &&
+            (errno != EOPNOTSUPP) )
+        {
+            return FALSE;
+        }
+        return (fseeko(pFile, blockEnd, SEEK_SET) == 0) ? TRUE : FALSE;
+    }
+    // Other patterns are written for real.
+    unsigned char chunk[4096];
+    memset(chunk, pItem->_pattern, sizeof(chunk));
+    if(fseeko(pFile, pItem->_offset, SEEK_SET) != 0){
         return FALSE;
     }
-    // Then read every block files.
-    char* const blockFilename =
-        malloc(strlen(outputDir) + (ADD_BLOCK_FILENAME_SIZE) + 1);
-    if(blockFilename == NULL){
+    tBlockSize remaining = pItem->_size;
+    while(remaining > 0){
+        const size_t size =
+            (remaining < sizeof(chunk)) ? remaining : sizeof(chunk);
+        if(fwrite(chunk, size, 1, pFile) != 1){
+            return FALSE;
+        }
+        remaining -= size;
+    }
+    return TRUE;
+}
+
+bool readBaseBlock(FILE* const pBaseFile, const tIndexItem* const pItem,
+    void* const pBuffer)
+{
+    assert((pItem != NULL) && (pItem->_type == BLOCK_TYPE_BASE));
+    if(pBaseFile == NULL){
+        return FALSE;
+    }
+    // Read into the caller buffer, or just check when there is none.
+    void* const pData = (pBuffer != NULL) ? pBuffer : malloc(pItem->_size);
+    if(pData == NULL){
         fprintf(
             stderr,
-            "Fail to allocate memory at %s line %d.\n", __FILE__, __LINE__
+            "Fail to allocate memory at %s line %d.\n",
+            __FILE__, __LINE__
         );
-        // Free index table.
-        free(indexTable._pItems);
         return FALSE;
     }
-    blockFilename[0] = '\0';
-    strcat(blockFilename, outputDir);
-    strcat(blockFilename, DIRECTORY_SEPARATOR);
-    strcat(blockFilename, DATA_BASENAME);
-    tDataBlock dataBlock = {{0, 0, 0, 0}, NULL};
-    const size_t blockFileNameIndex = strlen(blockFilename);
+    const bool result = (
+        (pread(fileno(pBaseFile), pData, pItem->_size, pItem->_reference) ==
+            (ssize_t) pItem->_size) &&
+        (fingerprintBlock(pData, pItem->_size) == pItem->_fingerprint)
+    ) ? TRUE : FALSE;
+    if(pBuffer == NULL){
+        free(pData);
+    }
+    return result;
+}
+
+bool completeDataFile(FILE* const pFile, const char* const fileName,
+    const tIndexTable* const pIndexTable, FILE* const pBaseFile)
+{
+    assert((pFile != NULL) && (pIndexTable != NULL));
+    // Data blocks are already in place, write the blocks sent as descriptors.
+    void* pBuffer = NULL;
+    bool result = TRUE;
     tBlockNumber i = 0;
-    for(; i < indexTable._nbItems; ++i){
-        sprintf(
-            blockFilename + blockFileNameIndex,
-            "%0" NUM_2_STR(MAX_BLOCK_DIGITS) "d",
-            indexTable._pItems[i]._number
-        );
-        readBlockFile(blockFilename, &dataBlock, TRUE);
-        // Append data block to file.
-        if(fwrite(dataBlock._pPayload,
-            dataBlock._header._payloadSize, 1, pFile) != 1)
+    for(; i < pIndexTable->_nbItems; ++i){
+        const tIndexItem* const pItem = &(pIndexTable->_pItems[i]);
+        if(pItem->_type == BLOCK_TYPE_DATA){
+            continue;
+        }
+        // Pattern blocks are generated.
+        if(pItem->_type == BLOCK_TYPE_PATTERN){
+            if(writePatternBlock(pFile, pItem) != TRUE){
+                fprintf(
+                    stderr,
+                    "Error writing pattern block %u to output file: '%s'.\n",
+                    pItem->_number, fileName
+                );
+                result = FALSE;
+                break;
+            }
+            continue;
+        }
+        void* const pData = realloc(pBuffer, pItem->_size);
+        if(pData == NULL){
+            fprintf(
+                stderr,
+                "Fail to allocate memory at %s line %d.\n",
+                __FILE__, __LINE__
+            );
+            result = FALSE;
+            break;
+        }
+        pBuffer = pData;
+        // Blocks of the previous release are copied from the base file,
+        // duplicate blocks from their canonical block (already written).
+        bool isRead = FALSE;
+        if(pItem->_type == BLOCK_TYPE_BASE){
+            isRead = readBaseBlock(pBaseFile, pItem, pBuffer);
+        }else if( (pItem->_type == BLOCK_TYPE_DUPLICATE) &&
+                  (pItem->_reference < pIndexTable->_nbItems) &&
+                  (fflush(pFile) == 0) )
+        {
+            const tIndexItem* const pCanonical =
+                &(pIndexTable->_pItems[pItem->_reference]);
+            isRead = (pread(fileno(pFile), pBuffer, pItem->_size,
+                pCanonical->_offset) == (ssize_t) pItem->_size) ? TRUE : FALSE;
+        }
+        if( (isRead != TRUE) ||
+            (fseeko(pFile, pItem->_offset, SEEK_SET) != 0) ||
+            (fwrite(pBuffer, pItem->_size, 1, pFile) != 1) )
         {
             fprintf(
                 stderr,
-                "Error appending to output file: '%s'.\n",
-                fileName
+                "Error copying block %u to output file: '%s'.\n",
+                pItem->_number, fileName
             );
-            // Free data block.
-            free(dataBlock._pPayload);
+            result = FALSE;
             break;
         }
-        // Free data block.
-        free(dataBlock._pPayload);
     }
-    // Free block filename.
-    free(blockFilename);
-    // Free index table.
-    free(indexTable._pItems);
-    return TRUE;
-}
\ No newline at end of file
+    free(pBuffer);
+    if(fflush(pFile) != 0){
+        fprintf(stderr, "Fail to write output file: '%s'.\n", fileName);
+        return FALSE;
+    }
+    return result;
+}
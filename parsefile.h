@@ -15,7 +15,8 @@
 #define PARSEFILE_H
 
 #include "types.h"          /* bool, tIndexTable, pDataBlock */
-#include "blockpacketmap.h" /*  */
+#include "blockpacketmap.h" /* tBlockPacketMap */
+#include <stdio.h>          /* FILE */
 
 #ifdef __cplusplus
 extern "C" {
@@ -38,7 +39,11 @@ bool readMapFile(const char* const fileName,
     tBlockPacketMap* const pBlockPacketMap);
 bool createMapFile(const char* const outputDir, const tBlockNumber blockNumber,
     tBlockPacketMap* const pBlockPacketMap);
-bool generateDataFile(const char* const fileName, const char* const outputDir);
+bool writePatternBlock(FILE* const pFile, const tIndexItem* const pItem);
+bool readBaseBlock(FILE* const pBaseFile, const tIndexItem* const pItem,
+    void* const pBuffer);
+bool completeDataFile(FILE* const pFile, const char* const fileName,
+    const tIndexTable* const pIndexTable, FILE* const pBaseFile);
 
 #ifdef __cplusplus
 }
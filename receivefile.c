@@ -1,382 +1,1153 @@
+#define _GNU_SOURCE         /* struct mmsghdr */
 #include "receivefile.h"
-#include "splitfile.h"      /* createOutputDir, resetOuputDir */
-#include "crc32.h"          /* crc32c */
+#include "splitfile.h"      /* createOutputDir */
 #include "macros.h"         /* NUM_2_STR */
 #include "types.h"          /* tChecksum */
-#include "constantes.h"     /* INVALID_BLOCK_NUMBER */
+#include "constantes.h"     /* INVALID_BLOCK_NUMBER, MAX_BLOCK_TOTAL,
+                               REPAIR_MAX_BLOCKS */
 #include "client.h"
+#include "packetring.h"     /* tPacketRing, acquireBatch, releaseBatch,
+                               wakeConsumer, isRingStopping */
+#include "ringclient.h"     /* tRingClient, initRingClient */
+#include "packetfilter.h"   /* tPacketFilter, updatePacketFilter */
 #include "blockpacketmap.h"
+#include "blockwindow.h"    /* tBlockWindow, openAssembly, adoptAssembly,
+                               releaseAssembly, discardAssembly,
+                               removeStoredBlocks */
+#include "blockworker.h"    /* tBlockWorker, pushBlock, popInvalidBlock */
+#include "blockstream.h"    /* tBlockStream, notifyBlockStream */
 #include "parsefile.h"
+#include "journal.h"        /* tJournal, openJournal, forgetBlock */
+#include "bitmap.h"         /* tBitmap, setBit, setRange, isBitmapFull */
+#include "repair.h"         /* tRepairPeer, startRepairPeer, stopRepairPeer */
+#include "catchup.h"        /* tCatchupClient, startCatchupClient */
 #include <stddef.h>         /* NULL */
-#include <stdlib.h>         /* EXIT_SUCCESS, malloc, calloc, free */
-#include <stdio.h>          /* fprintf, stderr */
+#include <stdlib.h>         /* EXIT_FAILURE, exit, malloc, free */
+#include <stdio.h>          /* fprintf, stderr, remove */
 #include <assert.h>         /* assert */
-#include <string.h>         /* memcpy */
-#include <errno.h>          /* errno, EEXIST */
+#include <string.h>         /* memcpy, strerror, strlen, strcat */
+#include <errno.h>          /* errno, ETIMEDOUT */
+#include <inttypes.h>       /* PRIu64 */
+#include <fcntl.h>          /* open, O_WRONLY */
+#include <unistd.h>         /* ftruncate, sysconf, close, STDOUT_FILENO */
+#include <sys/stat.h>       /* stat, S_ISFIFO */
+#include <stdatomic.h>      /* atomic_bool, atomic_flag */
+#include <pthread.h>        /* pthread_create, pthread_join */
+#include <semaphore.h>      /* sem_t, sem_timedwait, sem_post */
+#include <time.h>           /* time, clock_gettime, struct timespec */
 
-bool allocateIndexTable(tIndexTable* const pIndexTable,
-                        const tDataPacket* const pDataPacket)
+/*
+ * Complete the described blocks, in the index table and the blocks read.
+ * Base blocks not found in the previous file are left missing (counted),
+ * they may still be pulled as data blocks. Return TRUE when the last block
+ * missing was among them.
+ */
+static bool applyDescriptors(tIndexTable* const pIndexTable,
+                             const tDataPacket* const pDataPacket,
+                             FILE* const pBaseFile, tBitmap* const pBlocksRead,
+                             tBlockNumber* const pNbUnresolved)
 {
     assert((pIndexTable != NULL) && (pDataPacket != NULL));
-    // Allocate the index table.
-    if(pDataPacket->_header._blockTotal > MAX_BLOCK_NUMBER){
+    const tIndexItem* const pDescriptors = pDataPacket->_pPayload;
+    const size_t nbDescriptors =
+        pDataPacket->_header._payloadSize / sizeof(*pDescriptors);
+    bool isLast = FALSE;
+    size_t i = 0;
+    for(; i < nbDescriptors; ++i){
+        const tIndexItem* const pDescriptor = &(pDescriptors[i]);
+        if( (pDescriptor->_number >= pIndexTable->_nbItems) ||
+            (pDescriptor->_type == BLOCK_TYPE_DATA) ||
+            ( (pDescriptor->_type == BLOCK_TYPE_DUPLICATE) &&
+              (pDescriptor->_reference >= pIndexTable->_nbItems) ) )
+        {
+            fprintf(
+                stderr,
+                "Invalid block descriptor received: number %u, type %u.\n",
+                pDescriptor->_number, pDescriptor->_type
+            );
+            continue;
+        }
+        // Nothing else is needed, the block is complete as soon as described.
+        tIndexItem* const pItem = &(pIndexTable->_pItems[pDescriptor->_number]);
+        // A resumed block is replaced when described otherwise.
+        if( (pItem->_number == INVALID_BLOCK_NUMBER) ||
+            (memcmp(pItem, pDescriptor, sizeof(*pItem)) != 0) )
+        {
+            // Blocks of a delta session must be found in the previous file.
+            if( (pDescriptor->_type == BLOCK_TYPE_BASE) &&
+                (readBaseBlock(pBaseFile, pDescriptor, NULL) != TRUE) )
+            {
+                ++(*pNbUnresolved);
+                continue;
+            }
+            *pItem = *pDescriptor;
+            if(setBit(pBlocksRead, pDescriptor->_number) == TRUE){
+                isLast = TRUE;
+            }
+        }
+    }
+    return isLast;
+}
+
+/*
+ * Size the whole output file once its size is known (the end of the last
+ * block), blocks are then written in place. Nothing is allocated ahead,
+ * pattern blocks of zeroes stay holes.
+ */
+static bool reserveOutputFile(FILE* const pFile, const char* const fileName,
+                              const tBlockOffset size)
+{
+    if(ftruncate(fileno(pFile), size) != 0){
         fprintf(
             stderr,
-            "Number of blocks exceeds maximum authorized: "
-                "%u > " NUM_2_STR(MAX_BLOCK_NUMBER) ".\n",
-            pDataPacket->_header._blockTotal
+            "Fail to reserve %" PRIu64 " bytes for output file: '%s' "
+                "(%d: %s).\n",
+            (uint64_t) size, fileName, errno, strerror(errno)
         );
         return FALSE;
     }
-    // Allocate the index table (set it to zero).
-    pIndexTable->_pItems = calloc(
-        pDataPacket->_header._blockTotal, sizeof(*pIndexTable->_pItems)
-    );
-    if(pIndexTable->_pItems == NULL){
+    return TRUE;
+}
+
+/*
+ * State shared by the assemblers. Each assembler owns the blocks of its
+ * share (block number modulo the number of assemblers) and their window.
+ * Index table items are only written by the owner of their block (the
+ * descriptors of a packet are handed over to theirs). Settled blocks are
+ * the data blocks whose packets are ignored for sure (received, or resumed
+ * and confirmed by the sender checksum), the socket filter drops them. When
+ * streaming, the output file is the spool of the stream. A growing session
+ * (a live source) is sized for the most blocks it may hold, its block total
+ * is only known (non zero) once the sender ended it. Base blocks missing
+ * from the previous file are only received by a catch-up.
+ */
+typedef struct sReceiveSession{
+    const char*         _fileName;
+    const char*         _outputDir;
+    FILE*               _pFile;
+    FILE*               _pBaseFile;
+    tJournal            _journal;
+    tPacketRing         _packetRing;
+    tBlockWorker        _blockWorker;
+    tBlockStream*       _pStream;
+    tIndexTable         _indexTable;
+    pthread_mutex_t     _indexMutex;
+    atomic_bool         _isIndexed;
+    bool                _isGrowing;
+    _Atomic tBlockNumber _blockTotal;
+    tBitmap             _blocksRead;
+    tBitmap             _blocksSettled;
+    atomic_flag         _isReserved;
+    atomic_bool         _isBaseMissing;
+    sem_t               _complete;
+    uint32_t            _nbAssemblers;
+    struct sAssembler*  _pAssemblers;
+} tReceiveSession;
+
+// Block completed otherwise than by its packets (its payload is NULL when
+// only described).
+typedef struct sRepairedBlock{
+    tIndexItem          _item;
+    tDataBlock          _dataBlock;
+} tRepairedBlock;
+
+/*
+ * Blocks repaired by other threads (or described by a packet of another
+ * share) are handed over to the assembler owning them (it is woken up),
+ * which completes them in turn with its packets.
+ */
+typedef struct sAssembler{
+    tReceiveSession*    _pSession;
+    uint32_t            _share;
+    tBlockWindow        _blockWindow;
+    pthread_mutex_t     _repairedMutex;
+    tRepairedBlock*     _pRepaired;
+    size_t              _nbRepaired;
+    size_t              _maxRepaired;
+    pthread_t           _thread;
+} tAssembler;
+
+// Mark a block read, the one reading the last block wakes the session up.
+static void markBlockRead(tReceiveSession* const pSession,
+                          const tBlockNumber blockNumber)
+{
+    if(setBit(&pSession->_blocksRead, blockNumber) == TRUE){
+        sem_post(&pSession->_complete);
+    }
+}
+
+/*
+ * Tell the session base blocks are missing from the previous file (once),
+ * only a catch-up may complete it.
+ */
+static void markBaseMissing(tReceiveSession* const pSession)
+{
+    if(atomic_exchange(&pSession->_isBaseMissing, TRUE) == FALSE){
+        sem_post(&pSession->_complete);
+    }
+}
+
+/*
+ * Open the index table on the first received block (once for all), from
+ * the journal of a previous receive when it matches.
+ */
+static bool openIndexTable(tReceiveSession* const pSession,
+                           const tDataPacketHeader* const pHeader)
+{
+    if(atomic_load_explicit(&pSession->_isIndexed, memory_order_acquire)
+        == TRUE)
+    {
+        return TRUE;
+    }
+    pthread_mutex_lock(&pSession->_indexMutex);
+    if(atomic_load(&pSession->_isIndexed) == TRUE){
+        pthread_mutex_unlock(&pSession->_indexMutex);
+        return TRUE;
+    }
+    if(pHeader->_blockTotal > MAX_BLOCK_TOTAL){
         fprintf(
             stderr,
-            "Fail to allocate memory at %s line %d.\n",
-            __FILE__, __LINE__
+            "Number of blocks exceeds maximum authorized: "
+                "%u > " NUM_2_STR(MAX_BLOCK_TOTAL) ".\n",
+            pHeader->_blockTotal
         );
+        pthread_mutex_unlock(&pSession->_indexMutex);
         return FALSE;
     }
-    // Update index table size.
-    pIndexTable->_nbItems = pDataPacket->_header._blockTotal;
-    // Initialize index table values.
-    const tIndexItem initItem = {INVALID_BLOCK_NUMBER, 0};
+    const bool isGrowing =
+        ((pHeader->_flags & PACKET_FLAG_GROWING) != 0) ? TRUE : FALSE;
+    const tBlockNumber blockTotal = (isGrowing == TRUE) ?
+        LIVE_MAX_BLOCKS : pHeader->_blockTotal;
+    bool isResumed = FALSE;
+    if(openJournal(
+        &pSession->_journal, pSession->_outputDir, blockTotal,
+        pHeader->_session, &isResumed
+    ) != TRUE)
+    {
+        exit(EXIT_FAILURE);
+    }
+    const int fd = fileno(pSession->_pFile);
+    if( (initBitmap(&pSession->_blocksRead, blockTotal) != TRUE) ||
+        (initBitmap(&pSession->_blocksSettled, blockTotal) != TRUE) )
+    {
+        exit(EXIT_FAILURE);
+    }
+    tBlockNumber nbKept = 0;
+    if(isResumed == TRUE){
+        // Keep what the output file really holds.
+        nbKept = checkJournal(&pSession->_journal, fd);
+        fprintf(
+            stderr,
+            "Resuming receive: %u of %u blocks already received.\n",
+            nbKept, blockTotal
+        );
+    }else{
+        // Blocks stored by a previous receive are not restored either.
+        removeStoredBlocks(pSession->_outputDir);
+        if(ftruncate(fd, 0) != 0){
+            fprintf(
+                stderr,
+                "Fail to truncate output file: '%s' (%d: %s).\n",
+                pSession->_fileName, errno, strerror(errno)
+            );
+            exit(EXIT_FAILURE);
+        }
+    }
+    pSession->_indexTable._pItems = pSession->_journal._pItems;
+    pSession->_indexTable._nbItems = blockTotal;
+    pSession->_isGrowing = isGrowing;
+    atomic_store(&pSession->_blockTotal, (isGrowing == TRUE) ? 0 : blockTotal);
+    // The stream is indexed before the session may end.
+    if(pSession->_pStream != NULL){
+        indexBlockStream(
+            pSession->_pStream, &pSession->_indexTable, &pSession->_journal,
+            &pSession->_blocksRead, &pSession->_blocksSettled
+        );
+    }
+    atomic_store_explicit(&pSession->_isIndexed, TRUE, memory_order_release);
+    pthread_mutex_unlock(&pSession->_indexMutex);
+    // Blocks kept from the journal are already read.
     tBlockNumber i = 0;
-    for(; i < pIndexTable->_nbItems; ++i){
-        pIndexTable->_pItems[i] = initItem;
+    for(; (nbKept != 0) && (i < pSession->_indexTable._nbItems); ++i){
+        if(pSession->_indexTable._pItems[i]._number != INVALID_BLOCK_NUMBER){
+            markBlockRead(pSession, i);
+        }
     }
     return TRUE;
 }
 
-bool restoreBlockFromMapFile(const char* const outputDir,
-                             const tBlockNumber blockNumber,
-                             tBlockPacketMap* const pBlockPacketMap,
-                             tDataBlock* const pDataBlock)
+/*
+ * End a growing session with the block total the sender told (once for
+ * all): the blocks beyond are never sent, they are taken as read.
+ */
+static void endLiveSession(tReceiveSession* const pSession,
+                           const tBlockNumber blockTotal)
 {
-    // Build map filename.
-    char* const mapFileName = buildMapFileName(outputDir, blockNumber);
-    if(mapFileName == NULL){
-        return FALSE;
+    tBlockNumber expected = 0;
+    if( (blockTotal == 0) ||
+        (atomic_compare_exchange_strong(
+            &pSession->_blockTotal, &expected, blockTotal) != TRUE) )
+    {
+        return;
     }
-    // Read block packet map if available.
-    if(readMapFile(mapFileName, pBlockPacketMap) == TRUE){
-        // Remove it if successfully read.
-        if(remove(mapFileName) != 0){
-            fprintf(
-                stderr,
-                "Fail to remove map file: '%s' (%d: %s).\n",
-                mapFileName, errno, strerror(errno)
-            );
-        }
-        // Build block filename.
-        char* const blockFileName = buildBlockFileName(outputDir, blockNumber);
-        if(blockFileName == NULL){
-            // Free block packet map.
-            closeMap(pBlockPacketMap);
-            // Free map filename.
-            free(mapFileName);
+    const tBlockNumber nbItems = pSession->_indexTable._nbItems;
+    setRange(&pSession->_blocksSettled, blockTotal, nbItems);
+    setRange(&pSession->_blocksRead, blockTotal, nbItems);
+    if(pSession->_pStream != NULL){
+        endBlockStream(pSession->_pStream, blockTotal);
+    }
+    sem_post(&pSession->_complete);
+}
+
+// Reserve the output file the first time its size is known.
+static void reserveSessionFile(tReceiveSession* const pSession,
+                               const tBlockOffset size)
+{
+    if(atomic_flag_test_and_set(&pSession->_isReserved) == FALSE){
+        reserveOutputFile(pSession->_pFile, pSession->_fileName, size);
+    }
+}
+
+/*
+ * Take back the blocks the workers found invalid, they are received again.
+ * Every block looks read, wait for the workers to be sure of it.
+ */
+static bool checkBlocksRead(tReceiveSession* const pSession)
+{
+    waitBlockWorker(&pSession->_blockWorker);
+    tBlockNumber blockNumber = INVALID_BLOCK_NUMBER;
+    while(popInvalidBlock(&pSession->_blockWorker, &blockNumber) == TRUE){
+        forgetBlock(&pSession->_journal, blockNumber);
+        clearBit(&pSession->_blocksSettled, blockNumber);
+        clearBit(&pSession->_blocksRead, blockNumber);
+    }
+    return isBitmapFull(&pSession->_blocksRead);
+}
+
+/*
+ * Tell whether a block owned by the assembler is still wanted: neither read
+ * nor resumed (a block resumed from another transfer, the checksum differs,
+ * is taken back).
+ */
+static bool isBlockWanted(tAssembler* const pAssembler,
+                          const tDataPacketHeader* const pHeader)
+{
+    tReceiveSession* const pSession = pAssembler->_pSession;
+    tIndexTable* const pIndexTable = &pSession->_indexTable;
+    // The last block tells the output file size.
+    if((pHeader->_blockNumber + 1) == pIndexTable->_nbItems){
+        reserveSessionFile(
+            pSession, pHeader->_blockOffset + pHeader->_rawSize
+        );
+    }
+    // Get the index table item for this block.
+    tIndexItem* const pItem = &(pIndexTable->_pItems[pHeader->_blockNumber]);
+    // Check the block as not already been retrieved.
+    if(pItem->_number != INVALID_BLOCK_NUMBER){
+        // Unless resumed from another transfer (the checksum differs).
+        if( (pItem->_type != BLOCK_TYPE_DATA) ||
+            (pItem->_reference == pHeader->_checksum) )
+        {
+            // The sender confirms a resumed block.
+            if( (pItem->_type == BLOCK_TYPE_DATA) &&
+                (getBit(&pSession->_blocksSettled, pHeader->_blockNumber)
+                    != TRUE) )
+            {
+                setBit(&pSession->_blocksSettled, pHeader->_blockNumber);
+                if(pSession->_pStream != NULL){
+                    notifyBlockStream(pSession->_pStream);
+                }
+            }
             return FALSE;
         }
-        // Read block file.
-        if(readBlockFile(blockFileName, pDataBlock, FALSE) != TRUE){
-            // Free block packet map.
-            closeMap(pBlockPacketMap);
-        }else{
-            // Free map filename.
-            free(mapFileName);
-            // Free block filename.
-            free(blockFileName);
-            return TRUE;
-        }
-        // Free block filename.
-        free(blockFileName);
+        forgetBlock(&pSession->_journal, pHeader->_blockNumber);
+        clearBit(&pSession->_blocksRead, pHeader->_blockNumber);
     }
-    // Free map filename.
-    free(mapFileName);
-    return FALSE;
+    return TRUE;
 }
 
-void receiveFile(const char* const fileName, const char* const outputDir,
-    const char* const localAddr, const char* const multAddr,
-    const uint16_t port)
+// Complete an assembled block, the workers check and write it.
+static void completeAssembly(tAssembler* const pAssembler,
+                             tAssemblyBlock* const pAssembly)
+{
+    tReceiveSession* const pSession = pAssembler->_pSession;
+    tDataBlock* const pDataBlock = &pAssembly->_dataBlock;
+    // Update the index table (marked it as completed).
+    tIndexItem* const pItem =
+        &(pSession->_indexTable._pItems[pDataBlock->_header._blockNumber]);
+    pItem->_offset = pDataBlock->_header._offset;
+    pItem->_size = pDataBlock->_header._rawSize;
+    pItem->_type = BLOCK_TYPE_DATA;
+    pItem->_reference = pDataBlock->_header._checksum;
+    pItem->_number = pDataBlock->_header._blockNumber;
+    // Let the workers check and write it.
+    pushBlock(&pSession->_blockWorker, pDataBlock);
+    // Leave the window.
+    releaseAssembly(&pAssembler->_blockWindow, pAssembly);
+    setBit(&pSession->_blocksSettled, pItem->_number);
+    markBlockRead(pSession, pItem->_number);
+    // The block may already be written.
+    if(pSession->_pStream != NULL){
+        notifyBlockStream(pSession->_pStream);
+    }
+}
+
+// Complete a described block (received, or pulled from the sender).
+static void completeDescribedBlock(tReceiveSession* const pSession,
+                                   const tIndexItem* const pItem)
 {
-    assert((fileName != NULL) && (outputDir != NULL));
-    // Create output files directory.
-    createOutputDir(outputDir);
-    // Reset previous output files.
-    resetOuputDir(outputDir);
-    // Initialize client.
-    const int sd = initClient(localAddr, multAddr, port);
     tDataPacket dataPacket;
-    tIndexTable indexTable = {0, NULL};
-    tDataBlock dataBlock = {{0, 0, 0, 0}, NULL};
-    tBlockNumber nbBlockRead = 0;
-    tBlockPacketMap blockPacketMap = {{0, 0}, NULL};
-    tPacketSize maxPacketSize = 0;
-    for(;;){
-        // Read incoming data packet by packet.
-        if(readPacket(sd, &dataPacket) != TRUE){
-            continue;
+    memset(&dataPacket, 0, sizeof(dataPacket));
+    dataPacket._header._type = PACKET_TYPE_DESCRIPTOR;
+    dataPacket._header._payloadSize = sizeof(*pItem);
+    dataPacket._pPayload = (void*) pItem;
+    tBlockNumber nbUnresolved = 0;
+    if(applyDescriptors(
+        &pSession->_indexTable, &dataPacket, pSession->_pBaseFile,
+        &pSession->_blocksRead, &nbUnresolved
+    ) == TRUE)
+    {
+        sem_post(&pSession->_complete);
+    }
+    if(nbUnresolved != 0){
+        markBaseMissing(pSession);
+    }
+    if((pItem->_number + 1) == pSession->_indexTable._nbItems){
+        reserveSessionFile(pSession, pItem->_offset + pItem->_size);
+    }
+    if(pSession->_pStream != NULL){
+        notifyBlockStream(pSession->_pStream);
+    }
+}
+
+// Hand a block over to the assembler owning it (described when no payload).
+static void handOverBlock(tReceiveSession* const pSession,
+                          const tIndexItem* const pItem,
+                          tDataBlock* const pDataBlock)
+{
+    const uint32_t share = pItem->_number % pSession->_nbAssemblers;
+    tAssembler* const pAssembler = &(pSession->_pAssemblers[share]);
+    pthread_mutex_lock(&pAssembler->_repairedMutex);
+    if(pAssembler->_nbRepaired == pAssembler->_maxRepaired){
+        const size_t maxRepaired = (pAssembler->_maxRepaired == 0) ?
+            REPAIR_MAX_BLOCKS : 2*pAssembler->_maxRepaired;
+        tRepairedBlock* const pRepaired = realloc(
+            pAssembler->_pRepaired, maxRepaired*sizeof(*pRepaired)
+        );
+        if(pRepaired == NULL){
+            pthread_mutex_unlock(&pAssembler->_repairedMutex);
+            fprintf(
+                stderr,
+                "Fail to allocate memory at %s line %d.\n",
+                __FILE__, __LINE__
+            );
+            if(pDataBlock != NULL){
+                free(pDataBlock->_pPayload);
+            }
+            return;
         }
-        // Allocate the index table on the first received block.
-        if(indexTable._pItems == NULL){
-            // Try to allocate the index table.
-            if(allocateIndexTable(&indexTable, &dataPacket) != TRUE){
-                // Ignore the packet.
-                goto free_packet;
+        pAssembler->_pRepaired = pRepaired;
+        pAssembler->_maxRepaired = maxRepaired;
+    }
+    tRepairedBlock* const pRepaired =
+        &(pAssembler->_pRepaired[pAssembler->_nbRepaired++]);
+    pRepaired->_item = *pItem;
+    if(pDataBlock != NULL){
+        pRepaired->_dataBlock = *pDataBlock;
+    }else{
+        memset(&pRepaired->_dataBlock, 0, sizeof(pRepaired->_dataBlock));
+    }
+    pthread_mutex_unlock(&pAssembler->_repairedMutex);
+    wakeConsumer(&pSession->_packetRing, share);
+}
+
+// Put a packet of a block owned by the assembler at its place.
+static void assemblePacket(tAssembler* const pAssembler,
+                           const tDataPacket* const pDataPacket)
+{
+    tReceiveSession* const pSession = pAssembler->_pSession;
+    /*
+     * Descriptor packets complete blocks without any payload. A run of them
+     * may cross shards: each is completed by the owner of its block.
+     */
+    if(pDataPacket->_header._type == PACKET_TYPE_DESCRIPTOR){
+        const tIndexItem* const pDescriptors = pDataPacket->_pPayload;
+        size_t i = 0;
+        for(; i < (pDataPacket->_header._payloadSize /
+            sizeof(*pDescriptors)); ++i)
+        {
+            if((pDescriptors[i]._number % pSession->_nbAssemblers) ==
+                pAssembler->_share)
+            {
+                completeDescribedBlock(pSession, &(pDescriptors[i]));
+            }else{
+                handOverBlock(pSession, &(pDescriptors[i]), NULL);
             }
         }
-        // Check the block total number are consistent with the previous one.
-        else if(indexTable._nbItems != dataPacket._header._blockTotal){
+        return;
+    }
+    if(isBlockWanted(pAssembler, &pDataPacket->_header) != TRUE){
+        // Ignore the packet.
+        return;
+    }
+    // Find the block being assembled, or start assembling it.
+    tAssemblyBlock* const pAssembly =
+        openAssembly(&pAssembler->_blockWindow, &pDataPacket->_header);
+    if(pAssembly == NULL){
+        // Ignore the packet.
+        return;
+    }
+    tDataBlock* const pDataBlock = &pAssembly->_dataBlock;
+    tBlockPacketMap* const pBlockPacketMap = &pAssembly->_blockPacketMap;
+    // Check the packet as not already been retrieved.
+    if(getMap(pBlockPacketMap, pDataPacket->_header._packetNumber) == TRUE){
+        // Ignore the packet.
+        return;
+    }
+    // Check packet total consistency.
+    else if(pBlockPacketMap->_header._packetTotal !=
+        pDataPacket->_header._packetTotal)
+    {
+        fprintf(
+            stderr,
+            "Inconsistent packet total number received: %u != %u.\n",
+            pBlockPacketMap->_header._packetTotal,
+            pDataPacket->_header._packetTotal
+        );
+        // Ignore the packet.
+        return;
+    }
+    // Check checksum consistency.
+    else if(pDataBlock->_header._checksum !=
+        pDataPacket->_header._checksum)
+    {
+        fprintf(
+            stderr,
+            "Inconsistent packet checksum received: %u != %u.\n",
+            pDataBlock->_header._checksum,
+            pDataPacket->_header._checksum
+        );
+        // Ignore the packet.
+        return;
+    }
+    // Learn the packet size from a regular packet (restored blocks).
+    else if( (pAssembly->_maxPacketSize == 0) &&
+             (pDataPacket->_header._packetNumber !=
+                (pDataPacket->_header._packetTotal - 1)) )
+    {
+        pAssembly->_maxPacketSize = pDataPacket->_header._payloadSize;
+    }
+    const tPacketSize maxPacketSize = pAssembly->_maxPacketSize;
+    // The packet size is not known yet, wait for a regular packet.
+    if(maxPacketSize == 0){
+        // Ignore the packet.
+        return;
+    }
+    // Adjust data block payload if this is the last packet.
+    if(pDataPacket->_header._packetNumber ==
+        (pDataPacket->_header._packetTotal - 1))
+    {
+        // The last packet size can not be greater than the previous ones.
+        if(pDataPacket->_header._payloadSize > maxPacketSize){
             fprintf(
                 stderr,
-                "Inconsistent block total number received: %u != %u.\n",
-                indexTable._nbItems,
-                dataPacket._header._blockTotal
+                "Inconsistent packet payload size received: %u != %u.\n",
+                pDataPacket->_header._payloadSize, maxPacketSize
             );
             // Ignore the packet.
-            goto free_packet;
+            return;
         }
-        // Check if the block number is expected.
-        if(
-            (dataBlock._pPayload != NULL) &&
-            (dataPacket._header._blockNumber != dataBlock._header._blockNumber)
-        )
+        pDataBlock->_header._payloadSize -= (
+            maxPacketSize - pDataPacket->_header._payloadSize
+        );
+    }
+    // Check the block will not overflow.
+    const tBlockSize blockOffset =
+        maxPacketSize*pDataPacket->_header._packetNumber;
+    if((blockOffset + pDataPacket->_header._payloadSize) >
+        pDataBlock->_header._payloadSize)
+    {
+        fprintf(
+            stderr,
+            "Invalid payload size received: %zu + %u > %zu.\n",
+            blockOffset,
+            pDataPacket->_header._payloadSize,
+            pDataBlock->_header._payloadSize
+        );
+        // Ignore the packet.
+        return;
+    }
+    // Put the packet at its place in the block.
+    memcpy(
+        pDataBlock->_pPayload + blockOffset,
+        pDataPacket->_pPayload,
+        pDataPacket->_header._payloadSize
+    );
+    // Update the next packet number, the block is complete with its last bit.
+    if(setMap(pBlockPacketMap, pDataPacket->_header._packetNumber) == TRUE){
+        completeAssembly(pAssembler, pAssembly);
+    }
+}
+
+/*
+ * Put the packets of a block received in place: its buffer is adopted when
+ * the block is new, otherwise they are put at their place like received.
+ * The run buffer is freed unless adopted.
+ */
+static void assembleRun(tAssembler* const pAssembler,
+                        tPacketRun* const pRun)
+{
+    if(isBlockWanted(pAssembler, &pRun->_header) == TRUE){
+        tDataPacketHeader header = pRun->_header;
+        header._payloadSize = pRun->_packetSize;
+        tAssemblyBlock* pAssembly = NULL;
+        if(adoptAssembly(
+            &pAssembler->_blockWindow, &header, pRun->_pPayload, &pRun->_map,
+            &pAssembly
+        ) == TRUE)
         {
-#ifdef DISCARD_BLOCK_WITH_NEXT_ONE
-            if( (dataPacket._header._blockNumber ==
-                    (dataBlock._header._blockNumber + 1)) ||
-                (
-                    ((dataBlock._header._blockNumber + 1) ==
-                        indexTable._nbItems) &&
-                    (dataPacket._header._blockNumber == 0) &&
-                    (indexTable._nbItems != 1)
-                ) )
-            {
-                // Write the data block (what is available).
-                if(createBlockFile(outputDir, &dataBlock, FALSE) != FALSE){
-                    // Write the block map file.
-                    createMapFile(
-                        outputDir, dataBlock._header._blockNumber,
-                        &blockPacketMap
-                    );
+            // The last packet is only as large as it came.
+            if(pRun->_lastSize != 0){
+                pAssembly->_dataBlock._header._payloadSize -=
+                    (pRun->_packetSize - pRun->_lastSize);
+            }
+            if(isMapFull(&pAssembly->_blockPacketMap) == TRUE){
+                completeAssembly(pAssembler, pAssembly);
+            }
+            return;
+        }
+        tPacketNumber first = 0;
+        tPacketNumber end = 0;
+        while( (first < header._packetTotal) &&
+               (findMapRange(&pRun->_map, first, TRUE, &first, &end)
+                    == TRUE) )
+        {
+            for(; first < end; ++first){
+                tDataPacket dataPacket = {
+                    header, pRun->_pPayload + (size_t) first*pRun->_packetSize
+                };
+                dataPacket._header._packetNumber = first;
+                if(first == (header._packetTotal - 1)){
+                    dataPacket._header._payloadSize = pRun->_lastSize;
                 }
-                // Free block packet map.
-                closeMap(&blockPacketMap);
-                // Reset data block.
-                free(dataBlock._pPayload);
-                dataBlock._pPayload = NULL;
-                // Try to restore previously stored block and map state.
-                restoreBlockFromMapFile(
-                    outputDir, dataPacket._header._blockNumber,
-                    &blockPacketMap, &dataBlock
-                );
-            }else{
-                // Ignore the packet.
-                goto free_packet;
+                assemblePacket(pAssembler, &dataPacket);
             }
-#else
-            // Ignore the packet.
-            goto free_packet;
-#endif /* DISCARD_BLOCK_WITH_NEXT_ONE */
         }
-        // Get the index table item for this block.
-        tIndexItem* const pItem =
-            &(indexTable._pItems[dataPacket._header._blockNumber]);
-        // Check the block as not already been retrieved.
-        if(pItem->_number != INVALID_BLOCK_NUMBER){
-            // Ignore the packet.
-            goto free_packet;
+    }
+    closePacketRun(pRun);
+}
+
+// Complete a block repaired from a peer, by the assembler owning it.
+static void completeRepairedBlock(void* const pContext,
+                                  tDataBlock* const pDataBlock,
+                                  const uint64_t reference)
+{
+    const tIndexItem item = {
+        pDataBlock->_header._blockNumber, BLOCK_TYPE_DATA, 0, 0,
+        pDataBlock->_header._offset, pDataBlock->_header._rawSize,
+        reference, 0
+    };
+    handOverBlock(pContext, &item, pDataBlock);
+}
+
+/*
+ * Complete a repaired block owned by the assembler, unless received
+ * meanwhile. The packets assembled (or stored) so far are dropped.
+ */
+static void completeHandedBlock(tAssembler* const pAssembler,
+                                tRepairedBlock* const pRepaired)
+{
+    tReceiveSession* const pSession = pAssembler->_pSession;
+    tDataBlock* const pDataBlock = &pRepaired->_dataBlock;
+    if(pDataBlock->_pPayload == NULL){
+        completeDescribedBlock(pSession, &pRepaired->_item);
+        return;
+    }
+    const tBlockNumber blockNumber = pRepaired->_item._number;
+    tIndexItem* const pItem = &(pSession->_indexTable._pItems[blockNumber]);
+    if( (getBit(&pSession->_blocksRead, blockNumber) == TRUE) ||
+        (pItem->_number != INVALID_BLOCK_NUMBER) )
+    {
+        free(pDataBlock->_pPayload);
+        return;
+    }
+    if((blockNumber + 1) == pSession->_indexTable._nbItems){
+        reserveSessionFile(
+            pSession, pDataBlock->_header._offset + pDataBlock->_header._rawSize
+        );
+    }
+    discardAssembly(&pAssembler->_blockWindow, blockNumber);
+    *pItem = pRepaired->_item;
+    pushBlock(&pSession->_blockWorker, pDataBlock);
+    setBit(&pSession->_blocksSettled, blockNumber);
+    markBlockRead(pSession, blockNumber);
+    if(pSession->_pStream != NULL){
+        notifyBlockStream(pSession->_pStream);
+    }
+}
+
+// Complete the blocks handed over to the assembler so far.
+static void takeRepairedBlocks(tAssembler* const pAssembler)
+{
+    pthread_mutex_lock(&pAssembler->_repairedMutex);
+    tRepairedBlock* const pRepaired = pAssembler->_pRepaired;
+    const size_t nbRepaired = pAssembler->_nbRepaired;
+    pAssembler->_pRepaired = NULL;
+    pAssembler->_nbRepaired = 0;
+    pAssembler->_maxRepaired = 0;
+    pthread_mutex_unlock(&pAssembler->_repairedMutex);
+    size_t i = 0;
+    for(; i < nbRepaired; ++i){
+        completeHandedBlock(pAssembler, &(pRepaired[i]));
+    }
+    free(pRepaired);
+}
+
+/*
+ * Complete a block pulled from the catch-up server of the sender, by the
+ * assembler owning it (a described block is taken as a descriptor).
+ */
+static void completeCatchupBlock(void* const pContext,
+                                 const tIndexItem* const pItem,
+                                 tDataBlock* const pDataBlock)
+{
+    if(pDataBlock != NULL){
+        completeRepairedBlock(
+            pContext, pDataBlock, pDataBlock->_header._checksum
+        );
+        return;
+    }
+    handOverBlock(pContext, pItem, NULL);
+}
+
+/*
+ * Check a packet of a block owned by the assembler against the session,
+ * opening it on the first one. Return TRUE when the packet may be put.
+ */
+static bool acceptPacket(tAssembler* const pAssembler,
+                         const tDataPacketHeader* const pHeader)
+{
+    tReceiveSession* const pSession = pAssembler->_pSession;
+    // Allocate the index table on the first received block.
+    if(openIndexTable(pSession, pHeader) != TRUE){
+        return FALSE;
+    }
+    // A growing session ends with the first packet which is not.
+    if(pSession->_isGrowing == TRUE){
+        if(pHeader->_blockTotal > pSession->_indexTable._nbItems){
+            fprintf(
+                stderr,
+                "Live session exceeds %u blocks: %u.\n",
+                pSession->_indexTable._nbItems, pHeader->_blockTotal
+            );
+            return FALSE;
         }
-        // Check the packet as not already been retrieved.
-        else if(getMap(&blockPacketMap, dataPacket._header._packetNumber)
-            == TRUE)
-        {
-            // Ignore the packet.
-            goto free_packet;
+        if((pHeader->_flags & PACKET_FLAG_GROWING) == 0){
+            endLiveSession(pSession, pHeader->_blockTotal);
         }
-        // Listen the first block received.
-        else if(dataBlock._pPayload == NULL){
-            // Allocate the block payload only with the not the last packet.
-            if(dataPacket._header._packetNumber ==
-                (dataPacket._header._packetTotal - 1))
-            {
-                // Ignore the packet.
-                goto free_packet;
+    }
+    // Check the block total number are consistent with the previous one.
+    else if(pSession->_indexTable._nbItems != pHeader->_blockTotal){
+        fprintf(
+            stderr,
+            "Inconsistent block total number received: %u != %u.\n",
+            pSession->_indexTable._nbItems, pHeader->_blockTotal
+        );
+        return FALSE;
+    }
+    // Blocks are then assembled concurrently, by block number.
+    if( (pAssembler->_blockWindow._pBlocks == NULL) &&
+        (initBlockWindow(
+            &pAssembler->_blockWindow, pSession->_outputDir,
+            pSession->_indexTable._nbItems, pSession->_nbAssemblers
+        ) != TRUE) )
+    {
+        exit(EXIT_FAILURE);
+    }
+    return TRUE;
+}
+
+static void* runAssembler(void* const pArg)
+{
+    tAssembler* const pAssembler = pArg;
+    tReceiveSession* const pSession = pAssembler->_pSession;
+    for(;;){
+        tPacketBatch* const pBatch =
+            acquireBatch(&pSession->_packetRing, pAssembler->_share);
+        // Blocks repaired meanwhile go first (the assembler may only have
+        // been woken up for them).
+        takeRepairedBlocks(pAssembler);
+        if(pBatch == NULL){
+            if(isRingStopping(&pSession->_packetRing) == TRUE){
+                break;
             }
-            // Try to restore previously stored block and map state.
-            if(restoreBlockFromMapFile(
-                outputDir, dataPacket._header._blockNumber,
-                &blockPacketMap, &dataBlock
-            ) != TRUE)
+            continue;
+        }
+        // A block received in place came before the packets of the batch.
+        tPacketRun* const pRun = &pBatch->_run;
+        if( (pRun->_pPayload != NULL) &&
+            ((pRun->_header._blockNumber % pSession->_nbAssemblers) ==
+                pAssembler->_share) )
+        {
+            if(acceptPacket(pAssembler, &pRun->_header) == TRUE){
+                assembleRun(pAssembler, pRun);
+            }else{
+                closePacketRun(pRun);
+            }
+        }
+        size_t i = 0;
+        for(; i < pBatch->_nbPackets; ++i){
+            const tDataPacket* const pDataPacket = &(pBatch->_pPackets[i]);
+            // Other assemblers take care of the other blocks.
+            if( ((pDataPacket->_header._blockNumber %
+                    pSession->_nbAssemblers) == pAssembler->_share) &&
+                (acceptPacket(pAssembler, &pDataPacket->_header) == TRUE) )
             {
-                // Allocate the block payload.
-                dataBlock._pPayload = calloc(
-                    dataPacket._header._packetTotal,
-                    dataPacket._header._payloadSize
-                );
-                if(dataBlock._pPayload == NULL){
-                    fprintf(
-                        stderr,
-                        "Fail to allocate memory at %s line %d.\n",
-                        __FILE__, __LINE__
-                    );
-                    // Ignore the packet.
-                    goto free_packet;
-                }
-                dataBlock._header._blockNumber =
-                    dataPacket._header._blockNumber;
-                dataBlock._header._checksum =
-                    dataPacket._header._checksum;
-                dataBlock._header._payloadSize =
-                    dataPacket._header._packetTotal*
-                        dataPacket._header._payloadSize;
-                // Allocate the block packet map.
-                blockPacketMap._header._packetTotal =
-                    dataPacket._header._packetTotal;
-                initMap(&blockPacketMap);
+                assemblePacket(pAssembler, pDataPacket);
             }
-            // Memorize the max packet size.
-            maxPacketSize = dataPacket._header._payloadSize;
         }
-        // Check packet total consistency.
-        else if(blockPacketMap._header._packetTotal !=
-            dataPacket._header._packetTotal)
-        {
+        releaseBatch(&pSession->_packetRing, pAssembler->_share);
+    }
+    return NULL;
+}
+
+// Assemblers in use, one per core up to the maximum.
+static uint32_t getNbAssemblers(void)
+{
+    const long nbCores = sysconf(_SC_NPROCESSORS_ONLN);
+    if(nbCores < 1){
+        return 1;
+    }
+    return (nbCores < RECEIVE_ASSEMBLERS) ?
+        (uint32_t) nbCores : RECEIVE_ASSEMBLERS;
+}
+
+void receiveFile(const char* const fileName, const char* const outputDir,
+    const char* const localAddr, const char* const multAddr,
+    const uint16_t port, const tReceiveOptions* const pOptions)
+{
+    assert((fileName != NULL) && (outputDir != NULL) && (pOptions != NULL));
+    struct sockaddr_in catchupSock;
+    if( (pOptions->_catchupAddress != NULL) &&
+        (parseCatchupAddress(pOptions->_catchupAddress, &catchupSock)
+            != TRUE) )
+    {
+        exit(EXIT_FAILURE);
+    }
+    // Open the previous release, delta sessions only send what changed.
+    FILE* pBaseFile = NULL;
+    if(pOptions->_baseFileName != NULL){
+        if(strcmp(pOptions->_baseFileName, fileName) == 0){
             fprintf(
                 stderr,
-                "Inconsistent packet total number received: %u != %u.\n",
-                blockPacketMap._header._packetTotal,
-                dataPacket._header._packetTotal
+                "Base file must differ from the output file: '%s'.\n",
+                fileName
             );
-            // Ignore the packet.
-            goto free_packet;
+            exit(EXIT_FAILURE);
         }
-        // Check checksum consistency.
-        else if(dataBlock._header._checksum !=
-            dataPacket._header._checksum)
-        {
+        pBaseFile = fopen(pOptions->_baseFileName, "rb");
+        if(pBaseFile == NULL){
             fprintf(
                 stderr,
-                "Inconsistent packet checksum received: %u != %u.\n",
-                dataBlock._header._checksum,
-                dataPacket._header._checksum
+                "Fail to open base file: '%s'.\n",
+                pOptions->_baseFileName
             );
-            // Ignore the packet.
-            goto free_packet;
+            exit(EXIT_FAILURE);
         }
-        // Check block total consistency.
-        else if(dataBlock._header._blockNumber !=
-            dataPacket._header._blockNumber)
-        {
+    }
+    // Create output files directory (blocks spilled under memory pressure
+    // and the journal). Previous files are kept, a receive resumes from them.
+    createOutputDir(outputDir);
+    // The standard output and pipes get the file in order, as it comes,
+    // blocks are received into a spool file of the output directory.
+    struct stat buf;
+    int streamFd = -1;
+    char* spoolFileName = NULL;
+    if(strcmp(fileName, STREAM_OUTPUT) == 0){
+        streamFd = STDOUT_FILENO;
+    }else if((stat(fileName, &buf) == 0) && S_ISFIFO(buf.st_mode)){
+        // Wait for the reader.
+        streamFd = open(fileName, O_WRONLY);
+        if(streamFd < 0){
             fprintf(
                 stderr,
-                "Inconsistent packet block number received: %u != %u.\n",
-                dataBlock._header._blockNumber,
-                dataPacket._header._blockNumber
+                "Fail to open output stream: '%s' (%d: %s).\n",
+                fileName, errno, strerror(errno)
             );
-            // Ignore the packet.
-            goto free_packet;
+            exit(EXIT_FAILURE);
         }
-        // Adjust data block payload if this is the last packet.
-        if(dataPacket._header._packetNumber ==
-            (dataPacket._header._packetTotal - 1))
-        {
-            // The last packet size can not be greater than the previous ones.
-            if(dataPacket._header._payloadSize > maxPacketSize){
-                fprintf(
-                    stderr,
-                    "Inconsistent packet payload size received: %u != %u.\n",
-                    dataPacket._header._payloadSize, maxPacketSize
-                );
-                // Ignore the packet.
-                goto free_packet;
-            }
-            dataBlock._header._payloadSize -= (
-                maxPacketSize - dataPacket._header._payloadSize
+    }
+    if(streamFd >= 0){
+        spoolFileName = malloc(
+            strlen(outputDir) + strlen(DIRECTORY_SEPARATOR) +
+                strlen(STREAM_BASENAME) + 1
+        );
+        if(spoolFileName == NULL){
+            fprintf(
+                stderr,
+                "Fail to allocate memory at %s line %d.\n",
+                __FILE__, __LINE__
             );
+            exit(EXIT_FAILURE);
+        }
+        spoolFileName[0] = '\0';
+        strcat(spoolFileName, outputDir);
+        strcat(spoolFileName, DIRECTORY_SEPARATOR);
+        strcat(spoolFileName, STREAM_BASENAME);
+    }
+    const char* const outputFileName =
+        (spoolFileName != NULL) ? spoolFileName : fileName;
+    // Open the output file, blocks are written straight at their place (a
+    // previous receive is resumed from it).
+    FILE* pFile = fopen(outputFileName, "rb+");
+    if(pFile == NULL){
+        pFile = fopen(outputFileName, "wb+");
+    }
+    if(pFile == NULL){
+        fprintf(stderr, "Fail to open output file: '%s'.\n", outputFileName);
+        exit(EXIT_FAILURE);
+    }
+    tBlockStream blockStream;
+    if( (streamFd >= 0) &&
+        (initBlockStream(&blockStream, streamFd, fileno(pFile), pBaseFile)
+            != TRUE) )
+    {
+        exit(EXIT_FAILURE);
+    }
+    // Initialize client (or the ring shared with the kernel).
+    tRingClient ringClient;
+    tRingClient* const pRingClient =
+        (pOptions->_useRing == TRUE) ? &ringClient : NULL;
+    int sd = -1;
+    if(pRingClient == NULL){
+        sd = initClient(localAddr, multAddr, port);
+        if(sd < 0){
+            exit(EXIT_FAILURE);
+        }
+    }else if(initRingClient(pRingClient, localAddr, multAddr, port)
+        != TRUE)
+    {
+        exit(EXIT_FAILURE);
+    }
+    // Let the kernel drop the packets of other sessions, then those of the
+    // settled blocks.
+    tPacketFilter packetFilter;
+    bool isFiltered = initPacketFilter(
+        &packetFilter, (pRingClient == NULL) ? sd : pRingClient->_sd,
+        (pRingClient == NULL) ? FALSE : TRUE, multAddr, port
+    );
+    tReceiveSession session;
+    session._fileName = outputFileName;
+    session._outputDir = outputDir;
+    session._pFile = pFile;
+    session._pBaseFile = pBaseFile;
+    session._pStream = (streamFd >= 0) ? &blockStream : NULL;
+    session._indexTable = (tIndexTable) {0, INDEX_VERSION, NULL};
+    memset(&session._journal, 0, sizeof(session._journal));
+    pthread_mutex_init(&session._indexMutex, NULL);
+    atomic_init(&session._isIndexed, FALSE);
+    session._isGrowing = FALSE;
+    atomic_init(&session._blockTotal, 0);
+    memset(&session._blocksRead, 0, sizeof(session._blocksRead));
+    memset(&session._blocksSettled, 0, sizeof(session._blocksSettled));
+    atomic_flag_clear(&session._isReserved);
+    atomic_init(&session._isBaseMissing, FALSE);
+    sem_init(&session._complete, 0, 0);
+    session._nbAssemblers = getNbAssemblers();
+    tAssembler assemblers[RECEIVE_ASSEMBLERS];
+    session._pAssemblers = assemblers;
+    uint32_t i = 0;
+    for(; i < session._nbAssemblers; ++i){
+        assemblers[i]._pSession = &session;
+        assemblers[i]._share = i;
+        memset(
+            &(assemblers[i]._blockWindow), 0,
+            sizeof(assemblers[i]._blockWindow)
+        );
+        pthread_mutex_init(&(assemblers[i]._repairedMutex), NULL);
+        assemblers[i]._pRepaired = NULL;
+        assemblers[i]._nbRepaired = 0;
+        assemblers[i]._maxRepaired = 0;
+    }
+    // Start the workers which check, decompress and write completed blocks.
+    if(initBlockWorker(
+        &session._blockWorker, fileno(pFile), &session._journal,
+        session._pStream
+    ) != TRUE){
+        exit(EXIT_FAILURE);
+    }
+    // A network thread drains the socket, each assembler reads every batch
+    // and keeps the packets of its blocks.
+    if(startPacketRing(
+        &session._packetRing, sd, pRingClient, session._nbAssemblers
+    ) != TRUE)
+    {
+        exit(EXIT_FAILURE);
+    }
+    // Peers of the repair group hand over the blocks missed here.
+    tRepairPeer repairPeer;
+    const bool isRepaired = (pOptions->_repairPort != 0) ?
+        startRepairPeer(
+            &repairPeer, localAddr, multAddr, pOptions->_repairPort, port,
+            fileno(pFile), &session._journal, &session._indexTable,
+            &session._blocksRead, &session._isIndexed, completeRepairedBlock,
+            &session
+        ) : FALSE;
+    if((pOptions->_repairPort != 0) && (isRepaired != TRUE)){
+        fprintf(stderr, "Receiving without peer repair.\n");
+    }
+    for(i = 0; i < session._nbAssemblers; ++i){
+        if(pthread_create(
+            &(assemblers[i]._thread), NULL, runAssembler, &(assemblers[i])
+        ) != 0)
+        {
+            fprintf(stderr, "Fail to start the assembler threads.\n");
+            exit(EXIT_FAILURE);
         }
-        // Check the block will not overflow.
-        const tBlockSize blockOffset =
-            maxPacketSize*dataPacket._header._packetNumber;
-        if((blockOffset + dataPacket._header._payloadSize) >
-            dataBlock._header._payloadSize)
+    }
+    // Wait for every block (blocks found invalid are received again),
+    // updating the socket filter and flushing the journal at intervals.
+    // The last blocks are pulled from the sender once most of them came
+    // (or after a while), when it serves them.
+    tCatchupClient catchupClient;
+    bool isCatchingUp = FALSE;
+    const time_t start = time(NULL);
+    unsigned int nbIntervals = 0;
+    for(;;){
+        // Without a catch-up, blocks missing from the previous file are
+        // never received.
+        if( (pOptions->_catchupAddress == NULL) &&
+            (atomic_load(&session._isBaseMissing) == TRUE) )
         {
             fprintf(
                 stderr,
-                "Invalid payload size received: %zu + %u > %zu.\n",
-                dataBlock._header._payloadSize,
-                dataPacket._header._payloadSize,
-                dataBlock._header._payloadSize
+                "Delta session does not apply: blocks not found in the "
+                    "previous file (see " BASE_OPTION ", or "
+                    CATCHUP_OPTION ").\n"
             );
-            // Ignore the packet.
-            goto free_packet;
+            exit(EXIT_FAILURE);
         }
-        // Append the packet at the end of the block.
-        memcpy(
-            dataBlock._pPayload + blockOffset,
-            dataPacket._pPayload,
-            dataPacket._header._payloadSize
-        );
-        // Update the next packet number.
-        setMap(&blockPacketMap, dataPacket._header._packetNumber);
-        if(isMapFull(&blockPacketMap) == TRUE){
-            // Check data block checksum.
-            const tChecksum checksum =
-                crc32c(dataBlock._pPayload, dataBlock._header._payloadSize);
-            if(checksum == dataBlock._header._checksum){
-                // If the last packet was received, write the block.
-                createBlockFile(outputDir, &dataBlock, FALSE);
-                // Update the index table (marked it as completed).
-                pItem->_offset = dataBlock._header._payloadSize;
-                pItem->_number = dataBlock._header._blockNumber;
-            }else{
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += RECEIVE_FILTER_INTERVAL;
+        if(sem_timedwait(&session._complete, &deadline) == 0){
+            if(checkBlocksRead(&session) == TRUE){
+                break;
+            }
+        }else if( (errno == ETIMEDOUT) &&
+                  (atomic_load_explicit(
+                    &session._isIndexed, memory_order_acquire) == TRUE) )
+        {
+            if( (isFiltered == TRUE) &&
+                (updatePacketFilter(
+                    &packetFilter, atomic_load(&session._blockTotal),
+                    &session._blocksSettled) != TRUE) )
+            {
+                fprintf(stderr, "Receiving without socket filter.\n");
+                isFiltered = FALSE;
+            }
+            const tBlockNumber blockTotal = atomic_load(&session._blockTotal);
+            if( (pOptions->_catchupAddress != NULL) &&
+                (isCatchingUp == FALSE) && (blockTotal != 0) &&
+                ( ((uint64_t) (blockTotal -
+                    getNbMissing(&session._blocksRead))*100 >=
+                        (uint64_t) blockTotal*pOptions->_catchupThreshold) ||
+                  ((time(NULL) - start) >=
+                    (time_t) pOptions->_catchupBudget) ) )
+            {
                 fprintf(
                     stderr,
-                    "Invalid data block checksum detected: number %u.\n",
-                    dataBlock._header._blockNumber
+                    "Catching up %u missing blocks from '%s'.\n",
+                    getNbMissing(&session._blocksRead),
+                    pOptions->_catchupAddress
+                );
+                isCatchingUp = startCatchupClient(
+                    &catchupClient, &catchupSock, &session._blocksRead,
+                    blockTotal, completeCatchupBlock, &session
                 );
             }
-            // Reset data block.
-            free(dataBlock._pPayload);
-            dataBlock._pPayload = NULL;
-            // Reset block packet map.
-            closeMap(&blockPacketMap);
-            // Check if the last block has been read (and it was correct).
-            if( (checksum == dataBlock._header._checksum) &&
-                (++nbBlockRead == indexTable._nbItems) )
+            if((++nbIntervals*RECEIVE_FILTER_INTERVAL) >=
+                JOURNAL_FLUSH_INTERVAL)
             {
-                // Free the allocated packet memory.
-                free(dataPacket._pPayload);
-                break;
+                flushJournal(&session._journal, fileno(pFile));
+                nbIntervals = 0;
             }
         }
-free_packet:
-        // Free the allocated packet memory.
-        free(dataPacket._pPayload);
     }
+    if(isCatchingUp == TRUE){
+        stopCatchupClient(&catchupClient);
+    }
+    if(isRepaired == TRUE){
+        stopRepairPeer(&repairPeer);
+    }
+    stopPacketRing(&session._packetRing);
+    for(i = 0; i < session._nbAssemblers; ++i){
+        pthread_join(assemblers[i]._thread, NULL);
+        // Free the blocks still being assembled, or handed over.
+        closeBlockWindow(&(assemblers[i]._blockWindow));
+        size_t j = 0;
+        for(; j < assemblers[i]._nbRepaired; ++j){
+            free(assemblers[i]._pRepaired[j]._dataBlock._pPayload);
+        }
+        free(assemblers[i]._pRepaired);
+        pthread_mutex_destroy(&(assemblers[i]._repairedMutex));
+    }
+    closePacketRing(&session._packetRing);
+    // Only the blocks of a growing session which the sender cut are left.
+    session._indexTable._nbItems = atomic_load(&session._blockTotal);
+    sem_destroy(&session._complete);
+    pthread_mutex_destroy(&session._indexMutex);
     // Terminate client.
-    closeClient(sd);
-    // Reorganize index table by computing offset by block.
-    tBlockOffset offset = 0;
-    tBlockNumber i = 0;
-    for(; i < indexTable._nbItems; ++i){
-        tIndexItem* const pItem = &(indexTable._pItems[i]);
-        tBlockOffset blockOffset = pItem->_offset;
-        pItem->_offset = offset;
-        offset += blockOffset;
-    }
-    // Create the index file.
-    createIndexFile(outputDir, &indexTable);
-    // Free the index table.
-    if(indexTable._pItems != NULL){
-        free(indexTable._pItems);
-    }
-    // Generate the input file from block files.
-    generateDataFile(fileName, outputDir);
-    // Reset previous output files.
-    resetOuputDir(outputDir);
+    closePacketFilter(&packetFilter);
+    if(pRingClient == NULL){
+        closeClient(sd);
+    }else{
+        closeRingClient(pRingClient);
+    }
+    // Wait for the pending blocks to be written.
+    closeBlockWorker(&session._blockWorker);
+    if(session._blockWorker._failed == TRUE){
+        fprintf(
+            stderr, "Fail to write output file: '%s'.\n", outputFileName
+        );
+        exit(EXIT_FAILURE);
+    }
+    // The stream ends with the last block, the spool is then useless.
+    if(session._pStream != NULL){
+        if(closeBlockStream(session._pStream) != TRUE){
+            fprintf(stderr, "Fail to stream output file: '%s'.\n", fileName);
+            exit(EXIT_FAILURE);
+        }
+        if((streamFd != STDOUT_FILENO) && (close(streamFd) != 0)){
+            fprintf(
+                stderr,
+                "Fail to close output stream: '%s' (%d: %s).\n",
+                fileName, errno, strerror(errno)
+            );
+            exit(EXIT_FAILURE);
+        }
+    }
+    // Write the blocks which were only described (the index stays in memory).
+    const bool result = (session._pStream != NULL) ? TRUE :
+        completeDataFile(pFile, fileName, &session._indexTable, pBaseFile);
+    if(pBaseFile != NULL){
+        fclose(pBaseFile);
+    }
+    // Close the output file.
+    if((fclose(pFile) != 0) || (result != TRUE)){
+        fprintf(stderr, "Fail to complete output file: '%s'.\n", fileName);
+        exit(EXIT_FAILURE);
+    }
+    if((spoolFileName != NULL) && (remove(spoolFileName) != 0)){
+        fprintf(
+            stderr,
+            "Fail to remove spool file: '%s' (%d: %s).\n",
+            spoolFileName, errno, strerror(errno)
+        );
+    }
+    free(spoolFileName);
+    // The index table lives in the journal, nothing is left to resume.
+    closeJournal(&session._journal, TRUE);
+    closeBitmap(&session._blocksSettled);
+    closeBitmap(&session._blocksRead);
 }
@@ -8,15 +8,31 @@
 #ifndef RECEIVEFILE_H
 #define RECEIVEFILE_H
 
-#include <stdint.h>     /* uint16_t */
+#include "types.h"      /* bool */
+#include <stdint.h>     /* uint16_t, uint32_t */
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/*
+ * Missed blocks are repaired from the peers of the repair group port (0
+ * for none), the last ones pulled from the catch-up address of the sender
+ * ("<addr>:<port>", NULL for none) once this percentage of the blocks is
+ * received, or after this many seconds.
+ */
+typedef struct sReceiveOptions{
+    const char* _baseFileName;
+    bool        _useRing;
+    uint16_t    _repairPort;
+    const char* _catchupAddress;
+    uint32_t    _catchupThreshold;
+    uint32_t    _catchupBudget;
+} tReceiveOptions;
+
 void receiveFile(const char* const fileName, const char* const outputDir,
     const char* const localAddr, const char* const multAddr,
-    const uint16_t port);
+    const uint16_t port, const tReceiveOptions* const pOptions);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,544 @@
+#include "repair.h"
+#include "crc32.h"          /* crc32c */
+#include "codec.h"          /* maxCompressedSize, compressPayload */
+#include <stdio.h>          /* fprintf, perror, stderr */
+#include <stdlib.h>         /* malloc, realloc, free */
+#include <string.h>         /* memset, memcpy, strerror */
+#include <errno.h>          /* errno, EINTR */
+#include <time.h>           /* time, clock_gettime, struct timespec */
+#include <assert.h>         /* assert */
+#include <poll.h>           /* poll, struct pollfd, POLLIN */
+#include <unistd.h>         /* pread, close, usleep */
+#include <sys/socket.h>     /* socket, bind, listen, accept, send, recv */
+#include <arpa/inet.h>      /* inet_addr, htons, ntohs */
+
+#define NB_BITS_WORD (sizeof(uint64_t)*8)
+
+// Announced words of the written blocks bitmap.
+static uint32_t getNbWords(const tBlockNumber nbItems)
+{
+    return (uint32_t) (((uint64_t) nbItems + NB_BITS_WORD - 1) /
+        NB_BITS_WORD);
+}
+
+// Send or receive all the bytes (a peer late for REPAIR_TIMEOUT fails).
+static bool transferAll(const int sd, void* const pBuffer, const size_t size,
+                        const bool isSend)
+{
+    size_t done = 0;
+    while(done < size){
+        const ssize_t result = (isSend == TRUE) ?
+            send(sd, (char*) pBuffer + done, size - done, MSG_NOSIGNAL) :
+            recv(sd, (char*) pBuffer + done, size - done, 0);
+        if(result < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return FALSE;
+        }else if(result == 0){
+            return FALSE;
+        }
+        done += (size_t) result;
+    }
+    return TRUE;
+}
+
+/*
+ * Check raw bytes are the block the sender sent: its checksum covers them,
+ * or them compressed (the same way it was prepared).
+ */
+static bool isSentBlock(const void* const pRaw, const uint64_t size,
+                        const uint64_t reference)
+{
+    if(crc32c(pRaw, size) == reference){
+        return TRUE;
+    }
+    const tBlockSize compressedSize = maxCompressedSize(CODEC_ZLIB, size);
+    void* const pCompressed = malloc(compressedSize);
+    if(pCompressed == NULL){
+        fprintf(
+            stderr,
+            "Fail to allocate memory at %s line %d.\n",
+            __FILE__, __LINE__
+        );
+        return FALSE;
+    }
+    const tBlockSize packedSize = compressPayload(
+        CODEC_ZLIB, pRaw, size, pCompressed, compressedSize
+    );
+    const bool isSent = ( (packedSize != 0) &&
+        (crc32c(pCompressed, packedSize) == reference) ) ? TRUE : FALSE;
+    free(pCompressed);
+    return isSent;
+}
+
+static void setTimeout(const int sd)
+{
+    const struct timeval timeout = {REPAIR_TIMEOUT, 0};
+    setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(sd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+// Open the repair group (looped back: peers may share the host).
+static int openGroupSocket(const char* const localAddr,
+                           const char* const multAddr, const uint16_t port,
+                           struct sockaddr_in* const pGroupSock)
+{
+    const int sd = socket(AF_INET, SOCK_DGRAM, 0);
+    if(sd < 0){
+        perror("Error opening repair group socket");
+        return -1;
+    }
+    const int reuse = 1;
+    struct sockaddr_in localSock;
+    memset(&localSock, 0, sizeof(localSock));
+    localSock.sin_family = AF_INET;
+    localSock.sin_port = htons(port);
+    localSock.sin_addr.s_addr = INADDR_ANY;
+    struct ip_mreq group;
+    group.imr_multiaddr.s_addr = inet_addr(multAddr);
+    group.imr_interface.s_addr = inet_addr(localAddr);
+    struct in_addr localInterface;
+    localInterface.s_addr = inet_addr(localAddr);
+    if( (setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse))
+            != 0) ||
+        (bind(sd, (struct sockaddr*) &localSock, sizeof(localSock)) != 0) ||
+        (setsockopt(sd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &group, sizeof(group))
+            != 0) ||
+        (setsockopt(sd, IPPROTO_IP, IP_MULTICAST_IF, &localInterface,
+            sizeof(localInterface)) != 0) )
+    {
+        perror("Error joining repair group");
+        close(sd);
+        return -1;
+    }
+    memset(pGroupSock, 0, sizeof(*pGroupSock));
+    pGroupSock->sin_family = AF_INET;
+    pGroupSock->sin_addr.s_addr = inet_addr(multAddr);
+    pGroupSock->sin_port = htons(port);
+    return sd;
+}
+
+// Listen for the peers fetching blocks, on a port of the local address.
+static int openListenSocket(const char* const localAddr,
+                            uint16_t* const pPort)
+{
+    const int sd = socket(AF_INET, SOCK_STREAM, 0);
+    if(sd < 0){
+        perror("Error opening repair socket");
+        return -1;
+    }
+    struct sockaddr_in localSock;
+    memset(&localSock, 0, sizeof(localSock));
+    localSock.sin_family = AF_INET;
+    localSock.sin_port = 0;
+    localSock.sin_addr.s_addr = inet_addr(localAddr);
+    socklen_t size = sizeof(localSock);
+    if( (bind(sd, (struct sockaddr*) &localSock, sizeof(localSock)) != 0) ||
+        (listen(sd, REPAIR_BACKLOG) != 0) ||
+        (getsockname(sd, (struct sockaddr*) &localSock, &size) != 0) )
+    {
+        perror("Error listening for repair requests");
+        close(sd);
+        return -1;
+    }
+    *pPort = ntohs(localSock.sin_port);
+    return sd;
+}
+
+/*
+ * Announce the written blocks and how many are missing (every range: a
+ * peer tells whether it holds blocks missing here). Then see how far the
+ * receive went: the last block written, and whether it stalls.
+ */
+static void announceBlocks(tRepairPeer* const pPeer)
+{
+    const tBlockNumber nbItems = pPeer->_pIndexTable->_nbItems;
+    const uint32_t nbWords = getNbWords(nbItems);
+    const uint32_t nbMissing = getNbMissing(pPeer->_pBlocksRead);
+    char buffer[sizeof(tRepairAnnounce) + REPAIR_WORDS*sizeof(uint64_t)];
+    uint64_t words[REPAIR_WORDS];
+    uint32_t first = 0;
+    for(; first < nbWords; first += REPAIR_WORDS){
+        const uint32_t count = ((nbWords - first) < REPAIR_WORDS) ?
+            (nbWords - first) : REPAIR_WORDS;
+        uint32_t i = 0;
+        for(; i < count; ++i){
+            words[i] = atomic_load(&(pPeer->_pJournal->_pWritten[first + i]));
+            if(words[i] != 0){
+                pPeer->_lastWritten = (tBlockNumber) (
+                    (first + i)*NB_BITS_WORD + (NB_BITS_WORD - 1 -
+                        (unsigned) __builtin_clzll(words[i]))
+                );
+            }
+        }
+        const tRepairAnnounce announce = {
+            REPAIR_MAGIC, REPAIR_VERSION, pPeer->_port, pPeer->_dataPort,
+            (uint16_t) count, nbItems, pPeer->_pJournal->_session, first,
+            nbMissing
+        };
+        memcpy(buffer, &announce, sizeof(announce));
+        memcpy(buffer + sizeof(announce), words, count*sizeof(*words));
+        if(sendto(
+            pPeer->_groupSd, buffer, sizeof(announce) + count*sizeof(*words),
+            0, (struct sockaddr*) &pPeer->_groupSock,
+            sizeof(pPeer->_groupSock)
+        ) < 0)
+        {
+            perror("Error announcing repair blocks");
+        }
+    }
+    // The receive stalls when no block came since the previous announce.
+    pPeer->_nbIdle = (nbMissing == pPeer->_nbMissing) ?
+        (pPeer->_nbIdle + 1) : 0;
+    pPeer->_nbMissing = nbMissing;
+}
+
+// Fetch blocks from a peer, each one is handed over as soon as checked.
+static void fetchBlocks(tRepairPeer* const pPeer,
+                        const struct sockaddr_in* const pPeerSock,
+                        tRepairRequest* const pRequest)
+{
+    const int sd = socket(AF_INET, SOCK_STREAM, 0);
+    if(sd < 0){
+        perror("Error opening repair socket");
+        return;
+    }
+    setTimeout(sd);
+    if( (connect(sd, (const struct sockaddr*) pPeerSock, sizeof(*pPeerSock))
+            != 0) ||
+        (transferAll(sd, pRequest, sizeof(*pRequest), TRUE) != TRUE) )
+    {
+        fprintf(
+            stderr,
+            "Fail to ask %s:%u for blocks (%d: %s).\n",
+            inet_ntoa(pPeerSock->sin_addr), ntohs(pPeerSock->sin_port),
+            errno, strerror(errno)
+        );
+        close(sd);
+        return;
+    }
+    uint16_t i = 0;
+    for(; i < pRequest->_nbBlocks; ++i){
+        tRepairReply reply;
+        if( (transferAll(sd, &reply, sizeof(reply), FALSE) != TRUE) ||
+            (reply._magic != REPAIR_MAGIC) ||
+            (reply._number != pRequest->_numbers[i]) )
+        {
+            fprintf(stderr, "Invalid repair reply received.\n");
+            break;
+        }
+        if(reply._status != 0){
+            continue;
+        }
+        tDataBlock dataBlock;
+        memset(&dataBlock, 0, sizeof(dataBlock));
+        dataBlock._pPayload =
+            (reply._size <= UINT32_MAX) ? malloc(reply._size) : NULL;
+        if(dataBlock._pPayload == NULL){
+            fprintf(
+                stderr,
+                "Fail to allocate memory at %s line %d.\n",
+                __FILE__, __LINE__
+            );
+            break;
+        }
+        if(transferAll(sd, dataBlock._pPayload, reply._size, FALSE) != TRUE){
+            fprintf(stderr, "Fail to read a repaired block.\n");
+            free(dataBlock._pPayload);
+            break;
+        }
+        if( (crc32c(dataBlock._pPayload, reply._size) != reply._checksum) ||
+            (isSentBlock(dataBlock._pPayload, reply._size, reply._reference)
+                != TRUE) )
+        {
+            fprintf(
+                stderr,
+                "Invalid repaired block checksum detected: number %u.\n",
+                reply._number
+            );
+            free(dataBlock._pPayload);
+            continue;
+        }
+        // The block is raw, it is checked again before being written.
+        dataBlock._header._payloadSize = reply._size;
+        dataBlock._header._rawSize = reply._size;
+        dataBlock._header._offset = reply._offset;
+        dataBlock._header._checksum = reply._checksum;
+        dataBlock._header._blockNumber = reply._number;
+        dataBlock._header._codec = CODEC_NONE;
+        pPeer->_callback(pPeer->_pContext, &dataBlock, reply._reference);
+    }
+    close(sd);
+}
+
+/*
+ * Ask the announcing peer for the blocks missed here: behind the last
+ * block written (the sender already passed them), or any of them once the
+ * receive stalls. A peer missing blocks written here keeps this one a peer.
+ */
+static void repairFromAnnounce(tRepairPeer* const pPeer,
+                               const struct sockaddr_in* const pSourceSock,
+                               const char* const pBuffer, const size_t size)
+{
+    tRepairAnnounce announce;
+    if(size < sizeof(announce)){
+        return;
+    }
+    memcpy(&announce, pBuffer, sizeof(announce));
+    const tBlockNumber nbItems = pPeer->_pIndexTable->_nbItems;
+    const bool isStalled = (pPeer->_nbIdle >= REPAIR_IDLE) ? TRUE : FALSE;
+    // Other sessions and our own announces are ignored.
+    if( (announce._magic != REPAIR_MAGIC) ||
+        (announce._version != REPAIR_VERSION) ||
+        (announce._dataPort != pPeer->_dataPort) ||
+        (announce._nbItems != nbItems) ||
+        (announce._session != pPeer->_pJournal->_session) ||
+        (announce._nbWords > REPAIR_WORDS) ||
+        (size != (sizeof(announce) + announce._nbWords*sizeof(uint64_t))) ||
+        (((uint64_t) announce._firstWord + announce._nbWords) >
+            getNbWords(nbItems)) ||
+        ( (announce._port == pPeer->_port) &&
+          (pSourceSock->sin_addr.s_addr == pPeer->_localAddr.s_addr) ) )
+    {
+        return;
+    }
+    const bool isComplete = isBitmapFull(pPeer->_pBlocksRead);
+    tRepairRequest request;
+    memset(&request, 0, sizeof(request));
+    request._magic = REPAIR_MAGIC;
+    request._version = REPAIR_VERSION;
+    request._nbItems = nbItems;
+    request._session = pPeer->_pJournal->_session;
+    uint16_t i = 0;
+    for(; i < announce._nbWords; ++i){
+        uint64_t word;
+        memcpy(
+            &word, pBuffer + sizeof(announce) + i*sizeof(word), sizeof(word)
+        );
+        const uint32_t index = announce._firstWord + i;
+        const uint64_t written =
+            atomic_load(&(pPeer->_pJournal->_pWritten[index]));
+        if((announce._nbMissing != 0) && ((written & ~word) != 0)){
+            atomic_store(&pPeer->_lastNeeded, time(NULL));
+        }
+        word = (isComplete == TRUE) ? 0 : (word & ~written);
+        while((word != 0) && (request._nbBlocks < REPAIR_MAX_BLOCKS)){
+            const tBlockNumber blockNumber = (tBlockNumber) (
+                index*NB_BITS_WORD + (unsigned) __builtin_ctzll(word)
+            );
+            word &= word - 1;
+            if( (blockNumber < nbItems) &&
+                ((blockNumber < pPeer->_lastWritten) || (isStalled == TRUE)) &&
+                (getBit(pPeer->_pBlocksRead, blockNumber) != TRUE) )
+            {
+                request._numbers[request._nbBlocks++] = blockNumber;
+            }
+        }
+    }
+    if(request._nbBlocks == 0){
+        return;
+    }
+    struct sockaddr_in peerSock = *pSourceSock;
+    peerSock.sin_port = htons(announce._port);
+    fetchBlocks(pPeer, &peerSock, &request);
+}
+
+static void* runAnnouncer(void* const pArg)
+{
+    tRepairPeer* const pPeer = pArg;
+    char buffer[sizeof(tRepairAnnounce) + REPAIR_WORDS*sizeof(uint64_t)];
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while(atomic_load(&pPeer->_stopping) != TRUE){
+        // Nothing is known before the index table.
+        const bool isIndexed =
+            atomic_load_explicit(pPeer->_pIsIndexed, memory_order_acquire);
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        const long remaining =
+            (next.tv_sec - now.tv_sec)*1000 +
+                (next.tv_nsec - now.tv_nsec)/1000000;
+        if(remaining <= 0){
+            if(isIndexed == TRUE){
+                announceBlocks(pPeer);
+            }
+            next = now;
+            next.tv_sec += REPAIR_INTERVAL;
+            continue;
+        }
+        struct pollfd pollFd = {pPeer->_groupSd, POLLIN, 0};
+        if(poll(&pollFd, 1, (int) remaining) <= 0){
+            continue;
+        }
+        struct sockaddr_in sourceSock;
+        socklen_t sourceSize = sizeof(sourceSock);
+        const ssize_t size = recvfrom(
+            pPeer->_groupSd, buffer, sizeof(buffer), 0,
+            (struct sockaddr*) &sourceSock, &sourceSize
+        );
+        if((size > 0) && (isIndexed == TRUE)){
+            repairFromAnnounce(pPeer, &sourceSock, buffer, (size_t) size);
+        }
+    }
+    return NULL;
+}
+
+// Serve the blocks a peer asks for, those not written here are refused.
+static void serveBlocks(tRepairPeer* const pPeer, const int sd,
+                        void** const ppBuffer, size_t* const pSize)
+{
+    tRepairRequest request;
+    if( (transferAll(sd, &request, sizeof(request), FALSE) != TRUE) ||
+        (request._magic != REPAIR_MAGIC) ||
+        (request._version != REPAIR_VERSION) ||
+        (request._nbBlocks > REPAIR_MAX_BLOCKS) ||
+        (atomic_load_explicit(pPeer->_pIsIndexed, memory_order_acquire)
+            != TRUE) ||
+        (request._nbItems != pPeer->_pIndexTable->_nbItems) ||
+        (request._session != pPeer->_pJournal->_session) )
+    {
+        return;
+    }
+    uint16_t i = 0;
+    for(; i < request._nbBlocks; ++i){
+        const tBlockNumber blockNumber = request._numbers[i];
+        tRepairReply reply = {REPAIR_MAGIC, 1, 0, blockNumber, 0, 0, 0, 0};
+        if( (blockNumber < request._nbItems) &&
+            (isBlockWritten(pPeer->_pJournal, blockNumber) == TRUE) )
+        {
+            const tIndexItem item = pPeer->_pIndexTable->_pItems[blockNumber];
+            if(item._size > *pSize){
+                void* const pBuffer = realloc(*ppBuffer, item._size);
+                if(pBuffer != NULL){
+                    *ppBuffer = pBuffer;
+                    *pSize = item._size;
+                }
+            }
+            if( (item._type == BLOCK_TYPE_DATA) && (item._size <= *pSize) &&
+                (pread(pPeer->_fd, *ppBuffer, item._size, item._offset) ==
+                    (ssize_t) item._size) )
+            {
+                reply._status = 0;
+                reply._checksum = crc32c(*ppBuffer, item._size);
+                reply._offset = item._offset;
+                reply._size = item._size;
+                reply._reference = item._reference;
+            }
+        }
+        if( (transferAll(sd, &reply, sizeof(reply), TRUE) != TRUE) ||
+            ( (reply._status == 0) &&
+              (transferAll(sd, *ppBuffer, reply._size, TRUE) != TRUE) ) )
+        {
+            return;
+        }
+    }
+    atomic_store(&pPeer->_lastNeeded, time(NULL));
+}
+
+static void* runRepairServer(void* const pArg)
+{
+    tRepairPeer* const pPeer = pArg;
+    void* pBuffer = NULL;
+    size_t size = 0;
+    for(;;){
+        const int sd = accept(pPeer->_listenSd, NULL, NULL);
+        if(atomic_load(&pPeer->_stopping) == TRUE){
+            if(sd >= 0){
+                close(sd);
+            }
+            break;
+        }
+        if(sd < 0){
+            continue;
+        }
+        setTimeout(sd);
+        serveBlocks(pPeer, sd, &pBuffer, &size);
+        close(sd);
+    }
+    free(pBuffer);
+    return NULL;
+}
+
+bool startRepairPeer(tRepairPeer* const pPeer, const char* const localAddr,
+    const char* const multAddr, const uint16_t repairPort,
+    const uint16_t dataPort, const int fd, tJournal* const pJournal,
+    tIndexTable* const pIndexTable, tBitmap* const pBlocksRead,
+    atomic_bool* const pIsIndexed, const tRepairCallback callback,
+    void* const pContext)
+{
+    assert((pPeer != NULL) && (pJournal != NULL) && (pIndexTable != NULL) &&
+        (pBlocksRead != NULL) && (pIsIndexed != NULL) && (callback != NULL));
+    pPeer->_localAddr.s_addr = inet_addr(localAddr);
+    pPeer->_dataPort = dataPort;
+    pPeer->_fd = fd;
+    pPeer->_pJournal = pJournal;
+    pPeer->_pIndexTable = pIndexTable;
+    pPeer->_pBlocksRead = pBlocksRead;
+    pPeer->_pIsIndexed = pIsIndexed;
+    pPeer->_callback = callback;
+    pPeer->_pContext = pContext;
+    pPeer->_lastWritten = 0;
+    pPeer->_nbMissing = 0;
+    pPeer->_nbIdle = 0;
+    atomic_init(&pPeer->_stopping, FALSE);
+    atomic_init(&pPeer->_lastNeeded, 0);
+    pPeer->_groupSd = openGroupSocket(
+        localAddr, multAddr, repairPort, &pPeer->_groupSock
+    );
+    if(pPeer->_groupSd < 0){
+        return FALSE;
+    }
+    pPeer->_listenSd = openListenSocket(localAddr, &pPeer->_port);
+    if(pPeer->_listenSd < 0){
+        close(pPeer->_groupSd);
+        return FALSE;
+    }
+    if(pthread_create(
+        &pPeer->_serveThread, NULL, runRepairServer, pPeer
+    ) != 0)
+    {
+        fprintf(stderr, "Fail to start the repair threads.\n");
+        close(pPeer->_listenSd);
+        close(pPeer->_groupSd);
+        return FALSE;
+    }
+    if(pthread_create(
+        &pPeer->_announceThread, NULL, runAnnouncer, pPeer
+    ) != 0)
+    {
+        fprintf(stderr, "Fail to start the repair threads.\n");
+        atomic_store(&pPeer->_stopping, TRUE);
+        shutdown(pPeer->_listenSd, SHUT_RDWR);
+        pthread_join(pPeer->_serveThread, NULL);
+        close(pPeer->_listenSd);
+        close(pPeer->_groupSd);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+ * Stay a peer while the others still need blocks written here (until none
+ * fetched or missed any for REPAIR_LINGER seconds), then leave the group.
+ */
+void stopRepairPeer(tRepairPeer* const pPeer)
+{
+    assert(pPeer != NULL);
+    // The others are heard twice at least.
+    const time_t heard = time(NULL) - REPAIR_LINGER + 2*REPAIR_INTERVAL;
+    time_t lastNeeded = atomic_load(&pPeer->_lastNeeded);
+    if(lastNeeded < heard){
+        atomic_compare_exchange_strong(&pPeer->_lastNeeded, &lastNeeded, heard);
+    }
+    while((time(NULL) - atomic_load(&pPeer->_lastNeeded)) < REPAIR_LINGER){
+        usleep(100000);
+    }
+    atomic_store(&pPeer->_stopping, TRUE);
+    // Wake the server up, the announcer polls.
+    shutdown(pPeer->_listenSd, SHUT_RDWR);
+    pthread_join(pPeer->_serveThread, NULL);
+    pthread_join(pPeer->_announceThread, NULL);
+    close(pPeer->_listenSd);
+    close(pPeer->_groupSd);
+}
@@ -0,0 +1,113 @@
+/* 
+ * File:   repair.h
+ * Author: pilluh
+ *
+ * Created on 20 octobre 2026, 21:15
+ */
+
+#ifndef REPAIR_H
+#define REPAIR_H
+
+#include "types.h"      /* tDataBlock, tIndexTable, tBlockNumber, bool */
+#include "constantes.h" /* REPAIR_WORDS, REPAIR_MAX_BLOCKS */
+#include "journal.h"    /* tJournal */
+#include "bitmap.h"     /* tBitmap */
+#include <stdint.h>     /* uint16_t, uint32_t, uint64_t */
+#include <time.h>       /* time_t */
+#include <stdatomic.h>  /* _Atomic, atomic_bool */
+#include <pthread.h>    /* pthread_t */
+#include <netinet/in.h> /* struct sockaddr_in */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Announce of a peer: a range of its written blocks bitmap (words follow),
+// and the number of blocks it misses. Peers only repair each other within
+// the same session (the identity the sender gives its packets).
+typedef struct sRepairAnnounce{
+    uint32_t        _magic;
+    uint16_t        _version;
+    uint16_t        _port;
+    uint16_t        _dataPort;
+    uint16_t        _nbWords;
+    tBlockNumber    _nbItems;
+    uint32_t        _session;
+    uint32_t        _firstWord;
+    uint32_t        _nbMissing;
+} tRepairAnnounce;
+
+// Blocks a peer asks for, at once.
+typedef struct sRepairRequest{
+    uint32_t        _magic;
+    uint16_t        _version;
+    uint16_t        _nbBlocks;
+    tBlockNumber    _nbItems;
+    uint32_t        _session;
+    tBlockNumber    _numbers[REPAIR_MAX_BLOCKS];
+} tRepairRequest;
+
+// Reply for each block asked, its raw bytes follow when it is available.
+typedef struct sRepairReply{
+    uint32_t        _magic;
+    uint16_t        _status;
+    uint16_t        _padding;
+    tBlockNumber    _number;
+    tChecksum       _checksum;
+    tBlockOffset    _offset;
+    uint64_t        _size;
+    uint64_t        _reference;
+} tRepairReply;
+
+/*
+ * Called with each repaired block (its raw bytes, checked against the
+ * checksum the sender gave the block: the reference), the callee owns the
+ * payload (a block received meanwhile is dropped).
+ */
+typedef void (*tRepairCallback)(void* const pContext,
+    tDataBlock* const pDataBlock, const uint64_t reference);
+
+/*
+ * Peer repair among the receivers of a session: each one announces the
+ * blocks written into its output file (the journal bitmap) on a local
+ * repair group, and serves them by unicast (TCP). A receiver missing blocks
+ * the sender already passed (behind the last block written, or every block
+ * once the receive stalls) fetches them from a peer announcing them,
+ * instead of waiting for the next pass of the carousel.
+ */
+typedef struct sRepairPeer{
+    int                 _groupSd;
+    int                 _listenSd;
+    struct sockaddr_in  _groupSock;
+    struct in_addr      _localAddr;
+    uint16_t            _port;
+    uint16_t            _dataPort;
+    int                 _fd;
+    tJournal*           _pJournal;
+    tIndexTable*        _pIndexTable;
+    tBitmap*            _pBlocksRead;
+    atomic_bool*        _pIsIndexed;
+    tRepairCallback     _callback;
+    void*               _pContext;
+    tBlockNumber        _lastWritten;
+    uint32_t            _nbMissing;
+    unsigned int        _nbIdle;
+    atomic_bool         _stopping;
+    _Atomic time_t      _lastNeeded;
+    pthread_t           _announceThread;
+    pthread_t           _serveThread;
+} tRepairPeer;
+
+bool startRepairPeer(tRepairPeer* const pPeer, const char* const localAddr,
+    const char* const multAddr, const uint16_t repairPort,
+    const uint16_t dataPort, const int fd, tJournal* const pJournal,
+    tIndexTable* const pIndexTable, tBitmap* const pBlocksRead,
+    atomic_bool* const pIsIndexed, const tRepairCallback callback,
+    void* const pContext);
+void stopRepairPeer(tRepairPeer* const pPeer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* REPAIR_H */
@@ -0,0 +1,272 @@
+#define _GNU_SOURCE         /* struct iphdr, struct udphdr */
+#include "ringclient.h"
+#include "constantes.h"     /* RECEIVE_RING_BLOCK_SIZE, RECEIVE_RING_BLOCKS */
+#include <stdio.h>          /* perror, fprintf, stderr */
+#include <string.h>         /* memset */
+#include <errno.h>          /* errno, EINTR */
+#include <assert.h>         /* assert, _Static_assert */
+#include <unistd.h>         /* close, usleep */
+#include <stdatomic.h>      /* atomic_thread_fence */
+#include <poll.h>           /* poll */
+#include <ifaddrs.h>        /* getifaddrs, freeifaddrs */
+#include <net/if.h>         /* if_nametoindex */
+#include <sys/mman.h>       /* mmap, munmap */
+
+// Socket includes
+#include <sys/socket.h>
+#include <arpa/inet.h>      /* inet_addr, htons */
+#include <netinet/in.h>
+#include <netinet/ip.h>     /* struct iphdr, IP_MF, IP_OFFMASK */
+#include <netinet/udp.h>    /* struct udphdr */
+#include <linux/if_ether.h> /* ETH_P_IP */
+#include <linux/if_packet.h>
+
+#ifndef PACKET_FANOUT_FLAG_UNIQUEID
+#define PACKET_FANOUT_FLAG_UNIQUEID 0x2000
+#endif /* PACKET_FANOUT_FLAG_UNIQUEID */
+
+_Static_assert(
+    RECEIVE_RING_BLOCKS > RECEIVE_RING_BATCHES,
+    "The kernel needs ring blocks while the batches hold theirs."
+);
+
+// Interface holding the local address (any interface when not found).
+static unsigned int getInterfaceIndex(const char* const localAddr)
+{
+    const in_addr_t address = inet_addr(localAddr);
+    unsigned int index = 0;
+    struct ifaddrs* pAddresses = NULL;
+    if(getifaddrs(&pAddresses) != 0){
+        return 0;
+    }
+    const struct ifaddrs* pAddress = pAddresses;
+    for(; (pAddress != NULL) && (index == 0); pAddress = pAddress->ifa_next){
+        if( (pAddress->ifa_addr != NULL) &&
+            (pAddress->ifa_addr->sa_family == AF_INET) &&
+            (((const struct sockaddr_in*) pAddress->ifa_addr)->sin_addr.s_addr
+                == address) )
+        {
+            index = if_nametoindex(pAddress->ifa_name);
+        }
+    }
+    freeifaddrs(pAddresses);
+    return index;
+}
+
+// Join the group, nothing is read from this socket (it is left unbound).
+static int joinGroup(const char* const localAddr, const char* const multAddr)
+{
+    const int sd = socket(AF_INET, SOCK_DGRAM, 0);
+    if(sd < 0){
+        perror("Error opening datagram socket (ring client)");
+        return -1;
+    }
+    struct ip_mreq group;
+    group.imr_multiaddr.s_addr = inet_addr(multAddr);
+    group.imr_interface.s_addr = inet_addr(localAddr);
+    if(setsockopt(sd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &group, sizeof(group))
+        != 0)
+    {
+        perror("Error adding multicast group");
+        close(sd);
+        return -1;
+    }
+    return sd;
+}
+
+bool initRingClient(tRingClient* const pClient, const char* const localAddr,
+    const char* const multAddr, const uint16_t port)
+{
+    assert((pClient != NULL) && (localAddr != NULL) && (multAddr != NULL));
+    memset(pClient, 0, sizeof(*pClient));
+    pClient->_group = inet_addr(multAddr);
+    pClient->_port = htons(port);
+    pClient->_blockSize = RECEIVE_RING_BLOCK_SIZE;
+    pClient->_nbBlocks = RECEIVE_RING_BLOCKS;
+    pClient->_groupSd = joinGroup(localAddr, multAddr);
+    if(pClient->_groupSd < 0){
+        return FALSE;
+    }
+    // IP datagrams, link headers removed (needs CAP_NET_RAW).
+    pClient->_sd = socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_IP));
+    if(pClient->_sd < 0){
+        perror("Error opening packet socket");
+        close(pClient->_groupSd);
+        return FALSE;
+    }
+    const int version = TPACKET_V3;
+    struct tpacket_req3 request;
+    memset(&request, 0, sizeof(request));
+    request.tp_block_size = (unsigned int) pClient->_blockSize;
+    request.tp_block_nr = pClient->_nbBlocks;
+    // Nominal frame size, frames are packed in the blocks.
+    request.tp_frame_size = TPACKET_ALIGNMENT << 7;
+    request.tp_frame_nr =
+        (request.tp_block_size / request.tp_frame_size)*request.tp_block_nr;
+    request.tp_retire_blk_tov = RECEIVE_RING_TIMEOUT;
+    if( (setsockopt(
+            pClient->_sd, SOL_PACKET, PACKET_VERSION, &version,
+            sizeof(version)) != 0) ||
+        (setsockopt(
+            pClient->_sd, SOL_PACKET, PACKET_RX_RING, &request,
+            sizeof(request)) != 0) )
+    {
+        perror("Error setting up the packet ring");
+        closeRingClient(pClient);
+        return FALSE;
+    }
+    void* const pRing = mmap(
+        NULL, pClient->_blockSize*pClient->_nbBlocks,
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        pClient->_sd, 0
+    );
+    if(pRing == MAP_FAILED){
+        perror("Error mapping the packet ring");
+        closeRingClient(pClient);
+        return FALSE;
+    }
+    pClient->_pRing = pRing;
+    // Only the interface of the local address.
+    struct sockaddr_ll link;
+    memset(&link, 0, sizeof(link));
+    link.sll_family = AF_PACKET;
+    link.sll_protocol = htons(ETH_P_IP);
+    link.sll_ifindex = (int) getInterfaceIndex(localAddr);
+    if(bind(pClient->_sd, (struct sockaddr*) &link, sizeof(link)) != 0){
+        perror("Error binding packet socket");
+        closeRingClient(pClient);
+        return FALSE;
+    }
+    // A fanout group of its own, only to have fragments reassembled.
+    const int fanout = (PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG |
+        PACKET_FANOUT_FLAG_UNIQUEID) << 16;
+    if(setsockopt(
+        pClient->_sd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)
+    ) != 0)
+    {
+        perror("Error setting packet fanout");
+        closeRingClient(pClient);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+ * The datagram of a frame when it is sent to the group and port (the
+ * kernel does not check the UDP checksum here, blocks are checked anyway).
+ */
+static bool getDatagram(const tRingClient* const pClient,
+                        const struct tpacket3_hdr* const pFrame,
+                        unsigned char** const ppDatagram,
+                        size_t* const pLength)
+{
+    const struct sockaddr_ll* const pLink = (const struct sockaddr_ll*)
+        ((const unsigned char*) pFrame + TPACKET_ALIGN(sizeof(*pFrame)));
+    // What this host sends is no datagram received.
+    if(pLink->sll_pkttype == PACKET_OUTGOING){
+        return FALSE;
+    }
+    if(pFrame->tp_snaplen < pFrame->tp_len){
+        fprintf(
+            stderr,
+            "Error reading packet message (truncated datagram).\n"
+        );
+        return FALSE;
+    }
+    unsigned char* const pPacket =
+        (unsigned char*) pFrame + pFrame->tp_net;
+    const size_t size = pFrame->tp_snaplen;
+    const struct iphdr* const pIp = (const struct iphdr*) pPacket;
+    if( (size < sizeof(*pIp)) || (pIp->version != 4) ||
+        (pIp->protocol != IPPROTO_UDP) || (pIp->daddr != pClient->_group) ||
+        ((ntohs(pIp->frag_off) & (IP_MF | IP_OFFMASK)) != 0) )
+    {
+        return FALSE;
+    }
+    const size_t ipSize = (size_t) pIp->ihl*4;
+    const struct udphdr* const pUdp =
+        (const struct udphdr*) (pPacket + ipSize);
+    if( (size < (ipSize + sizeof(*pUdp))) ||
+        (pUdp->dest != pClient->_port) ||
+        (ntohs(pUdp->len) < sizeof(*pUdp)) ||
+        (ntohs(pUdp->len) > (size - ipSize)) )
+    {
+        return FALSE;
+    }
+    *ppDatagram = pPacket + ipSize + sizeof(*pUdp);
+    *pLength = ntohs(pUdp->len) - sizeof(*pUdp);
+    return TRUE;
+}
+
+bool readRingPackets(tRingClient* const pClient, tPacketBatch* const pBatch)
+{
+    assert((pClient != NULL) && (pBatch != NULL));
+    struct tpacket_block_desc* const pBlock = (struct tpacket_block_desc*)
+        (pClient->_pRing + pClient->_current*pClient->_blockSize);
+    pBatch->_nbPackets = 0;
+    pBatch->_pRingBlock = NULL;
+    // Wait a while for the next block (the caller checks it is not stopped).
+    if((pBlock->hdr.bh1.block_status & TP_STATUS_USER) == 0){
+        struct pollfd pollSd = {pClient->_sd, POLLIN | POLLERR, 0};
+        const int result = poll(&pollSd, 1, RECEIVE_RING_POLL);
+        if((result < 0) && (errno != EINTR)){
+            perror("Error waiting for the packet ring");
+        }else if( (result > 0) &&
+                  ((pBlock->hdr.bh1.block_status & TP_STATUS_USER) == 0) )
+        {
+            // Only the previous block is there, still held by a batch: this
+            // one is handed over when full or timed out, do not spin.
+            usleep(1000);
+        }
+        return FALSE;
+    }
+    // The block content is visible once its status is.
+    atomic_thread_fence(memory_order_acquire);
+    const struct tpacket3_hdr* pFrame = (const struct tpacket3_hdr*)
+        ((unsigned char*) pBlock + pBlock->hdr.bh1.offset_to_first_pkt);
+    uint32_t i = 0;
+    for(; i < pBlock->hdr.bh1.num_pkts; ++i){
+        unsigned char* pDatagram = NULL;
+        size_t length = 0;
+        if( (getDatagram(pClient, pFrame, &pDatagram, &length) == TRUE) &&
+            (length != 0) )
+        {
+            addDatagram(pBatch, pDatagram, length, length);
+        }
+        pFrame = (const struct tpacket3_hdr*)
+            ((const unsigned char*) pFrame + pFrame->tp_next_offset);
+    }
+    // The block goes back to the kernel once the batch is released.
+    pBatch->_pRingBlock = pBlock;
+    pClient->_current = (pClient->_current + 1) % pClient->_nbBlocks;
+    return TRUE;
+}
+
+void releaseRingPackets(tPacketBatch* const pBatch)
+{
+    assert(pBatch != NULL);
+    struct tpacket_block_desc* const pBlock = pBatch->_pRingBlock;
+    if(pBlock != NULL){
+        pBatch->_pRingBlock = NULL;
+        pBatch->_nbPackets = 0;
+        atomic_thread_fence(memory_order_release);
+        pBlock->hdr.bh1.block_status = TP_STATUS_KERNEL;
+    }
+}
+
+void closeRingClient(tRingClient* const pClient)
+{
+    assert(pClient != NULL);
+    if(pClient->_pRing != NULL){
+        munmap(pClient->_pRing, pClient->_blockSize*pClient->_nbBlocks);
+        pClient->_pRing = NULL;
+    }
+    if((pClient->_sd >= 0) && (close(pClient->_sd) != 0)){
+        perror("Error closing packet socket");
+    }
+    if((pClient->_groupSd >= 0) && (close(pClient->_groupSd) != 0)){
+        perror("Error closing socket");
+    }
+    pClient->_sd = -1;
+    pClient->_groupSd = -1;
+}
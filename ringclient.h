@@ -0,0 +1,47 @@
+/* 
+ * File:   ringclient.h
+ * Author: pilluh
+ *
+ * Created on 20 octobre 2026, 09:15
+ */
+
+#ifndef RINGCLIENT_H
+#define RINGCLIENT_H
+
+#include "types.h"      /* bool */
+#include "client.h"     /* tPacketBatch */
+#include <stdint.h>     /* uint16_t, uint32_t */
+#include <stddef.h>     /* size_t */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Receive ring shared with the kernel (AF_PACKET, TPACKET_V3): datagrams of
+ * the group and port are read straight from the ring blocks, without a
+ * copy nor a system call per batch. A block goes back to the kernel once
+ * every assembler released the batch holding it.
+ */
+typedef struct sRingClient{
+    int                 _sd;
+    int                 _groupSd;
+    unsigned char*      _pRing;
+    size_t              _blockSize;
+    unsigned int        _nbBlocks;
+    unsigned int        _current;
+    uint32_t            _group;
+    uint16_t            _port;
+} tRingClient;
+
+bool initRingClient(tRingClient* const pClient, const char* const localAddr,
+    const char* const multAddr, const uint16_t port);
+bool readRingPackets(tRingClient* const pClient, tPacketBatch* const pBatch);
+void releaseRingPackets(tPacketBatch* const pBatch);
+void closeRingClient(tRingClient* const pClient);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RINGCLIENT_H */
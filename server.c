@@ -1,64 +1,555 @@
 #include "server.h"
 #include "types.h"
-#include "constantes.h" /* MAX_PACKET_SIZE */
+#include "constantes.h" /* MAX_PACKET_SIZE, DATA_BASENAME */
 #include "macros.h"     /* NUM_2_STR */
-#include <stdlib.h>     /* EXIT_FAILURE */
-#include <stdio.h>      /* printf, fprintf, perror, stderr */
+#include "parsefile.h"  /* readBlockFile */
+#include "crc32.h"      /* crc32c */
+#include <stdlib.h>     /* EXIT_FAILURE, malloc, realloc, free */
+#include <stdio.h>      /* printf, fprintf, perror, stderr, sprintf */
 #include <assert.h>     /* assert, _Static_assert */
-#include <string.h>     /* memset */
+#include <string.h>     /* memset, memcpy, strlen, strcat, strerror */
+#include <errno.h>      /* ECANCELED, ENOBUFS, EAGAIN */
+#include <fcntl.h>      /* AT_FDCWD, O_RDONLY */
+#include <unistd.h>     /* usleep, close */
+#include <poll.h>       /* poll */
+#include <time.h>       /* time */
 // Socket includes
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <linux/errqueue.h> /* sock_extended_err, SO_EE_ORIGIN_ZEROCOPY */
 
-// This is defined in milliseconds. 
-#define THROT_WINDOW 100
-// This is defined in kilobits per second (not kilobytes). 
-#define THROT_BW 700
+// io_uring completions.
+#define URING_SEND      ((uint64_t) 1)
+#define URING_PACING    ((uint64_t) 2)
+#define URING_OPEN      ((uint64_t) 3)
+#define URING_READ      ((uint64_t) 4)
+#define URING_CLOSE     ((uint64_t) 5)
+// Registered send buffers, each one holds any packet.
+#define SEND_BUFFER_SIZE ((size_t) MAX_PACKET_SIZE + 1)
 
-void initServer(tMultServer* const server, const char* const localAddr,
-    const char* const multAddr, const uint16_t port)
+// Set the io_uring engine up (blocking calls are used without it).
+static bool initServerUring(tMultServer* const server)
 {
-    assert(server != NULL);
-    server->_sd = socket(AF_INET, SOCK_DGRAM, 0);
-    if(server->_sd < 0){
+    if(initUring(&server->_uring, SEND_URING_ENTRIES) != TRUE){
+        return FALSE;
+    }
+    server->_pBuffers = malloc(SEND_BATCH*SEND_BUFFER_SIZE);
+    if(server->_pBuffers == NULL){
+        closeUring(&server->_uring);
+        return FALSE;
+    }
+    const struct iovec buffers = {
+        server->_pBuffers, SEND_BATCH*SEND_BUFFER_SIZE
+    };
+    // Fixed buffer writes need a connected socket.
+    if( (registerUringBuffers(&server->_uring, &buffers, 1) != TRUE) ||
+        (registerUringFiles(&server->_uring, 1) != TRUE) ||
+        (connect(
+            server->_sd, (struct sockaddr*) &(server->_groupSock),
+            sizeof(server->_groupSock)) != 0) )
+    {
+        free(server->_pBuffers);
+        server->_pBuffers = NULL;
+        closeUring(&server->_uring);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+int openServerSocket(const char* const localAddr, const char* const multAddr,
+    const uint16_t port, struct sockaddr_in* const pGroupSock)
+{
+    assert(pGroupSock != NULL);
+    const int sd = socket(AF_INET, SOCK_DGRAM, 0);
+    if(sd < 0){
         perror("Opening datagram socket error");
-        exit(EXIT_FAILURE);
-    }else{
-        printf("Socket opened, starting MCAST distribution !\n");
+        return -1;
     }
-    memset(&(server->_groupSock), 0, sizeof(server->_groupSock));
-    server->_groupSock.sin_family = AF_INET;
+    memset(pGroupSock, 0, sizeof(*pGroupSock));
+    pGroupSock->sin_family = AF_INET;
     // FIXME : Externalize the multicast address and/or get it from the command line. 
-    server->_groupSock.sin_addr.s_addr = inet_addr(multAddr);
-    server->_groupSock.sin_port = htons(port);
+    pGroupSock->sin_addr.s_addr = inet_addr(multAddr);
+    pGroupSock->sin_port = htons(port);
     // We don't want to receive our own datagrams on the loopback so we disable it. 
     char loopch = 0;
-    if(setsockopt(server->_sd, IPPROTO_IP, IP_MULTICAST_LOOP, (char *) &loopch,
+    if(setsockopt(sd, IPPROTO_IP, IP_MULTICAST_LOOP, (char *) &loopch,
         sizeof(loopch)) < 0)
     {
         perror("Disabling loopback failed. Bailing out !");
-        close(server->_sd);
-        exit(EXIT_FAILURE);
+        close(sd);
+        return -1;
     }
     // FIXME : Get this IP address from the first available interface or from the command line. 
     struct in_addr localInterface;
     localInterface.s_addr = inet_addr(localAddr);
-    if(setsockopt(server->_sd, IPPROTO_IP, IP_MULTICAST_IF,
+    if(setsockopt(sd, IPPROTO_IP, IP_MULTICAST_IF,
         (char *) &localInterface, sizeof(localInterface)) < 0)
     {
         perror("Local interface can't be set, bailing out !");
-        close(server->_sd);
-        exit(EXIT_FAILURE);
+        close(sd);
+        return -1;
     }
+    return sd;
 }
 
-void runServer(tMultServer* const server,
-               const tDataBlock* const pDataBlock,
-               const tBlockNumber nDataBlock)
+bool initServer(tMultServer* const server, const char* const localAddr,
+    const char* const multAddr, const uint16_t port, const bool zeroCopy)
 {
     assert(server != NULL);
+    server->_sd =
+        openServerSocket(localAddr, multAddr, port, &(server->_groupSock));
+    if(server->_sd < 0){
+        return FALSE;
+    }
+    printf("Socket opened, starting MCAST distribution !\n");
+    server->_pBuffers = NULL;
+    server->_nbSends = 0;
+    server->_nbInFlight = 0;
+    server->_pacing = 0;
+    server->_nextFileName = NULL;
+    server->_nextNumber = INVALID_BLOCK_NUMBER;
+    server->_isLoadQueued = FALSE;
+    server->_nbLoading = 0;
+    server->_loadResult = 0;
+    server->_isZeroCopy = FALSE;
+    server->_firstHeld = 0;
+    server->_nbHeld = 0;
+    server->_isHolding = FALSE;
+    server->_nextSend = 0;
+    if(zeroCopy == TRUE){
+        const int enable = 1;
+        if(setsockopt(server->_sd, SOL_SOCKET, SO_ZEROCOPY, &enable,
+            sizeof(enable)) == 0)
+        {
+            server->_isZeroCopy = TRUE;
+        }else{
+            perror("Zero copy can't be enabled, sending copies");
+        }
+    }
+    // Zero copy sends go through the socket, one by one.
+    server->_hasUring = (server->_isZeroCopy != TRUE) ?
+        initServerUring(server) : FALSE;
+    if((server->_hasUring != TRUE) && (server->_isZeroCopy != TRUE)){
+        printf("Sending without io_uring.\n");
+    }
+    return TRUE;
+}
+
+// Account the zero copy sends the kernel is done with (first to last).
+static void completeSends(tMultServer* const server, const uint32_t first,
+                          const uint32_t last)
+{
+    // Send numbers wrap around, they are compared from the oldest held.
+    const uint32_t base = server->_held[server->_firstHeld]._firstSend;
+    const uint32_t start = first - base;
+    const uint32_t end = last - base + 1;
+    unsigned int i = 0;
+    for(; i < server->_nbHeld; ++i){
+        tHeldBlock* const pHeld =
+            &server->_held[(server->_firstHeld + i) % ZEROCOPY_BLOCKS];
+        const uint32_t heldStart = pHeld->_firstSend - base;
+        const uint32_t heldEnd = heldStart + pHeld->_nbSends;
+        const uint32_t from = (start > heldStart) ? start : heldStart;
+        const uint32_t to = (end < heldEnd) ? end : heldEnd;
+        if(from < to){
+            pHeld->_nbPending -= to - from;
+        }
+    }
+}
+
+/*
+ * Read the zero copy completions from the socket error queue (waiting for
+ * some when asked), then unload the blocks no more used by the kernel.
+ */
+static void reapZeroCopy(tMultServer* const server, const bool wait)
+{
+    if(wait == TRUE){
+        // Completions are an error condition of the socket.
+        struct pollfd pollSd = {server->_sd, 0, 0};
+        if((poll(&pollSd, 1, ZEROCOPY_POLL) < 0) && (errno != EINTR)){
+            perror("Error waiting for zero copy completions");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for(;;){
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err) +
+            sizeof(struct sockaddr_in))];
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        if(recvmsg(server->_sd, &message, MSG_ERRQUEUE) < 0){
+            if((errno != EAGAIN) && (errno != EINTR)){
+                perror("Error reading zero copy completions");
+            }
+            break;
+        }
+        struct cmsghdr* pCmsg = CMSG_FIRSTHDR(&message);
+        for(; pCmsg != NULL; pCmsg = CMSG_NXTHDR(&message, pCmsg)){
+            const struct sock_extended_err* const pError =
+                (const struct sock_extended_err*) CMSG_DATA(pCmsg);
+            if( (pCmsg->cmsg_level == IPPROTO_IP) &&
+                (pCmsg->cmsg_type == IP_RECVERR) &&
+                (pError->ee_origin == SO_EE_ORIGIN_ZEROCOPY) &&
+                (pError->ee_errno == 0) )
+            {
+                completeSends(server, pError->ee_info, pError->ee_data);
+            }
+        }
+    }
+    // The block being sent stays (it is the last one held).
+    while( (server->_nbHeld > 0) &&
+        (server->_held[server->_firstHeld]._nbPending == 0) &&
+        ((server->_isHolding != TRUE) || (server->_nbHeld > 1)) )
+    {
+        tHeldBlock* const pHeld = &server->_held[server->_firstHeld];
+        free(pHeld->_pPayload);
+        free(pHeld->_pHeaders);
+        server->_firstHeld = (server->_firstHeld + 1) % ZEROCOPY_BLOCKS;
+        --server->_nbHeld;
+    }
+}
+
+// Keep a block loaded while its packets are sent with zero copy.
+static void holdBlock(tMultServer* const server, tDataBlock* const pBlock,
+                      const size_t nbPackets)
+{
+    if(server->_isZeroCopy != TRUE){
+        return;
+    }
+    while(server->_nbHeld == ZEROCOPY_BLOCKS){
+        reapZeroCopy(server, TRUE);
+    }
+    tHeldBlock* const pHeld = &server->_held[
+        (server->_firstHeld + server->_nbHeld) % ZEROCOPY_BLOCKS];
+    // Without room for the headers, the block is sent with copies.
+    pHeld->_pHeaders = malloc(nbPackets*sizeof(*(pHeld->_pHeaders)));
+    if(pHeld->_pHeaders == NULL){
+        return;
+    }
+    pHeld->_pPayload = pBlock->_pPayload;
+    pHeld->_nbHeaders = 0;
+    pHeld->_maxHeaders = nbPackets;
+    pHeld->_firstSend = server->_nextSend;
+    pHeld->_nbSends = 0;
+    pHeld->_nbPending = 0;
+    ++server->_nbHeld;
+    server->_isHolding = TRUE;
+}
+
+// Unload a block, once the kernel is done with it when held.
+static void unloadBlock(tMultServer* const server, tDataBlock* const pBlock)
+{
+    if(server->_isHolding != TRUE){
+        free(pBlock->_pPayload);
+    }else{
+        server->_isHolding = FALSE;
+        reapZeroCopy(server, FALSE);
+    }
+    pBlock->_pPayload = NULL;
+}
+
+// Send a packet of the block held, from its buffer.
+static void sendZeroCopy(tMultServer* const server,
+                         const tDataPacket* const pDataPacket)
+{
+    tHeldBlock* const pHeld = &server->_held[
+        (server->_firstHeld + server->_nbHeld - 1) % ZEROCOPY_BLOCKS];
+    assert(pHeld->_nbHeaders < pHeld->_maxHeaders);
+    // The header must stay as well until the send completes.
+    tDataPacketHeader* const pHeader = &(pHeld->_pHeaders[pHeld->_nbHeaders++]);
+    *pHeader = pDataPacket->_header;
+    struct iovec iov[2] = {
+        {pHeader, sizeof(*pHeader)},
+        {pDataPacket->_pPayload, pDataPacket->_header._payloadSize}
+    };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_name = &(server->_groupSock);
+    message.msg_namelen = sizeof(server->_groupSock);
+    message.msg_iov = iov;
+    message.msg_iovlen = 2;
+    if(sendmsg(server->_sd, &message, MSG_ZEROCOPY) < 0){
+        // Too many sends in flight, wait for the kernel once.
+        const bool isFull = (errno == ENOBUFS) ? TRUE : FALSE;
+        if(isFull == TRUE){
+            reapZeroCopy(server, TRUE);
+        }
+        if( (isFull != TRUE) ||
+            (sendmsg(server->_sd, &message, MSG_ZEROCOPY) < 0) )
+        {
+            perror("Error sending packet data");
+            return;
+        }
+    }
+    ++pHeld->_nbSends;
+    ++pHeld->_nbPending;
+    ++server->_nextSend;
+}
+
+// Take the completions at hand.
+static void reapServer(tMultServer* const server)
+{
+    struct io_uring_cqe cqe;
+    while(peekUring(&server->_uring, &cqe) == TRUE){
+        if( (cqe.user_data == URING_SEND) || (cqe.user_data == URING_PACING) ){
+            if( (cqe.user_data == URING_SEND) && (cqe.res < 0) &&
+                (cqe.res != -ECANCELED) )
+            {
+                fprintf(
+                    stderr, "Error sending packet data: %s.\n",
+                    strerror(-cqe.res)
+                );
+            }
+            --server->_nbInFlight;
+        }else{
+            // Block load: the size read, or the first error.
+            if( ( (cqe.user_data == URING_READ) &&
+                  (server->_loadResult >= 0) ) ||
+                ( (cqe.user_data == URING_OPEN) && (cqe.res < 0) ) )
+            {
+                server->_loadResult = cqe.res;
+            }
+            --server->_nbLoading;
+        }
+    }
+}
+
+static void submitServer(tMultServer* const server,
+                         const unsigned int nbWaited)
+{
+    if(submitUring(&server->_uring, nbWaited) != TRUE){
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Queue the block load requested: open, read, then close, linked.
+static void queueLoad(tMultServer* const server)
+{
+    struct io_uring_sqe* const pOpen = queueUring(&server->_uring);
+    struct io_uring_sqe* const pRead = queueUring(&server->_uring);
+    struct io_uring_sqe* const pClose = queueUring(&server->_uring);
+    assert((pOpen != NULL) && (pRead != NULL) && (pClose != NULL));
+    pOpen->opcode = IORING_OP_OPENAT;
+    pOpen->fd = AT_FDCWD;
+    pOpen->addr = (uintptr_t) server->_nextFileName;
+    pOpen->open_flags = O_RDONLY;
+    pOpen->file_index = 1;
+    pOpen->flags = IOSQE_IO_LINK;
+    pOpen->user_data = URING_OPEN;
+    // A short read is expected, the file is closed anyway.
+    pRead->opcode = IORING_OP_READV;
+    pRead->fd = 0;
+    pRead->addr = (uintptr_t) server->_nextIov;
+    pRead->len = 2;
+    pRead->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+    pRead->user_data = URING_READ;
+    pClose->opcode = IORING_OP_CLOSE;
+    pClose->file_index = 1;
+    pClose->user_data = URING_CLOSE;
+    server->_isLoadQueued = FALSE;
+    server->_nbLoading = 3;
+}
+
+// Queue a pacing timeout in the chain of sends.
+static void queuePacing(tMultServer* const server,
+                        struct __kernel_timespec* const pTimeout,
+                        const uint64_t microseconds, const uint8_t flags)
+{
+    pTimeout->tv_sec = (int64_t) (microseconds / 1000000);
+    pTimeout->tv_nsec = (long long) ((microseconds % 1000000)*1000);
+    struct io_uring_sqe* const pSqe = queueUring(&server->_uring);
+    assert(pSqe != NULL);
+    pSqe->opcode = IORING_OP_TIMEOUT;
+    pSqe->fd = -1;
+    pSqe->addr = (uintptr_t) pTimeout;
+    pSqe->len = 1;
+    // A timeout expiring does not cancel the next sends.
+    pSqe->flags = flags;
+    pSqe->user_data = URING_PACING;
+    ++server->_nbInFlight;
+}
+
+/*
+ * Submit the packets queued, in order, each window of them followed by its
+ * pacing timeout (like the packets sent one by one), then wait for them. A
+ * block load requested goes along.
+ */
+static void flushSends(tMultServer* const server)
+{
+    if(server->_isLoadQueued == TRUE){
+        queueLoad(server);
+    }
+    struct __kernel_timespec timeouts[SEND_BATCH + 1];
+    unsigned int nbTimeouts = 0;
+    uint64_t pacing = server->_pacing;
+    unsigned int i = 0;
+    for(; i < server->_nbSends; ++i){
+        if(pacing >= (THROT_WINDOW * 1000)){
+            queuePacing(
+                server, &(timeouts[nbTimeouts++]), pacing, IOSQE_IO_HARDLINK
+            );
+            pacing = 0;
+        }
+        struct io_uring_sqe* const pSqe = queueUring(&server->_uring);
+        assert(pSqe != NULL);
+        pSqe->opcode = IORING_OP_WRITE_FIXED;
+        pSqe->fd = server->_sd;
+        pSqe->addr = (uintptr_t) (server->_pBuffers + i*SEND_BUFFER_SIZE);
+        pSqe->len = server->_sendSizes[i];
+        pSqe->buf_index = 0;
+        // A failure does not cancel the next ones.
+        pSqe->flags = IOSQE_IO_HARDLINK;
+        pSqe->user_data = URING_SEND;
+        ++server->_nbInFlight;
+        pacing += server->_sendPacings[i];
+    }
+    if((server->_nbSends != 0) || (pacing != 0)){
+        queuePacing(server, &(timeouts[nbTimeouts++]), pacing, 0);
+    }
+    server->_nbSends = 0;
+    server->_pacing = 0;
+    submitServer(server, server->_nbInFlight + server->_nbLoading);
+    for(;;){
+        reapServer(server);
+        if(server->_nbInFlight == 0){
+            break;
+        }
+        submitServer(server, 1);
+    }
+}
+
+static void sendPacket(tMultServer* const server,
+                       tDataPacket* const pDataPacket)
+{
+    if(server->_isHolding == TRUE){
+        sendZeroCopy(server, pDataPacket);
+        return;
+    }
+    if(server->_hasUring != TRUE){
+        writePacket(server, pDataPacket);
+        return;
+    }
+    if(server->_nbSends == SEND_BATCH){
+        flushSends(server);
+    }
+    // Rewrite packet in a registered buffer.
+    unsigned char* const pBuffer =
+        server->_pBuffers + server->_nbSends*SEND_BUFFER_SIZE;
+    memcpy(pBuffer, &(pDataPacket->_header), sizeof(pDataPacket->_header));
+    memcpy(pBuffer + sizeof(pDataPacket->_header), pDataPacket->_pPayload,
+        pDataPacket->_header._payloadSize);
+    server->_sendSizes[server->_nbSends] = (uint32_t)
+        (sizeof(pDataPacket->_header) + pDataPacket->_header._payloadSize);
+    server->_sendPacings[server->_nbSends++] = 0;
+}
+
+// Wait to adapt output bitrate (after the last packet queued with io_uring).
+static void paceServer(tMultServer* const server, const uint64_t microseconds)
+{
+    if(server->_hasUring != TRUE){
+        usleep(microseconds);
+    }else if(server->_nbSends == 0){
+        server->_pacing += microseconds;
+    }else{
+        server->_sendPacings[server->_nbSends - 1] += microseconds;
+    }
+}
+
+/*
+ * Request the load of the next block, it starts with the next batch of
+ * packets (with a copy of the file name, kept until the load is taken).
+ */
+static void prefetchBlock(tMultServer* const server,
+                          const char* const fileName,
+                          const tIndexItem* const pItem)
+{
+    if( (server->_hasUring != TRUE) ||
+        (server->_nextNumber != INVALID_BLOCK_NUMBER) )
+    {
+        return;
+    }
+    // The caller formats the next file names in the same buffer.
+    const size_t fileNameSize = strlen(fileName) + 1;
+    char* const nextFileName = realloc(server->_nextFileName, fileNameSize);
+    if(nextFileName == NULL){
+        return;
+    }
+    memcpy(nextFileName, fileName, fileNameSize);
+    server->_nextFileName = nextFileName;
+    // The payload is not bigger than the raw block, one more byte tells
+    // the file is longer.
+    tDataBlock* const pBlock = &server->_nextBlock;
+    pBlock->_pPayload = malloc(pItem->_size + 1);
+    if(pBlock->_pPayload == NULL){
+        return;
+    }
+    server->_nextIov[0].iov_base = &pBlock->_header;
+    server->_nextIov[0].iov_len = sizeof(pBlock->_header);
+    server->_nextIov[1].iov_base = pBlock->_pPayload;
+    server->_nextIov[1].iov_len = pItem->_size + 1;
+    server->_nextNumber = pItem->_number;
+    server->_loadResult = 0;
+    server->_isLoadQueued = TRUE;
+}
+
+// Load a block, the one prefetched when it is there and valid.
+static bool loadBlock(tMultServer* const server, const char* const fileName,
+                      const tIndexItem* const pItem,
+                      tDataBlock* const pDataBlock)
+{
+    if( (server->_hasUring == TRUE) &&
+        (server->_nextNumber == pItem->_number) )
+    {
+        server->_nextNumber = INVALID_BLOCK_NUMBER;
+        if(server->_isLoadQueued == TRUE){
+            flushSends(server);
+        }
+        while(server->_nbLoading != 0){
+            submitServer(server, 1);
+            reapServer(server);
+        }
+        const tDataBlock* const pBlock = &server->_nextBlock;
+        const size_t fileSize =
+            sizeof(pBlock->_header) + pBlock->_header._payloadSize;
+        if( (server->_loadResult == (int) fileSize) &&
+            (pBlock->_header._payloadSize <= pItem->_size) &&
+            (crc32c(pBlock->_pPayload, pBlock->_header._payloadSize) ==
+                pBlock->_header._checksum) )
+        {
+            *pDataBlock = *pBlock;
+            return TRUE;
+        }
+        // Read again, to tell what is wrong.
+        free(pBlock->_pPayload);
+    }
+    return readBlockFile(fileName, pDataBlock, TRUE);
+}
+
+/*
+ * Wait for the first block of a live source, return the blocks cut so far
+ * (and whether the source ended).
+ */
+static tBlockNumber waitLiveSource(tLiveSource* const pLive,
+                                   bool* const pIsEnded)
+{
+    tBlockNumber nbBlocks = 0;
+    while((nbBlocks = getLiveBlocks(pLive, pIsEnded)) == 0){
+        if(*pIsEnded == TRUE){
+            fprintf(stderr, "Invalid live source (empty).\n");
+            exit(EXIT_FAILURE);
+        }
+        usleep(LIVE_POLL*1000);
+    }
+    return nbBlocks;
+}
+
+void runServer(tMultServer* const server, const char* const outputDir,
+               const tIndexTable* const pIndexTable, tLiveSource* const pLive)
+{
+    assert((server != NULL) && (outputDir != NULL) && (pIndexTable != NULL));
     // FIXME : Implement throttling. 
     // Calculating throttling values
     _Static_assert(
@@ -82,13 +573,41 @@ void runServer(tMultServer* const server,
         exit(EXIT_FAILURE);
     }
     throtData -= sizeof(tDataBlockHeader);
+    // Blocks are loaded one at a time, the whole file may not fit in memory.
+    char* const blockFilename =
+        malloc(strlen(outputDir) + (ADD_BLOCK_FILENAME_SIZE) + 1);
+    if(blockFilename == NULL){
+        fprintf(
+            stderr,
+            "Fail to allocate memory at %s line %d.\n",
+            __FILE__, __LINE__
+        );
+        exit(EXIT_FAILURE);
+    }
+    blockFilename[0] = '\0';
+    strcat(blockFilename, outputDir);
+    strcat(blockFilename, DIRECTORY_SEPARATOR);
+    strcat(blockFilename, DATA_BASENAME);
+    const size_t blockFileNameIndex = strlen(blockFilename);
+    // The next block is loaded while the current one is sent.
+    char* const nextFilename = malloc(blockFileNameIndex + 1 +
+        MAX_BLOCK_DIGITS);
+    if(nextFilename == NULL){
+        fprintf(
+            stderr,
+            "Fail to allocate memory at %s line %d.\n",
+            __FILE__, __LINE__
+        );
+        exit(EXIT_FAILURE);
+    }
+    memcpy(nextFilename, blockFilename, blockFileNameIndex + 1);
     printf("Starting transmission... Press CTRL + C to interrupt.\n");
-    tDataPacket packet = {{0, 0, 0, 0, 0, 0}, NULL};
+    tDataPacket packet = {{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}, NULL};
+    tDataBlock block = {{0, 0, 0, 0, 0, 0, 0, 0}, NULL};
     tBlockSize blockSize = 0;
     tBlockNumber i;
     tPacketNumber j;
-#if BLOCK_SEND_REPEAT != 1
-    uint8_t k = 1;
+    uint8_t k;
     // Prevent wrong code logic and infinite block sending.
     _Static_assert(
         BLOCK_SEND_REPEAT >= 1,
@@ -99,17 +618,95 @@ void runServer(tMultServer* const server,
         BLOCK_SEND_REPEAT <= UINT8_MAX,
         "BLOCK_SEND_REPEAT constant exceeds UINT8_MAX value."
     );
-#endif /* BLOCK_SEND_REPEAT != 1 */
+    // Number of index items a descriptor packet can hold.
+    const tBlockNumber maxDescriptors = throtData / sizeof(tIndexItem);
+    // Packets tell the session they belong to (a receive is only resumed
+    // from the same one): the index table digest, or the time a live
+    // source started.
+    const uint32_t session = (pLive == NULL) ?
+        crc32c(
+            (const unsigned char*) pIndexTable->_pItems,
+            (size_t) pIndexTable->_nbItems*sizeof(tIndexItem)
+        ) : (uint32_t) time(NULL);
+    // The items of a live source are only read once counted.
+    bool isEnded = TRUE;
+    tBlockNumber nbBlocks = (pLive == NULL) ? pIndexTable->_nbItems :
+        waitLiveSource(pLive, &isEnded);
+    uint8_t flags = 0;
     for(;;){
-        for(i = 0; i < nDataBlock;
-#if BLOCK_SEND_REPEAT != 1
-            (k == BLOCK_SEND_REPEAT) ? ++i, k = 1 : ++k
-#else
-            ++i
-#endif /* BLOCK_SEND_REPEAT != 1 */
-        )
-        {
-            const tDataBlock* const pBlock = &(pDataBlock[i]);
+        for(i = 0; i < nbBlocks; ++i){
+            // Blocks a live source just cut go first, then the carousel goes
+            // on (the end of the session is told by the flags).
+            if(pLive != NULL){
+                const tBlockNumber nbCut = getLiveBlocks(pLive, &isEnded);
+                if(nbCut > nbBlocks){
+                    i = nbBlocks;
+                    nbBlocks = nbCut;
+                }
+                flags = (isEnded == TRUE) ? 0 : PACKET_FLAG_GROWING;
+            }
+            const tIndexItem* const pItem = &(pIndexTable->_pItems[i]);
+            // Consecutive blocks without block file go in descriptors.
+            if(pItem->_type != BLOCK_TYPE_DATA){
+                tBlockNumber nbItems = 1;
+                while( (nbItems < maxDescriptors) &&
+                    ((i + nbItems) < nbBlocks) &&
+                    (pItem[nbItems]._type != BLOCK_TYPE_DATA) )
+                {
+                    ++nbItems;
+                }
+                memset(&(packet._header), 0, sizeof(packet._header));
+                packet._header._magic = PACKET_MAGIC;
+                packet._header._version = PACKET_VERSION;
+                packet._header._type = PACKET_TYPE_DESCRIPTOR;
+                packet._header._blockNumber = pItem->_number;
+                packet._header._blockTotal = nbBlocks;
+                packet._header._flags = flags;
+                packet._header._session = session;
+                packet._header._blockOffset = pItem->_offset;
+                packet._header._packetTotal = 1;
+                packet._header._payloadSize = (tPacketSize)
+                    (nbItems*sizeof(*pItem));
+                packet._pPayload = (void*) pItem;
+                for(k = 0; k < BLOCK_SEND_REPEAT; ++k){
+                    sendPacket(server, &packet);
+                    // Wait in proportion of the (small) size sent.
+                    paceServer(server,
+                        (THROT_WINDOW * 1000 * packet._header._payloadSize) /
+                            throtData
+                    );
+                }
+                i += nbItems - 1;
+                continue;
+            }
+            sprintf(
+                blockFilename + blockFileNameIndex,
+                "%0" NUM_2_STR(MAX_BLOCK_DIGITS) "u",
+                pItem->_number
+            );
+            const bool isLoaded =
+                loadBlock(server, blockFilename, pItem, &block);
+            // Look for the next data block, around the carousel.
+            tBlockNumber next = i;
+            do{
+                next = (next + 1) % nbBlocks;
+            }while( (next != i) &&
+                (pIndexTable->_pItems[next]._type != BLOCK_TYPE_DATA) );
+            sprintf(
+                nextFilename + blockFileNameIndex,
+                "%0" NUM_2_STR(MAX_BLOCK_DIGITS) "u",
+                pIndexTable->_pItems[next]._number
+            );
+            prefetchBlock(server, nextFilename, &(pIndexTable->_pItems[next]));
+            if(isLoaded == FALSE){
+                fprintf(
+                    stderr,
+                    "Fail to read block file: '%s'.\n",
+                    blockFilename
+                );
+                continue;
+            }
+            const tDataBlock* const pBlock = &block;
             const tBlockSize nbThrotChunks =
                 (pBlock->_header._payloadSize / throtData) + 1;
             if(nbThrotChunks > MAX_PACKET_NUMBER){
@@ -119,60 +716,51 @@ void runServer(tMultServer* const server,
                         "%zu > " NUM_2_STR(MAX_PACKET_NUMBER) ".\n",
                     nbThrotChunks
                 );
+                free(block._pPayload);
                 // Wait to adapt output bitrate (even when no packets are sent).
-                usleep(THROT_WINDOW * 1000 * nbThrotChunks);
+                paceServer(server, THROT_WINDOW * 1000 * nbThrotChunks);
                 continue;
             }
-            for(j = 0; j < nbThrotChunks; ++j){
-                // Fill header values.
-                packet._header._blockNumber = pBlock->_header._blockNumber;
-                packet._header._blockTotal = nDataBlock;
-                packet._header._checksum = pBlock->_header._checksum;
-                packet._header._packetNumber = j;
-                packet._header._packetTotal = (tPacketNumber) nbThrotChunks;
-                packet._header._payloadSize = (tPacketSize)
-                    ((blockSize + throtData) <= pBlock->_header._payloadSize) ?
-                        throtData :
-                        pBlock->_header._payloadSize - blockSize;
-                packet._header._padding = 0;
-                // Allocate buffer.
-                const tPacketSize packetSize =
-                    sizeof(tDataPacketHeader) + packet._header._payloadSize;
-                void* const buffer = malloc(packetSize);
-                if(buffer == NULL){
-                    fprintf(
-                        stderr,
-                        "Fail to allocate memory at %s line %d.\n",
-                        __FILE__, __LINE__
-                    );
+            holdBlock(server, &block, nbThrotChunks*BLOCK_SEND_REPEAT);
+            for(k = 0; k < BLOCK_SEND_REPEAT; ++k){
+                for(j = 0; j < nbThrotChunks; ++j){
+                    // Fill header values.
+                    packet._header._magic = PACKET_MAGIC;
+                    packet._header._version = PACKET_VERSION;
+                    packet._header._blockNumber = pBlock->_header._blockNumber;
+                    packet._header._blockTotal = nbBlocks;
+                    packet._header._blockOffset = pBlock->_header._offset;
+                    packet._header._checksum = pBlock->_header._checksum;
+                    packet._header._packetNumber = j;
+                    packet._header._packetTotal = (tPacketNumber) nbThrotChunks;
+                    packet._header._payloadSize = (tPacketSize)
+                        ((blockSize + throtData) <=
+                            pBlock->_header._payloadSize) ?
+                                throtData :
+                                pBlock->_header._payloadSize - blockSize;
+                    packet._header._rawSize =
+                        (uint32_t) pBlock->_header._rawSize;
+                    packet._header._codec = pBlock->_header._codec;
+                    packet._header._type = PACKET_TYPE_DATA;
+                    packet._header._flags = flags;
+                    packet._header._session = session;
+                    packet._pPayload = pBlock->_pPayload + blockSize;
+                    sendPacket(server, &packet);
+                    // Increment payload size for next calls.
                     blockSize += packet._header._payloadSize;
-                    continue;
-                }
-                // Copy header.
-                memcpy(buffer, &(packet._header), sizeof(packet._header));
-                // Copy payload.
-                memcpy(
-                    buffer + sizeof(packet._header),
-                    pBlock->_pPayload + blockSize,
-                    packet._header._payloadSize
-                );
-                if(sendto(server->_sd, buffer, packetSize, 0,
-                    (struct sockaddr *) &(server->_groupSock),
-                    sizeof(server->_groupSock)) < 0)
-                {
-                    perror("Error sending packet data");
+                    // Wait to adapt output bitrate.
+                    paceServer(server, THROT_WINDOW * 1000);
                 }
-                // Increment payload size for next calls.
-                blockSize += packet._header._payloadSize;
-                // Free buffer.
-                free(buffer);
-                // Wait to adapt output bitrate.
-                usleep(THROT_WINDOW * 1000);
+                // Reset block size for each block.
+                blockSize = 0;
             }
-            // Reset block size for each block.
-            blockSize = 0;
-	}
+            // Unload the block until the next pass.
+            unloadBlock(server, &block);
+        }
     }
+    // Free block filenames (never reached, the carousel is endless).
+    free(nextFilename);
+    free(blockFilename);
 }
 
 int writePacket(tMultServer* const server, tDataPacket* const pDataPacket)
@@ -197,7 +785,7 @@ int writePacket(tMultServer* const server, tDataPacket* const pDataPacket)
     // Send data.
     if(sendto(server->_sd,
         buffer,
-        ((THROT_BW * 1000 / 8) * THROT_WINDOW) / 1000, 0,
+        bufferSize, 0,
         (struct sockaddr *) &(server->_groupSock),
         sizeof(server->_groupSock)) < 0)
     {
@@ -214,6 +802,23 @@ int writePacket(tMultServer* const server, tDataPacket* const pDataPacket)
 void closeServer(tMultServer* const server)
 {
     assert(server != NULL);
+    while(server->_nbHeld > 0){
+        reapZeroCopy(server, TRUE);
+    }
+    if(server->_hasUring == TRUE){
+        flushSends(server);
+        while(server->_nbLoading != 0){
+            submitServer(server, 1);
+            reapServer(server);
+        }
+        if(server->_nextNumber != INVALID_BLOCK_NUMBER){
+            free(server->_nextBlock._pPayload);
+        }
+        free(server->_nextFileName);
+        server->_nextFileName = NULL;
+        free(server->_pBuffers);
+        closeUring(&server->_uring);
+    }
     if(close(server->_sd) != 0){
         perror("Error closing socket");
         exit(EXIT_FAILURE);
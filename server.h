@@ -8,24 +8,70 @@
 #ifndef SERVER_H
 #define SERVER_H
 
-#include "types.h"      /* tDataBlock, tDataPacket, tBlockNumber */
-#include <stdint.h>     /* uint16_t */
+#include "types.h"      /* tIndexTable, tDataPacket */
+#include "constantes.h" /* SEND_BATCH, ZEROCOPY_BLOCKS */
+#include "uring.h"      /* tUring */
+#include "livesource.h" /* tLiveSource */
+#include <stdint.h>     /* uint16_t, uint64_t */
+#include <sys/uio.h>    /* struct iovec */
 #include <netinet/in.h> /* sockaddr_in */
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// A block sent with zero copy, and the headers of its packets.
+typedef struct sHeldBlock{
+    void*               _pPayload;
+    tDataPacketHeader*  _pHeaders;
+    size_t              _nbHeaders;
+    size_t              _maxHeaders;
+    uint32_t            _firstSend;
+    uint32_t            _nbSends;
+    uint32_t            _nbPending;
+} tHeldBlock;
+
+/*
+ * With zero copy, the kernel sends from the block buffers, which are held
+ * until it tells (on the error queue) it is done with them.
+ * With io_uring, one submission loop drives the network and the disk:
+ * packets are copied into registered buffers and sent by batches, each
+ * window of them linked to the timeout which paces it, while the next block
+ * file is opened, read and closed (linked as well). Otherwise, each packet is sent then waited
+ * for on its own.
+ */
 typedef struct sMultServer{
     int                 _sd;
     struct sockaddr_in  _groupSock;
+    bool                _hasUring;
+    tUring              _uring;
+    unsigned char*      _pBuffers;
+    uint32_t            _sendSizes[SEND_BATCH];
+    uint64_t            _sendPacings[SEND_BATCH];
+    unsigned int        _nbSends;
+    unsigned int        _nbInFlight;
+    uint64_t            _pacing;
+    char*               _nextFileName;
+    tDataBlock          _nextBlock;
+    struct iovec        _nextIov[2];
+    tBlockNumber        _nextNumber;
+    bool                _isLoadQueued;
+    unsigned int        _nbLoading;
+    int                 _loadResult;
+    bool                _isZeroCopy;
+    tHeldBlock          _held[ZEROCOPY_BLOCKS];
+    unsigned int        _firstHeld;
+    unsigned int        _nbHeld;
+    bool                _isHolding;
+    uint32_t            _nextSend;
 } tMultServer;
 
-void initServer(tMultServer* const server, const char* const localAddr,
-    const char* const multAddr, const uint16_t port);
-void runServer(tMultServer* const server,
-               const tDataBlock* const pDataBlock,
-               const tBlockNumber nDataBlock);
+int openServerSocket(const char* const localAddr, const char* const multAddr,
+    const uint16_t port, struct sockaddr_in* const pGroupSock);
+bool initServer(tMultServer* const server, const char* const localAddr,
+    const char* const multAddr, const uint16_t port, const bool zeroCopy);
+void runServer(tMultServer* const server, const char* const outputDir,
+               const tIndexTable* const pIndexTable, tLiveSource* const pLive);
 int writePacket(tMultServer* const server, tDataPacket* const pDataPacket);
 void closeServer(tMultServer* const server);
 
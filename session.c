@@ -0,0 +1,515 @@
+#define _GNU_SOURCE         /* struct mmsghdr */
+#include "session.h"
+#include "constantes.h"     /* THROT_WINDOW, THROT_BW, SEND_BATCH, ... */
+#include "server.h"         /* openServerSocket */
+#include "client.h"         /* initClient, tPacketBatch, readPackets */
+#include "blockpacketmap.h" /* tBlockPacketMap, initMap, setMap */
+#include "codec.h"          /* decompressBlock */
+#include "crc32.h"          /* crc32c */
+#include <stdio.h>          /* fprintf, perror, stderr */
+#include <stdlib.h>         /* malloc, calloc, free */
+#include <string.h>         /* memset, memcpy */
+#include <errno.h>          /* errno, EAGAIN, EINTR, ENOBUFS */
+#include <assert.h>         /* assert */
+#include <fcntl.h>          /* fcntl, O_NONBLOCK */
+#include <unistd.h>         /* read, close */
+#include <sys/socket.h>     /* sendmsg, MSG_DONTWAIT */
+#include <sys/timerfd.h>    /* timerfd_create, timerfd_settime */
+#include <netinet/in.h>     /* struct sockaddr_in */
+
+// A block being received (or received) in the caller memory.
+typedef struct sSessionBlock{
+    tDataBlock      _dataBlock;
+    tBlockPacketMap _blockPacketMap;
+    tPacketSize     _maxPacketSize;
+    bool            _isDone;
+} tSessionBlock;
+
+/*
+ * A sender goes around the blocks of the caller memory like the carousel
+ * of ftransmit, a timer paces it (its descriptor is the session one). A
+ * receiver assembles blocks apart then copies them at their place, the
+ * socket is the session descriptor.
+ */
+struct sMultSession{
+    bool                    _isSender;
+    int                     _sd;
+    int                     _timerFd;
+    struct sockaddr_in      _groupSock;
+    // Sender.
+    const unsigned char*    _pData;
+    size_t                  _size;
+    tBlockSize              _blockSize;
+    size_t                  _packetSize;
+    tChecksum*              _pChecksums;
+    tBlockNumber            _nbBlocks;
+    tBlockNumber            _block;
+    tPacketNumber           _packet;
+    uint8_t                 _repeat;
+    // Receiver.
+    unsigned char*          _pBuffer;
+    size_t                  _capacity;
+    tBlockCallback          _callback;
+    void*                   _pContext;
+    tPacketBatch            _batch;
+    tSessionBlock*          _pBlocks;
+    tBlockNumber            _blockTotal;
+    tBlockNumber            _nbDone;
+    size_t                  _fileSize;
+};
+
+// Arm the sender timer to go on after some milliseconds.
+static bool armSessionTimer(tMultSession* const pSession,
+                            const unsigned int milliseconds)
+{
+    struct itimerspec timer;
+    memset(&timer, 0, sizeof(timer));
+    timer.it_value.tv_sec = milliseconds / 1000;
+    // A zero value would disarm the timer.
+    timer.it_value.tv_nsec = (long) (milliseconds % 1000)*1000000L + 1;
+    if(timerfd_settime(pSession->_timerFd, 0, &timer, NULL) != 0){
+        perror("Error arming the session timer");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+tMultSession* openSendSession(const void* const pData, const size_t size,
+    const tBlockSize blockSize, const char* const localAddr,
+    const char* const multAddr, const uint16_t port)
+{
+    assert((pData != NULL) && (localAddr != NULL) && (multAddr != NULL));
+    // Packets are the ones of ftransmit.
+    const size_t packetSize = (((THROT_BW * 1000 / 8) * THROT_WINDOW) / 1000) -
+        sizeof(tDataBlockHeader);
+    if( (size == 0) || (blockSize == 0) ||
+        ((((size - 1) / blockSize) + 1) > (size_t) MAX_BLOCK_TOTAL) ||
+        ((((blockSize - 1) / packetSize) + 1) > MAX_PACKET_NUMBER) )
+    {
+        fprintf(
+            stderr,
+            "Invalid session: %zu bytes in blocks of %zu bytes.\n",
+            size, blockSize
+        );
+        return NULL;
+    }
+    tMultSession* const pSession = calloc(1, sizeof(*pSession));
+    if(pSession == NULL){
+        fprintf(
+            stderr,
+            "Fail to allocate memory at %s line %d.\n", __FILE__, __LINE__
+        );
+        return NULL;
+    }
+    pSession->_isSender = TRUE;
+    pSession->_pData = pData;
+    pSession->_size = size;
+    pSession->_blockSize = blockSize;
+    pSession->_packetSize = packetSize;
+    pSession->_nbBlocks = (tBlockNumber) (((size - 1) / blockSize) + 1);
+    pSession->_pChecksums =
+        malloc(pSession->_nbBlocks*sizeof(*pSession->_pChecksums));
+    pSession->_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    pSession->_sd =
+        openServerSocket(localAddr, multAddr, port, &pSession->_groupSock);
+    if( (pSession->_pChecksums == NULL) || (pSession->_timerFd < 0) ||
+        (pSession->_sd < 0) )
+    {
+        fprintf(stderr, "Fail to open the send session.\n");
+        closeSession(pSession);
+        return NULL;
+    }
+    // Blocks are sent raw, their checksums are computed once for all.
+    tBlockNumber i = 0;
+    for(; i < pSession->_nbBlocks; ++i){
+        const size_t offset = (size_t) i*blockSize;
+        pSession->_pChecksums[i] = crc32c(
+            pSession->_pData + offset,
+            ((size - offset) < blockSize) ? (size - offset) : blockSize
+        );
+    }
+    // Start sending at once.
+    if(armSessionTimer(pSession, 0) != TRUE){
+        closeSession(pSession);
+        return NULL;
+    }
+    return pSession;
+}
+
+tMultSession* openReceiveSession(void* const pBuffer, const size_t capacity,
+    const char* const localAddr, const char* const multAddr,
+    const uint16_t port, const tBlockCallback callback,
+    void* const pContext)
+{
+    assert((pBuffer != NULL) && (localAddr != NULL) && (multAddr != NULL));
+    tMultSession* const pSession = calloc(1, sizeof(*pSession));
+    if(pSession == NULL){
+        fprintf(
+            stderr,
+            "Fail to allocate memory at %s line %d.\n", __FILE__, __LINE__
+        );
+        return NULL;
+    }
+    pSession->_isSender = FALSE;
+    pSession->_timerFd = -1;
+    pSession->_pBuffer = pBuffer;
+    pSession->_capacity = capacity;
+    pSession->_callback = callback;
+    pSession->_pContext = pContext;
+    pSession->_sd = initClient(localAddr, multAddr, port);
+    if( (pSession->_sd < 0) ||
+        (fcntl(pSession->_sd, F_SETFL,
+            fcntl(pSession->_sd, F_GETFL) | O_NONBLOCK) != 0) ||
+        (initPacketBatch(&pSession->_batch) != TRUE) )
+    {
+        fprintf(stderr, "Fail to open the receive session.\n");
+        closeSession(pSession);
+        return NULL;
+    }
+    return pSession;
+}
+
+int getSessionFd(const tMultSession* const pSession)
+{
+    assert(pSession != NULL);
+    return (pSession->_isSender == TRUE) ? pSession->_timerFd : pSession->_sd;
+}
+
+// Send the packets of a pacing window, then wait for the next one.
+static int sendSession(tMultSession* const pSession)
+{
+    uint64_t nbExpirations = 0;
+    if( (read(pSession->_timerFd, &nbExpirations, sizeof(nbExpirations)) < 0)
+        && (errno == EAGAIN) )
+    {
+        // Not the time yet.
+        return SESSION_RUNNING;
+    }
+    unsigned int nbSent = 0;
+    for(; nbSent < SEND_BATCH; ++nbSent){
+        const tBlockNumber block = pSession->_block;
+        const size_t offset = (size_t) block*pSession->_blockSize;
+        const tBlockSize size =
+            ((pSession->_size - offset) < pSession->_blockSize) ?
+                (pSession->_size - offset) : pSession->_blockSize;
+        const tPacketNumber packetTotal =
+            (tPacketNumber) (((size - 1) / pSession->_packetSize) + 1);
+        const size_t packetOffset =
+            (size_t) pSession->_packet*pSession->_packetSize;
+        tDataPacketHeader header;
+        memset(&header, 0, sizeof(header));
+        header._magic = PACKET_MAGIC;
+        header._version = PACKET_VERSION;
+        header._blockNumber = block;
+        header._blockTotal = pSession->_nbBlocks;
+        header._blockOffset = offset;
+        header._checksum = pSession->_pChecksums[block];
+        header._packetNumber = pSession->_packet;
+        header._packetTotal = packetTotal;
+        header._payloadSize = (tPacketSize)
+            (((size - packetOffset) < pSession->_packetSize) ?
+                (size - packetOffset) : pSession->_packetSize);
+        header._rawSize = (uint32_t) size;
+        header._codec = CODEC_NONE;
+        header._type = PACKET_TYPE_DATA;
+        // The payload is sent from the caller memory.
+        struct iovec iov[2] = {
+            {&header, sizeof(header)},
+            {(void*) (pSession->_pData + offset + packetOffset),
+                header._payloadSize}
+        };
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_name = &pSession->_groupSock;
+        message.msg_namelen = sizeof(pSession->_groupSock);
+        message.msg_iov = iov;
+        message.msg_iovlen = 2;
+        if(sendmsg(pSession->_sd, &message, MSG_DONTWAIT) < 0){
+            // Full socket buffer, go on with the next window.
+            if((errno == EAGAIN) || (errno == ENOBUFS) || (errno == EINTR)){
+                break;
+            }
+            perror("Error sending packet data");
+            return SESSION_FAILED;
+        }
+        // Next packet, block repeat, then block around the carousel.
+        if(++pSession->_packet == packetTotal){
+            pSession->_packet = 0;
+            if(++pSession->_repeat == BLOCK_SEND_REPEAT){
+                pSession->_repeat = 0;
+                pSession->_block = (block + 1) % pSession->_nbBlocks;
+            }
+        }
+    }
+    // Wait to adapt output bitrate.
+    return (armSessionTimer(
+        pSession, THROT_WINDOW*((nbSent == 0) ? 1 : nbSent)) == TRUE) ?
+            SESSION_RUNNING : SESSION_FAILED;
+}
+
+// Account a block whose bytes are at their place.
+static void completeBlock(tMultSession* const pSession,
+                          const tBlockNumber blockNumber,
+                          const tBlockOffset offset, const tBlockSize size)
+{
+    pSession->_pBlocks[blockNumber]._isDone = TRUE;
+    ++pSession->_nbDone;
+    if((offset + size) > pSession->_fileSize){
+        pSession->_fileSize = offset + size;
+    }
+    if(pSession->_callback != NULL){
+        pSession->_callback(pSession->_pContext, blockNumber, offset, size);
+    }
+}
+
+// Tell whether a block fits in the caller memory.
+static bool checkCapacity(const tMultSession* const pSession,
+                          const tBlockOffset offset, const tBlockSize size)
+{
+    if( (offset > pSession->_capacity) ||
+        (size > (pSession->_capacity - offset)) )
+    {
+        fprintf(
+            stderr,
+            "Receive buffer too small: %zu < %zu.\n",
+            pSession->_capacity, (size_t) (offset + size)
+        );
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Put the blocks only described at their place.
+static int applySessionDescriptors(tMultSession* const pSession,
+                                   const tDataPacket* const pDataPacket)
+{
+    const tIndexItem* const pDescriptors = pDataPacket->_pPayload;
+    const size_t nbDescriptors =
+        pDataPacket->_header._payloadSize / sizeof(*pDescriptors);
+    size_t i = 0;
+    for(; i < nbDescriptors; ++i){
+        const tIndexItem* const pItem = &(pDescriptors[i]);
+        if( (pItem->_number >= pSession->_blockTotal) ||
+            (pSession->_pBlocks[pItem->_number]._isDone == TRUE) )
+        {
+            continue;
+        }
+        if(checkCapacity(pSession, pItem->_offset, pItem->_size) != TRUE){
+            return SESSION_FAILED;
+        }
+        if(pItem->_type == BLOCK_TYPE_PATTERN){
+            memset(pSession->_pBuffer + pItem->_offset, pItem->_pattern,
+                pItem->_size);
+        }else if( (pItem->_type == BLOCK_TYPE_DUPLICATE) &&
+                  (pItem->_reference < pSession->_blockTotal) )
+        {
+            const tSessionBlock* const pReference =
+                &(pSession->_pBlocks[pItem->_reference]);
+            // Copied once the referenced block is there (descriptors come
+            // again).
+            if(pReference->_isDone != TRUE){
+                continue;
+            }
+            memmove(pSession->_pBuffer + pItem->_offset,
+                pSession->_pBuffer + pReference->_dataBlock._header._offset,
+                pItem->_size);
+        }else{
+            fprintf(
+                stderr,
+                "Unsupported block descriptor: number %u, type %u (delta "
+                    "sessions need the previous file).\n",
+                pItem->_number, pItem->_type
+            );
+            return SESSION_FAILED;
+        }
+        pSession->_pBlocks[pItem->_number]._dataBlock._header._offset =
+            pItem->_offset;
+        completeBlock(pSession, pItem->_number, pItem->_offset, pItem->_size);
+    }
+    return SESSION_RUNNING;
+}
+
+// Put a data packet in its block, then the block at its place.
+static int receiveSessionPacket(tMultSession* const pSession,
+                                const tDataPacket* const pDataPacket)
+{
+    const tDataPacketHeader* const pHeader = &pDataPacket->_header;
+    tSessionBlock* const pBlock = &(pSession->_pBlocks[pHeader->_blockNumber]);
+    if(pBlock->_isDone == TRUE){
+        return SESSION_RUNNING;
+    }
+    tDataBlock* const pDataBlock = &pBlock->_dataBlock;
+    const bool isLastPacket =
+        (pHeader->_packetNumber == (pHeader->_packetTotal - 1)) ? TRUE : FALSE;
+    // Allocate the block with a regular packet (unless it is the only one).
+    if(pDataBlock->_pPayload == NULL){
+        if((isLastPacket == TRUE) && (pHeader->_packetTotal != 1)){
+            return SESSION_RUNNING;
+        }
+        pDataBlock->_pPayload =
+            calloc(pHeader->_packetTotal, pHeader->_payloadSize);
+        pBlock->_blockPacketMap._header._packetTotal = pHeader->_packetTotal;
+        if( (pDataBlock->_pPayload == NULL) ||
+            (initMap(&pBlock->_blockPacketMap) != TRUE) )
+        {
+            fprintf(
+                stderr,
+                "Fail to allocate memory at %s line %d.\n", __FILE__, __LINE__
+            );
+            return SESSION_FAILED;
+        }
+        pDataBlock->_header._blockNumber = pHeader->_blockNumber;
+        pDataBlock->_header._offset = pHeader->_blockOffset;
+        pDataBlock->_header._rawSize = pHeader->_rawSize;
+        pDataBlock->_header._codec = pHeader->_codec;
+        pDataBlock->_header._checksum = pHeader->_checksum;
+        pDataBlock->_header._payloadSize =
+            (tBlockSize) pHeader->_packetTotal*pHeader->_payloadSize;
+        pBlock->_maxPacketSize = pHeader->_payloadSize;
+    }
+    // Ignore the packets which do not match the block.
+    if( (getMap(&pBlock->_blockPacketMap, pHeader->_packetNumber) == TRUE) ||
+        (pBlock->_blockPacketMap._header._packetTotal !=
+            pHeader->_packetTotal) ||
+        (pDataBlock->_header._checksum != pHeader->_checksum) ||
+        (pHeader->_payloadSize > pBlock->_maxPacketSize) ||
+        ( (isLastPacket != TRUE) &&
+          (pHeader->_payloadSize != pBlock->_maxPacketSize) ) )
+    {
+        return SESSION_RUNNING;
+    }
+    if(isLastPacket == TRUE){
+        pDataBlock->_header._payloadSize -=
+            pBlock->_maxPacketSize - pHeader->_payloadSize;
+    }
+    memcpy(
+        pDataBlock->_pPayload +
+            (size_t) pBlock->_maxPacketSize*pHeader->_packetNumber,
+        pDataPacket->_pPayload, pHeader->_payloadSize
+    );
+    if(setMap(&pBlock->_blockPacketMap, pHeader->_packetNumber) != TRUE){
+        return SESSION_RUNNING;
+    }
+    closeMap(&pBlock->_blockPacketMap);
+    // The block is complete, received again when invalid.
+    const bool isValid =
+        ( (crc32c(pDataBlock->_pPayload, pDataBlock->_header._payloadSize) ==
+            pDataBlock->_header._checksum) &&
+          (decompressBlock(pDataBlock) == TRUE) &&
+          (pDataBlock->_header._payloadSize ==
+            pDataBlock->_header._rawSize) ) ? TRUE : FALSE;
+    const tBlockOffset offset = pDataBlock->_header._offset;
+    const tBlockSize size = pDataBlock->_header._rawSize;
+    if( (isValid == TRUE) &&
+        (checkCapacity(pSession, offset, size) != TRUE) )
+    {
+        return SESSION_FAILED;
+    }
+    if(isValid == TRUE){
+        memcpy(pSession->_pBuffer + offset, pDataBlock->_pPayload, size);
+    }else{
+        fprintf(
+            stderr,
+            "Invalid block received: %u.\n", pDataBlock->_header._blockNumber
+        );
+    }
+    free(pDataBlock->_pPayload);
+    pDataBlock->_pPayload = NULL;
+    if(isValid == TRUE){
+        completeBlock(pSession, pHeader->_blockNumber, offset, size);
+    }
+    return SESSION_RUNNING;
+}
+
+// Read every packet there, until the file is complete.
+static int receiveSession(tMultSession* const pSession)
+{
+    while( (pSession->_blockTotal == 0) ||
+           (pSession->_nbDone != pSession->_blockTotal) )
+    {
+        if(readPackets(pSession->_sd, &pSession->_batch, NULL) != TRUE){
+            // Nothing more to read for now.
+            return ((errno == EAGAIN) || (errno == EWOULDBLOCK) ||
+                (errno == EINTR)) ? SESSION_RUNNING : SESSION_FAILED;
+        }
+        size_t i = 0;
+        for(; i < pSession->_batch._nbPackets; ++i){
+            const tDataPacket* const pDataPacket =
+                &(pSession->_batch._pPackets[i]);
+            // Live sessions are taken once ended (blocks are sent again).
+            if((pDataPacket->_header._flags & PACKET_FLAG_GROWING) != 0){
+                continue;
+            }
+            // Allocate the blocks on the first received packet.
+            if(pSession->_pBlocks == NULL){
+                pSession->_pBlocks = calloc(
+                    pDataPacket->_header._blockTotal,
+                    sizeof(*pSession->_pBlocks)
+                );
+                if(pSession->_pBlocks == NULL){
+                    fprintf(
+                        stderr,
+                        "Fail to allocate memory at %s line %d.\n",
+                        __FILE__, __LINE__
+                    );
+                    return SESSION_FAILED;
+                }
+                pSession->_blockTotal = pDataPacket->_header._blockTotal;
+            }else if(pSession->_blockTotal !=
+                pDataPacket->_header._blockTotal)
+            {
+                // Ignore the packets of another session.
+                continue;
+            }
+            const int result =
+                (pDataPacket->_header._type == PACKET_TYPE_DESCRIPTOR) ?
+                    applySessionDescriptors(pSession, pDataPacket) :
+                    receiveSessionPacket(pSession, pDataPacket);
+            if(result != SESSION_RUNNING){
+                return result;
+            }
+        }
+    }
+    return SESSION_COMPLETE;
+}
+
+int processSession(tMultSession* const pSession)
+{
+    assert(pSession != NULL);
+    return (pSession->_isSender == TRUE) ?
+        sendSession(pSession) : receiveSession(pSession);
+}
+
+// Bytes of the received file (known once complete).
+size_t getSessionSize(const tMultSession* const pSession)
+{
+    assert(pSession != NULL);
+    return (pSession->_isSender == TRUE) ?
+        pSession->_size : pSession->_fileSize;
+}
+
+void closeSession(tMultSession* const pSession)
+{
+    if(pSession == NULL){
+        return;
+    }
+    if(pSession->_sd >= 0){
+        close(pSession->_sd);
+    }
+    if(pSession->_timerFd >= 0){
+        close(pSession->_timerFd);
+    }
+    free(pSession->_pChecksums);
+    tBlockNumber i = 0;
+    for(; (pSession->_pBlocks != NULL) && (i < pSession->_blockTotal); ++i){
+        if(pSession->_pBlocks[i]._dataBlock._pPayload != NULL){
+            free(pSession->_pBlocks[i]._dataBlock._pPayload);
+            closeMap(&(pSession->_pBlocks[i]._blockPacketMap));
+        }
+    }
+    free(pSession->_pBlocks);
+    if(pSession->_batch._pBuffers != NULL){
+        closePacketBatch(&pSession->_batch);
+    }
+    free(pSession);
+}
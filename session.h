@@ -0,0 +1,50 @@
+/* 
+ * File:   session.h
+ * Author: pilluh
+ *
+ * Created on 20 octobre 2026, 19:05
+ */
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "types.h"      /* tBlockNumber, tBlockOffset, tBlockSize */
+#include "constantes.h" /* SESSION_FAILED, SESSION_RUNNING, SESSION_COMPLETE */
+#include <stdint.h>     /* uint16_t */
+#include <stddef.h>     /* size_t */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Transfers embedded in another program (the library): a session sends
+ * from, or receives into, the memory of the caller, without any directory.
+ * Nothing blocks and nothing exits: the caller waits for the session file
+ * descriptor to be readable (poll, epoll...), then lets the session
+ * process what is ready. Errors are returned (and told on stderr).
+ */
+typedef struct sMultSession tMultSession;
+
+// Called once per block received, when its bytes are in place.
+typedef void (*tBlockCallback)(void* const pContext,
+    const tBlockNumber blockNumber, const tBlockOffset offset,
+    const tBlockSize size);
+
+tMultSession* openSendSession(const void* const pData, const size_t size,
+    const tBlockSize blockSize, const char* const localAddr,
+    const char* const multAddr, const uint16_t port);
+tMultSession* openReceiveSession(void* const pBuffer, const size_t capacity,
+    const char* const localAddr, const char* const multAddr,
+    const uint16_t port, const tBlockCallback callback,
+    void* const pContext);
+int getSessionFd(const tMultSession* const pSession);
+int processSession(tMultSession* const pSession);
+size_t getSessionSize(const tMultSession* const pSession);
+void closeSession(tMultSession* const pSession);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SESSION_H */
@@ -1,16 +1,23 @@
+#define _GNU_SOURCE     /* SEEK_DATA, SEEK_HOLE */
 #include "splitfile.h"
 #include "constantes.h"
 #include "macros.h"     /* NUM_2_STR */
 #include "crc32.h"      /* crc32c */
 #include "parsefile.h"  /* readIndexFile */
+#include "codec.h"      /* maxCompressedSize, compressPayload,
+                           decompressBlock */
+#include "blockscan.h"  /* findBlockPattern */
+#include "blockhash.h"  /* fingerprintBlock, tBlockHashTable */
+#include "chunker.h"    /* tChunker, findChunkBoundary */
 #include <stdio.h>      /* fopen, sprintf, fprintf, stderr */
+#include <inttypes.h>   /* PRIu64 */
 #include <stdlib.h>     /* EXIT_FAILURE, EXIT_SUCCESS */
-#include <string.h>     /* strlen, strerror */
+#include <string.h>     /* strlen, strerror, memcmp, memmove, memset */
 #include <assert.h>     /* assert */
 #include <sys/stat.h>   /* mkdir */
 #include <errno.h>      /* errno, EEXIST */
 #include <sys/types.h>
-#include <unistd.h>
+#include <unistd.h>     /* pread, access */
 
 void createOutputDir(const char* const outputDir)
 {
@@ -53,14 +60,24 @@ void resetOuputDir(const char* const outputDir)
     strcat(blockFilename, DIRECTORY_SEPARATOR);
     strcat(blockFilename, DATA_BASENAME);
     const size_t blockFileNameIndex = strlen(blockFilename);
+    // Older releases named block files with fewer digits.
+    const int nbDigits = (indexTable._version == LEGACY_INDEX_VERSION) ?
+        LEGACY_BLOCK_DIGITS : MAX_BLOCK_DIGITS;
     tBlockNumber i = 0;
     for(; i < indexTable._nbItems; ++i){
+        // Only data and base blocks have a block file (base blocks only
+        // since the fingerprints are checked against their bytes).
+        const uint8_t type = indexTable._pItems[i]._type;
+        if((type != BLOCK_TYPE_DATA) && (type != BLOCK_TYPE_BASE)){
+            continue;
+        }
         sprintf(
             blockFilename + blockFileNameIndex,
-            "%0" NUM_2_STR(MAX_BLOCK_DIGITS) "d",
-            indexTable._pItems[i]._number
+            "%0*u", nbDigits, indexTable._pItems[i]._number
         );
-        if(remove(blockFilename) != 0){
+        if( (remove(blockFilename) != 0) &&
+            ((type == BLOCK_TYPE_DATA) || (errno != ENOENT)) )
+        {
             fprintf(
                 stderr,
                 "Fail to remove block file: '%s' (%d: %s).\n",
@@ -87,11 +104,163 @@ void resetOuputDir(const char* const outputDir)
     free(indexFilename);
 }
 
+/*
+ * Read the index of a previous release and hash the fingerprints of its
+ * blocks kept in a block file (their blocks are at hand on the receivers
+ * which hold that release, their bytes are checked against the file).
+ */
+static void loadBaseIndex(const char* const baseDir,
+                          const char* const outputDir,
+                          tIndexTable* const pBaseTable,
+                          tBlockHashTable* const pBaseHash)
+{
+    if(strcmp(baseDir, outputDir) == 0){
+        fprintf(
+            stderr,
+            "Base directory must differ from the output one: '%s'.\n",
+            baseDir
+        );
+        exit(EXIT_FAILURE);
+    }
+    char* const indexFilename = buildIndexFileName(baseDir);
+    if( (indexFilename == NULL) ||
+        (readIndexFile(indexFilename, pBaseTable) != TRUE) ||
+        (pBaseTable->_version != INDEX_VERSION) )
+    {
+        fprintf(
+            stderr,
+            "Fail to read base index: '%s' (missing or older format).\n",
+            baseDir
+        );
+        free(indexFilename);
+        exit(EXIT_FAILURE);
+    }
+    free(indexFilename);
+    if(initBlockHash(pBaseHash, pBaseTable->_nbItems) != TRUE){
+        exit(EXIT_FAILURE);
+    }
+    tBlockNumber i = 0;
+    tBlockNumber number = 0;
+    for(; i < pBaseTable->_nbItems; ++i){
+        const tIndexItem* const pItem = &(pBaseTable->_pItems[i]);
+        if( ( (pItem->_type == BLOCK_TYPE_DATA) ||
+              (pItem->_type == BLOCK_TYPE_BASE) ) &&
+            (findBlockHash(pBaseHash, pItem->_fingerprint, &number) != TRUE) )
+        {
+            insertBlockHash(pBaseHash, pItem->_fingerprint, i);
+        }
+    }
+}
+
+/*
+ * Input window the blocks are read from (a content defined block is only
+ * known once up to its max size has been looked at).
+ */
+typedef struct sInputWindow{
+    unsigned char*  _pData;
+    tBlockSize      _capacity;
+    tBlockOffset    _offset;
+    tBlockSize      _length;
+} tInputWindow;
+
+static unsigned char* readWindow(FILE* const pFile,
+                                 tInputWindow* const pWindow,
+                                 const tBlockOffset offset,
+                                 const tBlockSize size,
+                                 tBlockSize* const pRead)
+{
+    // Keep the buffered bytes from the offset on, if any.
+    if( (offset < pWindow->_offset) ||
+        (offset > (pWindow->_offset + pWindow->_length)) )
+    {
+        pWindow->_offset = offset;
+        pWindow->_length = 0;
+    }
+    tBlockSize start = (tBlockSize) (offset - pWindow->_offset);
+    if((start + size) > pWindow->_length){
+        if((start + size) > pWindow->_capacity){
+            memmove(
+                pWindow->_pData, pWindow->_pData + start,
+                pWindow->_length - start
+            );
+            pWindow->_offset += start;
+            pWindow->_length -= start;
+            start = 0;
+        }
+        // Fill the whole window, fewer and larger reads.
+        while(pWindow->_length < pWindow->_capacity){
+            const ssize_t nbRead = pread(
+                fileno(pFile), pWindow->_pData + pWindow->_length,
+                pWindow->_capacity - pWindow->_length,
+                pWindow->_offset + pWindow->_length
+            );
+            if(nbRead <= 0){
+                break;
+            }
+            pWindow->_length += nbRead;
+        }
+    }
+    *pRead = ((pWindow->_length - start) < size) ?
+        (pWindow->_length - start) : size;
+    return pWindow->_pData + start;
+}
+
+/*
+ * Fingerprints only select a candidate, the bytes are compared for real
+ * (the canonical block is read back from the input file).
+ */
+static bool isSameBlock(FILE* const pFile, const tIndexItem* const pItem,
+                        const unsigned char* const pData,
+                        const tBlockSize size,
+                        unsigned char* const pVerify)
+{
+    if((pItem->_type != BLOCK_TYPE_DATA) || (pItem->_size != size)){
+        return FALSE;
+    }
+    if(pread(fileno(pFile), pVerify, size, pItem->_offset) != (ssize_t) size){
+        return FALSE;
+    }
+    return (memcmp(pVerify, pData, size) == 0) ? TRUE : FALSE;
+}
+
+/*
+ * Fingerprints only select a base candidate, its bytes are compared for
+ * real (read back from its block file in the previous release).
+ */
+static bool isBaseBlock(const char* const baseDir,
+                        const tIndexItem* const pItem,
+                        const unsigned char* const pData,
+                        const tBlockSize size)
+{
+    if(pItem->_size != size){
+        return FALSE;
+    }
+    char* const blockFileName = buildBlockFileName(baseDir, pItem->_number);
+    // Older releases kept no block file for base blocks.
+    tDataBlock dataBlock = {{0, 0, 0, 0, 0, 0, 0, 0}, NULL};
+    if( (blockFileName == NULL) ||
+        (access(blockFileName, F_OK) != 0) ||
+        (readBlockFile(blockFileName, &dataBlock, TRUE) != TRUE) )
+    {
+        free(blockFileName);
+        return FALSE;
+    }
+    free(blockFileName);
+    const bool result = (
+        (decompressBlock(&dataBlock) == TRUE) &&
+        (dataBlock._header._payloadSize == size) &&
+        (memcmp(dataBlock._pPayload, pData, size) == 0)
+    ) ? TRUE : FALSE;
+    free(dataBlock._pPayload);
+    return result;
+}
+
 void splitFile(const char* const fileName,
                const char* const outputDir,
-               const tBlockSize blockSize)
+               const tBlockSize blockSize,
+               const tSplitOptions* const pOptions)
 {
-    assert((fileName != NULL) && (outputDir != NULL));
+    assert((fileName != NULL) && (outputDir != NULL) && (pOptions != NULL));
     // Check block size parameter.
     if(blockSize < MIN_BLOCK_SIZE){
         fprintf(
@@ -101,6 +270,21 @@ void splitFile(const char* const fileName,
         );
         exit(EXIT_FAILURE);
     }
+    // Content defined blocks are blockSize long on average.
+    tChunker chunker;
+    if( (pOptions->_contentDefined == TRUE) &&
+        (initChunker(&chunker, blockSize) != TRUE) )
+    {
+        exit(EXIT_FAILURE);
+    }
+    const tBlockSize maxBlockSize =
+        (pOptions->_contentDefined == TRUE) ? chunker._maxSize : blockSize;
+    // Load the previous release first, a delta session only holds changes.
+    tIndexTable baseTable = {0, INDEX_VERSION, NULL};
+    tBlockHashTable baseHash = {0, 0, NULL};
+    if(pOptions->_baseDir != NULL){
+        loadBaseIndex(pOptions->_baseDir, outputDir, &baseTable, &baseHash);
+    }
     // Create output files directory.
     createOutputDir(outputDir);
     // Reset previous output files.
@@ -119,22 +303,26 @@ void splitFile(const char* const fileName,
         fclose(pFile);
         exit(EXIT_FAILURE);
     }
-    // Compute number of items needed.
-    tIndexTable indexTable = {
-        ((buf.st_size - 1) / blockSize) + 1,
-        NULL
-    };
+    // Compute number of items needed (before narrowing it).
+    uint64_t nbBlocks = (((uint64_t) buf.st_size - 1) / blockSize) + 1;
+    // Content defined blocks are counted as they come (the table grows).
+    if( (pOptions->_contentDefined == TRUE) &&
+        (nbBlocks > (uint64_t) MAX_BLOCK_TOTAL) )
+    {
+        nbBlocks = MAX_BLOCK_TOTAL;
+    }
     // Check the max number of blocks.
-    if(indexTable._nbItems > (MAX_BLOCK_NUMBER + 1)){
+    if(nbBlocks > (uint64_t) MAX_BLOCK_TOTAL){
         fprintf(
             stderr,
-            "Too much blocks will be generated: %u > "
-                NUM_2_STR(MAX_BLOCK_NUMBER + 1) ".\n",
-            indexTable._nbItems
+            "Too much blocks will be generated: %" PRIu64 " > "
+                NUM_2_STR(MAX_BLOCK_TOTAL) ".\n",
+            nbBlocks
         );
         fclose(pFile);
         exit(EXIT_FAILURE);
     }
+    tIndexTable indexTable = {(tBlockNumber) nbBlocks, INDEX_VERSION, NULL};
     // Allocate item table.
     indexTable._pItems = malloc(
         indexTable._nbItems*sizeof(*indexTable._pItems)
@@ -148,8 +336,15 @@ void splitFile(const char* const fileName,
         fclose(pFile);
         exit(EXIT_FAILURE);
     }
-    // Allocate data buffer memory.
-    unsigned char* const pData = malloc(blockSize);
+    // Allocate data buffer memory (twice the max size when looking ahead).
+    tInputWindow window = {
+        NULL,
+        (pOptions->_contentDefined == TRUE) ? 2 * maxBlockSize : maxBlockSize,
+        0,
+        0
+    };
+    window._pData = malloc(window._capacity);
+    unsigned char* const pData = window._pData;
     if(pData == NULL){
         fprintf(
             stderr,
@@ -159,19 +354,145 @@ void splitFile(const char* const fileName,
         fclose(pFile);
         exit(EXIT_FAILURE);
     }
+    // Allocate compressed data buffer memory (only when compressing).
+    unsigned char* pCompressed = NULL;
+    const tBlockSize compressedSize =
+        maxCompressedSize(pOptions->_codec, maxBlockSize);
+    if(pOptions->_codec != CODEC_NONE){
+        pCompressed = malloc(compressedSize);
+        if(pCompressed == NULL){
+            fprintf(
+                stderr,
+                "Fail to allocate memory at %s line %d.\n",
+                __FILE__, __LINE__
+            );
+            free(pData);
+            fclose(pFile);
+            exit(EXIT_FAILURE);
+        }
+    }
+    // Allocate the block fingerprints table and the comparison buffer.
+    unsigned char* const pVerify = malloc(maxBlockSize);
+    tBlockHashTable blockHash;
+    if( (pVerify == NULL) ||
+        (initBlockHash(&blockHash, indexTable._nbItems) != TRUE) )
+    {
+        fprintf(
+            stderr,
+            "Fail to allocate memory at %s line %d.\n",
+            __FILE__, __LINE__
+        );
+        free(pVerify);
+        free(pCompressed);
+        free(pData);
+        fclose(pFile);
+        exit(EXIT_FAILURE);
+    }
+    // Where zeroes are cut, holes are not read but must be cut the same way.
+    tBlockSize zeroBlockSize = maxBlockSize;
+    if(pOptions->_contentDefined == TRUE){
+        memset(pVerify, 0, maxBlockSize);
+        zeroBlockSize = findChunkBoundary(&chunker, pVerify, maxBlockSize);
+    }
     size_t result;
     tBlockNumber blockNumber = 0;
     tBlockOffset blockOffset = 0;
+    // Next data region (holes before it are known to be zeroes).
+    off_t nextData = 0;
+    off_t dataEnd = 0;
     do{
-        result = fread(pData, 1, blockSize, pFile);
-        if(result == 0){
+        const tBlockSize expected =
+            ((buf.st_size - blockOffset) < maxBlockSize) ?
+                (tBlockSize) (buf.st_size - blockOffset) : maxBlockSize;
+        if(expected == 0){
             break;
         }
+        // Ask the file system where data lies, whole holes are not read.
+        if((off_t) blockOffset >= dataEnd){
+            nextData = lseek(fileno(pFile), blockOffset, SEEK_DATA);
+            if(nextData < 0){
+                // ENXIO: only a hole remains, otherwise not supported.
+                nextData = (errno == ENXIO) ? buf.st_size : (off_t) blockOffset;
+                dataEnd = buf.st_size;
+            }else{
+                dataEnd = lseek(fileno(pFile), nextData, SEEK_HOLE);
+                if(dataEnd < 0){
+                    dataEnd = buf.st_size;
+                }
+            }
+        }
+        uint8_t pattern = 0;
+        uint8_t type = BLOCK_TYPE_DATA;
+        uint64_t reference = 0;
+        tFingerprint fingerprint = 0;
+        unsigned char* pBlock = NULL;
+        if(nextData >= (off_t) (blockOffset + expected)){
+            result = (zeroBlockSize < expected) ? zeroBlockSize : expected;
+            type = BLOCK_TYPE_PATTERN;
+        }else{
+            pBlock = readWindow(pFile, &window, blockOffset, expected, &result);
+            if(result == 0){
+                break;
+            }
+            if(pOptions->_contentDefined == TRUE){
+                result = findChunkBoundary(&chunker, pBlock, result);
+            }
+            if(findBlockPattern(pBlock, result, &pattern) == TRUE){
+                type = BLOCK_TYPE_PATTERN;
+            }
+        }
+        if(type == BLOCK_TYPE_DATA){
+            fingerprint = fingerprintBlock(pBlock, result);
+        }
+        // Blocks already in the previous release are taken from it.
+        tBlockNumber number = 0;
+        if( (type == BLOCK_TYPE_DATA) &&
+            (findBlockHash(&baseHash, fingerprint, &number) == TRUE) &&
+            (isBaseBlock(
+                pOptions->_baseDir, &(baseTable._pItems[number]), pBlock,
+                result) == TRUE) )
+        {
+            type = BLOCK_TYPE_BASE;
+            reference = baseTable._pItems[number]._offset;
+        }
+        // Identical data blocks are only stored (and sent) once.
+        if(type == BLOCK_TYPE_DATA){
+            if(findBlockHash(&blockHash, fingerprint, &number) != TRUE){
+                insertBlockHash(&blockHash, fingerprint, blockNumber);
+            }else if(isSameBlock(pFile, &(indexTable._pItems[number]),
+                pBlock, result, pVerify) == TRUE)
+            {
+                type = BLOCK_TYPE_DUPLICATE;
+                reference = number;
+            }
+        }
+        // Grow the index table (content defined blocks only).
+        if( (blockNumber == indexTable._nbItems) &&
+            (pOptions->_contentDefined == TRUE) &&
+            (indexTable._nbItems <= MAX_BLOCK_NUMBER) )
+        {
+            const tBlockNumber nbItems =
+                (indexTable._nbItems <= (MAX_BLOCK_NUMBER / 2)) ?
+                    2 * indexTable._nbItems : MAX_BLOCK_NUMBER + 1;
+            tIndexItem* const pItems = realloc(
+                indexTable._pItems, nbItems*sizeof(*indexTable._pItems)
+            );
+            if(pItems != NULL){
+                indexTable._pItems = pItems;
+                indexTable._nbItems = nbItems;
+            }
+        }
         // Set index item.
         if(blockNumber < indexTable._nbItems){
             tIndexItem* const item = &(indexTable._pItems[blockNumber]);
             item->_number = blockNumber;
+            item->_type = type;
+            item->_pattern = pattern;
+            item->_padding = 0;
             item->_offset = blockOffset;
+            item->_size = result;
+            item->_reference = reference;
+            item->_fingerprint = fingerprint;
         }else{
             fprintf(
                 stderr,
@@ -183,26 +504,70 @@ void splitFile(const char* const fileName,
             fclose(pFile);
             exit(EXIT_FAILURE);
         }
-        // Null terminates the data (for crc32 computing).
-        const tDataBlock dataBlock = {
-            {
-                result,
-                crc32c(pData, result),
-                blockNumber,
-                0
-            },
-            pData
-        };
-        // Write data block file.
-        createBlockFile(outputDir, &dataBlock, FALSE);
+        // Pattern and duplicate blocks are only described by the index.
+        // Base blocks are kept too: the next release is checked against
+        // them, and a receiver missing the previous file pulls them.
+        if((type == BLOCK_TYPE_DATA) || (type == BLOCK_TYPE_BASE)){
+            tDataBlock dataBlock = {
+                {
+                    result,
+                    result,
+                    blockOffset,
+                    0,
+                    blockNumber,
+                    CODEC_NONE,
+                    0,
+                    0
+                },
+                pBlock
+            };
+            // Compress the block, unless it does not get any smaller.
+            const tBlockSize packedSize = (pCompressed == NULL) ? 0 :
+                compressPayload(
+                    pOptions->_codec, pBlock, result,
+                    pCompressed, compressedSize
+                );
+            if(packedSize != 0){
+                dataBlock._header._payloadSize = packedSize;
+                dataBlock._header._codec = pOptions->_codec;
+                dataBlock._pPayload = pCompressed;
+            }
+            // The checksum covers the bytes as stored and sent.
+            dataBlock._header._checksum = crc32c(
+                dataBlock._pPayload, dataBlock._header._payloadSize
+            );
+            // Write data block file.
+            createBlockFile(outputDir, &dataBlock, FALSE);
+        }
         // Increment block offset.
         blockOffset += result;
         // Pass to next block number.
         ++blockNumber;
-    }while(result == blockSize);
+    }while(blockOffset < (tBlockOffset) buf.st_size);
+    // Only the blocks actually cut are indexed.
+    indexTable._nbItems = blockNumber;
     // Create index file.
     createIndexFile(outputDir, &indexTable);
+    // Print what the delta session saves.
+    if(pOptions->_baseDir != NULL){
+        tBlockNumber nbBaseBlocks = 0;
+        tBlockNumber i = 0;
+        for(; i < indexTable._nbItems; ++i){
+            if(indexTable._pItems[i]._type == BLOCK_TYPE_BASE){
+                ++nbBaseBlocks;
+            }
+        }
+        printf(
+            "Delta session: %u of %u blocks taken from '%s'.\n",
+            nbBaseBlocks, indexTable._nbItems, pOptions->_baseDir
+        );
+    }
     // Free buffer memory (no more needed).
+    closeBlockHash(&baseHash);
+    free(baseTable._pItems);
+    closeBlockHash(&blockHash);
+    free(pVerify);
+    free(pCompressed);
     free(pData);
     // Free index table.
     free(indexTable._pItems);
@@ -8,17 +8,24 @@
 #ifndef SPLITFILE_H
 #define SPLITFILE_H
 
-#include "types.h"  /* tBlockSize */
+#include "types.h"  /* tBlockSize, tCodec, bool */
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+typedef struct sSplitOptions{
+    tCodec      _codec;
+    const char* _baseDir;
+    bool        _contentDefined;
+} tSplitOptions;
+
 void createOutputDir(const char* const outputDir);
 void resetOuputDir(const char* const outputDir);
 void splitFile(const char* const fileName,
                const char* const outputDir,
-               const tBlockSize blockSize);
+               const tBlockSize blockSize,
+               const tSplitOptions* const pOptions);
 
 #ifdef __cplusplus
 }
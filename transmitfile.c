@@ -1,18 +1,54 @@
 #include "transmitfile.h"
 #include "server.h"
+#include "livesource.h"     /* tLiveSource, startLiveSource */
+#include "catchup.h"        /* tCatchupServer, startCatchupServer */
 #include "constantes.h"
 #include "macros.h"         /* NUM_2_STR */
 #include "types.h"
-#include "parsefile.h"      /* tDataBlock */
+#include "parsefile.h"      /* buildIndexFileName, readIndexFile */
 #include <assert.h>         /* assert */
 #include <stdlib.h>         /* EXIT_FAILURE */
 #include <string.h>         /* strlen */
 #include <stdio.h>          /* fprintf, stderr */
 
 void transmitFile(const char* const outputDir, const char* const localAddr,
-    const char* const multAddr, const uint16_t port)
+    const char* const multAddr, const uint16_t port,
+    const tTransmitOptions* const pOptions)
 {
-    assert(outputDir != NULL);
+    assert((outputDir != NULL) && (pOptions != NULL));
+    // A live source is sent while it is cut.
+    if(pOptions->_liveSource != NULL){
+        tLiveSource liveSource;
+        if(startLiveSource(
+            &liveSource, pOptions->_liveSource, outputDir, DEF_BLOCK_SIZE,
+            pOptions->_codec
+        ) != TRUE)
+        {
+            exit(EXIT_FAILURE);
+        }
+        tCatchupServer catchupServer;
+        if( (pOptions->_catchupAddress != NULL) &&
+            (startCatchupServer(
+                &catchupServer, pOptions->_catchupAddress, outputDir,
+                &liveSource._indexTable, &liveSource
+            ) != TRUE) )
+        {
+            exit(EXIT_FAILURE);
+        }
+        tMultServer server;
+        if(initServer(&server, localAddr, multAddr, port, pOptions->_zeroCopy)
+            != TRUE)
+        {
+            exit(EXIT_FAILURE);
+        }
+        runServer(&server, outputDir, &liveSource._indexTable, &liveSource);
+        closeServer(&server);
+        if(pOptions->_catchupAddress != NULL){
+            stopCatchupServer(&catchupServer);
+        }
+        closeLiveSource(&liveSource);
+        return;
+    }
     // Build index filename.
     char* const indexFilename = buildIndexFileName(outputDir);
     // First read index file if present.
@@ -26,69 +62,44 @@ void transmitFile(const char* const outputDir, const char* const localAddr,
         free(indexFilename);
         exit(EXIT_FAILURE);
     }
-    // Allocate necessary data block table.
-    tDataBlock* const pDataBlock =
-        malloc(sizeof(tDataBlock)*indexTable._nbItems);
-    if(pDataBlock == NULL){
+    // Free index filename (no more needed).
+    free(indexFilename);
+    // Block files of older releases have another header layout.
+    if(indexTable._version != INDEX_VERSION){
         fprintf(
             stderr,
-            "Fail to allocate memory at %s line %d.\n",
-            __FILE__, __LINE__
+            "Prepared directory '%s' uses an older format (version %u), "
+                "run " PREPARE_OPTION " again.\n",
+            outputDir, indexTable._version
         );
-        free(indexFilename);
+        free(indexTable._pItems);
         exit(EXIT_FAILURE);
     }
-    // Then read every block files.
-    char* const blockFilename =
-        malloc(strlen(outputDir) + (ADD_BLOCK_FILENAME_SIZE) + 1);
-    if(blockFilename == NULL){
-        fprintf(
-            stderr,
-            "Fail to allocate memory at %s line %d.\n",
-            __FILE__, __LINE__
-        );
-        free(indexFilename);
-        free(pDataBlock);
+    // Serve the blocks to straggling receivers meanwhile.
+    tCatchupServer catchupServer;
+    if( (pOptions->_catchupAddress != NULL) &&
+        (startCatchupServer(
+            &catchupServer, pOptions->_catchupAddress, outputDir, &indexTable,
+            NULL
+        ) != TRUE) )
+    {
+        free(indexTable._pItems);
         exit(EXIT_FAILURE);
     }
-    blockFilename[0] = '\0';
-    strcat(blockFilename, outputDir);
-    strcat(blockFilename, DIRECTORY_SEPARATOR);
-    strcat(blockFilename, DATA_BASENAME);
-    const size_t blockFileNameIndex = strlen(blockFilename);
-    tBlockNumber i = 0;
-    for(; i < indexTable._nbItems; ++i){
-        sprintf(
-            blockFilename + blockFileNameIndex,
-            "%0" NUM_2_STR(MAX_BLOCK_DIGITS) "d",
-            indexTable._pItems[i]._number
-        );
-        if(readBlockFile(blockFilename, &(pDataBlock[i]), TRUE) == FALSE){
-            fprintf(
-                stderr,
-                "Fail to read block file: '%s'.\n",
-                blockFilename
-            );
-            free(indexFilename);
-            free(pDataBlock);
-            free(blockFilename);
-            exit(EXIT_FAILURE);
-        }
-    }
-    // Free filenames (no more needed).
-    free(blockFilename);
-    free(indexFilename);
     // Initialize the server and start sending file blocks.
     {
         tMultServer server;
-        initServer(&server, localAddr, multAddr, port);
-        runServer(&server, pDataBlock, indexTable._nbItems);
+        if(initServer(&server, localAddr, multAddr, port, pOptions->_zeroCopy)
+            != TRUE)
+        {
+            exit(EXIT_FAILURE);
+        }
+        runServer(&server, outputDir, &indexTable, NULL);
         closeServer(&server);
     }
-    // Free index table and data blocks (no more needed).
-    free(indexTable._pItems);
-    for(i = 0; i < indexTable._nbItems; ++i){
-        free(pDataBlock[i]._pPayload);
+    if(pOptions->_catchupAddress != NULL){
+        stopCatchupServer(&catchupServer);
     }
-    free(pDataBlock);
+    // Free index table (no more needed).
+    free(indexTable._pItems);
 }
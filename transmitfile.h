@@ -8,14 +8,28 @@
 #ifndef TRANSMITFILE_H
 #define TRANSMITFILE_H
 
+#include "types.h"      /* bool, tCodec */
 #include <stdint.h>     /* uint16_t */
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/*
+ * A live source (NULL for none) is cut into the output directory while it
+ * is sent, with the codec given. Blocks are served to straggling receivers
+ * on the catch-up address ("<addr>:<port>", NULL for none).
+ */
+typedef struct sTransmitOptions{
+    bool        _zeroCopy;
+    const char* _liveSource;
+    tCodec      _codec;
+    const char* _catchupAddress;
+} tTransmitOptions;
+
 void transmitFile(const char* const outputDir, const char* const localAddr,
-    const char* const multAddr, const uint16_t port);
+    const char* const multAddr, const uint16_t port,
+    const tTransmitOptions* const pOptions);
 
 #ifdef __cplusplus
 }
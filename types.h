@@ -9,7 +9,7 @@
 #define TYPES_H
 
 #include <stddef.h>     /* size_t */
-#include <stdint.h>     /* uint16_t, uint32_t */
+#include <stdint.h>     /* uint8_t, uint16_t, uint32_t, uint64_t */
 
 #ifdef __cplusplus
 extern "C" {
@@ -20,28 +20,48 @@ typedef enum bool{
     TRUE    = 1
 } bool;
 
-typedef uint16_t    tBlockNumber;
-typedef uint32_t    tBlockOffset;
+typedef uint32_t    tBlockNumber;
+typedef uint64_t    tBlockOffset;
 typedef size_t      tBlockSize;
 typedef uint16_t    tPacketNumber;
 typedef uint16_t    tPacketSize;
 typedef uint32_t    tChecksum;
+typedef uint16_t    tCodec;
+typedef uint64_t    tFingerprint;
+
+typedef struct sIndexHeader{
+    uint32_t        _magic;
+    uint16_t        _version;
+    uint16_t        _padding;
+    tBlockNumber    _nbItems;
+} tIndexHeader;
 
 typedef struct sIndexItem{
     tBlockNumber    _number;
+    uint8_t         _type;
+    uint8_t         _pattern;
+    uint16_t        _padding;
     tBlockOffset    _offset;
+    tBlockSize      _size;
+    uint64_t        _reference;
+    tFingerprint    _fingerprint;
 } tIndexItem;
 
 typedef struct sIndexTable{
     tBlockNumber    _nbItems;
+    uint16_t        _version;
     tIndexItem*     _pItems;
 } tIndexTable;
 
 typedef struct sDataBlockHeader{
     tBlockSize      _payloadSize;
+    tBlockSize      _rawSize;
+    tBlockOffset    _offset;
     tChecksum       _checksum;
     tBlockNumber    _blockNumber;
+    tCodec          _codec;
     uint16_t        _padding;
+    uint32_t        _reserved;
 } tDataBlockHeader;
 
 typedef struct sDataBlock{
@@ -50,13 +70,20 @@ typedef struct sDataBlock{
 } tDataBlock;
 
 typedef struct sDataPacketHeader{
+    uint8_t         _magic;
+    uint8_t         _version;
+    tPacketSize     _payloadSize;
     tChecksum       _checksum;
     tBlockNumber    _blockNumber;
     tBlockNumber    _blockTotal;
+    tBlockOffset    _blockOffset;
     tPacketNumber   _packetNumber;
     tPacketNumber   _packetTotal;
-    tPacketSize     _payloadSize;
-    uint16_t        _padding;
+    uint32_t        _rawSize;
+    tCodec          _codec;
+    uint8_t         _type;
+    uint8_t         _flags;
+    uint32_t        _session;
 } tDataPacketHeader;
 
 typedef struct sDataPacket{
@@ -0,0 +1,188 @@
+#include "uring.h"
+#include <stdlib.h>         /* malloc, free */
+#include <stdio.h>          /* perror */
+#include <string.h>         /* memset */
+#include <errno.h>          /* errno, EINTR */
+#include <assert.h>         /* assert */
+#include <unistd.h>         /* syscall, close */
+#include <stdatomic.h>      /* atomic_load_explicit, atomic_store_explicit */
+#include <sys/mman.h>       /* mmap, munmap */
+#include <sys/syscall.h>    /* __NR_io_uring_setup, __NR_io_uring_enter */
+
+// Map a ring area of the queues.
+static void* mapUring(const int fd, const size_t size, const off_t offset)
+{
+    void* const pArea = mmap(
+        NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+        offset
+    );
+    return (pArea == MAP_FAILED) ? NULL : pArea;
+}
+
+bool initUring(tUring* const pUring, const unsigned int nbEntries)
+{
+    assert(pUring != NULL);
+    memset(pUring, 0, sizeof(*pUring));
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    pUring->_fd = (int) syscall(__NR_io_uring_setup, nbEntries, &params);
+    if(pUring->_fd < 0){
+        perror("Error setting up io_uring");
+        return FALSE;
+    }
+    pUring->_sqRingSize =
+        params.sq_off.array + params.sq_entries*sizeof(unsigned int);
+    pUring->_cqRingSize =
+        params.cq_off.cqes + params.cq_entries*sizeof(struct io_uring_cqe);
+    pUring->_sqesSize = params.sq_entries*sizeof(struct io_uring_sqe);
+    pUring->_pSqRing =
+        mapUring(pUring->_fd, pUring->_sqRingSize, IORING_OFF_SQ_RING);
+    pUring->_pCqRing =
+        mapUring(pUring->_fd, pUring->_cqRingSize, IORING_OFF_CQ_RING);
+    pUring->_pSqes = mapUring(pUring->_fd, pUring->_sqesSize, IORING_OFF_SQES);
+    if( (pUring->_pSqRing == NULL) || (pUring->_pCqRing == NULL) ||
+        (pUring->_pSqes == NULL) )
+    {
+        perror("Error mapping io_uring");
+        closeUring(pUring);
+        return FALSE;
+    }
+    unsigned char* const pSq = pUring->_pSqRing;
+    unsigned char* const pCq = pUring->_pCqRing;
+    pUring->_pSqHead = (unsigned int*) (pSq + params.sq_off.head);
+    pUring->_pSqTail = (unsigned int*) (pSq + params.sq_off.tail);
+    pUring->_pSqArray = (unsigned int*) (pSq + params.sq_off.array);
+    pUring->_sqMask = *((unsigned int*) (pSq + params.sq_off.ring_mask));
+    pUring->_sqEntries = params.sq_entries;
+    pUring->_pCqHead = (unsigned int*) (pCq + params.cq_off.head);
+    pUring->_pCqTail = (unsigned int*) (pCq + params.cq_off.tail);
+    pUring->_pCqes = (struct io_uring_cqe*) (pCq + params.cq_off.cqes);
+    pUring->_cqMask = *((unsigned int*) (pCq + params.cq_off.ring_mask));
+    return TRUE;
+}
+
+bool registerUringBuffers(tUring* const pUring,
+    const struct iovec* const pBuffers, const unsigned int nbBuffers)
+{
+    assert((pUring != NULL) && (pBuffers != NULL));
+    if(syscall(
+        __NR_io_uring_register, pUring->_fd, IORING_REGISTER_BUFFERS,
+        pBuffers, nbBuffers
+    ) != 0)
+    {
+        perror("Error registering io_uring buffers");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Register empty file slots, files are opened straight into them.
+bool registerUringFiles(tUring* const pUring, const unsigned int nbFiles)
+{
+    assert(pUring != NULL);
+    int* const pFiles = malloc(nbFiles*sizeof(*pFiles));
+    if(pFiles == NULL){
+        return FALSE;
+    }
+    unsigned int i = 0;
+    for(; i < nbFiles; ++i){
+        pFiles[i] = -1;
+    }
+    const long result = syscall(
+        __NR_io_uring_register, pUring->_fd, IORING_REGISTER_FILES,
+        pFiles, nbFiles
+    );
+    free(pFiles);
+    if(result != 0){
+        perror("Error registering io_uring files");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Next submission entry (cleared), NULL when the queue is full.
+struct io_uring_sqe* queueUring(tUring* const pUring)
+{
+    assert(pUring != NULL);
+    const unsigned int head =
+        atomic_load_explicit((_Atomic unsigned int*) pUring->_pSqHead,
+            memory_order_acquire);
+    const unsigned int tail = *pUring->_pSqTail + pUring->_nbQueued;
+    if((tail - head) >= pUring->_sqEntries){
+        return NULL;
+    }
+    const unsigned int index = tail & pUring->_sqMask;
+    struct io_uring_sqe* const pSqe = &(pUring->_pSqes[index]);
+    memset(pSqe, 0, sizeof(*pSqe));
+    pUring->_pSqArray[index] = index;
+    ++pUring->_nbQueued;
+    return pSqe;
+}
+
+// Submit the queued entries and wait for some completions, in one call.
+bool submitUring(tUring* const pUring, const unsigned int nbWaited)
+{
+    assert(pUring != NULL);
+    const unsigned int nbQueued = pUring->_nbQueued;
+    atomic_store_explicit(
+        (_Atomic unsigned int*) pUring->_pSqTail,
+        *pUring->_pSqTail + nbQueued, memory_order_release
+    );
+    pUring->_nbQueued = 0;
+    unsigned int nbSubmitted = 0;
+    unsigned int nbLeft = nbWaited;
+    for(;;){
+        const long result = syscall(
+            __NR_io_uring_enter, pUring->_fd, nbQueued - nbSubmitted,
+            nbLeft, (nbLeft != 0) ? IORING_ENTER_GETEVENTS : 0, NULL, 0
+        );
+        if(result >= 0){
+            nbSubmitted += (unsigned int) result;
+            if(nbSubmitted >= nbQueued){
+                return TRUE;
+            }
+        }else if(errno != EINTR){
+            perror("Error submitting io_uring entries");
+            return FALSE;
+        }
+        // Interrupted: completions may already be there.
+        nbLeft = 0;
+    }
+}
+
+// Take the next completion, if any.
+bool peekUring(tUring* const pUring, struct io_uring_cqe* const pCqe)
+{
+    assert((pUring != NULL) && (pCqe != NULL));
+    const unsigned int head = *pUring->_pCqHead;
+    if(head == atomic_load_explicit(
+        (_Atomic unsigned int*) pUring->_pCqTail, memory_order_acquire))
+    {
+        return FALSE;
+    }
+    *pCqe = pUring->_pCqes[head & pUring->_cqMask];
+    atomic_store_explicit(
+        (_Atomic unsigned int*) pUring->_pCqHead, head + 1,
+        memory_order_release
+    );
+    return TRUE;
+}
+
+void closeUring(tUring* const pUring)
+{
+    assert(pUring != NULL);
+    if(pUring->_pSqes != NULL){
+        munmap(pUring->_pSqes, pUring->_sqesSize);
+    }
+    if(pUring->_pCqRing != NULL){
+        munmap(pUring->_pCqRing, pUring->_cqRingSize);
+    }
+    if(pUring->_pSqRing != NULL){
+        munmap(pUring->_pSqRing, pUring->_sqRingSize);
+    }
+    if(pUring->_fd >= 0){
+        close(pUring->_fd);
+    }
+    memset(pUring, 0, sizeof(*pUring));
+    pUring->_fd = -1;
+}
@@ -0,0 +1,59 @@
+/* 
+ * File:   uring.h
+ * Author: pilluh
+ *
+ * Created on 20 octobre 2026, 15:20
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include "types.h"          /* bool */
+#include <stdint.h>         /* uint64_t */
+#include <stddef.h>         /* size_t */
+#include <sys/uio.h>        /* struct iovec */
+#include <linux/io_uring.h> /* struct io_uring_sqe, struct io_uring_cqe */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Submission and completion queues shared with the kernel (io_uring, with
+ * the raw system calls). Entries are queued, then submitted at once by the
+ * same call which waits for completions.
+ */
+typedef struct sUring{
+    int                     _fd;
+    void*                   _pSqRing;
+    size_t                  _sqRingSize;
+    void*                   _pCqRing;
+    size_t                  _cqRingSize;
+    struct io_uring_sqe*    _pSqes;
+    size_t                  _sqesSize;
+    unsigned int*           _pSqHead;
+    unsigned int*           _pSqTail;
+    unsigned int*           _pSqArray;
+    unsigned int            _sqMask;
+    unsigned int            _sqEntries;
+    unsigned int*           _pCqHead;
+    unsigned int*           _pCqTail;
+    struct io_uring_cqe*    _pCqes;
+    unsigned int            _cqMask;
+    unsigned int            _nbQueued;
+} tUring;
+
+bool initUring(tUring* const pUring, const unsigned int nbEntries);
+bool registerUringBuffers(tUring* const pUring,
+    const struct iovec* const pBuffers, const unsigned int nbBuffers);
+bool registerUringFiles(tUring* const pUring, const unsigned int nbFiles);
+struct io_uring_sqe* queueUring(tUring* const pUring);
+bool submitUring(tUring* const pUring, const unsigned int nbWaited);
+bool peekUring(tUring* const pUring, struct io_uring_cqe* const pCqe);
+void closeUring(tUring* const pUring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* URING_H */